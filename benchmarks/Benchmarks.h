@@ -0,0 +1,45 @@
+/*
+ * MeshUp - A visualization tool for multi-body systems based on skeletal
+ * animation and magic.
+ *
+ * Copyright (c) 2012-2018 Martin Felis <martin.felis@iwr.uni-heidelberg.de>
+ *
+ * Licensed under the MIT license. See LICENSE for more details.
+ */
+
+#ifndef _BENCHMARKS_H
+#define _BENCHMARKS_H
+
+#include <string>
+
+struct MeshVBO;
+
+/** \brief Writes the mesh as a Wavefront OBJ file (positions and normals). */
+void write_benchmark_obj (const std::string &filename, const MeshVBO &mesh);
+
+/** \brief Creates a fresh directory for the files generated by a benchmark. */
+std::string create_benchmark_directory (const std::string &name);
+
+/** \brief Loads a model that references many high resolution meshes with
+ * increasing numbers of threads.
+ *
+ * Arguments: [mesh_count] [sphere_rows]
+ */
+int benchmark_model_load (int argc, char* argv[]);
+
+/** \brief Parses large OBJ files made of triangles and of quads.
+ *
+ * Arguments: [grid_size] (the meshes have 2 * grid_size^2 triangles)
+ */
+int benchmark_obj_load (int argc, char* argv[]);
+
+/** \brief Draws a scene with many segments that share a few meshes and
+ * colors with and without the state sorting and the GLStateCache.
+ *
+ * Needs an OpenGL context (created offscreen by Qt).
+ *
+ * Arguments: [segment_count] [frame_count]
+ */
+int benchmark_render (int argc, char* argv[]);
+
+#endif
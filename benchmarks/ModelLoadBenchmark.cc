@@ -0,0 +1,108 @@
+/*
+ * MeshUp - A visualization tool for multi-body systems based on skeletal
+ * animation and magic.
+ *
+ * Copyright (c) 2012-2018 Martin Felis <martin.felis@iwr.uni-heidelberg.de>
+ *
+ * Licensed under the MIT license. See LICENSE for more details.
+ */
+
+#include <cstdlib>
+#include <iostream>
+#include <iomanip>
+#include <fstream>
+#include <sstream>
+#include <limits>
+
+#include <boost/filesystem.hpp>
+
+#include "Benchmarks.h"
+#include "Model.h"
+#include "thread_utils.h"
+#include "timer.h"
+
+using namespace std;
+
+int benchmark_model_load (int argc, char* argv[]) {
+	unsigned int mesh_count = 64;
+	unsigned int sphere_rows = 128;
+
+	if (argc > 0)
+		mesh_count = atoi (argv[0]);
+	if (argc > 1)
+		sphere_rows = atoi (argv[1]);
+
+	string directory = create_benchmark_directory ("model_load");
+	cout << "Generating " << mesh_count << " meshes in " << directory << endl;
+
+	string model_filename = directory + "/model.lua";
+	ofstream model_out (model_filename.c_str());
+	model_out << "return {" << endl << "  frames = {" << endl;
+
+	for (unsigned int i = 0; i < mesh_count; i++) {
+		ostringstream mesh_filename;
+		mesh_filename << directory << "/mesh_" << i << ".obj";
+
+		// vary the tessellation slightly so that the files differ
+		write_benchmark_obj (mesh_filename.str(), CreateUVSphere (sphere_rows + i % 4, sphere_rows));
+
+		model_out << "    {" << endl
+			<< "      name = \"BODY" << i << "\"," << endl
+			<< "      parent = \"ROOT\"," << endl
+			<< "      visuals = {" << endl
+			<< "        { src = \"" << mesh_filename.str() << "\", dimensions = { 0.1, 0.1, 0.1 } }," << endl
+			<< "      }," << endl
+			<< "    }," << endl;
+	}
+
+	model_out << "  }" << endl << "}" << endl;
+	model_out.close();
+
+	unsigned int max_threads = get_worker_thread_count();
+	const int repetitions = 3;
+	double single_thread_duration = 0.;
+
+	cout << setw(10) << "threads" << setw(14) << "time [ms]" << setw(10) << "speedup" << endl;
+
+	// powers of two and always the maximum number of threads
+	vector<unsigned int> thread_counts;
+	for (unsigned int thread_count = 1; thread_count < max_threads; thread_count *= 2)
+		thread_counts.push_back (thread_count);
+	thread_counts.push_back (max_threads);
+
+	for (size_t ti = 0; ti < thread_counts.size(); ti++) {
+		unsigned int thread_count = thread_counts[ti];
+
+		ostringstream thread_count_str;
+		thread_count_str << thread_count;
+		setenv ("MESHUP_THREADS", thread_count_str.str().c_str(), 1);
+
+		double best_duration = numeric_limits<double>::max();
+
+		for (int ri = 0; ri < repetitions; ri++) {
+			MeshupModel model;
+			model.skip_vbo_generation = true;
+
+			TimerInfo timer_info;
+			timer_start (&timer_info);
+
+			// silence the per mesh output of the loader
+			streambuf *cout_buf = cout.rdbuf (NULL);
+			model.loadModelFromLuaFile (model_filename.c_str());
+			cout.rdbuf (cout_buf);
+
+			best_duration = min (best_duration, timer_stop (&timer_info));
+		}
+
+		if (thread_count == 1)
+			single_thread_duration = best_duration;
+
+		cout << setw(10) << thread_count
+			<< setw(14) << fixed << setprecision(1) << best_duration * 1000.
+			<< setw(10) << setprecision(2) << single_thread_duration / best_duration << endl;
+	}
+
+	boost::filesystem::remove_all (directory);
+
+	return 0;
+}
@@ -0,0 +1,121 @@
+/*
+ * MeshUp - A visualization tool for multi-body systems based on skeletal
+ * animation and magic.
+ *
+ * Copyright (c) 2012-2018 Martin Felis <martin.felis@iwr.uni-heidelberg.de>
+ *
+ * Licensed under the MIT license. See LICENSE for more details.
+ */
+
+#include <cstdio>
+#include <cstdlib>
+#include <cmath>
+#include <iostream>
+#include <iomanip>
+#include <limits>
+
+#include <boost/filesystem.hpp>
+
+#include "Benchmarks.h"
+#include "MeshVBO.h"
+#include "timer.h"
+
+using namespace std;
+
+/** Writes a wavy height field as it would come from a scanner with shared
+ * vertices and normals. */
+static void write_grid_obj (const string &filename, unsigned int grid_size, bool quads) {
+	FILE* file_out = fopen (filename.c_str(), "w");
+	if (!file_out) {
+		cerr << "Error: could not write file " << filename << endl;
+		exit (1);
+	}
+
+	unsigned int row_size = grid_size + 1;
+	float scale = 1.f / static_cast<float>(grid_size);
+
+	for (unsigned int i = 0; i < row_size; i++) {
+		for (unsigned int j = 0; j < row_size; j++) {
+			float x = i * scale;
+			float y = j * scale;
+			fprintf (file_out, "v %f %f %f\n", x, y, 0.05f * sinf (20.f * x) * cosf (20.f * y));
+		}
+	}
+
+	for (unsigned int i = 0; i < row_size; i++) {
+		for (unsigned int j = 0; j < row_size; j++) {
+			float x = i * scale;
+			float y = j * scale;
+			float nx = -cosf (20.f * x) * cosf (20.f * y);
+			float ny = sinf (20.f * x) * sinf (20.f * y);
+			float length = sqrtf (nx * nx + ny * ny + 1.f);
+			fprintf (file_out, "vn %f %f %f\n", nx / length, ny / length, 1.f / length);
+		}
+	}
+
+	for (unsigned int i = 0; i < grid_size; i++) {
+		for (unsigned int j = 0; j < grid_size; j++) {
+			unsigned int a = i * row_size + j + 1;
+			unsigned int b = a + row_size;
+
+			if (quads) {
+				fprintf (file_out, "f %u//%u %u//%u %u//%u %u//%u\n", a, a, b, b, b + 1, b + 1, a + 1, a + 1);
+			} else {
+				fprintf (file_out, "f %u//%u %u//%u %u//%u\n", a, a, b, b, b + 1, b + 1);
+				fprintf (file_out, "f %u//%u %u//%u %u//%u\n", a, a, b + 1, b + 1, a + 1, a + 1);
+			}
+		}
+	}
+
+	fclose (file_out);
+}
+
+int benchmark_obj_load (int argc, char* argv[]) {
+	unsigned int grid_size = 1000;
+
+	if (argc > 0)
+		grid_size = atoi (argv[0]);
+
+	string directory = create_benchmark_directory ("obj_load");
+
+	const char* variants[] = { "triangles", "quads" };
+	const int repetitions = 3;
+
+	cout << setw(12) << "faces" << setw(12) << "triangles" << setw(12) << "size [MB]"
+		<< setw(14) << "time [ms]" << setw(10) << "MB/s" << setw(16) << "Mtriangles/s" << endl;
+
+	for (int vi = 0; vi < 2; vi++) {
+		string filename = directory + "/" + variants[vi] + ".obj";
+		write_grid_obj (filename, grid_size, vi == 1);
+
+		double file_size = static_cast<double>(boost::filesystem::file_size (filename)) / (1024. * 1024.);
+		double best_duration = numeric_limits<double>::max();
+		size_t triangle_count = 0;
+
+		for (int ri = 0; ri < repetitions; ri++) {
+			MeshVBO mesh;
+
+			TimerInfo timer_info;
+			timer_start (&timer_info);
+
+			if (!mesh.loadOBJ (filename.c_str(), NULL, false)) {
+				cerr << "Error: could not load benchmark mesh " << filename << endl;
+				return 1;
+			}
+
+			best_duration = min (best_duration, timer_stop (&timer_info));
+			triangle_count = mesh.drawCount() / 3;
+		}
+
+		cout << setw(12) << variants[vi]
+			<< setw(12) << triangle_count
+			<< setw(12) << fixed << setprecision(1) << file_size
+			<< setw(14) << best_duration * 1000.
+			<< setw(10) << file_size / best_duration
+			<< setw(16) << setprecision(2) << triangle_count / best_duration * 1.0e-6 << endl;
+	}
+
+	boost::filesystem::remove_all (directory);
+
+	return 0;
+}
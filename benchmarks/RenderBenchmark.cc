@@ -0,0 +1,246 @@
+/*
+ * MeshUp - A visualization tool for multi-body systems based on skeletal
+ * animation and magic.
+ *
+ * Copyright (c) 2012-2018 Martin Felis <martin.felis@iwr.uni-heidelberg.de>
+ *
+ * Licensed under the MIT license. See LICENSE for more details.
+ */
+
+#include "GL/glew.h"
+
+#include <QGuiApplication>
+#include <QOffscreenSurface>
+#include <QOpenGLContext>
+#include <QOpenGLFramebufferObject>
+
+#include <cstdlib>
+#include <cmath>
+#include <iostream>
+#include <iomanip>
+#include <fstream>
+#include <sstream>
+
+#include <boost/filesystem.hpp>
+
+#include "Benchmarks.h"
+#include "Model.h"
+#include "GLStateCache.h"
+#include "SegmentRenderer.h"
+#include "timer.h"
+
+using namespace std;
+
+/// size of the framebuffer the scene gets drawn into
+const int render_width = 800;
+const int render_height = 600;
+
+/// number of different meshes and colors of the segments
+const unsigned int mesh_count = 6;
+const unsigned int color_count = 5;
+
+/** Writes a model with the given number of bodies on a grid. Neighboring
+ * bodies use different meshes and colors, so drawing them in the order of
+ * the model needs a state change for nearly every segment. */
+static void write_render_model (const string &filename, unsigned int segment_count) {
+	ofstream model_out (filename.c_str());
+	if (!model_out) {
+		cerr << "Error: could not write file " << filename << endl;
+		exit (1);
+	}
+
+	const char* colors[color_count] = {
+		"{ 0.8, 0.2, 0.2 }",
+		"{ 0.2, 0.8, 0.2 }",
+		"{ 0.2, 0.2, 0.8 }",
+		"{ 0.8, 0.8, 0.2 }",
+		"{ 0.8, 0.8, 0.8 }"
+	};
+
+	unsigned int columns = static_cast<unsigned int>(ceil (sqrt (static_cast<double>(segment_count))));
+
+	model_out << "return {" << endl << "  frames = {" << endl;
+
+	for (unsigned int i = 0; i < segment_count; i++) {
+		unsigned int mesh_index = i % mesh_count;
+
+		// spheres of different resolutions are different meshes. They are
+		// coarse so that the draw calls and state changes dominate.
+		ostringstream geometry;
+		if (mesh_index == 0)
+			geometry << "box = { dimensions = { 0.6, 0.6, 0.6 } }";
+		else
+			geometry << "sphere = { radius = 0.4, rows = " << 3 + mesh_index << ", segments = 8 }";
+
+		model_out << "    {" << endl
+			<< "      name = \"BODY" << i << "\"," << endl
+			<< "      parent = \"ROOT\"," << endl
+			<< "      joint_frame = { r = { " << (i % columns) << ", 0, " << (i / columns) << " } }," << endl
+			<< "      visuals = {" << endl
+			<< "        { geometry = { " << geometry.str() << " }, color = " << colors[(i / mesh_count) % color_count] << " }," << endl
+			<< "      }," << endl
+			<< "    }," << endl;
+	}
+
+	model_out << "  }" << endl << "}" << endl;
+}
+
+/** Same lighting and material setup as the GLWidget. */
+static void setup_render_state (unsigned int segment_count) {
+	glEnable (GL_DEPTH_TEST);
+	glDepthFunc (GL_LEQUAL);
+	glEnable (GL_NORMALIZE);
+
+	glColorMaterial (GL_FRONT, GL_AMBIENT_AND_DIFFUSE);
+	glEnable (GL_COLOR_MATERIAL);
+
+	glEnable (GL_LIGHTING);
+	glEnable (GL_LIGHT0);
+	glLightfv (GL_LIGHT0, GL_POSITION, Vector4f (0.f, 3.f, 5.f, 1.f).data());
+
+	glViewport (0, 0, render_width, render_height);
+
+	// look at the whole grid from above
+	float extent = sqrtf (static_cast<float>(segment_count));
+
+	glMatrixMode (GL_PROJECTION);
+	glLoadIdentity();
+	glFrustum (-0.08f, 0.08f, -0.06f, 0.06f, 0.1f, 4.f * extent + 10.f);
+
+	glMatrixMode (GL_MODELVIEW);
+	glLoadIdentity();
+	glTranslatef (-0.5f * extent, 0.43f * extent, -1.5f * extent - 2.f);
+	glRotatef (60.f, 1.f, 0.f, 0.f);
+}
+
+int benchmark_render (int argc, char* argv[]) {
+	unsigned int segment_count = 2000;
+	unsigned int frame_count = 50;
+
+	if (argc > 0)
+		segment_count = atoi (argv[0]);
+	if (argc > 1)
+		frame_count = atoi (argv[1]);
+
+	// Qt needs the arguments to outlive the application
+	int app_argc = 1;
+	char app_name[] = "benchmarks";
+	char* app_argv[] = { app_name, NULL };
+	QGuiApplication app (app_argc, app_argv);
+
+	QSurfaceFormat format;
+	format.setProfile (QSurfaceFormat::CompatibilityProfile);
+	format.setDepthBufferSize (24);
+
+	QOpenGLContext context;
+	context.setFormat (format);
+	QOffscreenSurface surface;
+	surface.setFormat (format);
+	surface.create();
+
+	if (!context.create() || !context.makeCurrent (&surface)) {
+		cerr << "Error: could not create an OpenGL context" << endl;
+		return 1;
+	}
+
+	GLenum err = glewInit();
+	if (GLEW_OK != err) {
+		cerr << "Error initializing GLEW: " << glewGetErrorString(err) << endl;
+		return 1;
+	}
+
+	QOpenGLFramebufferObject framebuffer (render_width, render_height, QOpenGLFramebufferObject::Depth);
+	framebuffer.bind();
+
+	string directory = create_benchmark_directory ("render");
+	string model_filename = directory + "/model.lua";
+	write_render_model (model_filename, segment_count);
+
+	// deleted while the context is still current
+	MeshupModel *model = new MeshupModel();
+	model->batch_segments = false;
+
+	streambuf *cout_buf = cout.rdbuf (NULL);
+	model->loadModelFromLuaFile (model_filename.c_str());
+	cout.rdbuf (cout_buf);
+
+	model->updateFrames();
+	model->updateSegments();
+
+	cout << "Drawing " << model->segments.size() << " segments (" << mesh_count << " meshes, " << color_count << " colors) "
+		<< frame_count << " times with the fixed function pipeline" << endl;
+
+	setup_render_state (segment_count);
+
+	// the SegmentRenderer is not initialized, so the segments are drawn
+	// with the RenderQueue
+	SegmentRenderer &renderer = get_segment_renderer();
+	GLStateCache &state = get_gl_state_cache();
+
+	struct RenderConfig {
+		const char* name;
+		bool state_cache;
+		bool sorting;
+	};
+
+	const RenderConfig configs[] = {
+		{ "model order, no cache", false, false },
+		{ "model order, cache", true, false },
+		{ "sorted, cache", true, true }
+	};
+
+	cout << setw(24) << "" << setw(12) << "time [ms]" << setw(10) << "changes" << setw(10) << "skipped"
+		<< setw(10) << "queries" << setw(10) << "binds" << endl;
+
+	for (unsigned int ci = 0; ci < sizeof(configs) / sizeof(configs[0]); ci++) {
+		state.enabled = configs[ci].state_cache;
+		model->render_queue.sorting = configs[ci].sorting;
+
+		GLStateStats stats;
+		unsigned int mesh_binds = 0;
+		double duration = 0.;
+
+		// the first frames create the buffers
+		const unsigned int warmup_frames = 3;
+
+		for (unsigned int fi = 0; fi < warmup_frames + frame_count; fi++) {
+			TimerInfo timer_info;
+			timer_start (&timer_info);
+
+			renderer.beginFrame();
+			state.invalidate();
+			state.resetStats();
+
+			glClear (GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+			model->draw();
+			glFinish();
+
+			if (fi < warmup_frames)
+				continue;
+
+			duration += timer_stop (&timer_info);
+			stats += state.stats;
+			mesh_binds += model->render_queue.mesh_binds;
+		}
+
+		cout << setw(24) << configs[ci].name
+			<< setw(12) << fixed << setprecision(2) << duration * 1000. / frame_count
+			<< setw(10) << stats.state_changes / frame_count
+			<< setw(10) << stats.redundant_changes / frame_count
+			<< setw(10) << stats.driver_queries / frame_count
+			<< setw(10) << mesh_binds / frame_count << endl;
+	}
+
+	GLenum gl_error = glGetError();
+	if (gl_error != GL_NO_ERROR)
+		cerr << "OpenGL Error: " << gl_error << endl;
+
+	delete model;
+
+	framebuffer.release();
+	context.doneCurrent();
+
+	boost::filesystem::remove_all (directory);
+
+	return 0;
+}
@@ -0,0 +1,87 @@
+/*
+ * MeshUp - A visualization tool for multi-body systems based on skeletal
+ * animation and magic.
+ *
+ * Copyright (c) 2012-2018 Martin Felis <martin.felis@iwr.uni-heidelberg.de>
+ *
+ * Licensed under the MIT license. See LICENSE for more details.
+ */
+
+#include <cstring>
+#include <iostream>
+#include <fstream>
+
+#include <boost/filesystem.hpp>
+
+#include "Benchmarks.h"
+#include "MeshVBO.h"
+
+using namespace std;
+
+struct BenchmarkInfo {
+	const char* name;
+	int (*function)(int argc, char* argv[]);
+	const char* description;
+};
+
+static const BenchmarkInfo benchmarks[] = {
+	{ "model_load", benchmark_model_load, "load time of a model with many OBJ meshes for 1..N threads" },
+	{ "obj_load", benchmark_obj_load, "parsing throughput for large OBJ files" },
+	{ "render", benchmark_render, "frame time and state changes of a scene with many segments" },
+	{ NULL, NULL, NULL }
+};
+
+void write_benchmark_obj (const std::string &filename, const MeshVBO &mesh) {
+	ofstream file_out (filename.c_str());
+	if (!file_out) {
+		cerr << "Error: could not write file " << filename << endl;
+		exit (1);
+	}
+
+	for (size_t i = 0; i < mesh.vertices.size(); i++) {
+		file_out << "v " << mesh.vertices[i][0] << " " << mesh.vertices[i][1] << " " << mesh.vertices[i][2] << endl;
+	}
+
+	for (size_t i = 0; i < mesh.normals.size(); i++) {
+		file_out << "vn " << mesh.normals[i][0] << " " << mesh.normals[i][1] << " " << mesh.normals[i][2] << endl;
+	}
+
+	for (size_t i = 0; i + 2 < mesh.vertices.size(); i += 3) {
+		file_out << "f";
+		for (size_t j = i + 1; j < i + 4; j++)
+			file_out << " " << j << "//" << j;
+		file_out << endl;
+	}
+}
+
+std::string create_benchmark_directory (const std::string &name) {
+	boost::filesystem::path path = boost::filesystem::temp_directory_path()
+		/ boost::filesystem::unique_path ("meshup-" + name + "-%%%%%%%%");
+	boost::filesystem::create_directories (path);
+	return path.string();
+}
+
+void print_usage (const char* program) {
+	cout << "Usage: " << program << " <benchmark> [arguments]" << endl << endl;
+	cout << "Available benchmarks:" << endl;
+	for (const BenchmarkInfo *info = benchmarks; info->name != NULL; info++) {
+		cout << "  " << info->name << " - " << info->description << endl;
+	}
+}
+
+int main (int argc, char *argv[]) {
+	if (argc < 2) {
+		print_usage (argv[0]);
+		return 1;
+	}
+
+	for (const BenchmarkInfo *info = benchmarks; info->name != NULL; info++) {
+		if (strcmp (info->name, argv[1]) == 0)
+			return info->function (argc - 2, argv + 2);
+	}
+
+	cerr << "Error: unknown benchmark '" << argv[1] << "'" << endl;
+	print_usage (argv[0]);
+
+	return 1;
+}
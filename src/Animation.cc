@@ -10,6 +10,7 @@
 #include "GL/glew.h"
 
 #include "Animation.h"
+#include "FrameProfiler.h"
 
 #include "SimpleMath/SimpleMathGL.h"
 #include "string_utils.h"
@@ -93,6 +94,9 @@ bool Animation::loadFromFile (const char* filename, const FrameConfig &frame_con
 	}
 
 	configuration = frame_config;
+	animation_stamp = FileStamp::fromFile (filename);
+	data_stamp = FileStamp();
+	data_filename = "";
 
 	double force_fps_previous_frame = 0.;
 	int force_fps_frame_count = 0;
@@ -183,6 +187,9 @@ bool Animation::loadFromFile (const char* filename, const FrameConfig &frame_con
 				data_path = data_directory /= data_path;
 			}
 
+			data_filename = data_path.string();
+			data_stamp = FileStamp::fromFile (data_filename);
+
 			file_in.open(data_path.string().c_str());
 			cout << "Loading animation data from " << data_path.string() << endl;
 
@@ -505,9 +512,15 @@ void UpdateModelFromAnimation (MeshupModelPtr model, AnimationPtr animation, flo
 		animation->configuration = model->configuration;
 	}
 
+	FrameProfiler &profiler = get_frame_profiler();
+
+	profiler.beginCpu (ProfileAnimation);
 	KeyFrame keyframe = animation->getKeyFrameAtTime (time);
 	ModelApplyKeyFrame (model, keyframe);
+	profiler.endCpu();
 
+	profiler.beginCpu (ProfileSegmentUpdate);
 	model->updateFrames();
 	model->updateSegments();
+	profiler.endCpu();
 }
@@ -22,6 +22,7 @@
 #include "StateDescriptor.h"
 #include "FrameConfig.h"
 #include "Curve.h"
+#include "FileStamp.h"
 
 /** \brief A single pose of a frame at a given time */
 struct TransformInfo {
@@ -50,6 +51,7 @@ struct KeyFrame {
 struct Animation {
 	Animation() :
 		animation_filename(""),
+		data_filename(""),
 		current_time (0.f),
 		duration (0.f),
 		loop (false),
@@ -64,6 +66,23 @@ struct Animation {
 	KeyFrame getKeyFrameAtTime (float time);
 
 	std::string animation_filename;
+	/// file referenced by DATA_FROM (empty if the data is inline)
+	std::string data_filename;
+
+	/// stamps of the animation and the data file when they were loaded
+	FileStamp animation_stamp;
+	FileStamp data_stamp;
+
+	/// Returns true if the animation or its data file were modified,
+	/// refreshes the stamps otherwise
+	bool isModified () {
+		if (animation_stamp.isModified() || data_stamp.isModified())
+			return true;
+
+		animation_stamp.refresh();
+		data_stamp.refresh();
+		return false;
+	}
 
 	float current_time;
 	float duration;
@@ -43,6 +43,7 @@ bool CameraOperator::loadFromFile (const char* filename, bool strict) {
 	camera_display->clear();
 
 	string filename_str (filename);
+	camera_stamp = FileStamp::fromFile (filename_str);
 
 	cout << "Loading camera " << filename << endl;
 
@@ -10,6 +10,7 @@
 
 #include "SimpleMath/SimpleMath.h"
 #include "Camera.h"
+#include "FileStamp.h"
 
 struct CameraPosition {
 	float time;
@@ -50,6 +51,7 @@ struct CameraOperator{
 	}
 
     std::string camera_filename;
+    FileStamp camera_stamp;
     float duration;
     std::vector<CameraPosition*> cam_pos;
     bool fixed;
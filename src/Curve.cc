@@ -10,6 +10,7 @@
 #include "Curve.h"
 
 #include "GL/glew.h"
+#include "GLStateCache.h"
 
 #include <iostream>
 #include <cstdlib>
@@ -45,14 +46,16 @@ void Curve::draw() {
 		generate_vbo();
 	}
 
+	GLStateCache &state = get_gl_state_cache();
+
 	glLineWidth (width);
-	glEnable (GL_LINE_SMOOTH);
+	state.enable (GL_LINE_SMOOTH);
 	//glEnable (GL_BLEND);
 	glDepthMask (GL_FALSE);
 	glHint (GL_LINE_SMOOTH_HINT, GL_NICEST);
 
 	meshVBO.draw(GL_LINE_STRIP);
 
-	glDisable (GL_BLEND);
+	state.disable (GL_BLEND);
 	glDepthMask (GL_TRUE);
 }
@@ -0,0 +1,161 @@
+/*
+ * MeshUp - A visualization tool for multi-body systems based on skeletal
+ * animation and magic.
+ *
+ * Copyright (c) 2012-2018 Martin Felis <martin.felis@iwr.uni-heidelberg.de>
+ *
+ * Licensed under the MIT license. See LICENSE for more details.
+ */
+
+#ifndef _FILESTAMP_H
+#define _FILESTAMP_H
+
+#include <cstdio>
+#include <string>
+#include <stdint.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+
+/** \brief Computes the 64 bit FNV-1a hash of the content of a file. */
+inline uint64_t compute_file_hash (const std::string &filename) {
+	uint64_t hash = 14695981039346656037ULL;
+
+	FILE* file = fopen (filename.c_str(), "rb");
+	if (!file)
+		return hash;
+
+	unsigned char buffer[65536];
+	size_t count;
+	while ((count = fread (buffer, 1, sizeof(buffer), file)) > 0) {
+		for (size_t i = 0; i < count; i++) {
+			hash ^= buffer[i];
+			hash *= 1099511628211ULL;
+		}
+	}
+
+	fclose (file);
+
+	return hash;
+}
+
+/** \brief Reads modification time (in nanoseconds) and size of a file.
+ *
+ * \returns false if the file does not exist.
+ */
+inline bool get_file_status (const std::string &filename, int64_t &mtime, uint64_t &size) {
+#if defined(WIN32) || defined (_WIN32)
+	struct _stat64 file_status;
+	if (_stat64 (filename.c_str(), &file_status) != 0)
+		return false;
+
+	// only full seconds are available, so a rewrite with the same size
+	// within the same second is not noticed
+	mtime = static_cast<int64_t>(file_status.st_mtime) * 1000000000LL;
+#else
+	struct stat file_status;
+	if (stat (filename.c_str(), &file_status) != 0)
+		return false;
+
+#ifdef __APPLE__
+	mtime = static_cast<int64_t>(file_status.st_mtimespec.tv_sec) * 1000000000LL + file_status.st_mtimespec.tv_nsec;
+#else
+	mtime = static_cast<int64_t>(file_status.st_mtim.tv_sec) * 1000000000LL + file_status.st_mtim.tv_nsec;
+#endif
+#endif
+	size = file_status.st_size;
+
+	return true;
+}
+
+/** \brief Identifies the content of a file to detect modifications.
+ *
+ * Modification time and size are checked first. Only if the size is the
+ * same but the file was written again the content hashes get compared
+ * so that rewriting a file with identical content does not count as a
+ * modification. The hash is only computed when it is needed, i.e. not
+ * when the stamp gets created.
+ */
+struct FileStamp {
+	FileStamp() :
+		filename (""),
+		exists (false),
+		mtime (0),
+		size (0),
+		hash_valid (false),
+		hash (0)
+	{}
+
+	/// Creates the stamp of the current content of the file
+	static FileStamp fromFile (const std::string &filename) {
+		FileStamp result;
+		result.filename = filename;
+
+		if (!get_file_status (filename, result.mtime, result.size))
+			return result;
+
+		result.exists = true;
+
+		return result;
+	}
+
+	/// Hash of the stamped content, computed on the first call (while the
+	/// file still has the modification time of the stamp)
+	uint64_t contentHash () const {
+		if (!hash_valid) {
+			hash = compute_file_hash (filename);
+			hash_valid = true;
+		}
+
+		return hash;
+	}
+
+	/** \brief Returns true if the content of the file differs from the
+	 * stamp.
+	 *
+	 * An unmodified file gets hashed once so that a later rewrite with the
+	 * same content can be detected. If the hash was not known before the
+	 * file was written again it counts as modified.
+	 */
+	bool isModified () const {
+		if (filename == "")
+			return false;
+
+		int64_t current_mtime;
+		uint64_t current_size;
+		if (!get_file_status (filename, current_mtime, current_size))
+			return exists;
+
+		if (!exists || current_size != size)
+			return true;
+
+		if (current_mtime == mtime) {
+			contentHash();
+			return false;
+		}
+
+		if (!hash_valid)
+			return true;
+
+		return compute_file_hash (filename) != hash;
+	}
+
+	/// Takes over the current modification time. To be called when
+	/// isModified() found the content unchanged, so that later checks do
+	/// not need to hash the file again.
+	void refresh () {
+		int64_t current_mtime;
+		uint64_t current_size;
+		if (exists && get_file_status (filename, current_mtime, current_size) && current_size == size)
+			mtime = current_mtime;
+	}
+
+	std::string filename;
+	bool exists;
+	/// modification time in nanoseconds
+	int64_t mtime;
+	uint64_t size;
+	mutable bool hash_valid;
+	mutable uint64_t hash;
+};
+
+#endif
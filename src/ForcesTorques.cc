@@ -27,6 +27,8 @@ bool ForcesTorques::loadFromFile (const char* filename, bool strict) {
 		return false;
 	}
 
+	forces_stamp = FileStamp::fromFile (filename);
+
 	if (times.size() > 0) {
 		for(int i=0;i<times.size();i++) {
 			delete forces[i];
@@ -6,6 +6,7 @@
 #include "Math.h"
 #include "Model.h"
 #include "Arrow.h"
+#include "FileStamp.h"
 
 struct ForcesTorques {
 	ForcesTorques(MeshupModel* model) :
@@ -24,6 +25,7 @@ struct ForcesTorques {
 	}
 	// Metadata
 	std::string forces_filename;
+	FileStamp forces_stamp;
 	MeshupModel* model_ref;
 	float duration;
 
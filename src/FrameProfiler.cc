@@ -0,0 +1,284 @@
+/*
+ * MeshUp - A visualization tool for multi-body systems based on skeletal
+ * animation and magic.
+ *
+ * Copyright (c) 2012-2018 Martin Felis <martin.felis@iwr.uni-heidelberg.de>
+ *
+ * Licensed under the MIT license. See LICENSE for more details.
+ */
+
+#include "GL/glew.h"
+
+#include "FrameProfiler.h"
+
+#include <cstdlib>
+#include <iostream>
+
+#include <sys/time.h>
+
+using namespace std;
+
+/// results of timer queries above one second are not plausible
+static const GLuint64 max_query_nsec = 1000000000ull;
+
+static double profiler_time_msec () {
+	struct timeval clock_value;
+	gettimeofday (&clock_value, NULL);
+
+	return static_cast<double>(clock_value.tv_sec) * 1.0e3 + static_cast<double>(clock_value.tv_usec) * 1.0e-3;
+}
+
+const char* profile_cpu_section_name (ProfileCpuSection section) {
+	switch (section) {
+		case ProfileScripting: return "scripting";
+		case ProfileAnimation: return "animation";
+		case ProfileSegmentUpdate: return "segment_update";
+		case ProfileDrawSubmission: return "draw_submission";
+		default: break;
+	}
+
+	return "unknown";
+}
+
+const char* profile_gpu_pass_name (ProfileGpuPass pass) {
+	switch (pass) {
+		case ProfileShadowMapPass: return "shadow_map";
+		case ProfileFloorPass: return "floor";
+		case ProfileMeshPass: return "meshes";
+		case ProfileOverlayPass: return "overlays";
+		default: break;
+	}
+
+	return "unknown";
+}
+
+double FrameProfile::cpuTime() const {
+	double result = 0.;
+	for (unsigned int i = 0; i < ProfileCpuSectionCount; i++)
+		result += cpu_time[i];
+
+	return result;
+}
+
+double FrameProfile::gpuTime() const {
+	double result = 0.;
+	for (unsigned int i = 0; i < ProfileGpuPassCount; i++)
+		result += gpu_time[i];
+
+	return result;
+}
+
+void FrameProfiler::beginFrame() {
+	frame_start = profiler_time_msec();
+	frame_active = true;
+}
+
+void FrameProfiler::endFrame() {
+	if (!frame_active)
+		return;
+
+	frame_active = false;
+	current.frame_number = frame_count;
+	current.frame_time = profiler_time_msec() - frame_start;
+
+	if (history.size() < history_size)
+		history.push_back (current);
+	else
+		history[frame_count % history_size] = current;
+
+	frame_count++;
+
+	current = FrameProfile();
+	current.frame_number = frame_count;
+}
+
+void FrameProfiler::beginCpu (ProfileCpuSection section) {
+	double now = profiler_time_msec();
+
+	// the enclosing section is paused
+	if (cpu_sections.size() > 0) {
+		CpuSectionStart &outer = cpu_sections.back();
+		current.cpu_time[outer.section] += now - outer.start;
+	}
+
+	CpuSectionStart entered;
+	entered.section = section;
+	entered.start = now;
+	cpu_sections.push_back (entered);
+}
+
+void FrameProfiler::endCpu() {
+	if (cpu_sections.size() == 0) {
+		cerr << "Error: FrameProfiler::endCpu() called without a matching beginCpu()!" << endl;
+		abort();
+	}
+
+	double now = profiler_time_msec();
+
+	CpuSectionStart &left = cpu_sections.back();
+	current.cpu_time[left.section] += now - left.start;
+	cpu_sections.pop_back();
+
+	if (cpu_sections.size() > 0)
+		cpu_sections.back().start = now;
+}
+
+void FrameProfiler::beginGpu (ProfileGpuPass pass) {
+	if (gpu_pass_active) {
+		cerr << "Error: GPU pass " << profile_gpu_pass_name (pass) << " started while another one is still measured!" << endl;
+		abort();
+	}
+
+	if (!gpu_timing_checked) {
+		gpu_timing_supported = GLEW_ARB_timer_query || GLEW_VERSION_3_3;
+		gpu_timing_checked = true;
+
+		if (!gpu_timing_supported)
+			cerr << "Warning: timer queries are not supported, GPU times will not be measured." << endl;
+	}
+
+	if (!gpu_timing_supported)
+		return;
+
+	GLuint query_id = 0;
+	if (free_queries.size() > 0) {
+		query_id = free_queries.back();
+		free_queries.pop_back();
+	} else {
+		glGenQueries (1, &query_id);
+	}
+
+	glBeginQuery (GL_TIME_ELAPSED, query_id);
+
+	PendingQuery query;
+	query.query_id = query_id;
+	query.pass = pass;
+	query.frame_number = current.frame_number;
+	pending_queries.push_back (query);
+
+	current.gpu_queries++;
+	gpu_pass_active = true;
+}
+
+void FrameProfiler::endGpu() {
+	if (!gpu_pass_active)
+		return;
+
+	glEndQuery (GL_TIME_ELAPSED);
+	gpu_pass_active = false;
+}
+
+FrameProfile* FrameProfiler::findFrame (unsigned int frame_number) {
+	if (frame_number == current.frame_number)
+		return &current;
+
+	if (frame_number >= frame_count || frame_count - frame_number > history.size())
+		return NULL;
+
+	FrameProfile &frame = history[frame_number % history_size];
+	if (frame.frame_number != frame_number)
+		return NULL;
+
+	return &frame;
+}
+
+void FrameProfiler::collectGpuResults() {
+	if (gpu_pass_active)
+		return;
+
+	// the queries finish in the order they were issued
+	size_t collected = 0;
+	while (collected < pending_queries.size()) {
+		const PendingQuery &query = pending_queries[collected];
+
+		GLint available = 0;
+		glGetQueryObjectiv (query.query_id, GL_QUERY_RESULT_AVAILABLE, &available);
+		if (!available)
+			break;
+
+		GLuint64 elapsed_nsec = 0;
+		glGetQueryObjectui64v (query.query_id, GL_QUERY_RESULT, &elapsed_nsec);
+
+		// frames that already left the history are dropped. Some drivers
+		// return a time stamp for the very first query, such a frame is
+		// left without a GPU time.
+		FrameProfile *frame = findFrame (query.frame_number);
+		if (frame && elapsed_nsec < max_query_nsec) {
+			frame->gpu_time[query.pass] += static_cast<double>(elapsed_nsec) * 1.0e-6;
+			frame->gpu_results++;
+		}
+
+		free_queries.push_back (query.query_id);
+		collected++;
+	}
+
+	pending_queries.erase (pending_queries.begin(), pending_queries.begin() + collected);
+}
+
+void FrameProfiler::releaseQueries() {
+	if (gpu_pass_active)
+		endGpu();
+
+	for (size_t i = 0; i < pending_queries.size(); i++)
+		free_queries.push_back (pending_queries[i].query_id);
+	pending_queries.clear();
+
+	if (free_queries.size() > 0)
+		glDeleteQueries (free_queries.size(), &free_queries[0]);
+	free_queries.clear();
+}
+
+unsigned int FrameProfiler::historyCount() const {
+	return history.size();
+}
+
+const FrameProfile& FrameProfiler::historyFrame (unsigned int i) const {
+	if (history.size() < history_size)
+		return history[i];
+
+	return history[(frame_count + i) % history_size];
+}
+
+FrameProfile FrameProfiler::average() const {
+	FrameProfile result;
+
+	if (history.size() == 0)
+		return result;
+
+	unsigned int gpu_frames = 0;
+
+	for (size_t i = 0; i < history.size(); i++) {
+		const FrameProfile &frame = history[i];
+
+		result.frame_time += frame.frame_time;
+		for (unsigned int j = 0; j < ProfileCpuSectionCount; j++)
+			result.cpu_time[j] += frame.cpu_time[j];
+
+		if (!frame.gpuTimeValid())
+			continue;
+
+		for (unsigned int j = 0; j < ProfileGpuPassCount; j++)
+			result.gpu_time[j] += frame.gpu_time[j];
+		gpu_frames++;
+	}
+
+	result.frame_number = frame_count - 1;
+	result.frame_time /= history.size();
+	for (unsigned int j = 0; j < ProfileCpuSectionCount; j++)
+		result.cpu_time[j] /= history.size();
+
+	if (gpu_frames > 0) {
+		for (unsigned int j = 0; j < ProfileGpuPassCount; j++)
+			result.gpu_time[j] /= gpu_frames;
+	}
+
+	result.gpu_queries = gpu_frames;
+	result.gpu_results = gpu_frames;
+
+	return result;
+}
+
+FrameProfiler& get_frame_profiler () {
+	static FrameProfiler profiler;
+	return profiler;
+}
@@ -0,0 +1,180 @@
+/*
+ * MeshUp - A visualization tool for multi-body systems based on skeletal
+ * animation and magic.
+ *
+ * Copyright (c) 2012-2018 Martin Felis <martin.felis@iwr.uni-heidelberg.de>
+ *
+ * Licensed under the MIT license. See LICENSE for more details.
+ */
+
+#ifndef _FRAMEPROFILER_H
+#define _FRAMEPROFILER_H
+
+#include <vector>
+
+/// Parts of a frame whose CPU time is measured
+enum ProfileCpuSection {
+	ProfileScripting = 0,
+	ProfileAnimation,
+	ProfileSegmentUpdate,
+	ProfileDrawSubmission,
+	ProfileCpuSectionCount
+};
+
+/// Render passes whose GPU time is measured
+enum ProfileGpuPass {
+	ProfileShadowMapPass = 0,
+	ProfileFloorPass,
+	ProfileMeshPass,
+	ProfileOverlayPass,
+	ProfileGpuPassCount
+};
+
+/// Name of the section as used in the Lua table (e.g. "segment_update")
+const char* profile_cpu_section_name (ProfileCpuSection section);
+/// Name of the pass as used in the Lua table (e.g. "shadow_map")
+const char* profile_gpu_pass_name (ProfileGpuPass pass);
+
+/** \brief Timings of a single frame in milliseconds. */
+struct FrameProfile {
+	FrameProfile() :
+		frame_number (0),
+		frame_time (0.),
+		gpu_queries (0),
+		gpu_results (0)
+	{
+		for (unsigned int i = 0; i < ProfileCpuSectionCount; i++)
+			cpu_time[i] = 0.;
+		for (unsigned int i = 0; i < ProfileGpuPassCount; i++)
+			gpu_time[i] = 0.;
+	}
+
+	/// CPU time of the sections that were measured
+	double cpuTime() const;
+	/// GPU time of all passes
+	double gpuTime() const;
+	/// true if all timer queries of the frame have finished
+	bool gpuTimeValid() const {
+		return gpu_queries > 0 && gpu_results == gpu_queries;
+	}
+
+	unsigned int frame_number;
+	/// wall time between beginFrame() and endFrame()
+	double frame_time;
+	/// exclusive time of each section, i.e. without nested sections
+	double cpu_time[ProfileCpuSectionCount];
+	double gpu_time[ProfileGpuPassCount];
+
+	/// number of timer queries that were issued and that have finished
+	unsigned int gpu_queries;
+	unsigned int gpu_results;
+};
+
+/** \brief Measures where the time of a frame is spent.
+ *
+ * CPU sections may be nested, the time of a nested section is only
+ * counted for the inner one. The GPU time of the render passes is
+ * measured with GL_TIME_ELAPSED queries. Their results are only read
+ * once they are available (usually a frame or two later), so the
+ * profiler never waits for the GPU. GPU passes must not be nested.
+ *
+ * Sections that are measured outside of beginFrame() and endFrame()
+ * (e.g. when Qt redraws the widget on its own) are counted for the next
+ * frame.
+ */
+struct FrameProfiler {
+	FrameProfiler() :
+		history_size (120),
+		frame_count (0),
+		frame_active (false),
+		frame_start (0.),
+		gpu_timing_checked (false),
+		gpu_timing_supported (false),
+		gpu_pass_active (false)
+	{}
+
+	void beginFrame();
+	void endFrame();
+
+	void beginCpu (ProfileCpuSection section);
+	void endCpu();
+
+	/// Need a current OpenGL context
+	void beginGpu (ProfileGpuPass pass);
+	void endGpu();
+	/// Reads the results of the finished timer queries without waiting
+	void collectGpuResults();
+	/// Deletes the timer queries, has to be called while the context is
+	/// still current
+	void releaseQueries();
+
+	/// Number of frames in the history
+	unsigned int historyCount() const;
+	/// i-th frame of the history, 0 is the oldest one
+	const FrameProfile& historyFrame (unsigned int i) const;
+	/** \brief Average of the frames in the history.
+	 *
+	 * The GPU times are averaged over the frames whose queries have
+	 * finished, their number is stored in gpu_queries and gpu_results.
+	 */
+	FrameProfile average() const;
+
+	/// number of frames that are kept for the average and the graph, must
+	/// be set before the first frame
+	unsigned int history_size;
+
+	/// ring buffer of the last frames
+	std::vector<FrameProfile> history;
+	unsigned int frame_count;
+	FrameProfile current;
+
+	/// entered CPU sections with the time when they were entered or
+	/// when the last nested section was left
+	struct CpuSectionStart {
+		ProfileCpuSection section;
+		double start;
+	};
+
+	struct PendingQuery {
+		unsigned int query_id;
+		ProfileGpuPass pass;
+		unsigned int frame_number;
+	};
+
+	FrameProfile* findFrame (unsigned int frame_number);
+
+	bool frame_active;
+	double frame_start;
+	std::vector<CpuSectionStart> cpu_sections;
+
+	bool gpu_timing_checked;
+	bool gpu_timing_supported;
+	bool gpu_pass_active;
+	/// queries in the order they were issued
+	std::vector<PendingQuery> pending_queries;
+	std::vector<unsigned int> free_queries;
+};
+
+FrameProfiler& get_frame_profiler();
+
+/** \brief Measures the CPU time of a section until it goes out of scope. */
+struct ProfileCpuScope {
+	ProfileCpuScope (ProfileCpuSection section) {
+		get_frame_profiler().beginCpu (section);
+	}
+	~ProfileCpuScope() {
+		get_frame_profiler().endCpu();
+	}
+};
+
+/** \brief Measures the GPU time of a pass until it goes out of scope. */
+struct ProfileGpuScope {
+	ProfileGpuScope (ProfileGpuPass pass) {
+		get_frame_profiler().beginGpu (pass);
+	}
+	~ProfileGpuScope() {
+		get_frame_profiler().endGpu();
+	}
+};
+
+#endif
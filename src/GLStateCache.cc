@@ -0,0 +1,147 @@
+/*
+ * MeshUp - A visualization tool for multi-body systems based on skeletal
+ * animation and magic.
+ *
+ * Copyright (c) 2012-2018 Martin Felis <martin.felis@iwr.uni-heidelberg.de>
+ *
+ * Licensed under the MIT license. See LICENSE for more details.
+ */
+
+#include "GL/glew.h"
+
+#include "GLStateCache.h"
+
+using namespace std;
+
+void GLStateCache::invalidate() {
+	capabilities.clear();
+	client_states.clear();
+	buffer_bindings.clear();
+	shade_model = 0;
+	color_mask = -1;
+	color_valid = false;
+}
+
+bool GLStateCache::isEnabled (unsigned int capability) {
+	if (enabled) {
+		map<unsigned int, bool>::iterator state_iter = capabilities.find (capability);
+		if (state_iter != capabilities.end()) {
+			stats.local_queries++;
+			return state_iter->second;
+		}
+	}
+
+	stats.driver_queries++;
+	bool result = glIsEnabled (capability) == GL_TRUE;
+	capabilities[capability] = result;
+
+	return result;
+}
+
+void GLStateCache::setEnabled (unsigned int capability, bool enable) {
+	if (enabled) {
+		map<unsigned int, bool>::iterator state_iter = capabilities.find (capability);
+		if (state_iter != capabilities.end() && state_iter->second == enable) {
+			stats.redundant_changes++;
+			return;
+		}
+	}
+
+	stats.state_changes++;
+	if (enable)
+		glEnable (capability);
+	else
+		glDisable (capability);
+
+	capabilities[capability] = enable;
+}
+
+void GLStateCache::setClientState (unsigned int array, bool enable) {
+	if (enabled) {
+		map<unsigned int, bool>::iterator state_iter = client_states.find (array);
+		if (state_iter != client_states.end() && state_iter->second == enable) {
+			stats.redundant_changes++;
+			return;
+		}
+	}
+
+	stats.state_changes++;
+	if (enable)
+		glEnableClientState (array);
+	else
+		glDisableClientState (array);
+
+	client_states[array] = enable;
+}
+
+void GLStateCache::shadeModel (unsigned int mode) {
+	if (enabled && shade_model == mode) {
+		stats.redundant_changes++;
+		return;
+	}
+
+	stats.state_changes++;
+	glShadeModel (mode);
+	shade_model = mode;
+}
+
+void GLStateCache::colorMask (bool write_color) {
+	int mask = write_color ? 1 : 0;
+	if (enabled && color_mask == mask) {
+		stats.redundant_changes++;
+		return;
+	}
+
+	stats.state_changes++;
+	glColorMask (mask, mask, mask, mask);
+	color_mask = mask;
+}
+
+bool GLStateCache::writesColor() {
+	if (enabled && color_mask != -1) {
+		stats.local_queries++;
+		return color_mask == 1;
+	}
+
+	stats.driver_queries++;
+	GLboolean mask[4];
+	glGetBooleanv (GL_COLOR_WRITEMASK, mask);
+	bool result = mask[0] || mask[1] || mask[2] || mask[3];
+
+	// partial masks are not tracked
+	if (mask[0] == mask[1] && mask[0] == mask[2] && mask[0] == mask[3])
+		color_mask = result ? 1 : 0;
+
+	return result;
+}
+
+void GLStateCache::bindBuffer (unsigned int target, unsigned int buffer_id) {
+	if (enabled) {
+		map<unsigned int, unsigned int>::iterator binding_iter = buffer_bindings.find (target);
+		if (binding_iter != buffer_bindings.end() && binding_iter->second == buffer_id) {
+			stats.redundant_changes++;
+			return;
+		}
+	}
+
+	stats.state_changes++;
+	glBindBuffer (target, buffer_id);
+	buffer_bindings[target] = buffer_id;
+}
+
+void GLStateCache::setColor (const Vector4f &new_color) {
+	if (enabled && color_valid && color == new_color) {
+		stats.redundant_changes++;
+		return;
+	}
+
+	stats.state_changes++;
+	glColor4fv (new_color.data());
+	color = new_color;
+	color_valid = true;
+}
+
+GLStateCache& get_gl_state_cache () {
+	static GLStateCache cache;
+	return cache;
+}
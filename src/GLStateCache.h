@@ -0,0 +1,118 @@
+/*
+ * MeshUp - A visualization tool for multi-body systems based on skeletal
+ * animation and magic.
+ *
+ * Copyright (c) 2012-2018 Martin Felis <martin.felis@iwr.uni-heidelberg.de>
+ *
+ * Licensed under the MIT license. See LICENSE for more details.
+ */
+
+#ifndef _GLSTATECACHE_H
+#define _GLSTATECACHE_H
+
+#include <map>
+
+#include "Math.h"
+
+/** \brief Counts the calls that went through the GLStateCache. */
+struct GLStateStats {
+	GLStateStats() :
+		state_changes (0),
+		redundant_changes (0),
+		local_queries (0),
+		driver_queries (0)
+	{}
+
+	GLStateStats& operator+= (const GLStateStats &other) {
+		state_changes += other.state_changes;
+		redundant_changes += other.redundant_changes;
+		local_queries += other.local_queries;
+		driver_queries += other.driver_queries;
+		return *this;
+	}
+
+	/// calls that were passed on to OpenGL
+	unsigned int state_changes;
+	/// calls that were skipped as the state was already set
+	unsigned int redundant_changes;
+	/// queries that were answered by the cache
+	unsigned int local_queries;
+	/// queries that had to be sent to the driver
+	unsigned int driver_queries;
+};
+
+/** \brief Remembers the OpenGL state that is changed while drawing so
+ * that redundant changes are skipped and queries such as glIsEnabled()
+ * do not need a round trip to the driver.
+ *
+ * States are unknown until they are set or queried once. All changes of
+ * a state that is tracked by the cache have to go through it (or be
+ * undone before the cache is used again, e.g. by glPopAttrib()),
+ * otherwise invalidate() has to be called. Buffer bindings are expected
+ * to be reset to 0 after drawing, as the buffers are also bound when
+ * they get created.
+ *
+ * The current color is changed by draws with color arrays, so it is only
+ * valid until invalidateColor() is called.
+ */
+struct GLStateCache {
+	GLStateCache() :
+		enabled (true),
+		shade_model (0),
+		color_mask (-1),
+		color_valid (false),
+		color (0.f, 0.f, 0.f, 0.f)
+	{}
+
+	/// Forgets all states, e.g. at the start of a frame
+	void invalidate();
+	void invalidateColor() {
+		color_valid = false;
+	}
+
+	/// glIsEnabled() that only asks the driver if the state is unknown
+	bool isEnabled (unsigned int capability);
+	void setEnabled (unsigned int capability, bool enable);
+	void enable (unsigned int capability) {
+		setEnabled (capability, true);
+	}
+	void disable (unsigned int capability) {
+		setEnabled (capability, false);
+	}
+	/// glEnableClientState() or glDisableClientState()
+	void setClientState (unsigned int array, bool enable);
+	void shadeModel (unsigned int mode);
+	/// sets all four components of glColorMask()
+	void colorMask (bool write_color);
+	/// true if the color mask allows writing colors
+	bool writesColor();
+	/// only GL_ARRAY_BUFFER and GL_ELEMENT_ARRAY_BUFFER
+	void bindBuffer (unsigned int target, unsigned int buffer_id);
+	void setColor (const Vector4f &new_color);
+
+	/// can be cleared to pass all calls to OpenGL (the statistics are
+	/// still collected), e.g. for comparisons
+	bool enabled;
+	/// since the last call of resetStats()
+	GLStateStats stats;
+	void resetStats() {
+		stats = GLStateStats();
+	}
+
+	/// known states by capability (or client array), missing ones are
+	/// unknown
+	std::map<unsigned int, bool> capabilities;
+	std::map<unsigned int, bool> client_states;
+	std::map<unsigned int, unsigned int> buffer_bindings;
+	/// 0 if unknown
+	unsigned int shade_model;
+	/// -1 if unknown
+	int color_mask;
+	bool color_valid;
+	Vector4f color;
+};
+
+/** \brief The state cache of the OpenGL context of MeshUp. */
+GLStateCache& get_gl_state_cache ();
+
+#endif
@@ -0,0 +1,117 @@
+/*
+ * MeshUp - A visualization tool for multi-body systems based on skeletal
+ * animation and magic.
+ *
+ * Copyright (c) 2012-2018 Martin Felis <martin.felis@iwr.uni-heidelberg.de>
+ *
+ * Licensed under the MIT license. See LICENSE for more details.
+ */
+
+#include "GL/glew.h"
+
+#include "LineBatch.h"
+#include "GLStateCache.h"
+
+#include <iostream>
+#include <set>
+
+using namespace std;
+
+/// position and color
+const size_t vertex_float_count = 6;
+
+/** Warns once for every line width that is not supported by the graphics
+ * driver. The supported range is only queried once. */
+static void check_line_width (float width) {
+	static bool range_queried = false;
+	static float line_width_range[2] = { 1.f, 1.f };
+	static set<float> reported_widths;
+
+	if (!range_queried) {
+		glGetFloatv (GL_ALIASED_LINE_WIDTH_RANGE, line_width_range);
+		range_queried = true;
+	}
+
+	if ((width < line_width_range[0] || width > line_width_range[1])
+			&& reported_widths.find (width) == reported_widths.end()) {
+		cerr << "Warning: Only line widths within range [" << line_width_range[0] << ", " << line_width_range[1] << "] are supported by the graphics driver! (line_width = " << width << ")" << endl;
+		reported_widths.insert (width);
+	}
+}
+
+LineBatch::~LineBatch() {
+	if (buffer_id != 0)
+		glDeleteBuffers (1, &buffer_id);
+}
+
+void LineBatch::clear() {
+	map<float, vector<float> >::iterator width_iter = vertices.begin();
+	while (width_iter != vertices.end()) {
+		width_iter->second.clear();
+		width_iter++;
+	}
+}
+
+void LineBatch::addLine (const Vector3f &start, const Vector3f &end, const Vector3f &color, float width) {
+	vector<float> &width_vertices = vertices[width];
+
+	width_vertices.insert (width_vertices.end(), start.data(), start.data() + 3);
+	width_vertices.insert (width_vertices.end(), color.data(), color.data() + 3);
+	width_vertices.insert (width_vertices.end(), end.data(), end.data() + 3);
+	width_vertices.insert (width_vertices.end(), color.data(), color.data() + 3);
+}
+
+size_t LineBatch::lineCount() const {
+	size_t count = 0;
+
+	map<float, vector<float> >::const_iterator width_iter = vertices.begin();
+	while (width_iter != vertices.end()) {
+		count += width_iter->second.size() / (2 * vertex_float_count);
+		width_iter++;
+	}
+
+	return count;
+}
+
+void LineBatch::draw() {
+	buffer_vertices.clear();
+
+	map<float, vector<float> >::iterator width_iter = vertices.begin();
+	while (width_iter != vertices.end()) {
+		buffer_vertices.insert (buffer_vertices.end(), width_iter->second.begin(), width_iter->second.end());
+		width_iter++;
+	}
+
+	if (buffer_vertices.size() == 0)
+		return;
+
+	if (buffer_id == 0)
+		glGenBuffers (1, &buffer_id);
+
+	GLStateCache &state = get_gl_state_cache();
+	state.bindBuffer (GL_ARRAY_BUFFER, buffer_id);
+	glBufferData (GL_ARRAY_BUFFER, buffer_vertices.size() * sizeof(float), &buffer_vertices[0], GL_STREAM_DRAW);
+
+	size_t vertex_stride = vertex_float_count * sizeof(float);
+	glVertexPointer (3, GL_FLOAT, vertex_stride, NULL);
+	glColorPointer (3, GL_FLOAT, vertex_stride, (const GLvoid *) (3 * sizeof(float)));
+	state.setClientState (GL_VERTEX_ARRAY, true);
+	state.setClientState (GL_COLOR_ARRAY, true);
+	state.setClientState (GL_NORMAL_ARRAY, false);
+
+	size_t first_vertex = 0;
+	for (width_iter = vertices.begin(); width_iter != vertices.end(); width_iter++) {
+		size_t vertex_count = width_iter->second.size() / vertex_float_count;
+		if (vertex_count == 0)
+			continue;
+
+		check_line_width (width_iter->first);
+		glLineWidth (width_iter->first);
+		glDrawArrays (GL_LINES, first_vertex, vertex_count);
+
+		first_vertex += vertex_count;
+	}
+
+	state.setClientState (GL_COLOR_ARRAY, false);
+	state.bindBuffer (GL_ARRAY_BUFFER, 0);
+}
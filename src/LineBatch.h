@@ -0,0 +1,55 @@
+/*
+ * MeshUp - A visualization tool for multi-body systems based on skeletal
+ * animation and magic.
+ *
+ * Copyright (c) 2012-2018 Martin Felis <martin.felis@iwr.uni-heidelberg.de>
+ *
+ * Licensed under the MIT license. See LICENSE for more details.
+ */
+
+#ifndef _LINEBATCH_H
+#define _LINEBATCH_H
+
+#include <vector>
+#include <map>
+#include <cstddef>
+
+#include "Math.h"
+
+/** \brief Colored lines that are collected each frame and drawn from a
+ * single dynamic vertex buffer.
+ *
+ * Lines of the same width are drawn with one draw call. The lines are
+ * given in the coordinates of the current modelview matrix, so overlays
+ * of several models can share a batch. Copies start out empty.
+ */
+struct LineBatch {
+	LineBatch() :
+		buffer_id (0)
+	{}
+	LineBatch (const LineBatch &other) :
+		buffer_id (0)
+	{}
+	LineBatch& operator= (const LineBatch &other) {
+		clear();
+		return *this;
+	}
+	~LineBatch();
+
+	/// Removes all lines but keeps the allocated memory
+	void clear();
+	void addLine (const Vector3f &start, const Vector3f &end, const Vector3f &color, float width = 1.f);
+	/// number of lines of all widths
+	size_t lineCount() const;
+	/// Uploads the lines and draws them, does nothing if there are no lines
+	void draw();
+
+	/// positions and colors (3 floats each) of the line vertices by line
+	/// width
+	std::map<float, std::vector<float> > vertices;
+	/// vertices of all widths that were uploaded by draw()
+	std::vector<float> buffer_vertices;
+	unsigned int buffer_id;
+};
+
+#endif
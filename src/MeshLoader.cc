@@ -0,0 +1,418 @@
+/*
+ * MeshUp - A visualization tool for multi-body systems based on skeletal
+ * animation and magic.
+ *
+ * Copyright (c) 2012-2018 Martin Felis <martin.felis@iwr.uni-heidelberg.de>
+ *
+ * Licensed under the MIT license. See LICENSE for more details.
+ */
+
+#include "MeshLoader.h"
+
+#include <iostream>
+
+#include "ObjParser.h"
+#include "thread_utils.h"
+#include "timer.h"
+
+using namespace std;
+
+bool load_meshes_parallel (std::vector<MeshLoadRequest> &requests, bool bounds_only) {
+	if (requests.size() == 0)
+		return true;
+
+	// all objects that are requested from the same file are loaded by one
+	// thread so that the file only gets parsed once
+	std::vector<std::vector<size_t> > file_requests;
+	std::map<std::string, size_t> file_indices;
+	for (size_t i = 0; i < requests.size(); i++) {
+		std::pair<std::map<std::string, size_t>::iterator, bool> inserted
+			= file_indices.insert (std::make_pair (requests[i].filename, file_requests.size()));
+		if (inserted.second)
+			file_requests.push_back (std::vector<size_t>());
+
+		file_requests[inserted.first->second].push_back (i);
+	}
+
+	unsigned int thread_count = get_worker_thread_count();
+	if (thread_count > file_requests.size())
+		thread_count = file_requests.size();
+
+	for (size_t i = 0; i < requests.size(); i++) {
+		const char* what = bounds_only ? "bounds of " : "";
+		if (requests[i].object_name != "")
+			cout << "Loading " << what << "sub object " << requests[i].object_name << " from file " << requests[i].filename << endl;
+		else
+			cout << "Loading " << what << "mesh " << requests[i].filename << endl;
+	}
+
+	TimerInfo timer_info;
+	timer_start (&timer_info);
+
+	parallel_for (file_requests.size(), [&requests, &file_requests, bounds_only](size_t fi) {
+			const std::vector<size_t> &request_indices = file_requests[fi];
+			const std::string &filename = requests[request_indices[0]].filename;
+
+			// the stamp is taken before reading so that changes while
+			// loading are detected later on
+			FileStamp stamp = FileStamp::fromFile (filename);
+
+			// the file is only parsed if a mesh is not in a cache file
+			ObjData obj_data;
+			bool read = false;
+			bool parsed = false;
+
+			for (size_t ri = 0; ri < request_indices.size(); ri++) {
+				MeshLoadRequest &request = requests[request_indices[ri]];
+				const char* object_name = NULL;
+				if (request.object_name != "")
+					object_name = request.object_name.c_str();
+
+				request.stamp = stamp;
+
+				if (bounds_only) {
+					// the header of a cache file is enough for the box
+					if (request.cache_filename != "") {
+						request.mesh->source_filename = filename;
+						request.mesh->source_object_name = request.object_name;
+						request.success = request.mesh->loadMeshBinBoundingBox (request.cache_filename.c_str(), stamp);
+						if (request.success)
+							continue;
+					}
+
+					request.success = request.mesh->loadOBJBoundingBox (filename.c_str(), object_name);
+					continue;
+				}
+
+				if (request.cache_filename != "") {
+					request.mesh->source_filename = filename;
+					request.mesh->source_object_name = request.object_name;
+					request.success = request.mesh->loadMeshBin (request.cache_filename.c_str(), stamp);
+					if (request.success)
+						continue;
+				}
+
+				if (request_indices.size() > 1) {
+					if (!read) {
+						parsed = read_obj_file (filename.c_str(), NULL, obj_data);
+						read = true;
+					}
+					request.success = parsed && request.mesh->loadOBJObject (obj_data, filename.c_str(), object_name);
+				} else {
+					request.success = request.mesh->loadOBJ (filename.c_str(), object_name);
+				}
+
+				if (request.success && request.cache_filename != "")
+					request.mesh->saveMeshBin (request.cache_filename.c_str(), stamp);
+			}
+			}, thread_count);
+
+	double duration = timer_stop (&timer_info);
+
+	bool result = true;
+	for (size_t i = 0; i < requests.size(); i++) {
+		if (!requests[i].success)
+			result = false;
+	}
+
+	cout << "Loaded " << requests.size() << " meshes from " << file_requests.size() << " file(s) in " << duration * 1000. << " ms using " << thread_count << " thread(s)." << endl;
+
+	return result;
+}
+
+void upload_meshes (std::vector<MeshLoadRequest> &requests) {
+	for (size_t i = 0; i < requests.size(); i++) {
+		if (requests[i].success && !requests[i].mesh->bounds_only)
+			requests[i].mesh->generate_vbo();
+	}
+}
+
+LazyMeshLoader::~LazyMeshLoader() {
+	{
+		std::lock_guard<std::mutex> lock (mutex);
+		quit = true;
+	}
+	queue_condition.notify_all();
+
+	for (size_t i = 0; i < threads.size(); i++) {
+		threads[i].join();
+	}
+
+	for (size_t i = 0; i < finished.size(); i++) {
+		delete finished[i].second;
+	}
+}
+
+void LazyMeshLoader::requestLoad (MeshVBO* mesh) {
+	{
+		std::lock_guard<std::mutex> lock (mutex);
+
+		if (requested.find (mesh) != requested.end())
+			return;
+
+		requested.insert (mesh);
+		queued.push_back (mesh);
+
+		// workers are only started once they are needed
+		if (threads.size() == 0) {
+			unsigned int thread_count = get_worker_thread_count();
+			for (unsigned int i = 0; i < thread_count; i++) {
+				threads.push_back (std::thread (&LazyMeshLoader::workerLoop, this));
+			}
+		}
+	}
+
+	queue_condition.notify_one();
+}
+
+void LazyMeshLoader::workerLoop () {
+	std::unique_lock<std::mutex> lock (mutex);
+
+	while (true) {
+		queue_condition.wait (lock, [this]() { return quit || queued.size() > 0; });
+
+		if (quit)
+			return;
+
+		// all queued meshes of the same file are loaded together so that
+		// the file only gets parsed once
+		std::vector<MeshVBO*> meshes;
+		string filename = queued.front()->source_filename;
+		for (std::deque<MeshVBO*>::iterator iter = queued.begin(); iter != queued.end(); ) {
+			if ((*iter)->source_filename == filename) {
+				meshes.push_back (*iter);
+				iter = queued.erase (iter);
+			} else {
+				iter++;
+			}
+		}
+		in_progress += meshes.size();
+
+		// the meshes themselves must not be touched outside of the GL thread
+		std::vector<MeshVBO*> loaded_meshes;
+		std::vector<string> object_names;
+		for (size_t i = 0; i < meshes.size(); i++) {
+			MeshVBO* loaded_mesh = new MeshVBO;
+			loaded_mesh->optimize = meshes[i]->optimize;
+			loaded_mesh->generate_lods = meshes[i]->generate_lods;
+			loaded_meshes.push_back (loaded_mesh);
+			object_names.push_back (meshes[i]->source_object_name);
+		}
+
+		lock.unlock();
+
+		ObjData obj_data;
+		bool parsed = false;
+		if (meshes.size() > 1)
+			parsed = read_obj_file (filename.c_str(), NULL, obj_data);
+
+		std::vector<bool> success (meshes.size(), false);
+		for (size_t i = 0; i < meshes.size(); i++) {
+			const char* object_name = NULL;
+			if (object_names[i] != "")
+				object_name = object_names[i].c_str();
+
+			if (meshes.size() > 1)
+				success[i] = parsed && loaded_meshes[i]->loadOBJObject (obj_data, filename.c_str(), object_name);
+			else
+				success[i] = loaded_meshes[i]->loadOBJ (filename.c_str(), object_name);
+		}
+
+		lock.lock();
+
+		in_progress -= meshes.size();
+		for (size_t i = 0; i < meshes.size(); i++) {
+			if (success[i]) {
+				finished.push_back (std::make_pair (meshes[i], loaded_meshes[i]));
+			} else {
+				cerr << "Error: could not load mesh " << mesh_cache_key (filename, object_names[i]) << endl;
+				delete loaded_meshes[i];
+			}
+		}
+	}
+}
+
+unsigned int LazyMeshLoader::processFinishedLoads () {
+	std::vector<std::pair<MeshVBO*, MeshVBO*> > loaded;
+
+	{
+		std::lock_guard<std::mutex> lock (mutex);
+		if (finished.size() == 0)
+			return 0;
+
+		loaded.swap (finished);
+	}
+
+	for (size_t i = 0; i < loaded.size(); i++) {
+		MeshVBO* mesh = loaded[i].first;
+		MeshVBO* loaded_mesh = loaded[i].second;
+
+		// the bounding box of the placeholder is the one of the loaded
+		// data, so the segments stay in place once the data arrives
+		mesh->vertices.swap (loaded_mesh->vertices);
+		mesh->normals.swap (loaded_mesh->normals);
+		mesh->colors.swap (loaded_mesh->colors);
+		mesh->indices.swap (loaded_mesh->indices);
+		mesh->lods.swap (loaded_mesh->lods);
+		mesh->smooth_shading = loaded_mesh->smooth_shading;
+		mesh->bounds_only = false;
+
+		if (mesh->vertices.size() != 0)
+			mesh->generate_vbo();
+
+		delete loaded_mesh;
+	}
+
+	return loaded.size();
+}
+
+bool LazyMeshLoader::hasPendingLoads () {
+	std::lock_guard<std::mutex> lock (mutex);
+	return queued.size() > 0 || in_progress > 0 || finished.size() > 0;
+}
+
+LazyMeshLoader& get_lazy_mesh_loader () {
+	static LazyMeshLoader loader;
+	return loader;
+}
+
+MeshCache& get_mesh_cache () {
+	static MeshCache cache;
+	return cache;
+}
+
+std::string mesh_cache_filename (const std::string &filename, const std::string &object_name) {
+	if (object_name == "")
+		return filename + ".meshbin";
+
+	// object names may contain characters that are not valid in file names
+	std::string name (object_name);
+	for (size_t i = 0; i < name.size(); i++) {
+		if (name[i] == '/' || name[i] == '\\' || name[i] == ':')
+			name[i] = '_';
+	}
+
+	return filename + "." + name + ".meshbin";
+}
+
+std::string mesh_cache_key (const std::string &filename, const std::string &object_name) {
+	if (object_name == "")
+		return filename;
+
+	return filename + ":" + object_name;
+}
+
+void add_to_mesh_cache (const std::vector<MeshLoadRequest> &requests) {
+	MeshCache &cache = get_mesh_cache();
+
+	for (size_t i = 0; i < requests.size(); i++) {
+		if (!requests[i].success)
+			continue;
+
+		MeshCacheEntry &entry = cache[mesh_cache_key (requests[i].filename, requests[i].object_name)];
+		entry.mesh = requests[i].mesh;
+		entry.stamp = requests[i].stamp;
+	}
+}
+
+unsigned int reload_modified_meshes () {
+	MeshCache &cache = get_mesh_cache();
+
+	std::vector<MeshCacheEntry*> modified;
+	for (MeshCache::iterator iter = cache.begin(); iter != cache.end(); iter++) {
+		if (iter->second.stamp.isModified())
+			modified.push_back (&(iter->second));
+		else
+			iter->second.stamp.refresh();
+	}
+
+	if (modified.size() == 0)
+		return 0;
+
+	// load into temporary meshes so that the current data stays intact if
+	// the new file is broken. Meshes that are not yet fully loaded only
+	// need their new bounds.
+	std::vector<MeshLoadRequest> bounds_requests;
+	std::vector<MeshLoadRequest> data_requests;
+	std::vector<MeshCacheEntry*> bounds_entries;
+	std::vector<MeshCacheEntry*> data_entries;
+
+	for (size_t i = 0; i < modified.size(); i++) {
+		MeshLoadRequest request;
+		request.filename = modified[i]->mesh->source_filename;
+		request.object_name = modified[i]->mesh->source_object_name;
+		request.mesh = new MeshVBO;
+		request.mesh->optimize = modified[i]->mesh->optimize;
+		request.mesh->generate_lods = modified[i]->mesh->generate_lods;
+
+		if (modified[i]->mesh->bounds_only) {
+			bounds_requests.push_back (request);
+			bounds_entries.push_back (modified[i]);
+		} else {
+			data_requests.push_back (request);
+			data_entries.push_back (modified[i]);
+		}
+	}
+
+	load_meshes_parallel (bounds_requests, true);
+	load_meshes_parallel (data_requests, false);
+
+	unsigned int reload_count = 0;
+
+	for (size_t i = 0; i < bounds_requests.size(); i++) {
+		MeshVBO* mesh = bounds_entries[i]->mesh;
+		MeshVBO* loaded_mesh = bounds_requests[i].mesh;
+
+		// the stamp is also updated on failure so that a broken or missing
+		// file is only reported once. Files that were written once are
+		// likely to be written again, so their content gets hashed right
+		// away to detect rewrites with the same content.
+		bounds_entries[i]->stamp = bounds_requests[i].stamp;
+		bounds_entries[i]->stamp.contentHash();
+
+		if (bounds_requests[i].success) {
+			mesh->bbox_min = loaded_mesh->bbox_min;
+			mesh->bbox_max = loaded_mesh->bbox_max;
+			reload_count++;
+		}
+
+		delete loaded_mesh;
+	}
+
+	for (size_t i = 0; i < data_requests.size(); i++) {
+		MeshVBO* mesh = data_entries[i]->mesh;
+		MeshVBO* loaded_mesh = data_requests[i].mesh;
+
+		data_entries[i]->stamp = data_requests[i].stamp;
+		data_entries[i]->stamp.contentHash();
+
+		if (data_requests[i].success) {
+			bool had_vbo = mesh->vbo_id != 0;
+			mesh->delete_vbo();
+
+			mesh->vertices.swap (loaded_mesh->vertices);
+			mesh->normals.swap (loaded_mesh->normals);
+			mesh->colors.swap (loaded_mesh->colors);
+			mesh->indices.swap (loaded_mesh->indices);
+			mesh->lods.swap (loaded_mesh->lods);
+			mesh->cpu_data_released = false;
+			mesh->closeMeshBin();
+			vector<char>().swap (mesh->packed_vertices);
+			vector<char>().swap (mesh->packed_indices);
+			mesh->smooth_shading = loaded_mesh->smooth_shading;
+			mesh->bbox_min = loaded_mesh->bbox_min;
+			mesh->bbox_max = loaded_mesh->bbox_max;
+
+			if (had_vbo)
+				mesh->generate_vbo();
+
+			reload_count++;
+		} else {
+			cerr << "Error: could not reload mesh " << data_requests[i].filename << ", keeping the previous data." << endl;
+		}
+
+		delete loaded_mesh;
+	}
+
+	return reload_count;
+}
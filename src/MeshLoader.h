@@ -0,0 +1,153 @@
+/*
+ * MeshUp - A visualization tool for multi-body systems based on skeletal
+ * animation and magic.
+ *
+ * Copyright (c) 2012-2018 Martin Felis <martin.felis@iwr.uni-heidelberg.de>
+ *
+ * Licensed under the MIT license. See LICENSE for more details.
+ */
+
+#ifndef _MESHLOADER_H
+#define _MESHLOADER_H
+
+#include <string>
+#include <vector>
+#include <deque>
+#include <set>
+#include <map>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+
+#include "MeshVBO.h"
+#include "FileStamp.h"
+
+/** \brief A mesh (or a named object within an OBJ file) that has to be
+ * loaded from disk. */
+struct MeshLoadRequest {
+	MeshLoadRequest() :
+		filename (""),
+		object_name (""),
+		cache_filename (""),
+		mesh (NULL),
+		success (false)
+	{}
+
+	/// full path of the OBJ file
+	std::string filename;
+	/// name of the object within the file or empty for the whole file
+	std::string object_name;
+	/// mesh cache file (see mesh_cache_filename()) that is used instead of
+	/// the OBJ file if it is up to date and that gets written otherwise.
+	/// Empty if no cache file should be used.
+	std::string cache_filename;
+	/// mesh into which the data gets loaded
+	MeshVBO* mesh;
+	/// stamp of the file taken before it was loaded
+	FileStamp stamp;
+	/// set to true once the mesh was loaded successfully
+	bool success;
+};
+
+/** \brief Parses the OBJ files of all requests concurrently.
+ *
+ * Only the CPU side data of the meshes gets filled. The vertex buffers
+ * have to be created afterwards by the thread that owns the OpenGL
+ * context, see upload_meshes(). The number of threads can be controlled
+ * with the environment variable MESHUP_THREADS.
+ *
+ * If bounds_only is true only the bounding boxes of the meshes are read
+ * and the full data can later be loaded using the LazyMeshLoader.
+ *
+ * \returns true if all meshes were loaded successfully.
+ */
+bool load_meshes_parallel (std::vector<MeshLoadRequest> &requests, bool bounds_only = false);
+
+/** \brief Creates the vertex buffers of all successfully loaded meshes.
+ *
+ * Must be called from the thread that owns the OpenGL context.
+ */
+void upload_meshes (std::vector<MeshLoadRequest> &requests);
+
+/** \brief Loads the data of bounds only meshes in the background.
+ *
+ * Meshes are parsed by worker threads into separate MeshVBO instances.
+ * The thread that owns the OpenGL context has to call
+ * processFinishedLoads() regularly which moves the loaded data into the
+ * requested meshes and creates their vertex buffers.
+ */
+struct LazyMeshLoader {
+	LazyMeshLoader() :
+		in_progress (0),
+		quit (false)
+	{}
+	~LazyMeshLoader();
+
+	/// Queues loading of the mesh data. Each mesh is only loaded once.
+	void requestLoad (MeshVBO* mesh);
+	/** \brief Moves the data of loaded meshes into place.
+	 *
+	 * \returns the number of meshes that became drawable.
+	 */
+	unsigned int processFinishedLoads ();
+	/// Returns true while meshes are queued or being loaded
+	bool hasPendingLoads ();
+
+	void workerLoop ();
+
+	std::mutex mutex;
+	std::condition_variable queue_condition;
+	std::vector<std::thread> threads;
+
+	/// all meshes ever requested (also the failed ones)
+	std::set<MeshVBO*> requested;
+	/// meshes waiting for a worker thread
+	std::deque<MeshVBO*> queued;
+	/// number of meshes that are currently loaded by the workers
+	unsigned int in_progress;
+	/// pairs of requested mesh and the freshly loaded mesh data
+	std::vector<std::pair<MeshVBO*, MeshVBO*> > finished;
+	bool quit;
+};
+
+/** \brief The loader that is shared by all models. */
+LazyMeshLoader& get_lazy_mesh_loader ();
+
+/** \brief A mesh loaded from an OBJ file together with the stamp of the file. */
+struct MeshCacheEntry {
+	MeshCacheEntry() :
+		mesh (NULL)
+	{}
+
+	MeshVBO* mesh;
+	FileStamp stamp;
+};
+
+/** \brief All meshes loaded from OBJ files, shared between the models.
+ *
+ * Meshes stay in the cache when models get reloaded so that unchanged
+ * meshes (and their vertex buffers) are reused.
+ */
+typedef std::map<std::string, MeshCacheEntry> MeshCache;
+MeshCache& get_mesh_cache ();
+
+std::string mesh_cache_key (const std::string &filename, const std::string &object_name);
+
+/** \brief Name of the binary mesh cache file (.meshbin) next to the OBJ
+ * file that holds the vertex buffers of the mesh ready for uploading. */
+std::string mesh_cache_filename (const std::string &filename, const std::string &object_name);
+
+/** \brief Adds the successfully loaded meshes to the mesh cache. */
+void add_to_mesh_cache (const std::vector<MeshLoadRequest> &requests);
+
+/** \brief Reloads all cached meshes whose files were modified.
+ *
+ * The meshes are updated in place so that all models using them see the
+ * new data. Meshes that fail to load keep their previous data. Must be
+ * called from the thread that owns the OpenGL context.
+ *
+ * \returns the number of meshes that were reloaded.
+ */
+unsigned int reload_modified_meshes ();
+
+#endif
@@ -0,0 +1,640 @@
+/*
+ * MeshUp - A visualization tool for multi-body systems based on skeletal
+ * animation and magic.
+ *
+ * Copyright (c) 2012-2018 Martin Felis <martin.felis@iwr.uni-heidelberg.de>
+ *
+ * Licensed under the MIT license. See LICENSE for more details.
+ */
+
+#include "MeshOptimizer.h"
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+
+using namespace std;
+
+float compute_acmr (const std::vector<unsigned int> &indices, size_t vertex_count, unsigned int cache_size) {
+	if (indices.size() < 3)
+		return 0.f;
+
+	// position of each vertex in the FIFO is given by the time it was added
+	vector<size_t> cache_timestamps (vertex_count, 0);
+	size_t timestamp = cache_size + 1;
+	size_t transform_count = 0;
+
+	for (size_t i = 0; i < indices.size(); i++) {
+		unsigned int vertex = indices[i];
+		if (timestamp - cache_timestamps[vertex] > cache_size) {
+			cache_timestamps[vertex] = timestamp++;
+			transform_count++;
+		}
+	}
+
+	return static_cast<float>(transform_count) / static_cast<float>(indices.size() / 3);
+}
+
+//
+// Forsyth vertex cache optimization
+//
+static const unsigned int forsyth_cache_size = 32;
+static const unsigned int forsyth_max_valence = 32;
+
+struct ForsythScores {
+	ForsythScores() {
+		const float cache_decay_power = 1.5f;
+		const float last_triangle_score = 0.75f;
+		const float valence_boost_scale = 2.0f;
+		const float valence_boost_power = 0.5f;
+
+		for (unsigned int i = 0; i < forsyth_cache_size; i++) {
+			// the vertices of the last triangle get a fixed score so that
+			// the same triangle is not used for strips
+			if (i < 3) {
+				cache[i] = last_triangle_score;
+			} else {
+				float scale = 1.f / static_cast<float>(forsyth_cache_size - 3);
+				cache[i] = powf (1.f - (i - 3) * scale, cache_decay_power);
+			}
+		}
+
+		// vertices with few remaining triangles are preferred to get rid of
+		// them quickly
+		valence[0] = 0.f;
+		for (unsigned int i = 1; i <= forsyth_max_valence; i++) {
+			valence[i] = valence_boost_scale * powf (static_cast<float>(i), -valence_boost_power);
+		}
+	}
+
+	float cache[forsyth_cache_size];
+	float valence[forsyth_max_valence + 1];
+};
+
+static float vertex_score (const ForsythScores &scores, int cache_position, unsigned int remaining_triangles) {
+	if (remaining_triangles == 0)
+		return -1.f;
+
+	float score = 0.f;
+	if (cache_position >= 0)
+		score = scores.cache[cache_position];
+
+	return score + scores.valence[min (remaining_triangles, forsyth_max_valence)];
+}
+
+void optimize_vertex_cache (std::vector<unsigned int> &indices, size_t vertex_count) {
+	static const ForsythScores scores;
+
+	size_t triangle_count = indices.size() / 3;
+	if (triangle_count < 2)
+		return;
+
+	// triangles that use each vertex (compressed row storage)
+	vector<unsigned int> remaining (vertex_count, 0);
+	for (size_t i = 0; i < triangle_count * 3; i++)
+		remaining[indices[i]]++;
+
+	vector<size_t> triangle_offsets (vertex_count + 1, 0);
+	for (size_t vi = 0; vi < vertex_count; vi++)
+		triangle_offsets[vi + 1] = triangle_offsets[vi] + remaining[vi];
+
+	vector<unsigned int> vertex_triangles (triangle_offsets[vertex_count]);
+	vector<size_t> fill_position (triangle_offsets.begin(), triangle_offsets.end() - 1);
+	for (size_t ti = 0; ti < triangle_count; ti++) {
+		for (int k = 0; k < 3; k++) {
+			unsigned int vertex = indices[ti * 3 + k];
+			vertex_triangles[fill_position[vertex]++] = ti;
+		}
+	}
+
+	vector<int> cache_position (vertex_count, -1);
+	vector<float> scores_of_vertex (vertex_count);
+	for (size_t vi = 0; vi < vertex_count; vi++)
+		scores_of_vertex[vi] = vertex_score (scores, -1, remaining[vi]);
+
+	vector<bool> emitted (triangle_count, false);
+	vector<unsigned int> result;
+	result.reserve (triangle_count * 3);
+
+	vector<unsigned int> cache;
+	vector<unsigned int> new_cache;
+	cache.reserve (forsyth_cache_size + 3);
+	new_cache.reserve (forsyth_cache_size + 3);
+
+	size_t next_unemitted = 0;
+	long best_triangle = -1;
+
+	for (size_t emitted_count = 0; emitted_count < triangle_count; emitted_count++) {
+		// dead end: continue with the next triangle in the original order
+		if (best_triangle < 0) {
+			while (emitted[next_unemitted])
+				next_unemitted++;
+			best_triangle = next_unemitted;
+		}
+
+		const unsigned int* triangle = &indices[best_triangle * 3];
+		result.push_back (triangle[0]);
+		result.push_back (triangle[1]);
+		result.push_back (triangle[2]);
+		emitted[best_triangle] = true;
+
+		// remove the triangle from the lists of its vertices
+		for (int k = 0; k < 3; k++) {
+			unsigned int vertex = triangle[k];
+			unsigned int* begin = &vertex_triangles[triangle_offsets[vertex]];
+			unsigned int* end = begin + remaining[vertex];
+			unsigned int* position = std::find (begin, end, static_cast<unsigned int>(best_triangle));
+			*position = *(end - 1);
+			remaining[vertex]--;
+		}
+
+		// the vertices of the triangle move to the front of the cache
+		new_cache.clear();
+		for (int k = 0; k < 3; k++) {
+			if (std::find (new_cache.begin(), new_cache.end(), triangle[k]) == new_cache.end())
+				new_cache.push_back (triangle[k]);
+		}
+		for (size_t ci = 0; ci < cache.size(); ci++) {
+			if (std::find (new_cache.begin(), new_cache.end(), cache[ci]) == new_cache.end())
+				new_cache.push_back (cache[ci]);
+		}
+
+		// vertices that drop out of the cache
+		for (size_t ci = forsyth_cache_size; ci < new_cache.size(); ci++) {
+			unsigned int vertex = new_cache[ci];
+			cache_position[vertex] = -1;
+			scores_of_vertex[vertex] = vertex_score (scores, -1, remaining[vertex]);
+		}
+		if (new_cache.size() > forsyth_cache_size)
+			new_cache.resize (forsyth_cache_size);
+
+		cache.swap (new_cache);
+
+		for (size_t ci = 0; ci < cache.size(); ci++) {
+			unsigned int vertex = cache[ci];
+			cache_position[vertex] = ci;
+			scores_of_vertex[vertex] = vertex_score (scores, ci, remaining[vertex]);
+		}
+
+		// only triangles that use a cached vertex are candidates for the
+		// next triangle
+		best_triangle = -1;
+		float best_score = -1.f;
+		for (size_t ci = 0; ci < cache.size(); ci++) {
+			unsigned int vertex = cache[ci];
+			for (size_t i = 0; i < remaining[vertex]; i++) {
+				unsigned int ti = vertex_triangles[triangle_offsets[vertex] + i];
+				float score = scores_of_vertex[indices[ti * 3]]
+					+ scores_of_vertex[indices[ti * 3 + 1]]
+					+ scores_of_vertex[indices[ti * 3 + 2]];
+
+				if (score > best_score) {
+					best_score = score;
+					best_triangle = ti;
+				}
+			}
+		}
+	}
+
+	indices.swap (result);
+}
+
+//
+// Overdraw optimization
+//
+struct TriangleCluster {
+	size_t begin;
+	size_t end;
+	float sort_key;
+
+	bool operator< (const TriangleCluster &other) const {
+		return sort_key > other.sort_key;
+	}
+};
+
+void optimize_overdraw (std::vector<unsigned int> &indices, const std::vector<Vector4f> &vertices) {
+	const unsigned int cache_size = 16;
+
+	size_t triangle_count = indices.size() / 3;
+	if (triangle_count < 2)
+		return;
+
+	// clusters start at triangles for which all vertices miss the cache so
+	// that reordering them hardly affects the cache efficiency
+	vector<TriangleCluster> clusters;
+	vector<size_t> cache_timestamps (vertices.size(), 0);
+	size_t timestamp = cache_size + 1;
+
+	for (size_t ti = 0; ti < triangle_count; ti++) {
+		int misses = 0;
+		for (int k = 0; k < 3; k++) {
+			unsigned int vertex = indices[ti * 3 + k];
+			if (timestamp - cache_timestamps[vertex] > cache_size) {
+				cache_timestamps[vertex] = timestamp++;
+				misses++;
+			}
+		}
+
+		if (ti == 0 || misses == 3) {
+			if (clusters.size() > 0)
+				clusters.back().end = ti;
+
+			TriangleCluster cluster;
+			cluster.begin = ti;
+			cluster.end = triangle_count;
+			cluster.sort_key = 0.f;
+			clusters.push_back (cluster);
+		}
+	}
+
+	if (clusters.size() < 2)
+		return;
+
+	// area weighted centers and normals
+	vector<Vector3f> cluster_centers (clusters.size(), Vector3f (0.f, 0.f, 0.f));
+	vector<Vector3f> cluster_normals (clusters.size(), Vector3f (0.f, 0.f, 0.f));
+	Vector3f mesh_center (0.f, 0.f, 0.f);
+	float mesh_area = 0.f;
+
+	for (size_t ci = 0; ci < clusters.size(); ci++) {
+		float cluster_area = 0.f;
+
+		for (size_t ti = clusters[ci].begin; ti < clusters[ci].end; ti++) {
+			const Vector4f &v0 = vertices[indices[ti * 3]];
+			const Vector4f &v1 = vertices[indices[ti * 3 + 1]];
+			const Vector4f &v2 = vertices[indices[ti * 3 + 2]];
+
+			Vector3f p0 (v0[0], v0[1], v0[2]);
+			Vector3f p1 (v1[0], v1[1], v1[2]);
+			Vector3f p2 (v2[0], v2[1], v2[2]);
+
+			Vector3f normal = (p1 - p0).cross (p2 - p0);
+			float area = normal.norm();
+
+			cluster_centers[ci] += (p0 + p1 + p2) * (area / 3.f);
+			cluster_normals[ci] += normal;
+			cluster_area += area;
+		}
+
+		mesh_center += cluster_centers[ci];
+		mesh_area += cluster_area;
+
+		if (cluster_area > 0.f)
+			cluster_centers[ci] = cluster_centers[ci] / cluster_area;
+	}
+
+	if (mesh_area <= 0.f)
+		return;
+
+	mesh_center = mesh_center / mesh_area;
+
+	for (size_t ci = 0; ci < clusters.size(); ci++) {
+		float normal_length = cluster_normals[ci].norm();
+		if (normal_length > 0.f)
+			clusters[ci].sort_key = (cluster_centers[ci] - mesh_center).dot (cluster_normals[ci] / normal_length);
+	}
+
+	stable_sort (clusters.begin(), clusters.end());
+
+	vector<unsigned int> result;
+	result.reserve (indices.size());
+	for (size_t ci = 0; ci < clusters.size(); ci++) {
+		result.insert (result.end(), indices.begin() + clusters[ci].begin * 3, indices.begin() + clusters[ci].end * 3);
+	}
+
+	indices.swap (result);
+}
+
+std::vector<unsigned int> optimize_vertex_fetch (std::vector<unsigned int> &indices, size_t vertex_count) {
+	const unsigned int unused = numeric_limits<unsigned int>::max();
+
+	vector<unsigned int> new_index (vertex_count, unused);
+	vector<unsigned int> old_index;
+	old_index.reserve (vertex_count);
+
+	for (size_t i = 0; i < indices.size(); i++) {
+		unsigned int &vertex = new_index[indices[i]];
+		if (vertex == unused) {
+			vertex = old_index.size();
+			old_index.push_back (indices[i]);
+		}
+
+		indices[i] = vertex;
+	}
+
+	return old_index;
+}
+
+//
+// Mesh simplification
+//
+
+/// Sum of squared distances to a set of (area weighted) planes
+struct Quadric {
+	Quadric() :
+		a00 (0.), a01 (0.), a02 (0.), a11 (0.), a12 (0.), a22 (0.),
+		b0 (0.), b1 (0.), b2 (0.),
+		c (0.),
+		weight (0.)
+	{}
+
+	void addPlane (const Vector3f &normal, float distance, float plane_weight) {
+		a00 += plane_weight * normal[0] * normal[0];
+		a01 += plane_weight * normal[0] * normal[1];
+		a02 += plane_weight * normal[0] * normal[2];
+		a11 += plane_weight * normal[1] * normal[1];
+		a12 += plane_weight * normal[1] * normal[2];
+		a22 += plane_weight * normal[2] * normal[2];
+		b0 += plane_weight * distance * normal[0];
+		b1 += plane_weight * distance * normal[1];
+		b2 += plane_weight * distance * normal[2];
+		c += plane_weight * distance * distance;
+		weight += plane_weight;
+	}
+
+	void add (const Quadric &other) {
+		a00 += other.a00; a01 += other.a01; a02 += other.a02;
+		a11 += other.a11; a12 += other.a12; a22 += other.a22;
+		b0 += other.b0; b1 += other.b1; b2 += other.b2;
+		c += other.c;
+		weight += other.weight;
+	}
+
+	/// weighted sum of the squared distances of the point to the planes
+	double evaluate (const Vector4f &point) const {
+		double x = point[0];
+		double y = point[1];
+		double z = point[2];
+
+		return a00 * x * x + a11 * y * y + a22 * z * z
+			+ 2. * (a01 * x * y + a02 * x * z + a12 * y * z)
+			+ 2. * (b0 * x + b1 * y + b2 * z)
+			+ c;
+	}
+
+	double a00, a01, a02, a11, a12, a22;
+	double b0, b1, b2;
+	double c;
+	double weight;
+};
+
+/** Within one pass of simplify_mesh() the neighbors of a collapsed vertex
+ * must not move as otherwise the check for flipped triangles would use
+ * outdated positions. */
+enum CollapseState {
+	VertexFree = 0,
+	VertexFixed,
+	VertexCollapsed
+};
+
+struct EdgeCollapse {
+	unsigned int from;
+	unsigned int to;
+	float error;
+
+	bool operator< (const EdgeCollapse &other) const {
+		return error < other.error;
+	}
+};
+
+struct PositionLess {
+	PositionLess (const std::vector<Vector4f> &vertices) :
+		vertices (vertices)
+	{}
+
+	bool operator() (unsigned int a, unsigned int b) const {
+		return lexicographical_compare (vertices[a].data(), vertices[a].data() + 3,
+				vertices[b].data(), vertices[b].data() + 3);
+	}
+
+	const std::vector<Vector4f> &vertices;
+};
+
+static Vector3f triangle_normal (const Vector4f &v0, const Vector4f &v1, const Vector4f &v2) {
+	Vector3f edge1 (v1[0] - v0[0], v1[1] - v0[1], v1[2] - v0[2]);
+	Vector3f edge2 (v2[0] - v0[0], v2[1] - v0[1], v2[2] - v0[2]);
+
+	return edge1.cross (edge2);
+}
+
+/// Triangles that use each vertex (compressed row storage)
+static void build_vertex_triangles (const std::vector<unsigned int> &indices, size_t vertex_count, std::vector<size_t> &triangle_offsets, std::vector<unsigned int> &vertex_triangles) {
+	triangle_offsets.assign (vertex_count + 1, 0);
+	for (size_t i = 0; i < indices.size(); i++)
+		triangle_offsets[indices[i] + 1]++;
+	for (size_t vi = 0; vi < vertex_count; vi++)
+		triangle_offsets[vi + 1] += triangle_offsets[vi];
+
+	vertex_triangles.resize (indices.size());
+	vector<size_t> fill_position (triangle_offsets.begin(), triangle_offsets.end() - 1);
+	for (size_t i = 0; i < indices.size(); i++)
+		vertex_triangles[fill_position[indices[i]]++] = i / 3;
+}
+
+/// Checks whether a triangle contains the directed edge from a to b
+static bool has_edge (const std::vector<unsigned int> &indices, const std::vector<size_t> &triangle_offsets, const std::vector<unsigned int> &vertex_triangles, unsigned int a, unsigned int b) {
+	for (size_t i = triangle_offsets[a]; i < triangle_offsets[a + 1]; i++) {
+		const unsigned int* triangle = &indices[vertex_triangles[i] * 3];
+		for (int k = 0; k < 3; k++) {
+			if (triangle[k] == a && triangle[(k + 1) % 3] == b)
+				return true;
+		}
+	}
+
+	return false;
+}
+
+float simplify_mesh (std::vector<unsigned int> &indices, const std::vector<Vector4f> &vertices, size_t target_triangle_count, float max_error) {
+	size_t vertex_count = vertices.size();
+	double max_error_squared = static_cast<double>(max_error) * max_error;
+	double result_error = 0.;
+
+	if (indices.size() / 3 <= target_triangle_count)
+		return 0.f;
+
+	vector<bool> locked (vertex_count, false);
+
+	// vertices that share a position with other vertices (e.g. different
+	// normals on both sides of a crease)
+	vector<unsigned int> sorted_vertices (vertex_count);
+	for (size_t vi = 0; vi < vertex_count; vi++)
+		sorted_vertices[vi] = vi;
+
+	sort (sorted_vertices.begin(), sorted_vertices.end(), PositionLess (vertices));
+
+	for (size_t i = 1; i < vertex_count; i++) {
+		const Vector4f &a = vertices[sorted_vertices[i - 1]];
+		const Vector4f &b = vertices[sorted_vertices[i]];
+		if (a[0] == b[0] && a[1] == b[1] && a[2] == b[2]) {
+			locked[sorted_vertices[i - 1]] = true;
+			locked[sorted_vertices[i]] = true;
+		}
+	}
+
+	vector<size_t> triangle_offsets;
+	vector<unsigned int> vertex_triangles;
+	build_vertex_triangles (indices, vertex_count, triangle_offsets, vertex_triangles);
+
+	// vertices on open borders (edges without opposite edge)
+	for (size_t i = 0; i < indices.size(); i += 3) {
+		for (int k = 0; k < 3; k++) {
+			unsigned int a = indices[i + k];
+			unsigned int b = indices[i + (k + 1) % 3];
+			if (!has_edge (indices, triangle_offsets, vertex_triangles, b, a)) {
+				locked[a] = true;
+				locked[b] = true;
+			}
+		}
+	}
+
+	vector<Quadric> quadrics (vertex_count);
+	for (size_t i = 0; i < indices.size(); i += 3) {
+		const Vector4f &v0 = vertices[indices[i]];
+		Vector3f normal = triangle_normal (v0, vertices[indices[i + 1]], vertices[indices[i + 2]]);
+		float length = normal.norm();
+		if (length == 0.f)
+			continue;
+
+		normal = normal / length;
+		float distance = - (normal[0] * v0[0] + normal[1] * v0[1] + normal[2] * v0[2]);
+
+		for (int k = 0; k < 3; k++)
+			quadrics[indices[i + k]].addPlane (normal, distance, length * 0.5f);
+	}
+
+	vector<EdgeCollapse> best_collapses (vertex_count);
+	vector<EdgeCollapse> collapses;
+	vector<unsigned int> remap (vertex_count);
+	vector<CollapseState> collapse_state (vertex_count);
+
+	// every pass collapses the cheapest edges that do not influence each
+	// other
+	while (indices.size() / 3 > target_triangle_count) {
+		size_t triangle_count = indices.size() / 3;
+
+		if (triangle_offsets.size() == 0)
+			build_vertex_triangles (indices, vertex_count, triangle_offsets, vertex_triangles);
+
+		// cheapest collapse for every vertex that can be moved
+		for (size_t vi = 0; vi < vertex_count; vi++) {
+			best_collapses[vi].from = vi;
+			best_collapses[vi].to = vi;
+			best_collapses[vi].error = numeric_limits<float>::max();
+		}
+
+		for (size_t i = 0; i < indices.size(); i += 3) {
+			for (int k = 0; k < 3; k++) {
+				unsigned int from = indices[i + k];
+				if (locked[from])
+					continue;
+
+				for (int j = 1; j < 3; j++) {
+					unsigned int to = indices[i + (k + j) % 3];
+
+					// mean squared distance to the planes of both vertices
+					double weight = quadrics[from].weight + quadrics[to].weight;
+					if (weight <= 0.)
+						continue;
+
+					double error = (quadrics[from].evaluate (vertices[to]) + quadrics[to].evaluate (vertices[to])) / weight;
+
+					if (error < best_collapses[from].error) {
+						best_collapses[from].to = to;
+						best_collapses[from].error = static_cast<float>(max (0., error));
+					}
+				}
+			}
+		}
+
+		collapses.clear();
+		for (size_t vi = 0; vi < vertex_count; vi++) {
+			if (best_collapses[vi].to != vi && best_collapses[vi].error <= max_error_squared)
+				collapses.push_back (best_collapses[vi]);
+		}
+
+		sort (collapses.begin(), collapses.end());
+
+		for (size_t vi = 0; vi < vertex_count; vi++)
+			remap[vi] = vi;
+		fill (collapse_state.begin(), collapse_state.end(), VertexFree);
+
+		size_t removed_triangles = 0;
+		size_t collapse_count = 0;
+
+		for (size_t ci = 0; ci < collapses.size(); ci++) {
+			if (triangle_count - removed_triangles <= target_triangle_count)
+				break;
+
+			unsigned int from = collapses[ci].from;
+			unsigned int to = collapses[ci].to;
+			if (collapse_state[from] != VertexFree || collapse_state[to] == VertexCollapsed)
+				continue;
+
+			// reject collapses that flip (or nearly flip) triangles
+			bool flips = false;
+			for (size_t i = triangle_offsets[from]; i < triangle_offsets[from + 1] && !flips; i++) {
+				const unsigned int* triangle = &indices[vertex_triangles[i] * 3];
+				if (triangle[0] == to || triangle[1] == to || triangle[2] == to)
+					continue;
+
+				const Vector4f* positions[3];
+				const Vector4f* collapsed[3];
+				for (int k = 0; k < 3; k++) {
+					positions[k] = &vertices[triangle[k]];
+					collapsed[k] = triangle[k] == from ? &vertices[to] : positions[k];
+				}
+
+				Vector3f normal = triangle_normal (*positions[0], *positions[1], *positions[2]);
+				Vector3f collapsed_normal = triangle_normal (*collapsed[0], *collapsed[1], *collapsed[2]);
+
+				if (normal.dot (collapsed_normal) <= 0.25f * normal.norm() * collapsed_normal.norm())
+					flips = true;
+			}
+
+			if (flips)
+				continue;
+
+			for (size_t i = triangle_offsets[from]; i < triangle_offsets[from + 1]; i++) {
+				const unsigned int* triangle = &indices[vertex_triangles[i] * 3];
+				if (triangle[0] == to || triangle[1] == to || triangle[2] == to)
+					removed_triangles++;
+
+				for (int k = 0; k < 3; k++) {
+					if (collapse_state[triangle[k]] == VertexFree)
+						collapse_state[triangle[k]] = VertexFixed;
+				}
+			}
+
+			collapse_state[from] = VertexCollapsed;
+			collapse_state[to] = VertexCollapsed;
+
+			remap[from] = to;
+			quadrics[to].add (quadrics[from]);
+			result_error = max (result_error, static_cast<double>(collapses[ci].error));
+			collapse_count++;
+		}
+
+		if (collapse_count == 0)
+			break;
+
+		// remove the triangles of the collapsed edges
+		size_t write_index = 0;
+		for (size_t i = 0; i < indices.size(); i += 3) {
+			unsigned int a = remap[indices[i]];
+			unsigned int b = remap[indices[i + 1]];
+			unsigned int c = remap[indices[i + 2]];
+
+			if (a == b || b == c || a == c)
+				continue;
+
+			indices[write_index++] = a;
+			indices[write_index++] = b;
+			indices[write_index++] = c;
+		}
+
+		indices.resize (write_index);
+		triangle_offsets.clear();
+	}
+
+	return static_cast<float>(sqrt (result_error));
+}
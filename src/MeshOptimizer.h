@@ -0,0 +1,67 @@
+/*
+ * MeshUp - A visualization tool for multi-body systems based on skeletal
+ * animation and magic.
+ *
+ * Copyright (c) 2012-2018 Martin Felis <martin.felis@iwr.uni-heidelberg.de>
+ *
+ * Licensed under the MIT license. See LICENSE for more details.
+ */
+
+#ifndef _MESHOPTIMIZER_H
+#define _MESHOPTIMIZER_H
+
+#include <cstddef>
+#include <vector>
+
+#include "Math.h"
+
+/** \brief Average number of vertex shader invocations per triangle (ACMR)
+ * for a FIFO post-transform cache of the given size.
+ *
+ * The value is between 0.5 (best case for large regular meshes) and 3
+ * (no reuse at all).
+ */
+float compute_acmr (const std::vector<unsigned int> &indices, size_t vertex_count, unsigned int cache_size = 16);
+
+/** \brief Reorders the triangles so that the post-transform vertex cache
+ * gets used well.
+ *
+ * Uses the greedy algorithm of Tom Forsyth, "Linear-Speed Vertex Cache
+ * Optimisation".
+ */
+void optimize_vertex_cache (std::vector<unsigned int> &indices, size_t vertex_count);
+
+/** \brief Reorders clusters of triangles to reduce overdraw.
+ *
+ * The triangles (which should already be optimized for the vertex cache)
+ * are split into clusters wherever the cache is fully missed. Clusters
+ * that face away from the center of the mesh are likely to occlude other
+ * clusters and are moved to the front. The vertex cache efficiency
+ * therefore stays almost the same.
+ */
+void optimize_overdraw (std::vector<unsigned int> &indices, const std::vector<Vector4f> &vertices);
+
+/** \brief Orders the vertices by their first use in the indices.
+ *
+ * \returns for each new vertex the index of the old vertex. Vertices that
+ * are not used by any triangle are removed.
+ */
+std::vector<unsigned int> optimize_vertex_fetch (std::vector<unsigned int> &indices, size_t vertex_count);
+
+/** \brief Removes triangles by collapsing edges until at most
+ * target_triangle_count triangles remain.
+ *
+ * The cost of an edge collapse is the quadric error metric of Garland and
+ * Heckbert. Vertices are only moved onto other existing vertices so that
+ * all levels of detail of a mesh can share the same vertices. Vertices on
+ * open borders and vertices that share their position with others (e.g.
+ * because of different normals) stay where they are.
+ *
+ * \param max_error no collapse moves the surface by more than this
+ * distance.
+ *
+ * \returns the largest distance the surface was moved by a collapse.
+ */
+float simplify_mesh (std::vector<unsigned int> &indices, const std::vector<Vector4f> &vertices, size_t target_triangle_count, float max_error);
+
+#endif
@@ -12,32 +12,205 @@
 
 #include "SimpleMath/SimpleMathGL.h"
 #include "string_utils.h"
+#include "ObjParser.h"
+#include "MeshOptimizer.h"
+#include "GLStateCache.h"
 
 #include <string.h>
+#include <cstdio>
+#include <cstdlib>
 #include <iomanip>
 #include <fstream>
 #include <limits>
 #include <iostream>
+#include <unordered_map>
+#include <stdint.h>
+#include <assert.h>
+
+#include <boost/filesystem.hpp>
 
 using namespace std;
 
 // warning vbos seem to be buggy!
 const bool use_vbo = true;
 
+/** Mesh cache file that stays mapped until its buffers were uploaded. */
+struct MeshBinMapping {
+	MappedFile file;
+	const char* vertex_data;
+	size_t vertex_data_size;
+	const char* index_data;
+	size_t index_data_size;
+};
+
+/** Decodes the buffers of a mesh cache file with the vertex layout of mesh
+ * into the vertex data of result. Fails if the buffers do not fit the
+ * layout. */
+static bool unpack_meshbin (const MeshVBO &mesh, const MeshBinMapping &mapping, MeshVBO &result) {
+	size_t vertex_count = mesh.vertex_count;
+	if (mesh.vertex_stride <= 0 || mapping.vertex_data_size != vertex_count * mesh.vertex_stride)
+		return false;
+
+	vector<Vector4f> vertices (vertex_count);
+	vector<Vector3f> normals (mesh.has_normals ? vertex_count : 0);
+	vector<Vector4f> colors (mesh.has_colors ? vertex_count : 0);
+
+	for (size_t i = 0; i < vertex_count; i++) {
+		const char* vertex = mapping.vertex_data + i * mesh.vertex_stride;
+
+		if (mesh.position_type == GL_SHORT) {
+			GLshort position[3];
+			memcpy (position, vertex, sizeof(position));
+			for (int j = 0; j < 3; j++)
+				vertices[i][j] = mesh.position_offset[j] + mesh.position_scale * position[j];
+			vertices[i][3] = 1.f;
+		} else {
+			float position[4] = { 0.f, 0.f, 0.f, 1.f };
+			memcpy (position, vertex, sizeof(GLfloat) * mesh.position_size);
+			vertices[i] = Vector4f (position[0], position[1], position[2], position[3]);
+		}
+
+		if (mesh.has_normals) {
+			const char* normal = vertex + mesh.normal_offset;
+			if (mesh.normal_type == GL_BYTE) {
+				for (int j = 0; j < 3; j++)
+					normals[i][j] = std::max (-1.f, reinterpret_cast<const GLbyte*>(normal)[j] / 127.f);
+			} else {
+				memcpy (normals[i].data(), normal, sizeof(GLfloat) * 3);
+			}
+		}
+
+		if (mesh.has_colors) {
+			const char* color = vertex + mesh.color_offset;
+			if (mesh.color_type == GL_UNSIGNED_BYTE) {
+				for (int j = 0; j < 4; j++)
+					colors[i][j] = reinterpret_cast<const GLubyte*>(color)[j] / 255.f;
+			} else {
+				memcpy (colors[i].data(), color, sizeof(GLfloat) * 4);
+			}
+		}
+	}
+
+	// the indices of the levels of detail follow the ones of the full mesh
+	vector<unsigned int> all_indices;
+	if (mesh.index_type == GL_UNSIGNED_SHORT) {
+		all_indices.resize (mapping.index_data_size / sizeof(GLushort));
+		for (size_t i = 0; i < all_indices.size(); i++) {
+			GLushort index;
+			memcpy (&index, mapping.index_data + i * sizeof(GLushort), sizeof(GLushort));
+			all_indices[i] = index;
+		}
+	} else if (mesh.index_type == GL_UNSIGNED_INT) {
+		all_indices.resize (mapping.index_data_size / sizeof(GLuint));
+		if (all_indices.size() != 0)
+			memcpy (&all_indices[0], mapping.index_data, all_indices.size() * sizeof(GLuint));
+	}
+
+	if (mesh.index_count > all_indices.size())
+		return false;
+
+	vector<unsigned int> indices (all_indices.begin(), all_indices.begin() + mesh.index_count);
+	vector<MeshLOD> lods (mesh.lods);
+	for (size_t i = 0; i < lods.size(); i++) {
+		if (lods[i].index_offset + lods[i].index_count > all_indices.size())
+			return false;
+
+		vector<unsigned int>::const_iterator lod_begin = all_indices.begin() + lods[i].index_offset;
+		lods[i].indices.assign (lod_begin, lod_begin + lods[i].index_count);
+	}
+
+	result.vertices.swap (vertices);
+	result.normals.swap (normals);
+	result.colors.swap (colors);
+	result.indices.swap (indices);
+	result.lods.swap (lods);
+
+	return true;
+}
+
+/** Loads the vertex data of a mesh into result. The mesh cache file is
+ * used as long as it is valid as it is much faster to read than the
+ * source file. */
+static bool load_source_data (const MeshVBO &mesh, MeshVBO &result) {
+	if (mesh.mesh_bin != NULL && unpack_meshbin (mesh, *mesh.mesh_bin, result))
+		return true;
+
+	if (mesh.mesh_bin_filename.size() != 0) {
+		MeshVBO cached;
+		cached.compact_vertices = mesh.compact_vertices;
+		cached.optimize = mesh.optimize;
+		cached.generate_lods = mesh.generate_lods;
+		cached.source_filename = mesh.source_filename;
+		cached.source_object_name = mesh.source_object_name;
+
+		if (cached.loadMeshBin (mesh.mesh_bin_filename.c_str(), FileStamp::fromFile (mesh.source_filename))
+				&& unpack_meshbin (cached, *cached.mesh_bin, result))
+			return true;
+	}
+
+	MeshVBO loaded;
+	loaded.optimize = mesh.optimize;
+	loaded.generate_lods = mesh.generate_lods;
+
+	const char* object_name = NULL;
+	if (mesh.source_object_name.size() != 0)
+		object_name = mesh.source_object_name.c_str();
+
+	if (!loaded.loadOBJ (mesh.source_filename.c_str(), object_name)) {
+		cerr << "Error: could not restore the data of mesh " << mesh.source_filename << endl;
+		return false;
+	}
+
+	result.vertices.swap (loaded.vertices);
+	result.normals.swap (loaded.normals);
+	result.colors.swap (loaded.colors);
+	result.indices.swap (loaded.indices);
+	result.lods.swap (loaded.lods);
+
+	return true;
+}
+
 MeshVBO::MeshVBO (const MeshVBO& mesh)
 {
 	vbo_id = 0;
+	ibo_id = 0;
+	vao_id = 0;
+	index_type = 0;
+	mesh_bin = NULL;
 	started = mesh.started;
 	smooth_shading = mesh.smooth_shading;
+	bounds_only = mesh.bounds_only;
+	compact_vertices = mesh.compact_vertices;
+	optimize = mesh.optimize;
+	generate_lods = mesh.generate_lods;
+	release_cpu_data = mesh.release_cpu_data;
+	cpu_data_released = false;
+	source_filename = mesh.source_filename;
+	source_object_name = mesh.source_object_name;
+	mesh_bin_filename = mesh.mesh_bin_filename;
 	buffer_size = mesh.buffer_size;
 	normal_offset = mesh.normal_offset;
 	color_offset = mesh.color_offset;
+	vertex_stride = mesh.vertex_stride;
+	position_type = mesh.position_type;
+	position_size = mesh.position_size;
+	normal_type = mesh.normal_type;
+	color_type = mesh.color_type;
+	position_offset = mesh.position_offset;
+	position_scale = mesh.position_scale;
 	bbox_min = mesh.bbox_min;
 	bbox_max = mesh.bbox_max;
 
-	vertices = mesh.vertices;
-	normals = mesh.normals;
-	colors = mesh.colors;
+	if (mesh.cpu_data_released) {
+		// the data of the other mesh only exists on the GPU
+		load_source_data (mesh, *this);
+	} else {
+		vertices = mesh.vertices;
+		normals = mesh.normals;
+		colors = mesh.colors;
+		indices = mesh.indices;
+		lods = mesh.lods;
+	}
 
 	if (mesh.vbo_id != 0) {
 		generate_vbo();
@@ -48,17 +221,43 @@ MeshVBO& MeshVBO::operator=(const MeshVBO& mesh)
 {
 	if (this != &mesh) {
 		vbo_id = 0;
+		ibo_id = 0;
+		vao_id = 0;
+		index_type = 0;
+		closeMeshBin();
 		started = mesh.started;
 		smooth_shading = mesh.smooth_shading;
+		bounds_only = mesh.bounds_only;
+		compact_vertices = mesh.compact_vertices;
+		optimize = mesh.optimize;
+		generate_lods = mesh.generate_lods;
+		release_cpu_data = mesh.release_cpu_data;
+		cpu_data_released = false;
+		source_filename = mesh.source_filename;
+		source_object_name = mesh.source_object_name;
+		mesh_bin_filename = mesh.mesh_bin_filename;
 		buffer_size = 0;
 		normal_offset = 0;
 		color_offset = 0;
+		vertex_stride = 0;
+		position_type = 0;
+		position_size = 0;
+		normal_type = 0;
+		color_type = 0;
+		position_offset = Vector3f (0.f, 0.f, 0.f);
+		position_scale = 1.f;
 		bbox_min = mesh.bbox_min;
 		bbox_max = mesh.bbox_max;
 
-		vertices = mesh.vertices;
-		normals = mesh.normals;
-		colors = mesh.colors;
+		if (mesh.cpu_data_released) {
+			load_source_data (mesh, *this);
+		} else {
+			vertices = mesh.vertices;
+			normals = mesh.normals;
+			colors = mesh.colors;
+			indices = mesh.indices;
+			lods = mesh.lods;
+		}
 
 		if (mesh.vbo_id != 0) {
 			generate_vbo();
@@ -74,6 +273,9 @@ void MeshVBO::begin() {
 	vertices.resize(0);
 	normals.resize(0);
 	colors.resize(0);
+	indices.resize(0);
+	lods.clear();
+	cpu_data_released = false;
 }
 
 void MeshVBO::end() {
@@ -87,7 +289,88 @@ void MeshVBO::end() {
 	started = false;
 }
 
-unsigned int MeshVBO::generate_vbo() {
+static GLubyte pack_unorm8 (float value) {
+	value = std::max (0.f, std::min (1.f, value));
+	return static_cast<GLubyte>(floorf (value * 255.f + 0.5f));
+}
+
+static GLbyte pack_snorm8 (float value) {
+	value = std::max (-1.f, std::min (1.f, value));
+	return static_cast<GLbyte>(floorf (value * 127.f + 0.5f));
+}
+
+void MeshVBO::chooseVertexLayout() {
+	bool have_normals = normals.size() != 0;
+	bool have_colors = colors.size() != 0;
+
+	bool homogeneous = false;
+	for (size_t i = 0; i < vertices.size(); i++) {
+		if (vertices[i][3] != 1.f) {
+			homogeneous = true;
+			break;
+		}
+	}
+
+	// quantization is relative to the bounding box of the actual data
+	// (bbox_min and bbox_max may also contain previously added vertices)
+	Vector3f data_min (vertices[0][0], vertices[0][1], vertices[0][2]);
+	Vector3f data_max (data_min);
+	for (size_t i = 1; i < vertices.size(); i++) {
+		for (int j = 0; j < 3; j++) {
+			data_min[j] = std::min (data_min[j], vertices[i][j]);
+			data_max[j] = std::max (data_max[j], vertices[i][j]);
+		}
+	}
+
+	float extent = 0.f;
+	for (int j = 0; j < 3; j++)
+		extent = std::max (extent, data_max[j] - data_min[j]);
+
+	position_offset = (data_min + data_max) * 0.5f;
+	position_scale = 1.f;
+
+	// 16 bit positions have a resolution of 1/65534 of the largest side of
+	// the bounding box. The scale is the same along all axes so that the
+	// normals are not distorted by the modelview matrix.
+	if (compact_vertices && !homogeneous && extent > 0.f && extent < std::numeric_limits<float>::max()) {
+		position_type = GL_SHORT;
+		position_size = 3;
+		position_scale = extent * 0.5f / 32767.f;
+		vertex_stride = 4 * sizeof(GLshort);
+	} else {
+		position_type = GL_FLOAT;
+		position_size = homogeneous ? 4 : 3;
+		position_offset = Vector3f (0.f, 0.f, 0.f);
+		vertex_stride = position_size * sizeof(GLfloat);
+	}
+
+	normal_offset = vertex_stride;
+	if (have_normals) {
+		// packed 10_10_10_2 normals would be more precise but
+		// glNormalPointer() only takes them with a size of 4, which
+		// implementations reject as normals have three components
+		if (compact_vertices) {
+			normal_type = GL_BYTE;
+			vertex_stride += 4 * sizeof(GLbyte);
+		} else {
+			normal_type = GL_FLOAT;
+			vertex_stride += 3 * sizeof(GLfloat);
+		}
+	}
+
+	color_offset = vertex_stride;
+	if (have_colors) {
+		if (compact_vertices) {
+			color_type = GL_UNSIGNED_BYTE;
+			vertex_stride += 4 * sizeof(GLubyte);
+		} else {
+			color_type = GL_FLOAT;
+			vertex_stride += 4 * sizeof(GLfloat);
+		}
+	}
+}
+
+void MeshVBO::packBuffers() {
 	bool have_normals = false;
 	bool have_colors = false;
 		
@@ -97,78 +380,281 @@ unsigned int MeshVBO::generate_vbo() {
 	if (colors.size() != 0)
 		have_colors = true;
 
-	assert (vbo_id == 0);
 	assert (started == false);
 	assert (vertices.size() != 0);
 	assert (!have_normals || (normals.size() == vertices.size()));
 	assert (!have_colors || (colors.size() == vertices.size()));
 
+	chooseVertexLayout();
+
+	// all attributes of a vertex are stored next to each other
+	buffer_size = vertex_stride * vertices.size();
+	packed_vertices.assign (buffer_size, 0);
+
+	for (size_t i = 0; i < vertices.size(); i++) {
+		char* vertex = &packed_vertices[i * vertex_stride];
+
+		if (position_type == GL_SHORT) {
+			GLshort* position = reinterpret_cast<GLshort*>(vertex);
+			for (int j = 0; j < 3; j++) {
+				float value = (vertices[i][j] - position_offset[j]) / position_scale;
+				value = std::max (-32767.f, std::min (32767.f, floorf (value + 0.5f)));
+				position[j] = static_cast<GLshort>(value);
+			}
+			position[3] = 0;
+		} else {
+			memcpy (vertex, vertices[i].data(), sizeof(GLfloat) * position_size);
+		}
+
+		if (have_normals) {
+			char* normal = vertex + normal_offset;
+			if (normal_type == GL_BYTE) {
+				GLbyte* packed = reinterpret_cast<GLbyte*>(normal);
+				for (int j = 0; j < 3; j++)
+					packed[j] = pack_snorm8 (normals[i][j]);
+				packed[3] = 0;
+			} else {
+				memcpy (normal, normals[i].data(), sizeof(GLfloat) * 3);
+			}
+		}
+
+		if (have_colors) {
+			char* color = vertex + color_offset;
+			if (color_type == GL_UNSIGNED_BYTE) {
+				for (int j = 0; j < 4; j++)
+					reinterpret_cast<GLubyte*>(color)[j] = pack_unorm8 (colors[i][j]);
+			} else {
+				memcpy (color, colors[i].data(), sizeof(GLfloat) * 4);
+			}
+		}
+	}
+
+	packed_indices.clear();
+	index_type = 0;
+
+	if (indices.size() != 0) {
+		// the levels of detail follow the indices of the full mesh
+		vector<GLuint> all_indices (indices.begin(), indices.end());
+		for (size_t i = 0; i < lods.size(); i++) {
+			lods[i].index_offset = all_indices.size();
+			all_indices.insert (all_indices.end(), lods[i].indices.begin(), lods[i].indices.end());
+		}
+
+		// most meshes have few enough vertices for 16 bit indices
+		if (vertices.size() <= numeric_limits<GLushort>::max()) {
+			vector<GLushort> short_indices (all_indices.begin(), all_indices.end());
+			index_type = GL_UNSIGNED_SHORT;
+			packed_indices.resize (sizeof(GLushort) * short_indices.size());
+			memcpy (&packed_indices[0], &short_indices[0], packed_indices.size());
+		} else {
+			index_type = GL_UNSIGNED_INT;
+			packed_indices.resize (sizeof(GLuint) * all_indices.size());
+			memcpy (&packed_indices[0], &all_indices[0], packed_indices.size());
+		}
+	}
+
+	vertex_count = vertices.size();
+	index_count = indices.size();
+	has_normals = have_normals;
+	has_colors = have_colors;
+	for (size_t i = 0; i < lods.size(); i++)
+		lods[i].index_count = lods[i].indices.size();
+}
+
+unsigned int MeshVBO::generate_vbo() {
+	assert (vbo_id == 0);
+
+	// meshes loaded from a mesh cache file get uploaded from the mapped file
+	if (mesh_bin == NULL && packed_vertices.size() == 0) {
+		// the buffers were deleted after the data was released
+		if (!restoreCpuData())
+			return 0;
+
+		packBuffers();
+	}
+
+	size_t vertex_data_size = 0;
+	size_t index_data_size = 0;
+	const char* vertex_data = vertexBufferData (vertex_data_size);
+	const char* index_data = indexBufferData (index_data_size);
+
 	// create the buffer
 	glGenBuffers (1, &vbo_id);
 
-	// initialize the buffer object
 	glBindBuffer (GL_ARRAY_BUFFER, vbo_id);
+	glBufferData (GL_ARRAY_BUFFER, vertex_data_size, vertex_data, GL_STATIC_DRAW);
+	glBindBuffer (GL_ARRAY_BUFFER, 0);
 
-	buffer_size = sizeof(float) * 4 * vertices.size();
-	normal_offset = 0;
-	color_offset = 0;
-	
-	if (have_normals) {
-		normal_offset = buffer_size;
-		buffer_size += sizeof(float) * 3 * normals.size();
+	if (index_data_size != 0) {
+		glGenBuffers (1, &ibo_id);
+		glBindBuffer (GL_ELEMENT_ARRAY_BUFFER, ibo_id);
+		glBufferData (GL_ELEMENT_ARRAY_BUFFER, index_data_size, index_data, GL_STATIC_DRAW);
+		glBindBuffer (GL_ELEMENT_ARRAY_BUFFER, 0);
 	}
-	if (have_colors) {
-		color_offset = buffer_size;
-		buffer_size += sizeof(float) * 4 * colors.size();
+
+	// the data now lives on the GPU
+	closeMeshBin();
+	vector<char>().swap (packed_vertices);
+	vector<char>().swap (packed_indices);
+
+	if (release_cpu_data)
+		releaseCpuData();
+
+	return vbo_id;
+}
+
+const char* MeshVBO::vertexBufferData (size_t &size) const {
+	if (mesh_bin != NULL) {
+		size = mesh_bin->vertex_data_size;
+		return mesh_bin->vertex_data;
 	}
 
-	glBufferData (GL_ARRAY_BUFFER, buffer_size, NULL, GL_STATIC_DRAW);
+	size = packed_vertices.size();
+	return size != 0 ? &packed_vertices[0] : NULL;
+}
 
-	// fill the data
-	
-	float *raw_buffer = (float*) glMapBuffer (GL_ARRAY_BUFFER, GL_READ_WRITE);
-	memcpy (&(raw_buffer[0]), &vertices[0], sizeof(float) * 4 * vertices.size());
+const char* MeshVBO::indexBufferData (size_t &size) const {
+	if (mesh_bin != NULL) {
+		size = mesh_bin->index_data_size;
+		return mesh_bin->index_data;
+	}
+
+	size = packed_indices.size();
+	return size != 0 ? &packed_indices[0] : NULL;
+}
+
+void MeshVBO::releaseCpuData() {
+	// meshes that were not loaded from a file could not be restored
+	if (vbo_id == 0 || source_filename.size() == 0 || cpu_data_released)
+		return;
+
+	vector<Vector4f>().swap (vertices);
+	vector<Vector3f>().swap (normals);
+	vector<Vector4f>().swap (colors);
+	vector<unsigned int>().swap (indices);
+	for (size_t i = 0; i < lods.size(); i++)
+		vector<unsigned int>().swap (lods[i].indices);
+
+	cpu_data_released = true;
+}
+
+bool MeshVBO::restoreCpuData() {
+	if (!cpu_data_released)
+		return true;
+
+	vector<MeshLOD> uploaded_lods (lods);
+	if (!load_source_data (*this, *this))
+		return false;
+
+	cpu_data_released = false;
+
+	// packed buffers of a mesh cache file would not follow modifications
+	closeMeshBin();
+	vector<char>().swap (packed_vertices);
+	vector<char>().swap (packed_indices);
+
+	// the file might have changed since the data was uploaded
+	bool matches_buffers = vertices.size() == vertex_count
+		&& indices.size() == index_count
+		&& lods.size() == uploaded_lods.size();
+
+	for (size_t i = 0; i < lods.size() && matches_buffers; i++) {
+		if (lods[i].indices.size() != uploaded_lods[i].index_count)
+			matches_buffers = false;
+
+		lods[i].index_offset = uploaded_lods[i].index_offset;
+		lods[i].index_count = uploaded_lods[i].index_count;
+	}
+
+	if (!matches_buffers && vbo_id != 0)
+		delete_vbo();
+
+	return true;
+}
+
+bool MeshVBO::copyCpuData (MeshVBO &result) const {
+	if (cpu_data_released)
+		return load_source_data (*this, result);
+
+	result.vertices = vertices;
+	result.normals = normals;
+	result.colors = colors;
+	result.indices = indices;
+	result.lods = lods;
+
+	return true;
+}
+
+unsigned int MeshVBO::generate_vao() {
+	assert (vao_id == 0 && vbo_id != 0);
 
-	if (have_normals)
-		memcpy (&(raw_buffer[4 * vertices.size()]), &normals[0], sizeof(float) * 3 * normals.size());
+	glGenVertexArrays (1, &vao_id);
+	glBindVertexArray (vao_id);
 
-	if (have_colors)
-		memcpy (&(raw_buffer[(4 * vertices.size() + 3 * normals.size())]), &colors[0], sizeof(float) * 4 * colors.size());
+	glBindBuffer (GL_ARRAY_BUFFER, vbo_id);
+	glVertexAttribPointer (0, position_size, position_type, GL_FALSE, vertex_stride, NULL);
+	glEnableVertexAttribArray (0);
+
+	if (has_normals) {
+		glVertexAttribPointer (1, 3, normal_type, GL_TRUE, vertex_stride, (const GLvoid *) normal_offset);
+		glEnableVertexAttribArray (1);
+	}
 
-	glUnmapBuffer (GL_ARRAY_BUFFER);
+	if (has_colors) {
+		glVertexAttribPointer (2, 4, color_type, GL_TRUE, vertex_stride, (const GLvoid *) color_offset);
+		glEnableVertexAttribArray (2);
+	}
 
+	// the index buffer binding is part of the vertex array object
+	if (ibo_id != 0)
+		glBindBuffer (GL_ELEMENT_ARRAY_BUFFER, ibo_id);
+
+	glBindVertexArray (0);
 	glBindBuffer (GL_ARRAY_BUFFER, 0);
+	glBindBuffer (GL_ELEMENT_ARRAY_BUFFER, 0);
 
-	return vbo_id;
+	return vao_id;
 }
 
 void MeshVBO::delete_vbo() {
+	if (vao_id != 0) {
+		glDeleteVertexArrays (1, &vao_id);
+	}
+
 	if (vbo_id != 0) {
 		glDeleteBuffers (1, &vbo_id);
 	}
 
+	if (ibo_id != 0) {
+		glDeleteBuffers (1, &ibo_id);
+	}
+
 	vbo_id = 0;
+	ibo_id = 0;
+	vao_id = 0;
 }
 
 void MeshVBO::debug_vbo () {
 	assert (vbo_id != 0 && "MeshVBO not initialized!");
 
+	cout << "vertex stride = " << vertex_stride
+		<< " normal offset = " << normal_offset
+		<< " color offset = " << color_offset << endl;
+
 	glBindBuffer (GL_ARRAY_BUFFER, vbo_id);
 
-	float *raw_buffer =(float*) glMapBuffer (GL_ARRAY_BUFFER, GL_READ_ONLY);
+	const char *raw_buffer = (const char*) glMapBuffer (GL_ARRAY_BUFFER, GL_READ_ONLY);
 	cout << "vertices = " << endl;
-	for (unsigned int i=0; i < vertices.size(); i++) {
-		cout << "  [" << i << "] = " << raw_buffer[i*4] << ", " << raw_buffer[i*4 + 1] << ", " << raw_buffer[i*4+2] << endl;
-	}
-
-	cout << "normals = " << endl;
-	for (unsigned int i=vertices.size(); i < vertices.size() + normals.size(); i++) {
-		cout << "  [" << i << "] = " << raw_buffer[i*3] << ", " << raw_buffer[i*3 + 1] << ", " << raw_buffer[i*3+2] << endl;
-	}
-
-	cout << "colors = " << endl;
-	for (unsigned int i=vertices.size() + normals.size(); i < vertices.size() + normals.size() + colors.size(); i++) {
-		cout << "  [" << i << "] = " << raw_buffer[i*4] << ", " << raw_buffer[i*4 + 1] << ", " << raw_buffer[i*4+2] << endl;
+	for (unsigned int i=0; i < vertex_count; i++) {
+		const char *vertex = raw_buffer + i * vertex_stride;
+		Vector3f position;
+		for (int j = 0; j < 3; j++) {
+			if (position_type == GL_SHORT)
+				position[j] = position_offset[j] + position_scale * reinterpret_cast<const GLshort*>(vertex)[j];
+			else
+				position[j] = reinterpret_cast<const GLfloat*>(vertex)[j];
+		}
+		cout << "  [" << i << "] = " << position[0] << ", " << position[1] << ", " << position[2] << endl;
 	}
 
 	glUnmapBuffer(GL_ARRAY_BUFFER);
@@ -184,6 +670,10 @@ void MeshVBO::addVertex4f (float x, float y, float z, float w) {
 	vertex[3] = w;
 	vertices.push_back(vertex);
 
+	updateBoundingBox (vertex);
+}
+
+void MeshVBO::updateBoundingBox (const Vector4f &vertex) {
 	bbox_max[0] = max (vertex[0], bbox_max[0]);
 	bbox_max[1] = max (vertex[1], bbox_max[1]);
 	bbox_max[2] = max (vertex[2], bbox_max[2]);
@@ -237,47 +727,77 @@ void MeshVBO::addColor3f (float r, float g, float b) {
 void MeshVBO::addColor3fv (const float color[3]) {
 	addColor4f (color[0], color[1], color[2], 1.f);
 }
-void MeshVBO::draw(unsigned int mode) {
-	if (vbo_id == 0)
-		generate_vbo();
+void MeshVBO::bind() {
+	GLStateCache &state = get_gl_state_cache();
 
-	if (smooth_shading)
-		glShadeModel(GL_SMOOTH);
-	else
-		glShadeModel(GL_FLAT);
+	// the vertex data might have been released, so only the sizes of the
+	// uploaded data are used
+	state.bindBuffer (GL_ARRAY_BUFFER, vbo_id);
 
-	if (use_vbo) {
-		glBindBuffer (GL_ARRAY_BUFFER, vbo_id);
+	glVertexPointer (position_size, position_type, vertex_stride, NULL);
 
-		glVertexPointer (4, GL_FLOAT, 0, NULL);
+	if (has_normals) {
+		glNormalPointer (normal_type, vertex_stride, (const GLvoid *) normal_offset);
+	}
 
-		if (normals.size() != 0) {
-			glNormalPointer (GL_FLOAT, 0, (const GLvoid *) normal_offset);
-		}
+	if (has_colors) {
+		glColorPointer (4, color_type, vertex_stride, (const GLvoid *) (color_offset));
+	}
 
-		if (colors.size() != 0) {
-			glColorPointer (4, GL_FLOAT, 0, (const GLvoid *) (color_offset));
-		}
-		
-		glEnableClientState (GL_VERTEX_ARRAY);
+	state.setClientState (GL_VERTEX_ARRAY, true);
+	state.setClientState (GL_NORMAL_ARRAY, has_normals);
+	state.setClientState (GL_COLOR_ARRAY, has_colors);
 
-		if (normals.size() != 0) {
-			glEnableClientState (GL_NORMAL_ARRAY);
-		} else {
-			glDisableClientState (GL_NORMAL_ARRAY);
-		}
+	state.bindBuffer (GL_ELEMENT_ARRAY_BUFFER, ibo_id);
+}
 
-		if (colors.size() != 0) {
-			glEnableClientState (GL_COLOR_ARRAY);
-		} else {
-			glDisableClientState (GL_COLOR_ARRAY);
+void MeshVBO::draw(unsigned int mode, unsigned int lod_level) {
+	if (bounds_only)
+		return;
+
+	if (vbo_id == 0 && generate_vbo() == 0)
+		return;
+
+	lod_level = std::min (lod_level, static_cast<unsigned int>(lods.size()));
+
+	GLStateCache &state = get_gl_state_cache();
+	state.shadeModel (smooth_shading ? GL_SMOOTH : GL_FLAT);
+
+	if (use_vbo) {
+		bind();
+
+		// quantized positions are mapped back onto the bounding box
+		bool quantized = position_type == GL_SHORT;
+		bool normalize_enabled = true;
+		if (quantized) {
+			glMatrixMode (GL_MODELVIEW);
+			glPushMatrix();
+			glTranslatef (position_offset[0], position_offset[1], position_offset[2]);
+			glScalef (position_scale, position_scale, position_scale);
+
+			normalize_enabled = state.isEnabled (GL_NORMALIZE);
+			if (!normalize_enabled && has_normals)
+				state.enable (GL_NORMALIZE);
 		}
 
-		glDrawArrays (mode, 0, vertices.size());
-		glBindBuffer (GL_ARRAY_BUFFER, 0);
+		drawBuffers (mode, lod_level);
+
+		state.bindBuffer (GL_ELEMENT_ARRAY_BUFFER, 0);
+		state.bindBuffer (GL_ARRAY_BUFFER, 0);
+
+		if (quantized) {
+			if (!normalize_enabled && has_normals)
+				state.disable (GL_NORMALIZE);
+
+			glPopMatrix();
+		}
 	} else {
+		const vector<unsigned int> &level_indices = lod_level == 0 ? indices : lods[lod_level - 1].indices;
+
 		glBegin (mode);
-		for (size_t vi = 0; vi < vertices.size(); vi++) {
+		size_t draw_count = level_indices.size() != 0 ? level_indices.size() : vertices.size();
+		for (size_t di = 0; di < draw_count; di++) {
+			size_t vi = level_indices.size() != 0 ? level_indices[di] : di;
 			if (colors.size() != 0)
 				glColor3fv (colors[vi].data());
 			if (normals.size() != 0)
@@ -288,45 +808,129 @@ void MeshVBO::draw(unsigned int mode) {
 	}
 }
 
+void MeshVBO::drawBuffers(unsigned int mode, unsigned int lod_level, unsigned int instance_count) {
+	lod_level = std::min (lod_level, static_cast<unsigned int>(lods.size()));
+
+	if (ibo_id != 0) {
+		size_t index_offset = lod_level == 0 ? 0 : lods[lod_level - 1].index_offset;
+		size_t level_index_count = lod_level == 0 ? index_count : lods[lod_level - 1].index_count;
+		size_t index_size = index_type == GL_UNSIGNED_SHORT ? sizeof(GLushort) : sizeof(GLuint);
+		const GLvoid *index_pointer = (const GLvoid *) (index_offset * index_size);
+
+		if (instance_count == 1)
+			glDrawElements (mode, level_index_count, index_type, index_pointer);
+		else
+			glDrawElementsInstanced (mode, level_index_count, index_type, index_pointer, instance_count);
+	} else {
+		if (instance_count == 1)
+			glDrawArrays (mode, 0, vertex_count);
+		else
+			glDrawArraysInstanced (mode, 0, vertex_count, instance_count);
+	}
+}
+
 void MeshVBO::setColor(const Vector4f &color) {
+	restoreCpuData();
+	release_cpu_data = false;
+
 	for(int i=0;i<colors.size();i++) {
 		colors[i] = color;
 	}
 }
 
-void MeshVBO::transform(const Matrix44f &transformation) {
-	//save current data to be transformed 
-	MeshVBO old = MeshVBO(*this);
+/** Transformation of normals for a transformation of the positions.
+ *
+ * This is the inverse transpose of the linear part, computed from the
+ * cofactors so that it is valid for scaling as well as for singular
+ * transformations. The length of the normals has to be restored after
+ * the transformation.
+ */
+Matrix33f normal_transformation (const Matrix44f &transformation) {
+	Matrix33f cofactors;
+	for (unsigned int i = 0; i < 3; i++) {
+		unsigned int i1 = (i + 1) % 3;
+		unsigned int i2 = (i + 2) % 3;
+		for (unsigned int j = 0; j < 3; j++) {
+			unsigned int j1 = (j + 1) % 3;
+			unsigned int j2 = (j + 2) % 3;
+			cofactors(i,j) = transformation(i1,j1) * transformation(i2,j2) - transformation(i1,j2) * transformation(i2,j1);
+		}
+	}
 
-	bool have_normals = false;
-	bool have_colors = false;
-	if (normals.size() != 0)
-		have_normals = true;
-	if (colors.size() != 0)
-		have_colors = true;
+	// mirroring transformations would otherwise flip the normals
+	float determinant = transformation(0,0) * cofactors(0,0)
+		+ transformation(0,1) * cofactors(0,1)
+		+ transformation(0,2) * cofactors(0,2);
+	if (determinant < 0.f)
+		cofactors = cofactors * -1.f;
 
-	//clear current data
-	vertices.clear();
-	normals.clear();
-	colors.clear();
+	return cofactors;
+}
 
-	Matrix33f rotation = transformation.block<3,3>(0,0);
+static Vector3f transform_normal (const Vector3f &normal, const Matrix33f &normal_matrix) {
+	Vector3f result = (normal.transpose() * normal_matrix).transpose();
+	float length = result.norm();
+	if (length > 0.f)
+		result = result / length;
 
-	for (unsigned int i = 0; i < old.vertices.size(); i++) {
-		addVertex4fv ((old.vertices[i].transpose() * transformation).data());
-		if (have_normals)
-			addNormalfv ((old.normals[i].transpose() * rotation).data());
-		if (have_colors)
-			addColor4fv (old.colors[i].data());
+	return result;
+}
+
+void MeshVBO::transform(const Matrix44f &transformation) {
+	restoreCpuData();
+	release_cpu_data = false;
+
+	Matrix33f normal_matrix = normal_transformation (transformation);
+
+	bbox_min.set (std::numeric_limits<float>::max(), std::numeric_limits<float>::max(), std::numeric_limits<float>::max());
+	bbox_max.set (-std::numeric_limits<float>::max(), -std::numeric_limits<float>::max(), -std::numeric_limits<float>::max());
+
+	for (size_t i = 0; i < vertices.size(); i++) {
+		vertices[i] = (vertices[i].transpose() * transformation).transpose();
+		updateBoundingBox (vertices[i]);
 	}
+
+	for (size_t i = 0; i < normals.size(); i++)
+		normals[i] = transform_normal (normals[i], normal_matrix);
+}
+
+void MeshVBO::reserve (size_t vertex_count, size_t index_count, bool with_normals, bool with_colors) {
+	restoreCpuData();
+
+	vertices.reserve (vertex_count);
+	if (with_normals)
+		normals.reserve (vertex_count);
+	if (with_colors)
+		colors.reserve (vertex_count);
+	indices.reserve (index_count);
 }
 
 void MeshVBO::join (const Matrix44f &transformation, const MeshVBO &other) {
+	joinMesh (transformation, other, NULL);
+}
+
+void MeshVBO::join (const Matrix44f &transformation, const MeshVBO &other, const Vector4f &vertex_color) {
+	joinMesh (transformation, other, &vertex_color);
+}
+
+void MeshVBO::joinMesh (const Matrix44f &transformation, const MeshVBO &other, const Vector4f *vertex_color) {
 	if (&other == this) {
 		cerr << "Cannot join meshes not supported!" << endl;
 		// To fix this create a temporary copy and use that for copying
 		abort();
 	}
+
+	if (other.cpu_data_released) {
+		MeshVBO restored;
+		if (load_source_data (other, restored))
+			joinMesh (transformation, restored, vertex_color);
+
+		return;
+	}
+
+	restoreCpuData();
+	release_cpu_data = false;
+
 	bool have_normals = false;
 	bool have_colors = false;
 	bool other_have_normals = false;
@@ -339,7 +943,8 @@ void MeshVBO::join (const Matrix44f &transformation, const MeshVBO &other) {
 
 	if (other.normals.size() != 0)
 		other_have_normals = true;
-	if (other.colors.size() != 0)
+	// vertices without a color get the given one
+	if (other.colors.size() != 0 || vertex_color != NULL)
 		other_have_colors = true;
 
 	if (vertices.size() == 0) {
@@ -357,18 +962,208 @@ void MeshVBO::join (const Matrix44f &transformation, const MeshVBO &other) {
 		abort();
 	}
 
-	Matrix33f rotation = transformation.block<3,3>(0,0);
+	// the simplified versions only cover the original mesh
+	lods.clear();
+
+	size_t offset = vertices.size();
+	size_t count = other.vertices.size();
+
+	// if one of the meshes is indexed the result is indexed as well
+	if (indices.size() != 0 || other.indices.size() != 0) {
+		if (indices.size() == 0) {
+			indices.resize (offset);
+			for (size_t i = 0; i < offset; i++)
+				indices[i] = i;
+		}
+
+		size_t index_offset = indices.size();
+		if (other.indices.size() == 0) {
+			indices.resize (index_offset + count);
+			for (size_t i = 0; i < count; i++)
+				indices[index_offset + i] = offset + i;
+		} else {
+			indices.resize (index_offset + other.indices.size());
+			for (size_t i = 0; i < other.indices.size(); i++)
+				indices[index_offset + i] = offset + other.indices[i];
+		}
+	}
+
+	vertices.resize (offset + count);
+	for (size_t i = 0; i < count; i++) {
+		vertices[offset + i] = (other.vertices[i].transpose() * transformation).transpose();
+		updateBoundingBox (vertices[offset + i]);
+	}
+
+	if (have_normals) {
+		Matrix33f normal_matrix = normal_transformation (transformation);
+		normals.resize (offset + count);
+		for (size_t i = 0; i < count; i++)
+			normals[offset + i] = transform_normal (other.normals[i], normal_matrix);
+	}
+
+	if (have_colors) {
+		if (other.colors.size() != 0)
+			colors.insert (colors.end(), other.colors.begin(), other.colors.end());
+		else
+			colors.resize (offset + count, *vertex_color);
+	}
+}
+
+/** Position, normal and color of a vertex, used to find identical vertices. */
+struct VertexKey {
+	float data[11];
+
+	bool operator== (const VertexKey &other) const {
+		return memcmp (data, other.data, sizeof(data)) == 0;
+	}
+};
+
+struct VertexKeyHash {
+	size_t operator() (const VertexKey &key) const {
+		const unsigned char* bytes = reinterpret_cast<const unsigned char*>(key.data);
+		uint64_t hash = 14695981039346656037ULL;
+		for (size_t i = 0; i < sizeof(key.data); i++) {
+			hash ^= bytes[i];
+			hash *= 1099511628211ULL;
+		}
+		return static_cast<size_t>(hash);
+	}
+};
+
+void MeshVBO::createIndices() {
+	assert (vbo_id == 0);
+	restoreCpuData();
+
+	if (indices.size() != 0 || vertices.size() == 0)
+		return;
+
+	bool have_normals = normals.size() != 0;
+	bool have_colors = colors.size() != 0;
+
+	std::unordered_map<VertexKey, unsigned int, VertexKeyHash> unique_vertices;
+	unique_vertices.reserve (vertices.size());
+
+	vector<Vector4f> unique_positions;
+	vector<Vector3f> unique_normals;
+	vector<Vector4f> unique_colors;
+
+	indices.resize (vertices.size());
+
+	for (size_t i = 0; i < vertices.size(); i++) {
+		VertexKey key;
+		memset (key.data, 0, sizeof(key.data));
+		memcpy (&key.data[0], vertices[i].data(), sizeof(float) * 4);
+		if (have_normals)
+			memcpy (&key.data[4], normals[i].data(), sizeof(float) * 3);
+		if (have_colors)
+			memcpy (&key.data[7], colors[i].data(), sizeof(float) * 4);
+
+		std::pair<std::unordered_map<VertexKey, unsigned int, VertexKeyHash>::iterator, bool> inserted
+			= unique_vertices.insert (std::make_pair (key, static_cast<unsigned int>(unique_positions.size())));
+
+		if (inserted.second) {
+			unique_positions.push_back (vertices[i]);
+			if (have_normals)
+				unique_normals.push_back (normals[i]);
+			if (have_colors)
+				unique_colors.push_back (colors[i]);
+		}
+
+		indices[i] = inserted.first->second;
+	}
+
+	vertices.swap (unique_positions);
+	normals.swap (unique_normals);
+	colors.swap (unique_colors);
+}
+
+void MeshVBO::optimizeVertexOrder() {
+	assert (vbo_id == 0);
+	restoreCpuData();
+
+	createIndices();
+
+	if (indices.size() < 6)
+		return;
+
+	// the vertices of the simplified versions would change as well
+	lods.clear();
+
+	float acmr_before = compute_acmr (indices, vertices.size());
+
+	optimize_vertex_cache (indices, vertices.size());
+	optimize_overdraw (indices, vertices);
+	vector<unsigned int> vertex_order = optimize_vertex_fetch (indices, vertices.size());
+
+	bool have_normals = normals.size() != 0;
+	bool have_colors = colors.size() != 0;
+
+	vector<Vector4f> ordered_vertices (vertex_order.size());
+	vector<Vector3f> ordered_normals (have_normals ? vertex_order.size() : 0);
+	vector<Vector4f> ordered_colors (have_colors ? vertex_order.size() : 0);
 
-	for (unsigned int i = 0; i < other.vertices.size(); i++) {
-		addVertex4fv ((other.vertices[i].transpose() * transformation).data());
+	for (size_t i = 0; i < vertex_order.size(); i++) {
+		ordered_vertices[i] = vertices[vertex_order[i]];
 		if (have_normals)
-			addNormalfv ((other.normals[i].transpose() * rotation).data());
+			ordered_normals[i] = normals[vertex_order[i]];
 		if (have_colors)
-			addColor4fv (other.colors[i].data());
+			ordered_colors[i] = colors[vertex_order[i]];
+	}
+
+	vertices.swap (ordered_vertices);
+	normals.swap (ordered_normals);
+	colors.swap (ordered_colors);
+
+	cout << "Optimized mesh " << (source_filename.size() != 0 ? source_filename : "<generated>")
+		<< ": ACMR " << fixed << setprecision(3) << acmr_before
+		<< " -> " << compute_acmr (indices, vertices.size()) << defaultfloat << endl;
+}
+
+// meshes with fewer triangles are always drawn at full resolution
+const size_t lod_min_triangles = 2048;
+// the coarsest level still has at least this many triangles
+const size_t lod_target_min_triangles = 256;
+const unsigned int lod_max_levels = 8;
+// largest simplification error relative to the bounding box diagonal
+const float lod_max_relative_error = 0.1f;
+
+void MeshVBO::generateLODs() {
+	restoreCpuData();
+	lods.clear();
+
+	if (indices.size() / 3 < lod_min_triangles)
+		return;
+
+	float diagonal = (bbox_max - bbox_min).norm();
+	float max_error = lod_max_relative_error * diagonal;
+
+	// every level is simplified from the previous one, the errors add up
+	vector<unsigned int> level_indices (indices);
+	float error = 0.f;
+
+	while (lods.size() < lod_max_levels && level_indices.size() / 3 >= lod_target_min_triangles * 2) {
+		size_t triangle_count = level_indices.size() / 3;
+		error += simplify_mesh (level_indices, vertices, triangle_count / 2, max_error - error);
+
+		// stop once the mesh cannot be simplified much further
+		if (level_indices.size() / 3 > triangle_count * 3 / 4)
+			break;
+
+		MeshLOD lod;
+		lod.indices = level_indices;
+		lod.error = error;
+
+		if (optimize)
+			optimize_vertex_cache (lod.indices, vertices.size());
+
+		lods.push_back (lod);
 	}
 }
 
 void MeshVBO::center() {
+	restoreCpuData();
+	release_cpu_data = false;
+
 	Vector3f displacement = - bbox_min - (bbox_max - bbox_min) * 0.5;
 	for (size_t i = 0; i < vertices.size(); i++) {
 		vertices[i] = vertices[i] + Vector4f (displacement[0], displacement[1], displacement[2], 0.);
@@ -382,32 +1177,72 @@ void MeshVBO::center() {
 //
 const string invalid_id_characters = "{}[],;: \r\n\t";
 
-struct FaceInfo {
-	FaceInfo () {
-		vertex_index[0] = -1;
-		vertex_index[1] = -1;
-		vertex_index[2] = -1;
+// faces of a smoothing group whose normals differ by more than this angle
+// (in degrees) keep a sharp edge between them
+const float obj_normals_crease_angle = 60.f;
 
-		texcoord_index[0] = -1;
-		texcoord_index[1] = -1;
-		texcoord_index[2] = -1;
+bool read_obj_file (const char* filename, const char* object_name, ObjData &result) {
+	if (!parse_obj_file (filename, object_name, result)) {
+		if (result.error_line == 0)
+			cerr << "Error: " << result.error << endl;
+		else
+			cerr << "Error: " << result.error << " (" << filename << ": " << result.error_line << ")" << endl;
 
-		normal_index[0] = -1;
-		normal_index[1] = -1;
-		normal_index[2] = -1;
+		return false;
 	}
 
-	int vertex_index[3];
-	int texcoord_index[3];
-	int normal_index[3];
-};
+	// meshes without normals would be drawn unlit
+	generate_obj_normals (result, obj_normals_crease_angle);
+
+	return true;
+}
 
 bool MeshVBO::loadOBJ (const char* filename, const char* object_name, bool strict) {
-	string line, original_line;
-	ifstream file_stream (filename);
+	ObjData obj_data;
+	if (!read_obj_file (filename, object_name, obj_data)) {
+		if (strict)
+			exit (1);
 
-	if (!file_stream) {
-		cerr << "Error: Could not open OBJ file '" << filename << "'!" << endl;
+		return false;
+	}
+
+	return loadOBJObject (obj_data, filename, object_name, strict);
+}
+
+bool MeshVBO::loadOBJObject (const ObjData &obj_data, const char* filename, const char* object_name, bool strict) {
+	size_t triangle_offset = 0;
+	size_t triangle_count = obj_data.triangle_positions.size() / 3;
+
+	if (object_name != NULL) {
+		const ObjObject* object = obj_data.findObject (object_name);
+
+		if (object == NULL) {
+			cerr << "Warning: could not find object '" << object_name << "' in OBJ file '" << filename << "'" << endl;
+
+			if (strict)
+				exit(1);
+
+			return false;
+		}
+
+		triangle_offset = object->triangle_offset;
+		triangle_count = object->triangle_count;
+	}
+
+	// normals are either given for all vertices or for none
+	size_t first_vertex = triangle_offset * 3;
+	size_t vertex_count = triangle_count * 3;
+	const int* triangle_positions = vertex_count != 0 ? &obj_data.triangle_positions[first_vertex] : NULL;
+	const int* triangle_normals = vertex_count != 0 ? &obj_data.triangle_normals[first_vertex] : NULL;
+
+	size_t normal_count = 0;
+	for (size_t i = 0; i < vertex_count; i++) {
+		if (triangle_normals[i] != -1)
+			normal_count++;
+	}
+
+	if (normal_count != 0 && normal_count != vertex_count) {
+		cerr << "Error: either all or no face vertices must have normals! (" << filename << ")" << endl;
 
 		if (strict)
 			exit (1);
@@ -415,237 +1250,411 @@ bool MeshVBO::loadOBJ (const char* filename, const char* object_name, bool stric
 		return false;
 	}
 
-	string current_object_name = "";
-	string material_library = "";
-	string material_name = "";
-	bool smooth_shading = false;
-	bool object_found = false;
+	this->begin();
 
-	std::vector<Vector4f> vertices;
-	std::vector<Vector3f> normals;
-	std::vector<Vector3f> texture_coordinates;
-	std::vector<FaceInfo> face_infos;
-	int line_index = 0;
+	// every distinct pair of position and normal index becomes one shared
+	// vertex. The vertex data is written directly instead of using
+	// addVertex3f() and addNormal() as this is a lot faster for large meshes.
+	// The positions are shared by all objects of the file, so only the
+	// used ones are copied.
+	size_t expected_vertex_count = std::min (obj_data.positions.size(), vertex_count);
+	std::unordered_map<uint64_t, unsigned int> unique_vertices;
+	unique_vertices.reserve (expected_vertex_count);
+	vertices.reserve (expected_vertex_count);
+	if (normal_count != 0)
+		normals.reserve (expected_vertex_count);
+
+	indices.resize (vertex_count);
+	for (size_t i = 0; i < vertex_count; i++) {
+		uint64_t key = (static_cast<uint64_t>(triangle_positions[i]) << 32)
+			| static_cast<uint32_t>(triangle_normals[i]);
+
+		std::pair<std::unordered_map<uint64_t, unsigned int>::iterator, bool> inserted
+			= unique_vertices.insert (std::make_pair (key, static_cast<unsigned int>(vertices.size())));
+
+		if (inserted.second) {
+			const Vector3f &position = obj_data.positions[triangle_positions[i]];
+			vertices.push_back (Vector4f (position[0], position[1], position[2], 1.f));
+
+			bbox_max[0] = max (position[0], bbox_max[0]);
+			bbox_max[1] = max (position[1], bbox_max[1]);
+			bbox_max[2] = max (position[2], bbox_max[2]);
+
+			bbox_min[0] = min (position[0], bbox_min[0]);
+			bbox_min[1] = min (position[1], bbox_min[1]);
+			bbox_min[2] = min (position[2], bbox_min[2]);
+
+			if (normal_count != 0)
+				normals.push_back (obj_data.normals[triangle_normals[i]]);
+		}
 
-	while (!file_stream.eof()) {
-		getline (file_stream, line);
-		line_index ++;
+		indices[i] = inserted.first->second;
+	}
 
-//		cout << "reading line " << line_index << endl;
+	this->end();
 
-		original_line = line;
-		line = trim_line (line);
-		if (line.size() == 0)
-			continue;
+	bounds_only = false;
+	source_filename = filename;
+	source_object_name = object_name != NULL ? object_name : "";
 
-//		cout << "inp: '" << line << "'" << endl;
+	if (optimize)
+		optimizeVertexOrder();
 
-		if (line.substr (0, 6) == "mtllib") {
-			material_library = line.substr (8, line.size());
+	if (generate_lods)
+		generateLODs();
 
-			continue;
-		}
+	return true;
+}
 
-		if (line.substr (0, 6) == "usemtl") {
-			if (line.size() > 9) {
-				material_name = line.substr (8, line.size());
-			}
+bool MeshVBO::loadOBJBoundingBox (const char* filename, const char* object_name) {
+	// the file still gets parsed, only the normals, the vertex data and
+	// the buffers are skipped
+	ObjData obj_data;
+	if (!parse_obj_file (filename, object_name, obj_data)) {
+		if (obj_data.error_line == 0)
+			cerr << "Error: " << obj_data.error << endl;
+		else
+			cerr << "Error: " << obj_data.error << " (" << filename << ": " << obj_data.error_line << ")" << endl;
 
-			continue;
-		}
+		return false;
+	}
 
-		if (line.substr (0, 2) == "s ") {
-			if (line.substr (2, 3) == "off"
-					|| line.substr (2, 1) == "0")
-				smooth_shading = false;
-			else if (line.substr (2, 2) == "on"
-					|| line.substr (2, 1) == "1")
-				smooth_shading = true;
+	if (object_name != NULL && obj_data.object_found == false) {
+		cerr << "Warning: could not find object '" << object_name << "' in OBJ file '" << filename << "'" << endl;
+		return false;
+	}
 
-			continue;
-		}
+	// like for the full load only the vertices that are used by the faces
+	// count, as the vertices of an object may be declared anywhere in the
+	// file
+	for (size_t i = 0; i < obj_data.triangle_positions.size(); i++) {
+		const Vector3f &position = obj_data.positions[obj_data.triangle_positions[i]];
 
-		if (line[0] == 'o') {
-			// If we have found our object already we can skip all following
-			// objects.
-			if (object_found)
-				break;
-
-			// we need a copy of the line that still contains the original case
-			// as line contains the line transformed to lowercase.
-			string object_line = strip_whitespaces(strip_comments(original_line));
-
-			current_object_name = object_line.substr (2, object_line.size());
-//			cout << "current_object_name = " << current_object_name << endl;
-			if (object_name != NULL && current_object_name == object_name)
-				object_found = true;
-			
-			continue;
+		for (unsigned int j = 0; j < 3; j++) {
+			bbox_min[j] = min (position[j], bbox_min[j]);
+			bbox_max[j] = max (position[j], bbox_max[j]);
 		}
+	}
 
-		if (line.substr (0,2) == "v ") {
-			float v1, v2, v3, v4 = 1.f;
-			istringstream values (line.substr (2, line.size()));
-			values >> v1;
-			values >> v2;
-			values >> v3;
+	bounds_only = true;
+	source_filename = filename;
+	source_object_name = object_name != NULL ? object_name : "";
 
-			if (!(values >> v4))
-				v4 = 1.f;
+	return true;
+}
 
-			vertices.push_back (Vector4f (v1, v2, v3, v4));
+//
+// Mesh cache files
+//
+const char meshbin_magic[8] = { 'M', 'E', 'S', 'H', 'B', 'I', 'N', '\0' };
+const uint32_t meshbin_version = 2;
+
+/** Start of a mesh cache file. It is followed by the object name, the
+ * levels of detail (MeshBinLOD) and the vertex and index buffer content. */
+struct MeshBinHeader {
+	char magic[8];
+	uint32_t version;
+	/// loading options the data was created with
+	uint32_t options;
+	/// identifies the OBJ file the data was created from. The hash is only
+	/// compared if the modification time differs.
+	uint64_t source_size;
+	int64_t source_mtime;
+	uint64_t source_hash;
+
+	float bbox_min[3];
+	float bbox_max[3];
+	float position_offset[3];
+	float position_scale;
+
+	uint32_t position_type;
+	uint32_t position_size;
+	uint32_t normal_type;
+	uint32_t color_type;
+	uint32_t index_type;
+	uint32_t vertex_stride;
+	uint32_t normal_offset;
+	uint32_t color_offset;
+	uint32_t has_normals;
+	uint32_t has_colors;
+	uint32_t smooth_shading;
+	uint32_t lod_count;
+
+	uint64_t vertex_count;
+	uint64_t index_count;
+	uint64_t vertex_data_size;
+	uint64_t index_data_size;
+	uint64_t object_name_length;
+};
 
-//			cerr << "line " << line << " ended up as vertice: " << vertices[vertices.size() -1].transpose() << endl;
-			
-			continue;
-		}
+struct MeshBinLOD {
+	float error;
+	uint32_t padding;
+	uint64_t index_offset;
+	uint64_t index_count;
+};
+
+static uint32_t meshbin_options (const MeshVBO &mesh) {
+	return (mesh.optimize ? 1 : 0)
+		| (mesh.generate_lods ? 2 : 0)
+		| (mesh.compact_vertices ? 4 : 0);
+}
 
-		if (line.substr (0,3) == "vn ") {
-			float v1, v2, v3;
-			istringstream values (line.substr (3, line.size()));
-			values >> v1;
-			values >> v2;
-			values >> v3;
+/** Checks whether a mesh cache file was created with the options of the
+ * mesh from the current version of the source file. The source file only
+ * gets read if it was written again, in which case source_rewritten is
+ * set. */
+static bool meshbin_matches (const MeshBinHeader &header, const MeshVBO &mesh, const FileStamp &source_stamp, bool &source_rewritten) {
+	// outdated files are silently ignored and get replaced
+	if (memcmp (header.magic, meshbin_magic, sizeof(meshbin_magic)) != 0
+			|| header.version != meshbin_version
+			|| header.options != meshbin_options (mesh)
+			|| !source_stamp.exists
+			|| header.source_size != source_stamp.size
+			|| header.object_name_length != mesh.source_object_name.size()
+			|| header.vertex_data_size == 0)
+		return false;
 
-			normals.push_back (Vector3f (v1, v2, v3));
+	source_rewritten = header.source_mtime != source_stamp.mtime;
+	if (source_rewritten && header.source_hash != source_stamp.contentHash())
+		return false;
 
-			continue;
-		}	
+	return true;
+}
 
-		if (line.substr (0,3) == "vt ") {
-			float v1, v2, v3;
-			istringstream values (line.substr (3, line.size()));
-			values >> v1;
-			values >> v2;
-			values >> v3;
+/** Pieces of memory that get written one after the other. */
+typedef std::vector<std::pair<const void*, size_t> > FileChunks;
 
-			texture_coordinates.push_back (Vector3f (v1, v2, v3));
+/** Writes a file through a temporary file that replaces it at the end, so
+ * that readers (also other instances) never see a partially written file.
+ * On failure the previous file stays untouched. */
+static bool write_file_atomically (const char* filename, const FileChunks &chunks) {
+	string temp_filename = string (filename) + "."
+		+ boost::filesystem::unique_path ("%%%%%%%%").string() + ".tmp";
 
-			continue;
-		}	
+	FILE* file_out = fopen (temp_filename.c_str(), "wb");
+	if (!file_out)
+		return false;
 
-		if (line.substr (0,2) == "f "
-				&& (object_name == NULL || current_object_name == object_name)
-				) {
-			std::vector<string> tokens = tokenize (line.substr (2, line.size()));
-			if (tokens.size() != 3) {
-				cerr << "Error: Faces must be triangles! (" << filename << ": " << line_index << ")" << endl;
-				cerr << tokens.size() << endl;
+	bool result = true;
+	for (size_t i = 0; i < chunks.size() && result; i++) {
+		if (chunks[i].second != 0)
+			result = fwrite (chunks[i].first, chunks[i].second, 1, file_out) == 1;
+	}
 
-				if (strict)
-					exit (1);
+	result = fclose (file_out) == 0 && result;
+	if (result) {
+		// also replaces an existing file on Windows
+		boost::system::error_code error;
+		boost::filesystem::rename (temp_filename, filename, error);
+		result = !error;
+	}
+	if (!result)
+		remove (temp_filename.c_str());
 
-				return false;
-			}
+	return result;
+}
 
-			FaceInfo face_info;
-
-			// read faces
-			//
-			// the following are valid face definitions:
-			//   f v1 v2 v3
-			//   f v1/n1 v2/n2 v3/n3
-			//   f v1/t1/t1 v2/t2/t2 v3/t3/t3
-			//   f v1//t1 v2//t2 v3//t3
-			for (int vi = 0; vi < 3; vi++) {
-				// first data
-				std::vector<string> vertex_tokens = tokenize (tokens[vi], "/");
-
-				if (vertex_tokens.size() == 1) {
-					if (vertex_tokens[0].size() > 0) {
-						istringstream values (vertex_tokens[0]);
-						values >> face_info.vertex_index[vi];
-					}
-				}
-
-				else if (vertex_tokens.size() == 2) {
-					// two possible cases:
-					//   v1/t1  or v1//n1
-					
-					// first one is always the vertex index
-					if (vertex_tokens[0].size() > 0) {
-						istringstream values (vertex_tokens[0]);
-						values >> face_info.vertex_index[vi];
-					}
-
-					if (count_char (tokens[vi], "/") == 1) {
-						// v1/t1
-						if (vertex_tokens[1].size() > 0) {
-							istringstream values (vertex_tokens[1]);
-							values >> face_info.texcoord_index[vi];
-						}
-					} else {
-						// v1/n1
-						if (vertex_tokens[1].size() > 0) {
-							istringstream values (vertex_tokens[1]);
-							values >> face_info.normal_index[vi];
-						}
-					}
-				}
-
-				else if (vertex_tokens.size() == 3) {
-					// two possible cases:
-					//   v1/t1/n1
-
-//					cout << "t1 = " << vertex_tokens[0] << " t2 = " << vertex_tokens[1] << " t3 = " << vertex_tokens[2];
-					if (vertex_tokens[0].size() > 0) {
-						istringstream values (vertex_tokens[0]);
-						values >> face_info.vertex_index[vi];
-					}
-					if (vertex_tokens[1].size() > 0) {
-						istringstream values (vertex_tokens[1]);
-						values >> face_info.texcoord_index[vi];
-					}
-					if (vertex_tokens[2].size() > 0) {
-						istringstream values (vertex_tokens[2]);
-						values >> face_info.normal_index[vi];
-					}
-				}
-
-//				cout << " parsed line '" << line << "' into: " 
-//					<< face_info.vertex_index[vi] << ","
-//					<< face_info.texcoord_index[vi] << ","
-//					<< face_info.normal_index[vi] << endl;
-			}
-			face_infos.push_back (face_info);
+bool MeshVBO::saveMeshBin (const char* filename, const FileStamp &source_stamp) {
+	if (cpu_data_released || bounds_only || vertices.size() == 0 || !source_stamp.exists)
+		return false;
 
-			continue;
-		}
+	packBuffers();
+
+	MeshBinHeader header;
+	memset (&header, 0, sizeof(header));
+	memcpy (header.magic, meshbin_magic, sizeof(meshbin_magic));
+	header.version = meshbin_version;
+	header.options = meshbin_options (*this);
+	header.source_size = source_stamp.size;
+	header.source_mtime = source_stamp.mtime;
+	header.source_hash = source_stamp.contentHash();
+	for (int j = 0; j < 3; j++) {
+		header.bbox_min[j] = bbox_min[j];
+		header.bbox_max[j] = bbox_max[j];
+		header.position_offset[j] = position_offset[j];
+	}
+	header.position_scale = position_scale;
+	header.position_type = position_type;
+	header.position_size = position_size;
+	header.normal_type = normal_type;
+	header.color_type = color_type;
+	header.index_type = index_type;
+	header.vertex_stride = vertex_stride;
+	header.normal_offset = normal_offset;
+	header.color_offset = color_offset;
+	header.has_normals = has_normals;
+	header.has_colors = has_colors;
+	header.smooth_shading = smooth_shading;
+	header.lod_count = lods.size();
+	header.vertex_count = vertex_count;
+	header.index_count = index_count;
+	header.vertex_data_size = packed_vertices.size();
+	header.index_data_size = packed_indices.size();
+	header.object_name_length = source_object_name.size();
+
+	vector<MeshBinLOD> lod_data (lods.size());
+	for (size_t i = 0; i < lods.size(); i++) {
+		memset (&lod_data[i], 0, sizeof(MeshBinLOD));
+		lod_data[i].error = lods[i].error;
+		lod_data[i].index_offset = lods[i].index_offset;
+		lod_data[i].index_count = lods[i].index_count;
 	}
 
-	if (object_name != NULL && object_found == false) {
-		cerr << "Warning: could not find object '" << object_name << "' in OBJ file '" << filename << "'" << endl;
+	FileChunks chunks;
+	chunks.push_back (make_pair (static_cast<const void*>(&header), sizeof(header)));
+	chunks.push_back (make_pair (static_cast<const void*>(source_object_name.c_str()), source_object_name.size()));
+	if (lod_data.size() != 0)
+		chunks.push_back (make_pair (static_cast<const void*>(&lod_data[0]), sizeof(MeshBinLOD) * lod_data.size()));
+	chunks.push_back (make_pair (static_cast<const void*>(&packed_vertices[0]), packed_vertices.size()));
+	if (packed_indices.size() != 0)
+		chunks.push_back (make_pair (static_cast<const void*>(&packed_indices[0]), packed_indices.size()));
 
-		if (strict)
-			exit(1);
+	bool result = write_file_atomically (filename, chunks);
+
+	// the vertex data might still change before it gets uploaded
+	vector<char>().swap (packed_vertices);
+	vector<char>().swap (packed_indices);
+
+	return result;
+}
+
+/** Maps a mesh cache file and checks that it belongs to the mesh. On
+ * success header and lod_data point into the mapped file. */
+static bool map_meshbin (const char* filename, const MeshVBO &mesh, const FileStamp &source_stamp, MeshBinMapping &mapping, MeshBinHeader &header, const char* &lod_data, bool &source_rewritten) {
+	MappedFile &file = mapping.file;
+	if (!file.open (filename) || file.size < sizeof(MeshBinHeader))
+		return false;
+
+	memcpy (&header, file.data, sizeof(header));
+	if (!meshbin_matches (header, mesh, source_stamp, source_rewritten))
+		return false;
+
+	uint64_t expected_size = sizeof(header) + header.object_name_length
+		+ sizeof(MeshBinLOD) * header.lod_count
+		+ header.vertex_data_size + header.index_data_size;
+	if (file.size != expected_size)
+		return false;
+
+	const char* data = file.data + sizeof(header);
+	if (string (data, header.object_name_length) != mesh.source_object_name)
+		return false;
+
+	lod_data = data + header.object_name_length;
+	mapping.vertex_data = lod_data + sizeof(MeshBinLOD) * header.lod_count;
+	mapping.vertex_data_size = header.vertex_data_size;
+	mapping.index_data = mapping.vertex_data + header.vertex_data_size;
+	mapping.index_data_size = header.index_data_size;
+
+	return true;
+}
 
+bool MeshVBO::loadMeshBin (const char* filename, const FileStamp &source_stamp) {
+	MeshBinMapping* mapping = new MeshBinMapping;
+	MeshBinHeader header;
+	const char* data = NULL;
+	bool source_rewritten = false;
+
+	if (!map_meshbin (filename, *this, source_stamp, *mapping, header, data, source_rewritten)) {
+		delete mapping;
 		return false;
 	}
 
-//	cout << "found " << vertices.size() << " vertices" << endl;
-//	cout << "found " << normals.size() << " normals" << endl;
-//	cout << "found " << face_infos.size() << " faces" << endl;
+	begin();
+	end();
 
-	this->begin();
-	// add all vertices to the MeshVBO
-	for (size_t fi = 0; fi < face_infos.size(); fi++) {
-		for (int vi = 0; vi < 3; vi ++) {
-			Vector4f vertex = vertices.at(face_infos[fi].vertex_index[vi] - 1);
-			this->addVertex3f(vertex[0], vertex[1], vertex[2]);
-	//		cout << "added vertice " << vertex.transpose() << endl;
-
-			if (face_infos[fi].normal_index[vi] != -1) {
-				Vector3f normal = normals.at(face_infos[fi].normal_index[vi] - 1);
-				this->addNormal(normal[0], normal[1], normal[2]);
-			}
-		}
+	// the buffers get uploaded from the mapped file without a copy
+	closeMeshBin();
+	vector<char>().swap (packed_vertices);
+	vector<char>().swap (packed_indices);
+	mesh_bin = mapping;
+
+	lods.resize (header.lod_count);
+	for (size_t i = 0; i < lods.size(); i++) {
+		MeshBinLOD lod;
+		memcpy (&lod, data, sizeof(lod));
+		data += sizeof(lod);
+
+		lods[i].error = lod.error;
+		lods[i].index_offset = lod.index_offset;
+		lods[i].index_count = lod.index_count;
 	}
 
-	this->end();
+	for (int j = 0; j < 3; j++) {
+		bbox_min[j] = header.bbox_min[j];
+		bbox_max[j] = header.bbox_max[j];
+		position_offset[j] = header.position_offset[j];
+	}
+	position_scale = header.position_scale;
+	position_type = header.position_type;
+	position_size = header.position_size;
+	normal_type = header.normal_type;
+	color_type = header.color_type;
+	index_type = header.index_type;
+	vertex_stride = header.vertex_stride;
+	normal_offset = header.normal_offset;
+	color_offset = header.color_offset;
+	has_normals = header.has_normals != 0;
+	has_colors = header.has_colors != 0;
+	smooth_shading = header.smooth_shading != 0;
+	vertex_count = header.vertex_count;
+	index_count = header.index_count;
+	buffer_size = header.vertex_data_size;
+
+	// the vertex data gets decoded from the buffers when it is needed
+	bounds_only = false;
+	cpu_data_released = true;
+	mesh_bin_filename = filename;
+
+	// the content is the same, so later loads do not need to hash it again.
+	// The file is replaced as a whole (the mapping keeps the old one) and
+	// if that fails the next load only hashes the source again.
+	if (source_rewritten) {
+		header.source_mtime = source_stamp.mtime;
+
+		FileChunks chunks;
+		chunks.push_back (make_pair (static_cast<const void*>(&header), sizeof(header)));
+		chunks.push_back (make_pair (static_cast<const void*>(mesh_bin->file.data + sizeof(header)), mesh_bin->file.size - sizeof(header)));
+		if (!write_file_atomically (filename, chunks))
+			cerr << "Warning: could not update the mesh cache file " << filename << endl;
+	}
 
-	smooth_shading = smooth_shading;
+	return true;
+}
+
+void MeshVBO::closeMeshBin() {
+	delete mesh_bin;
+	mesh_bin = NULL;
+}
+
+bool MeshVBO::loadMeshBinBoundingBox (const char* filename, const FileStamp &source_stamp) {
+	FILE* file = fopen (filename, "rb");
+	if (!file)
+		return false;
+
+	// only the header and the object name are read
+	MeshBinHeader header;
+	bool source_rewritten = false;
+	bool result = fread (&header, sizeof(header), 1, file) == 1
+		&& meshbin_matches (header, *this, source_stamp, source_rewritten);
+
+	if (result && header.object_name_length != 0) {
+		string object_name (header.object_name_length, '\0');
+		result = fread (&object_name[0], object_name.size(), 1, file) == 1
+			&& object_name == source_object_name;
+	}
+
+	fclose (file);
+
+	if (!result)
+		return false;
+
+	for (int j = 0; j < 3; j++) {
+		bbox_min[j] = header.bbox_min[j];
+		bbox_max[j] = header.bbox_max[j];
+	}
 
-	file_stream.close();
+	bounds_only = true;
 
 	return true;
 }
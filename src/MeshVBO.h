@@ -10,14 +10,19 @@
 #define _MESHVBO_H
 
 #include <vector>
+#include <string>
 #include <iostream>
 #include <cstddef>
 #include <limits>
 
 #include "Math.h"
+#include "FileStamp.h"
 
 typedef ptrdiff_t GLsizeiptr;
 
+struct ObjData;
+struct MeshBinMapping;
+
 struct MaterialLib {
 };
 
@@ -40,30 +45,69 @@ struct Material {
 	unsigned int texture_bump;
 };
 
+/** \brief Simplified version of a mesh that uses the same vertices. */
+struct MeshLOD {
+	MeshLOD() :
+		error (0.f),
+		index_offset (0),
+		index_count (0)
+	{}
+
+	std::vector<unsigned int> indices;
+	/// largest distance between the simplified and the full surface
+	float error;
+	/// position of the first index in the index buffer of the mesh
+	size_t index_offset;
+	/// number of uploaded indices (also valid once the indices were released)
+	size_t index_count;
+};
+
 /** \brief Loads Wavefront VBO files and prepares them for use in
  * OpenGL.
  */
 struct MeshVBO {
 	MeshVBO() :
 		vbo_id(0),
+		ibo_id(0),
+		vao_id(0),
+		index_type(0),
 		started(false),
 		smooth_shading(true),
+		bounds_only(false),
+		compact_vertices(true),
+		optimize(false),
+		generate_lods(false),
+		release_cpu_data(false),
+		cpu_data_released(false),
+		vertex_count (0),
+		index_count (0),
+		has_normals (false),
+		has_colors (false),
 		buffer_size (0),
 		normal_offset (0),
 		color_offset (0),
+		vertex_stride (0),
+		position_type (0),
+		position_size (0),
+		normal_type (0),
+		color_type (0),
+		position_offset (0.f, 0.f, 0.f),
+		position_scale (1.f),
 		bbox_min (std::numeric_limits<float>::max(),
 				std::numeric_limits<float>::max(),
 				std::numeric_limits<float>::max()),
 		bbox_max (-std::numeric_limits<float>::max(),
 				-std::numeric_limits<float>::max(),
-				-std::numeric_limits<float>::max())
+				-std::numeric_limits<float>::max()),
+		mesh_bin (NULL)
 	{}
 	MeshVBO (const MeshVBO& mesh);
 	MeshVBO& operator= (const MeshVBO& mesh);
 	~MeshVBO() {
-		if (vbo_id != 0) {
+		if (vbo_id != 0 || ibo_id != 0) {
 			delete_vbo();
 		}
+		closeMeshBin();
 	}
 
 	void begin();
@@ -79,20 +123,151 @@ struct MeshVBO {
 	void addColor4fv (const float color[4]);
 	void addColor3f (float x, float y, float z);
 	void addColor3fv (const float color[3]);
+	/// extends the bounding box so that it contains the vertex
+	void updateBoundingBox (const Vector4f &vertex);
 
+	/** \brief Selects the vertex buffer layout for the current data.
+	 *
+	 * If compact_vertices is set positions are stored as 16 bit integers
+	 * relative to the bounding box (unless a w component other than 1 is
+	 * used), normals as 8 bit values and colors as RGBA8. Otherwise float values are used.
+	 */
+	void chooseVertexLayout();
+	/** \brief Creates the content of the vertex and index buffers (see
+	 * packed_vertices) without uploading it.
+	 *
+	 * Does not need an OpenGL context.
+	 */
+	void packBuffers();
+	/// Uploads the packed buffers (packs them first if needed)
 	unsigned int generate_vbo();
+	/** \brief Content of the vertex and index buffer that is waiting for
+	 * the upload, i.e. packed_vertices and packed_indices or the mapped
+	 * mesh cache file (see loadMeshBin()).
+	 */
+	const char* vertexBufferData (size_t &size) const;
+	const char* indexBufferData (size_t &size) const;
+	/** \brief Creates a vertex array object for the buffers that feeds
+	 * the generic attributes 0 (position), 1 (normal) and 2 (color).
+	 *
+	 * Needs OpenGL 3.0. The buffers have to exist already.
+	 */
+	unsigned int generate_vao();
 	void delete_vbo();
 	void debug_vbo();
 
-	void draw(unsigned int mode);
+	/** \brief Draws the mesh or one of its simplified versions.
+	 *
+	 * Level 0 is the full mesh, level i > 0 is lods[i - 1].
+	 */
+	void draw(unsigned int mode, unsigned int lod_level = 0);
+	/** \brief Binds the buffers and sets up the vertex arrays for
+	 * drawBuffers() with the fixed function pipeline.
+	 *
+	 * The buffers have to exist already. Uses the GLStateCache, so the
+	 * buffer bindings have to be reset through it afterwards.
+	 */
+	void bind();
+	/** \brief Only issues the draw call, i.e. the buffers (or the vertex
+	 * array object) have to be bound already.
+	 *
+	 * An instance_count other than 1 needs OpenGL 3.1.
+	 */
+	void drawBuffers(unsigned int mode, unsigned int lod_level = 0, unsigned int instance_count = 1);
+
+	/** \brief Merges identical vertices and draws the mesh using indices.
+	 *
+	 * Vertices are identical if position, normal and color are the same.
+	 */
+	void createIndices();
+	/** \brief Reorders triangles and vertices for the post-transform
+	 * vertex cache, less overdraw and sequential vertex fetches.
+	 *
+	 * Non-indexed meshes get indexed first. The triangles stay the same,
+	 * only their order changes.
+	 */
+	void optimizeVertexOrder();
+	/** \brief Creates a chain of simplified versions (each with about half
+	 * the triangles of the previous one) of large indexed meshes.
+	 */
+	void generateLODs();
+	/// Number of vertices that get drawn (i.e. three per triangle)
+	size_t drawCount() const {
+		if (cpu_data_released)
+			return index_count != 0 ? index_count : vertex_count;
+
+		return indices.size() != 0 ? indices.size() : vertices.size();
+	}
+
+	/** \brief Frees the vertex data that is only needed on the GPU.
+	 *
+	 * Only the bounding box and what is needed for drawing is kept. Only
+	 * meshes that were loaded from a file can be released as their data
+	 * gets loaded again by restoreCpuData() when needed.
+	 */
+	void releaseCpuData();
+	/** \brief Reloads the vertex data of a mesh that was released.
+	 *
+	 * The data comes from the mesh cache file if the mesh was loaded from
+	 * a valid one (with the precision of the packed buffers) and from the
+	 * source file otherwise. All functions that need the vertex data (e.g.
+	 * join() or transform()) call this themselves.
+	 */
+	bool restoreCpuData();
+	/** \brief Copies the vertex data into result. Released meshes are not
+	 * restored, their data only gets loaded into result.
+	 */
+	bool copyCpuData (MeshVBO &result) const;
 
 	unsigned int vbo_id;
+	/// index buffer, only used for indexed meshes
+	unsigned int ibo_id;
+	/// vertex array object, only used by the SegmentRenderer
+	unsigned int vao_id;
+	/// GL type of the values in the index buffer (16 or 32 bit)
+	unsigned int index_type;
 	bool started;
 	bool smooth_shading;
+	/// true while only the bounding box of the mesh is known, see
+	/// loadOBJBoundingBox()
+	bool bounds_only;
+	/// allows lossy but smaller encodings in the vertex buffer
+	bool compact_vertices;
+	/// run optimizeVertexOrder() after a mesh was loaded
+	bool optimize;
+	/// run generateLODs() after a mesh was loaded
+	bool generate_lods;
+	/// run releaseCpuData() once the mesh was uploaded. Gets disabled when
+	/// the vertex data is modified (e.g. by transform()) as the changes
+	/// could not be restored from the file.
+	bool release_cpu_data;
+	bool cpu_data_released;
+
+	/// size of the uploaded data, valid as long as the buffers exist
+	size_t vertex_count;
+	size_t index_count;
+	bool has_normals;
+	bool has_colors;
 
+	/// OBJ file (and object within it) the mesh was loaded from
+	std::string source_filename;
+	std::string source_object_name;
+	/// mesh cache file the buffers were loaded from, the vertex data gets
+	/// restored from it as long as it is valid
+	std::string mesh_bin_filename;
+
+	/// the attributes of a vertex are interleaved in the vertex buffer
 	GLsizeiptr buffer_size;
 	GLsizeiptr normal_offset;
 	GLsizeiptr color_offset;
+	int vertex_stride;
+	unsigned int position_type;
+	int position_size;
+	unsigned int normal_type;
+	unsigned int color_type;
+	/// maps quantized positions back: p = position_offset + position_scale * q
+	Vector3f position_offset;
+	float position_scale;
 	
 	Vector3f bbox_min;
 	Vector3f bbox_max;
@@ -100,14 +275,93 @@ struct MeshVBO {
 	std::vector<Vector4f> vertices;
 	std::vector<Vector3f> normals;
 	std::vector<Vector4f> colors;
+	/// if not empty the vertices are shared and the triangles are defined
+	/// by these indices
+	std::vector<unsigned int> indices;
+	/// levels of detail, ordered from fine to coarse
+	std::vector<MeshLOD> lods;
+
+	/// content of the vertex and index buffer in the layout selected by
+	/// chooseVertexLayout(). Only kept until the buffers are created.
+	std::vector<char> packed_vertices;
+	std::vector<char> packed_indices;
+	/// mesh cache file the buffers get uploaded from, see loadMeshBin()
+	MeshBinMapping* mesh_bin;
 
+	/** \brief Reserves memory so that meshes can be joined without
+	 * reallocations. */
+	void reserve (size_t vertex_count, size_t index_count, bool with_normals, bool with_colors);
 	void join (const Matrix44f &transformation, const MeshVBO &other);
+	/** \brief Joins the other mesh and uses vertex_color for all of its
+	 * vertices that have no color, i.e. the result always has colors. */
+	void join (const Matrix44f &transformation, const MeshVBO &other, const Vector4f &vertex_color);
+	void joinMesh (const Matrix44f &transformation, const MeshVBO &other, const Vector4f *vertex_color);
 	void transform(const Matrix44f &transformation);
 	void setColor(const Vector4f &color);
 	void center ();
 	bool loadOBJ (const char* filename, const char* object_name = NULL, bool strict = false);
+	/** \brief Creates the mesh from an OBJ file that was already parsed
+	 * (see read_obj_file()).
+	 *
+	 * This allows to load all objects of a file while parsing it only once.
+	 * If object_name is NULL all faces of obj_data are used.
+	 */
+	bool loadOBJObject (const ObjData &obj_data, const char* filename, const char* object_name = NULL, bool strict = false);
+	/** \brief Only computes the bounding box of the vertices of an OBJ
+	 * file.
+	 *
+	 * Only vertices that are used by the faces (of the object) count, so
+	 * the box is the same as the one of the full load. The whole file still
+	 * gets parsed, but no normals and buffers are created. The mesh gets
+	 * marked as bounds_only and cannot be drawn until the full data was
+	 * loaded using loadOBJ() on the source file.
+	 */
+	bool loadOBJBoundingBox (const char* filename, const char* object_name = NULL);
+
+	/** \brief Writes the packed vertex and index buffers into a mesh cache
+	 * file (.meshbin) for the OBJ file with the given stamp.
+	 *
+	 * Needs the vertex data of a mesh that was loaded from an OBJ file.
+	 */
+	bool saveMeshBin (const char* filename, const FileStamp &source_stamp);
+	/** \brief Loads the buffers from a mesh cache file.
+	 *
+	 * Fails if the file was created from a different version of the source
+	 * file (see source_filename and source_object_name) or with different
+	 * loading options. The mesh can be drawn afterwards but its vertex data
+	 * is treated as released, i.e. it gets decoded from the buffers once it
+	 * is needed (see restoreCpuData()).
+	 *
+	 * The file stays mapped until generate_vbo() uploads the buffers
+	 * directly from it.
+	 */
+	bool loadMeshBin (const char* filename, const FileStamp &source_stamp);
+	/// Unmaps the file of loadMeshBin() if its buffers were not uploaded
+	void closeMeshBin();
+	/** \brief Only reads the bounding box from the header of a mesh cache
+	 * file (see loadMeshBin()) and marks the mesh as bounds_only.
+	 *
+	 * The size of the file does not matter as only its header is read.
+	 */
+	bool loadMeshBinBoundingBox (const char* filename, const FileStamp &source_stamp);
 };
 
+/** \brief Matrix that transforms normals (as row vectors) with the
+ * linear part of the transformation, i.e. its inverse transpose up to a
+ * positive factor.
+ *
+ * The transformed normals have to be normalized afterwards.
+ */
+Matrix33f normal_transformation (const Matrix44f &transformation);
+
+/** \brief Parses an OBJ file and reports errors.
+ *
+ * If object_name is NULL the whole file is parsed and all its objects are
+ * listed in ObjData::objects. Faces without normals get generated ones
+ * (see generate_obj_normals()).
+ */
+bool read_obj_file (const char* filename, const char* object_name, ObjData &result);
+
 MeshVBO CreateUVSphere (unsigned int rows, unsigned int segments);
 
 MeshVBO CreateCuboid (float width, float height, float depth);
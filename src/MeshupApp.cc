@@ -14,6 +14,7 @@
 #include <QProgressDialog>
 #include <QRegExp>
 #include <QRegExpValidator>
+#include <QFileInfo>
 #include <algorithm>
 
 #include "meshup_config.h"
@@ -24,6 +25,9 @@
 #include "ForcesTorques.h"
 #include "Scene.h"
 #include "Scripting.h"
+#include "MeshLoader.h"
+#include "SegmentRenderer.h"
+#include "FrameProfiler.h"
 
 #include <assert.h>
 #include <iostream>
@@ -31,6 +35,7 @@
 #include <iomanip>
 #include <cstdlib>
 #include <fstream>
+#include <set>
 #include <signal.h>
 #include <sys/socket.h>
 #include <unistd.h>
@@ -55,6 +60,12 @@ MeshupApp::MeshupApp(QWidget *parent)
 
 	selected_cam = NULL;
 	scene = new Scene;
+	lazyMeshLoading = false;
+	optimizeMeshes = false;
+	meshLods = true;
+	releaseMeshData = false;
+	batchSegments = true;
+	meshCacheFiles = true;
 
 	//setting up the socket pair for signal handling
 	if (!::socketpair(AF_UNIX, SOCK_STREAM,0,sigusr1Fd)) {
@@ -76,10 +87,20 @@ MeshupApp::MeshupApp(QWidget *parent)
 	//  that makes sense
 	glRefreshTime=20; 
 
+	// the scene is only drawn when something changed
 	sceneRefreshTimer = new QTimer (this);
-	sceneRefreshTimer->setSingleShot(false);
+	sceneRefreshTimer->setSingleShot(true);
 	updateTime.start();
 
+	// editors and exporters often write files in several steps. Changes
+	// are therefore only reloaded once the files stopped changing for
+	// fileSettleTime milliseconds.
+	fileWatcher = new QFileSystemWatcher (this);
+	fileReloadTimer = new QTimer (this);
+	fileReloadTimer->setSingleShot(true);
+	fileSettleTime = 300;
+	fileChangesPending = false;
+
 	timeLine = new QTimeLine (TimeLineDuration, this);
 	timeLine->setCurveShape(QTimeLine::LinearCurve);
 
@@ -134,8 +155,9 @@ MeshupApp::MeshupApp(QWidget *parent)
 	dockPlayerControls->setVisible(true);
 	dockViewSettings->setVisible(false);
 
-	// the sceneRefreshTimer is used to continously redraw the OpenGL widget
+	// the sceneRefreshTimer is used to redraw the OpenGL widget
 	connect (sceneRefreshTimer, SIGNAL(timeout()), this , SLOT(drawScene()));
+	connect (glWidget, SIGNAL (view_changed()), this, SLOT (requestRedraw()));
 
 	//camera interaction
 	connect (listWidgetCameraList, SIGNAL(itemClicked(QListWidgetItem*)), this, SLOT(select_camera(QListWidgetItem*)));
@@ -161,6 +183,7 @@ MeshupApp::MeshupApp(QWidget *parent)
 	connect (checkBoxDrawTorques, SIGNAL (toggled(bool)), glWidget, SLOT (toggle_draw_torques(bool)));	
 	connect (checkBoxCameraFixed, SIGNAL (toggled(bool)), this, SLOT (toggle_camera_fix(bool)));	
 	connect (actionToggleWhiteBackground, SIGNAL (toggled(bool)), glWidget, SLOT (toggle_white_mode(bool)));
+	connect (actionToggleProfiler, SIGNAL (toggled(bool)), glWidget, SLOT (toggle_draw_profiler(bool)));
 
 	connect (actionFrontView, SIGNAL (triggered()), glWidget, SLOT (set_front_view()));
 	connect (actionSideView, SIGNAL (triggered()), glWidget, SLOT (set_side_view()));
@@ -188,6 +211,10 @@ MeshupApp::MeshupApp(QWidget *parent)
 	connect (exportCameraFile, SIGNAL (clicked()), this, SLOT(actionCameraMovementSaveToFile()));
 
 	connect (actionReloadFiles, SIGNAL ( triggered() ), this, SLOT(action_reload_files()));
+	connect (actionAutoReload, SIGNAL ( toggled(bool) ), this, SLOT(toggle_auto_reload(bool)));
+	connect (fileWatcher, SIGNAL (fileChanged(const QString&)), this, SLOT (watched_file_changed(const QString&)));
+	connect (fileWatcher, SIGNAL (directoryChanged(const QString&)), this, SLOT (watched_file_changed(const QString&)));
+	connect (fileReloadTimer, SIGNAL (timeout()), this, SLOT (reload_settled_files()));
 
 	connect (glWidget, SIGNAL (camera_changed()), this, SLOT (camera_changed()));	
 	connect (glWidget, SIGNAL (toggle_camera_fix(bool)), this, SLOT (toggle_camera_fix(bool)));	
@@ -201,24 +228,48 @@ MeshupApp::MeshupApp(QWidget *parent)
 
 	loadSettings();
 	
-	sceneRefreshTimer->start(glRefreshTime);
+	requestRedraw();
 }
 
 void MeshupApp::opengl_initialized () {
 	glWidget->scene = scene;
 
 	parseArguments (main_argc, main_argv);
+
+	requestRedraw();
 }
 
 void MeshupApp::drawScene () {
-	if (L)
-		scripting_update (L, 1.0e-3f * static_cast<float>(updateTime.restart()) );
+	FrameProfiler &profiler = get_frame_profiler();
+	profiler.beginFrame();
+
+	bool continuous_update = false;
+	if (L) {
+		profiler.beginCpu (ProfileScripting);
+		continuous_update = scripting_update (L, 1.0e-3f * static_cast<float>(updateTime.restart()) );
+		profiler.endCpu();
+	}
 
 	scene->setCurrentTime(scene->current_time);
 	glWidget->updateGL();
 
-	if (L)
+	if (L) {
+		profiler.beginCpu (ProfileScripting);
 		scripting_draw (L);
+		profiler.endCpu();
+	}
+
+	profiler.endFrame();
+
+	// meshes that are loaded in the background get placed while drawing,
+	// the profiler graph scrolls with every frame
+	if (continuous_update || get_lazy_mesh_loader().hasPendingLoads() || glWidget->draw_profiler)
+		requestRedraw();
+}
+
+void MeshupApp::requestRedraw () {
+	if (!sceneRefreshTimer->isActive())
+		sceneRefreshTimer->start (glRefreshTime);
 }
 
 void MeshupApp::loadModel(const char* filename) {
@@ -228,12 +279,21 @@ void MeshupApp::loadModel(const char* filename) {
 	}
 
 	MeshupModel* model = new MeshupModel;
+	model->lazy_mesh_loading = lazyMeshLoading;
+	model->optimize_meshes = optimizeMeshes;
+	model->generate_mesh_lods = meshLods;
+	model->release_mesh_data = releaseMeshData;
+	model->batch_segments = batchSegments;
+	model->use_mesh_cache_files = meshCacheFiles;
 	// TODO: gracefully ignore erroneous files
 	model->loadModelFromFile (filename);
 	model->resetPoses();
 	model->updateSegments();
 	
 	scene->models.push_back (model);
+
+	updateWatchedFiles();
+	requestRedraw();
 }
 
 void MeshupApp::loadAnimation(const char* filename) {
@@ -264,6 +324,9 @@ void MeshupApp::loadAnimation(const char* filename) {
 	animation_speed_changed(spinBoxSpeed->value());
 
  	initialize_curves(); 
+
+	updateWatchedFiles();
+	requestRedraw();
 }
 
 void MeshupApp::loadForcesAndTorques(const char* filename) {
@@ -294,6 +357,9 @@ void MeshupApp::loadForcesAndTorques(const char* filename) {
 		checkBoxDrawTorques->setChecked(glWidget->draw_torques);
 	 }
 	 scene->forcesTorquesQueue.push_back (forcesTorques);
+
+	updateWatchedFiles();
+	requestRedraw();
 }
 
 void MeshupApp::loadCamera(const char* filename) {
@@ -301,11 +367,81 @@ void MeshupApp::loadCamera(const char* filename) {
 		cam_operator->loadFromFile(filename); 
 	}
 	camera_changed();
+
+	updateWatchedFiles();
+}
+
+std::vector<std::string> MeshupApp::getLoadedFiles () {
+	std::vector<std::string> result;
+
+	for (unsigned int i = 0; i < scene->models.size(); i++) {
+		result.push_back (scene->models[i]->model_filename);
+	}
+
+	MeshCache &mesh_cache = get_mesh_cache();
+	for (MeshCache::iterator iter = mesh_cache.begin(); iter != mesh_cache.end(); iter++) {
+		result.push_back (iter->second.stamp.filename);
+	}
+
+	for (unsigned int i = 0; i < scene->animations.size(); i++) {
+		result.push_back (scene->animations[i]->animation_filename);
+		result.push_back (scene->animations[i]->data_filename);
+	}
+
+	for (unsigned int i = 0; i < scene->forcesTorquesQueue.size(); i++) {
+		result.push_back (scene->forcesTorquesQueue[i]->forces_filename);
+	}
+
+	result.push_back (cam_operator->camera_filename);
+
+	std::sort (result.begin(), result.end());
+	result.erase (std::unique (result.begin(), result.end()), result.end());
+	result.erase (std::remove (result.begin(), result.end(), string("")), result.end());
+
+	return result;
+}
+
+void MeshupApp::updateWatchedFiles () {
+	if (!actionAutoReload->isChecked())
+		return;
+
+	std::vector<std::string> loaded_files = getLoadedFiles();
+
+	// the directories are watched as well since many editors save by
+	// writing a new file and renaming it, which removes the old file from
+	// the watcher
+	QStringList paths;
+	loadedFileStatus.clear();
+	for (unsigned int i = 0; i < loaded_files.size(); i++) {
+		QFileInfo file_info (loaded_files[i].c_str());
+		if (!file_info.exists())
+			continue;
+
+		paths << file_info.absoluteFilePath();
+		if (!paths.contains (file_info.absolutePath()))
+			paths << file_info.absolutePath();
+
+		std::pair<int64_t, uint64_t> &status = loadedFileStatus[loaded_files[i]];
+		get_file_status (loaded_files[i], status.first, status.second);
+	}
+
+	QStringList watched_paths = fileWatcher->files() + fileWatcher->directories();
+	for (int i = 0; i < watched_paths.size(); i++) {
+		if (!paths.contains (watched_paths[i]))
+			fileWatcher->removePath (watched_paths[i]);
+	}
+
+	// re-adding is needed for files that were replaced
+	for (int i = 0; i < paths.size(); i++) {
+		if (!watched_paths.contains (paths[i]) || !fileWatcher->files().contains (paths[i]))
+			fileWatcher->addPath (paths[i]);
+	}
 }
 
 void MeshupApp::setAnimationFraction (float fraction, bool editingTime) {
 	float set_time = fraction * scene->longest_animation;
 	scene->setCurrentTime(set_time);
+	requestRedraw();
 	if (selected_cam != NULL && !playerPaused && editingTime) {
 		CameraPosition* campos = selected_cam->camera_data;
 		int row = cam_operator->setCameraPosTime(campos, set_time);
@@ -322,6 +458,25 @@ void print_usage() {
 		<< "				 for examples and documentation. Note that any re-" << endl
 		<< "				 maining arguments will be sent to the meshup.load(args)" << endl
 		<< "				 script function." << endl
+		<< "--lazy-meshes		 only read the bounding boxes of meshes when loading" << endl
+		<< "				 a model. Meshes are loaded in the background once" << endl
+		<< "				 they are visible. The boxes come from the mesh" << endl
+		<< "				 cache files, without them the OBJ files still" << endl
+		<< "				 get parsed completely." << endl
+		<< "--optimize-meshes	 reorder the triangles and vertices of meshes after" << endl
+		<< "				 loading for faster rendering of large meshes." << endl
+		<< "--no-mesh-lods		 always draw meshes at full resolution instead of" << endl
+		<< "				 using simplified versions for distant segments." << endl
+		<< "--release-mesh-data	 free the vertex data of meshes once they are on the" << endl
+		<< "				 graphics card to reduce memory usage." << endl
+		<< "--no-segment-batching	 draw every segment on its own instead of merging" << endl
+		<< "				 the small meshes attached to the same frame." << endl
+		<< "--no-mesh-cache		 neither read nor write the binary mesh cache files" << endl
+		<< "				 (.meshbin) next to the OBJ files." << endl
+		<< "--fixed-function	 draw the segments with the fixed function pipeline" << endl
+		<< "				 instead of shaders." << endl
+		<< "--shadow-map-size N	 use a shadow map of NxN pixels (default: 2048)." << endl
+		<< "--soft-shadows		 smooth the shadow edges over a wider area (slower)." << endl
 		<< endl
 		<< "Report bugs to <martin.felis@iwr.uni-heidelberg.de>" << endl;
 }
@@ -329,6 +484,34 @@ void print_usage() {
 void MeshupApp::parseArguments (int argc, char* argv[]) {
 	string scripting_file = "";
 
+	// options that affect loading have to be known before any file gets
+	// loaded
+	for (int i = 1; i < argc; i++) {
+		if (string(argv[i]) == "--lazy-meshes")
+			lazyMeshLoading = true;
+		else if (string(argv[i]) == "--optimize-meshes")
+			optimizeMeshes = true;
+		else if (string(argv[i]) == "--no-mesh-lods")
+			meshLods = false;
+		else if (string(argv[i]) == "--release-mesh-data")
+			releaseMeshData = true;
+		else if (string(argv[i]) == "--no-segment-batching")
+			batchSegments = false;
+		else if (string(argv[i]) == "--no-mesh-cache")
+			meshCacheFiles = false;
+		else if (string(argv[i]) == "--fixed-function")
+			get_segment_renderer().enabled = false;
+		else if (string(argv[i]) == "--soft-shadows")
+			get_segment_renderer().soft_shadows = true;
+		else if (string(argv[i]) == "--shadow-map-size") {
+			if (i + 1 == argc || atoi (argv[i + 1]) <= 0) {
+				cerr << "Error: --shadow-map-size requires a positive size!" << endl;
+				abort();
+			}
+			glWidget->shadow_map_size = atoi (argv[++i]);
+		}
+	}
+
 	for (int i = 1; i < argc; i++) {
 
 		// check if diplaying help was part of input
@@ -360,6 +543,15 @@ void MeshupApp::parseArguments (int argc, char* argv[]) {
 
 			scripting_file = arg;
 
+		} else if (arg == "--lazy-meshes" || arg == "--optimize-meshes" || arg == "--no-mesh-lods"
+				|| arg == "--release-mesh-data" || arg == "--no-segment-batching"
+				|| arg == "--no-mesh-cache" || arg == "--fixed-function"
+				|| arg == "--soft-shadows") {
+			// already handled above
+		} else if (arg == "--shadow-map-size") {
+			// already handled above
+			i++;
+
 		// In case arg is model file
 		} else if (arg.size() >= 3 && arg.substr (arg.size() - 3) == "lua") {
 			string model_filename = find_model_file_by_name (arg.c_str());
@@ -428,6 +620,9 @@ void MeshupApp::saveSettings () {
 	settings_json["configuration"]["docks"]["player_controls"]["visible"] = dockPlayerControls->isVisible();
 	settings_json["configuration"]["docks"]["player_controls"]["repeat"] = checkBoxLoopAnimation->isChecked();
 
+	settings_json["configuration"]["reload"]["auto_reload"] = actionAutoReload->isChecked();
+	settings_json["configuration"]["reload"]["settle_time"] = fileSettleTime;
+
 	settings_json["configuration"]["window"]["width"] = width();
 	settings_json["configuration"]["window"]["height"] = height();
 	settings_json["configuration"]["window"]["xpos"] = x();
@@ -507,6 +702,9 @@ void MeshupApp::loadSettings () {
 	dockPlayerControls->setVisible(settings_json["configuration"]["docks"]["player_controls"].get("visible", true).asBool());
 	checkBoxLoopAnimation->setChecked(settings_json["configuration"]["docks"]["player_controls"].get("repeat", true).asBool());
 
+	fileSettleTime = settings_json["configuration"]["reload"].get("settle_time", fileSettleTime).asInt();
+	actionAutoReload->setChecked(settings_json["configuration"]["reload"].get("auto_reload", false).asBool());
+
 	renderImageSeriesDialog->WidthSpinBox->setValue(settings_json["configuration"]["render"].get("width", glWidget->width()).asInt());
 	renderImageSeriesDialog->HeightSpinBox->setValue(settings_json["configuration"]["render"].get("height", glWidget->height()).asInt());
 	renderImageSeriesDialog->FpsSpinBox->setValue(settings_json["configuration"]["render"].get("fps", 25).asInt());
@@ -561,6 +759,8 @@ void MeshupApp::camera_changed() {
 		deleteCameraButton->setDisabled(true);
 		movingCameraCheckBox->setChecked(false);
 	}
+
+	requestRedraw();
 }
 
 Vector3f parse_vec3_string (const std::string vec3_string) {
@@ -739,25 +939,60 @@ void MeshupApp::action_load_camera() {
 }
 
 void MeshupApp::action_reload_files() {
+	// only files that were modified since they were loaded are parsed again
+	unsigned int reload_count = 0;
+
+	// vertex buffers get replaced
+	glWidget->makeCurrent();
+
+	// meshes are shared between the models and get updated in place
+	unsigned int mesh_reload_count = reload_modified_meshes();
+	if (mesh_reload_count > 0) {
+		for (unsigned int i = 0; i < scene->models.size(); i++) {
+			scene->models[i]->updateSegments();
+			scene->models[i]->updateSegmentBatches();
+		}
+		reload_count += mesh_reload_count;
+	}
+
+	std::set<MeshupModel*> reloaded_models;
 	for (unsigned int i = 0; i < scene->models.size(); i++) {
-		string filename = scene->models[i]->model_filename;
 		MeshupModel* model = scene->models[i];
+		if (!model->model_stamp.isModified()) {
+			model->model_stamp.refresh();
+			continue;
+		}
+
+		string filename = model->model_filename;
 		model->clear();
 
-		if (model->loadModelFromFile (filename.c_str())) {
+		// reloaded files are hashed right away, so that a later rewrite
+		// with the same content does not trigger another reload
+		if (model->loadModelFromFile (filename.c_str(), false)) {
+			model->model_stamp.contentHash();
 			model->resetPoses();
 			model->updateSegments();
 		} else {
 			cerr << "Error loading model " << scene->models[i]->model_filename << endl;
 		}
+
+		reloaded_models.insert (model);
+		reload_count++;
 	}
 
 	scene->longest_animation = 0;
 	for (unsigned int i = 0; i < scene->animations.size(); i++) {
 		Animation* animation = scene->animations[i];
 
-		if (!animation->loadFromFile (animation->animation_filename.c_str(), scene->models[i]->configuration)) {
-			cerr << "Error loading animation " << scene->animations[i]->animation_filename << endl;
+		// the animation depends on the configuration of the model
+		if (animation->isModified() || reloaded_models.count (scene->models[i]) > 0) {
+			if (!animation->loadFromFile (animation->animation_filename.c_str(), scene->models[i]->configuration, false)) {
+				cerr << "Error loading animation " << scene->animations[i]->animation_filename << endl;
+			} else {
+				animation->animation_stamp.contentHash();
+				animation->data_stamp.contentHash();
+			}
+			reload_count++;
 		}
 		scene->longest_animation = std::max(scene->longest_animation, animation->duration);	
 		animation_speed_changed(spinBoxSpeed->value());
@@ -766,18 +1001,94 @@ void MeshupApp::action_reload_files() {
 	for (unsigned int i = 0; i < scene->forcesTorquesQueue.size(); i++){
 		ForcesTorques* forcesTorques = scene->forcesTorquesQueue[i];
 
-		if (!forcesTorques->loadFromFile(forcesTorques->forces_filename.c_str())){
+		bool forces_modified = forcesTorques->forces_stamp.isModified();
+		if (!forces_modified)
+			forcesTorques->forces_stamp.refresh();
+
+		if (!forces_modified && reloaded_models.count (forcesTorques->model_ref) == 0)
+			continue;
+
+		if (!forcesTorques->loadFromFile(forcesTorques->forces_filename.c_str(), false)){
 			cerr << "Error loading forces " << scene->forcesTorquesQueue[i]->forces_filename << endl;
+		} else {
+			forcesTorques->forces_stamp.contentHash();
 		}
+		reload_count++;
 	}
 
+	if (!cam_operator->camera_stamp.isModified()) {
+		cam_operator->camera_stamp.refresh();
+	} else {
+		// the camera positions and list entries get recreated
+		selected_cam = NULL;
+		if (!cam_operator->loadFromFile (cam_operator->camera_filename.c_str(), false)) {
+			cerr << "Error loading camera " << cam_operator->camera_filename << endl;
+		} else {
+			cam_operator->camera_stamp.contentHash();
+		}
+		camera_changed();
+		reload_count++;
+	}
+
+	cout << "Reloaded " << reload_count << " modified file(s)." << endl;
+
+	updateWatchedFiles();
+
  	initialize_curves(); 
 
 	emit (animation_loaded());
+	requestRedraw();
 	
 	return;
 }
 
+void MeshupApp::toggle_auto_reload (bool status) {
+	if (status) {
+		updateWatchedFiles();
+		return;
+	}
+
+	fileReloadTimer->stop();
+	fileChangesPending = false;
+	loadedFileStatus.clear();
+
+	QStringList watched_paths = fileWatcher->files() + fileWatcher->directories();
+	if (watched_paths.size() > 0)
+		fileWatcher->removePaths (watched_paths);
+}
+
+void MeshupApp::watched_file_changed (const QString &path) {
+	// restarting the timer coalesces bursts of change notifications
+	fileReloadTimer->start (fileSettleTime);
+}
+
+void MeshupApp::reload_settled_files () {
+	std::map<std::string, std::pair<int64_t, uint64_t> > file_status;
+
+	std::vector<std::string> loaded_files = getLoadedFiles();
+	for (unsigned int i = 0; i < loaded_files.size(); i++) {
+		std::pair<int64_t, uint64_t> status (0, 0);
+		if (get_file_status (loaded_files[i], status.first, status.second))
+			file_status[loaded_files[i]] = status;
+	}
+
+	// files that are still being written (or were just removed to be
+	// replaced) are checked again after another settle period
+	if (file_status != loadedFileStatus) {
+		loadedFileStatus = file_status;
+		fileChangesPending = true;
+		fileReloadTimer->start (fileSettleTime);
+		return;
+	}
+
+	// changes of other files in the watched directories
+	if (!fileChangesPending)
+		return;
+
+	fileChangesPending = false;
+	action_reload_files();
+}
+
 void MeshupApp::action_quit () {
 	saveSettings();
 	qApp->quit();
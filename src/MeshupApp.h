@@ -14,6 +14,9 @@
 #include <QTimer>
 #include <QTimeLine>
 #include <QSocketNotifier>
+#include <QFileSystemWatcher>
+#include <map>
+#include <stdint.h>
 #include "ui_MainWindow.h"
 #include "CameraOperator.h"
 #include "RenderImageDialog.h"
@@ -47,6 +50,19 @@ public:
 		std::vector<std::string> animation_files_queue;
 		std::vector<std::string> force_files_queue;
 
+		/// load meshes only once they are visible (--lazy-meshes)
+		bool lazyMeshLoading;
+		/// optimize the vertex order of meshes when loading (--optimize-meshes)
+		bool optimizeMeshes;
+		/// draw simplified versions of distant meshes (disabled by --no-mesh-lods)
+		bool meshLods;
+		/// only keep mesh data on the GPU (--release-mesh-data)
+		bool releaseMeshData;
+		/// draw the segments of a frame together (disabled by --no-segment-batching)
+		bool batchSegments;
+		/// use and write .meshbin files next to the meshes (disabled by --no-mesh-cache)
+		bool meshCacheFiles;
+
 		void parseArguments (int argc, char* argv[]);
 		void loadModel (const char *filename);
 		void loadAnimation (const char *filename);
@@ -54,12 +70,19 @@ public:
 		void loadForcesAndTorques (const char *filename);
 		void loadCamera(const char *filename);
 
+		/// Returns the names of all files that are currently loaded
+		std::vector<std::string> getLoadedFiles ();
+		/// Adds all loaded files (and their directories) to the file watcher
+		void updateWatchedFiles ();
+
 		// unix signal handler
 		static void SIGUSR1Handler(int unused);
 		
 protected:
 		unsigned int AnimationFrameCount;
 		QTime updateTime;
+		/// draws the scene once after a change was requested (see
+		/// requestRedraw())
 		QTimer *sceneRefreshTimer;
 		QTimeLine *timeLine;
 		QLabel *versionLabel;
@@ -71,6 +94,16 @@ protected:
 		RenderImageSeriesDialog* renderImageSeriesDialog;
 		RenderVideoDialog* renderVideoDialog;
 
+		QFileSystemWatcher *fileWatcher;
+		/// restarted on every change so that bursts of writes are coalesced
+		QTimer *fileReloadTimer;
+		/// time in milliseconds that files must be unchanged before reloading
+		int fileSettleTime;
+		/// modification time and size of the loaded files when the last change
+		/// was noticed
+		std::map<std::string, std::pair<int64_t, uint64_t> > loadedFileStatus;
+		bool fileChangesPending;
+
 public slots:
 		virtual void closeEvent(QCloseEvent *event);
 		virtual void focusChanged (QFocusEvent *event);
@@ -80,6 +113,9 @@ public slots:
 
 		void opengl_initialized();
 		void drawScene ();
+		/// Schedules drawing the scene, all requests within glRefreshTime
+		/// milliseconds are drawn together
+		void requestRedraw ();
 
 		void saveSettings ();
 		void loadSettings ();
@@ -102,6 +138,9 @@ public slots:
 		void action_load_camera();
 
 		void action_reload_files ();
+		void toggle_auto_reload (bool status);
+		void watched_file_changed (const QString &path);
+		void reload_settled_files ();
 		void action_quit();
 
 		void animation_loaded();
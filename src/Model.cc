@@ -10,6 +10,8 @@
 #include "GL/glew.h"
 
 #include "Model.h"
+#include "GLStateCache.h"
+#include "FrameProfiler.h"
 
 #include "SimpleMath/SimpleMathGL.h"
 #include "string_utils.h"
@@ -21,8 +23,10 @@
 #include <iomanip>
 #include <fstream>
 #include <ostream>
+#include <sstream>
 #include <stack>
 #include <limits>
+#include <algorithm>
 
 #include <boost/filesystem.hpp>
 
@@ -36,6 +40,8 @@ extern "C"
 
 #include "Curve.h"
 #include "Animation.h"
+#include "MeshLoader.h"
+#include "PointRenderer.h"
 
 using namespace std;
 using namespace SimpleMath::GL;
@@ -225,7 +231,8 @@ void MeshupModel::addSegment (
 		const Vector3f &translate,
 		const Quaternion &rotate,
 		const Vector3f &scale,
-		const Vector3f &mesh_center) {
+		const Vector3f &mesh_center,
+		const Matrix44f &mesh_transform) {
 	Segment segment;
 
 	// cout << "addSegment( " << frame_name << "," << endl
@@ -257,6 +264,7 @@ void MeshupModel::addSegment (
 	}
 
 	segment.mesh = mesh;
+	segment.mesh_transform = mesh_transform;
 	segment.meshcenter = configuration.axes_rotation.transpose() * mesh_center;
 	segment.frame = findFrame ((frame_name).c_str());
 	assert (segment.frame != NULL);
@@ -326,237 +334,733 @@ void MeshupModel::updateFrames() {
 	}
 }
 
+void transform_bounding_box (const Vector3f &bbox_min, const Vector3f &bbox_max, const Matrix44f &transform, Vector3f &result_min, Vector3f &result_max) {
+	result_min = Vector3f (
+			std::numeric_limits<float>::max(),
+			std::numeric_limits<float>::max(),
+			std::numeric_limits<float>::max());
+	result_max = -result_min;
+
+	for (unsigned int ci = 0; ci < 8; ci++) {
+		Vector3f corner (
+				(ci & 1) ? bbox_max[0] : bbox_min[0],
+				(ci & 2) ? bbox_max[1] : bbox_min[1],
+				(ci & 4) ? bbox_max[2] : bbox_min[2]);
+
+		for (unsigned int j = 0; j < 3; j++) {
+			float value = corner[0] * transform(0,j)
+				+ corner[1] * transform(1,j)
+				+ corner[2] * transform(2,j)
+				+ transform(3,j);
+
+			result_min[j] = std::min (result_min[j], value);
+			result_max[j] = std::max (result_max[j], value);
+		}
+	}
+}
+
+/** Transformation of the segment mesh into the frame of the segment. */
+static Matrix44f segment_local_transform (const Segment &segment) {
+	// bounding box of the mesh after applying the mesh transformation
+	Vector3f bbox_min, bbox_max;
+	transform_bounding_box (segment.mesh->bbox_min, segment.mesh->bbox_max, segment.mesh_transform, bbox_min, bbox_max);
+	Vector3f bbox_size (bbox_max - bbox_min);
+
+	Vector3f scale(1.0f,1.0f,1.0f) ;
+
+	//only scale, if the dimensions are valid, i.e. are set in json-File
+	if (segment.dimensions.squaredNorm() > 1.0e-4) {
+		scale = Vector3f(
+				fabs(segment.dimensions[0]) / bbox_size[0],
+				fabs(segment.dimensions[1]) / bbox_size[1],
+				fabs(segment.dimensions[2]) / bbox_size[2]
+				);
+	} else if (segment.scale[0] > 0.f) {
+		scale=segment.scale;
+	}
+	
+	Vector3f translate(0.0f,0.0f,0.0f);
+	//only translate with meshcenter if it is defined in json file
+	if (!isnan(segment.meshcenter[0])) {
+			Vector3f center ( bbox_min + bbox_size * 0.5f);
+			translate[0] = -center[0] * scale[0] + segment.meshcenter[0];
+			translate[1] = -center[1] * scale[1] + segment.meshcenter[1];
+			translate[2] = -center[2] * scale[2] + segment.meshcenter[2];
+	}
+	translate+=segment.translate;
+	
+	// we also have to apply the scaling after the transform:
+	return segment.mesh_transform
+		* SimpleMath::GL::ScaleMat44 (scale[0], scale[1], scale[2])
+		* segment.rotate.toGLMatrix()
+		* SimpleMath::GL::TranslateMat44 (translate[0], translate[1], translate[2]);
+}
+
 void MeshupModel::updateSegments() {
 	MeshupModel::SegmentList::iterator seg_iter = segments.begin();
 
 	while (seg_iter != segments.end()) {
-		Vector3f bbox_size (seg_iter->mesh->bbox_max - seg_iter->mesh->bbox_min);
-
-		Vector3f scale(1.0f,1.0f,1.0f) ;
-
-		//only scale, if the dimensions are valid, i.e. are set in json-File
-		if (seg_iter->dimensions.squaredNorm() > 1.0e-4) {
-			scale = Vector3f(
-					fabs(seg_iter->dimensions[0]) / bbox_size[0],
-					fabs(seg_iter->dimensions[1]) / bbox_size[1],
-					fabs(seg_iter->dimensions[2]) / bbox_size[2]
-					);
-		} else if (seg_iter->scale[0] > 0.f) {
-			scale=seg_iter->scale;
-		}
-		
-		Vector3f translate(0.0f,0.0f,0.0f);
-		//only translate with meshcenter if it is defined in json file
-		if (!isnan(seg_iter->meshcenter[0])) {
-				Vector3f center ( seg_iter->mesh->bbox_min + bbox_size * 0.5f);
-				translate[0] = -center[0] * scale[0] + seg_iter->meshcenter[0];
-				translate[1] = -center[1] * scale[1] + seg_iter->meshcenter[1];
-				translate[2] = -center[2] * scale[2] + seg_iter->meshcenter[2];
-		}
-		translate+=seg_iter->translate;
-		
-		// we also have to apply the scaling after the transform:
-		seg_iter->gl_matrix = 
-			SimpleMath::GL::ScaleMat44 (scale[0], scale[1], scale[2])
-			* seg_iter->rotate.toGLMatrix()
-			* SimpleMath::GL::TranslateMat44 (translate[0], translate[1], translate[2])
-			* seg_iter->frame->pose_transform;
+		seg_iter->gl_matrix = segment_local_transform (*seg_iter) * seg_iter->frame->pose_transform;
 
 		seg_iter++;
 	}
 }
 
-void MeshupModel::initDefaultFrameTransform() {
-	Matrix44f base_transform (Matrix44f::Identity());
+bool MeshupModel::getBoundingBox (Vector3f &bbox_min, Vector3f &bbox_max) {
+	bbox_min = Vector3f (
+			std::numeric_limits<float>::max(),
+			std::numeric_limits<float>::max(),
+			std::numeric_limits<float>::max());
+	bbox_max = -bbox_min;
 
-	for (unsigned int bi = 0; bi < frames.size(); bi++) {
-		frames[bi]->initDefaultFrameTransform (base_transform, configuration);
+	bool found = false;
+
+	for (SegmentList::iterator seg_iter = segments.begin(); seg_iter != segments.end(); seg_iter++) {
+		const MeshVBO *mesh = seg_iter->mesh;
+		if (mesh->bbox_min[0] > mesh->bbox_max[0])
+			continue;
+
+		Vector3f segment_min, segment_max;
+		transform_bounding_box (mesh->bbox_min, mesh->bbox_max, seg_iter->gl_matrix, segment_min, segment_max);
+
+		for (unsigned int j = 0; j < 3; j++) {
+			bbox_min[j] = std::min (bbox_min[j], segment_min[j]);
+			bbox_max[j] = std::max (bbox_max[j], segment_max[j]);
+		}
+		found = true;
 	}
 
-	frames_initialized = true;
+	return found;
 }
 
-void MeshupModel::draw() {
-	// save current state of GL_NORMALIZE to properly restore the original
-	// state
-	bool normalize_enabled = glIsEnabled (GL_NORMALIZE);
-	if (!normalize_enabled)
-		glEnable (GL_NORMALIZE);
+// meshes with more vertices are not batched as they are drawn efficiently
+// on their own and copying them would only cost memory
+const size_t batch_max_vertex_count = 65536;
 
-	SegmentList::iterator seg_iter = segments.begin();
-
-	while (seg_iter != segments.end()) {
-		glPushMatrix();
+void MeshupModel::clearSegmentBatches() {
+	for (size_t i = 0; i < segment_batches.size(); i++)
+		delete segment_batches[i].mesh;
+	segment_batches.clear();
 
-		glMultMatrixf (seg_iter->gl_matrix.data());
+	for (SegmentList::iterator seg_iter = segments.begin(); seg_iter != segments.end(); seg_iter++)
+		seg_iter->batched = false;
 
-		// drawing
-		glColor3f (seg_iter->color[0], seg_iter->color[1], seg_iter->color[2]);
+	// the draw lists refer to the batches
+	segment_draws.clear();
+	render_queue.clear();
 
-		seg_iter->mesh->draw(GL_TRIANGLES);
+	// the segments may have changed
+	clearCullingHierarchy();
+}
 
-		glPopMatrix();
+void MeshupModel::clearPrimitiveMeshes() {
+	for (MeshMap::iterator iter = primitive_meshes.begin(); iter != primitive_meshes.end(); iter++)
+		delete iter->second;
+	primitive_meshes.clear();
+}
 
-		seg_iter++;
+void MeshupModel::copyPrimitiveMeshes (const MeshupModel &other) {
+	std::map<MeshPtr, MeshPtr> copies;
+	for (MeshMap::const_iterator iter = other.primitive_meshes.begin(); iter != other.primitive_meshes.end(); iter++) {
+		MeshPtr copy = new MeshVBO (*(iter->second));
+		primitive_meshes[iter->first] = copy;
+		copies[iter->second] = copy;
 	}
 
-	// disable normalize if it was previously not enabled
-	if (!normalize_enabled)
-		glDisable (GL_NORMALIZE);
+	for (SegmentList::iterator seg_iter = segments.begin(); seg_iter != segments.end(); seg_iter++) {
+		std::map<MeshPtr, MeshPtr>::iterator copy_iter = copies.find (seg_iter->mesh);
+		if (copy_iter != copies.end())
+			seg_iter->mesh = copy_iter->second;
+	}
 }
 
-void MeshupModel::drawFrameAxes() {
-	// backup the depth test and line width values
-	bool depth_test_enabled = glIsEnabled (GL_DEPTH_TEST);
-	if (depth_test_enabled)
-		glDisable (GL_DEPTH_TEST);
+void MeshupModel::updateSegmentBatches() {
+	clearSegmentBatches();
 
-	bool light_enabled = glIsEnabled (GL_LIGHTING);
-	if (light_enabled)
-		glDisable (GL_LIGHTING);
+	if (!batch_segments)
+		return;
 
-	float line_width;
-	glGetFloatv (GL_LINE_WIDTH, &line_width);
+	// only meshes with the same attributes and shading can be merged
+	typedef std::pair<FramePtr, int> BatchKey;
+	std::map<BatchKey, std::vector<Segment*> > frame_segments;
 
-	glLineWidth (2.f);
+	for (SegmentList::iterator seg_iter = segments.begin(); seg_iter != segments.end(); seg_iter++) {
+		const MeshVBO* mesh = seg_iter->mesh;
 
-	// for the rotation of the axes
-	Matrix44f axes_rotation_matrix (Matrix44f::Identity());
-	axes_rotation_matrix.block<3,3> (0,0) = configuration.axes_rotation;
+		// meshes that are still loading or that have levels of detail are
+		// drawn on their own
+		if (mesh->bounds_only || mesh->lods.size() != 0)
+			continue;
 
-	FrameMap::iterator frame_iter = framemap.begin();
+		size_t vertex_count = mesh->cpu_data_released ? mesh->vertex_count : mesh->vertices.size();
+		if (vertex_count == 0 || vertex_count > batch_max_vertex_count)
+			continue;
 
-	while (frame_iter != framemap.end()) {
-		if (frame_iter->second->name == "ROOT") {
-			frame_iter++;
+		bool has_normals = mesh->cpu_data_released ? mesh->has_normals : mesh->normals.size() != 0;
+		int attributes = (has_normals ? 1 : 0) | (mesh->smooth_shading ? 2 : 0);
+
+		frame_segments[BatchKey (seg_iter->frame, attributes)].push_back (&*seg_iter);
+	}
+
+	// released meshes (e.g. from mesh cache files) are only loaded once for
+	// all segments that use them
+	std::map<const MeshVBO*, MeshVBO> restored_meshes;
+
+	std::map<BatchKey, std::vector<Segment*> >::iterator batch_iter;
+	for (batch_iter = frame_segments.begin(); batch_iter != frame_segments.end(); batch_iter++) {
+		const std::vector<Segment*> &members = batch_iter->second;
+		if (members.size() < 2)
 			continue;
+
+		size_t vertex_count = 0;
+		size_t index_count = 0;
+		for (size_t i = 0; i < members.size(); i++) {
+			const MeshVBO* mesh = members[i]->mesh;
+			vertex_count += mesh->cpu_data_released ? mesh->vertex_count : mesh->vertices.size();
+			index_count += mesh->drawCount();
 		}
-		glPushMatrix();
 
-		Matrix44f transform_matrix = axes_rotation_matrix * frame_iter->second->pose_transform;
-		glMultMatrixf (transform_matrix.data());
+		SegmentBatch batch;
+		batch.frame = batch_iter->first.first;
+		batch.segment_count = members.size();
+		batch.mesh = new MeshVBO;
+		batch.mesh->smooth_shading = (batch_iter->first.second & 2) != 0;
+		batch.mesh->reserve (vertex_count, index_count, (batch_iter->first.second & 1) != 0, true);
+
+		// the segment color is used for meshes without own colors as it
+		// cannot be set per draw call anymore
+		for (size_t i = 0; i < members.size(); i++) {
+			Segment* segment = members[i];
+			const MeshVBO* mesh = segment->mesh;
+
+			if (mesh->cpu_data_released) {
+				std::map<const MeshVBO*, MeshVBO>::iterator restored = restored_meshes.find (mesh);
+				if (restored == restored_meshes.end()) {
+					restored = restored_meshes.insert (std::make_pair (mesh, MeshVBO())).first;
+					mesh->copyCpuData (restored->second);
+				}
 
-		glBegin (GL_LINES);
-		glColor3f (1.f, 0.f, 0.f);
-		glVertex3f (0.f, 0.f, 0.f);
-		glVertex3f (0.1f, 0.f, 0.f);
-		glColor3f (0.f, 1.f, 0.f);
-		glVertex3f (0.f, 0.f, 0.f);
-		glVertex3f (0.f, 0.1f, 0.f);
-		glColor3f (0.f, 0.f, 1.f);
-		glVertex3f (0.f, 0.f, 0.f);
-		glVertex3f (0.f, 0.f, 0.1f);
-		glEnd();
+				// the segment gets drawn on its own if its data is gone
+				if (restored->second.vertices.size() == 0)
+					continue;
 
-		glPopMatrix();
+				mesh = &restored->second;
+			}
 
-		frame_iter++;
+			Vector4f color (segment->color[0], segment->color[1], segment->color[2], 1.f);
+			batch.mesh->join (segment_local_transform (*segment), *mesh, color);
+			segment->batched = true;
+		}
+
+		segment_batches.push_back (batch);
 	}
+}
+
+/** Adds the nodes of the frame and its descendants in depth first order. */
+static void add_culling_nodes (const FramePtr &frame, size_t parent, vector<CullingNode> &nodes) {
+	size_t index = nodes.size();
 
-	if (depth_test_enabled)
-		glEnable (GL_DEPTH_TEST);
+	CullingNode node;
+	node.frame = frame;
+	node.parent = parent;
+	nodes.push_back (node);
 
-	if (light_enabled)
-		glEnable (GL_LIGHTING);
+	for (size_t i = 0; i < frame->children.size(); i++)
+		add_culling_nodes (frame->children[i], index, nodes);
 
-	glLineWidth (line_width);
+	nodes[index].subtree_end = nodes.size();
 }
 
-void MeshupModel::drawBaseFrameAxes() {
-	// backup the depth test and line width values
-	bool depth_test_enabled = glIsEnabled (GL_DEPTH_TEST);
-	if (depth_test_enabled)
-		glDisable (GL_DEPTH_TEST);
+/** Returns the index of the culling node of the frame. */
+static size_t find_culling_node (const vector<pair<FramePtr, size_t> > &frame_nodes, const FramePtr &frame) {
+	vector<pair<FramePtr, size_t> >::const_iterator iter = std::lower_bound (frame_nodes.begin(), frame_nodes.end(), make_pair (frame, (size_t) 0));
 
-	bool light_enabled = glIsEnabled (GL_LIGHTING);
-	if (light_enabled)
-		glDisable (GL_LIGHTING);
+	if (iter == frame_nodes.end() || iter->first != frame) {
+		cerr << "Error: frame '" << frame->name << "' is not part of the frame tree!" << endl;
+		abort();
+	}
+
+	return iter->second;
+}
 
-	float line_width;
-	glGetFloatv (GL_LINE_WIDTH, &line_width);
+void MeshupModel::clearCullingHierarchy() {
+	culling_nodes.clear();
+	culling_segments.clear();
+	culling_frame_nodes.clear();
+	culling_frame_index = 0;
+}
 
-	glLineWidth (2.f);
+void MeshupModel::updateCullingHierarchy() {
+	if (culling_nodes.size() != framemap.size() || culling_segments.size() != segments.size()) {
+		clearCullingHierarchy();
 
-	// for the rotation of the axes
-	Matrix44f axes_rotation_matrix (Matrix44f::Identity());
-	axes_rotation_matrix.block<3,3> (0,0) = configuration.axes_rotation;
+		for (size_t i = 0; i < frames.size(); i++)
+			add_culling_nodes (frames[i], std::numeric_limits<size_t>::max(), culling_nodes);
+
+		for (size_t i = 0; i < culling_nodes.size(); i++)
+			culling_frame_nodes.push_back (make_pair (culling_nodes[i].frame, i));
+		std::sort (culling_frame_nodes.begin(), culling_frame_nodes.end());
 
-	glPushMatrix();
+		// sort the segments by their node, i.e. in depth first order
+		vector<size_t> segment_nodes;
+		for (SegmentList::iterator seg_iter = segments.begin(); seg_iter != segments.end(); seg_iter++) {
+			size_t node_index = find_culling_node (culling_frame_nodes, seg_iter->frame);
+			culling_nodes[node_index].segment_count++;
+			segment_nodes.push_back (node_index);
+		}
 
-	Matrix44f transform_matrix = axes_rotation_matrix * framemap["ROOT"]->pose_transform;
-	glMultMatrixf (transform_matrix.data());
+		size_t segment_count = 0;
+		for (size_t i = 0; i < culling_nodes.size(); i++) {
+			culling_nodes[i].first_segment = segment_count;
+			segment_count += culling_nodes[i].segment_count;
+		}
 
-	glBegin (GL_LINES);
-	glColor3f (1.f, 0.f, 0.f);
-	glVertex3f (0.f, 0.f, 0.f);
-	glVertex3f (1.f, 0.f, 0.f);
-	glColor3f (0.f, 1.f, 0.f);
-	glVertex3f (0.f, 0.f, 0.f);
-	glVertex3f (0.f, 1.f, 0.f);
-	glColor3f (0.f, 0.f, 1.f);
-	glVertex3f (0.f, 0.f, 0.f);
-	glVertex3f (0.f, 0.f, 1.f);
-	glEnd();
+		vector<size_t> node_fill (culling_nodes.size(), 0);
+		culling_segments.resize (segments.size(), NULL);
 
-	glPopMatrix();
+		size_t si = 0;
+		for (SegmentList::iterator seg_iter = segments.begin(); seg_iter != segments.end(); seg_iter++, si++) {
+			CullingNode &node = culling_nodes[segment_nodes[si]];
+			culling_segments[node.first_segment + node_fill[segment_nodes[si]]++] = &*seg_iter;
+		}
+
+		for (size_t i = 0; i < culling_nodes.size(); i++) {
+			const CullingNode &last = culling_nodes[culling_nodes[i].subtree_end - 1];
+			culling_nodes[i].subtree_segment_end = last.first_segment + last.segment_count;
+		}
+	}
+
+	for (size_t i = 0; i < culling_nodes.size(); i++)
+		culling_nodes[i].has_bounds = false;
+
+	// the descendants follow their parent, so the boxes of the children
+	// are complete once the parent is reached
+	for (size_t ni = culling_nodes.size(); ni > 0; ni--) {
+		CullingNode &node = culling_nodes[ni - 1];
+
+		for (size_t i = node.first_segment; i < node.first_segment + node.segment_count; i++) {
+			Segment *segment = culling_segments[i];
+			const MeshVBO *mesh = segment->mesh;
+
+			// meshes without vertices are never culled
+			if (mesh->bbox_min[0] > mesh->bbox_max[0]) {
+				segment->bbox_min = mesh->bbox_min;
+				segment->bbox_max = mesh->bbox_max;
+				continue;
+			}
+
+			transform_bounding_box (mesh->bbox_min, mesh->bbox_max, segment->gl_matrix, segment->bbox_min, segment->bbox_max);
+
+			if (!node.has_bounds) {
+				node.bbox_min = segment->bbox_min;
+				node.bbox_max = segment->bbox_max;
+				node.has_bounds = true;
+				continue;
+			}
+
+			for (unsigned int j = 0; j < 3; j++) {
+				node.bbox_min[j] = std::min (node.bbox_min[j], segment->bbox_min[j]);
+				node.bbox_max[j] = std::max (node.bbox_max[j], segment->bbox_max[j]);
+			}
+		}
 
-	if (depth_test_enabled)
-		glEnable (GL_DEPTH_TEST);
+		if (!node.has_bounds || node.parent == std::numeric_limits<size_t>::max())
+			continue;
 
-	if (light_enabled)
-		glEnable (GL_LIGHTING);
+		CullingNode &parent = culling_nodes[node.parent];
+		if (!parent.has_bounds) {
+			parent.bbox_min = node.bbox_min;
+			parent.bbox_max = node.bbox_max;
+			parent.has_bounds = true;
+			continue;
+		}
 
-	glLineWidth (line_width);
+		for (unsigned int j = 0; j < 3; j++) {
+			parent.bbox_min[j] = std::min (parent.bbox_min[j], node.bbox_min[j]);
+			parent.bbox_max[j] = std::max (parent.bbox_max[j], node.bbox_max[j]);
+		}
+	}
 }
 
-void MeshupModel::drawCurves() {
-	CurveMap::iterator curve_iter = curvemap.begin();
-	while (curve_iter != curvemap.end()) {
-		curve_iter->second->draw();
-		curve_iter++;
+void MeshupModel::cullSegments (const Matrix44f &modelview_projection) {
+	culling_stats = CullingStats();
+
+	size_t ni = 0;
+	while (ni < culling_nodes.size()) {
+		const CullingNode &node = culling_nodes[ni];
+
+		FrustumTestResult result = FrustumInside;
+		if (node.has_bounds) {
+			culling_stats.node_tests++;
+			result = test_box_in_frustum (node.bbox_min, node.bbox_max, modelview_projection);
+		}
+
+		// the whole subtree is either visible or not
+		if (result != FrustumIntersecting) {
+			bool visible = result == FrustumInside;
+			for (size_t i = node.first_segment; i < node.subtree_segment_end; i++)
+				culling_segments[i]->visible = visible;
+
+			if (visible)
+				culling_stats.visible_segments += node.subtree_segment_end - node.first_segment;
+			else
+				culling_stats.culled_segments += node.subtree_segment_end - node.first_segment;
+
+			ni = node.subtree_end;
+			continue;
+		}
+
+		for (size_t i = node.first_segment; i < node.first_segment + node.segment_count; i++) {
+			Segment *segment = culling_segments[i];
+
+			segment->visible = true;
+			if (segment->bbox_min[0] <= segment->bbox_max[0]) {
+				culling_stats.segment_tests++;
+				segment->visible = test_box_in_frustum (segment->bbox_min, segment->bbox_max, modelview_projection) != FrustumOutside;
+			}
+
+			if (segment->visible)
+				culling_stats.visible_segments++;
+			else
+				culling_stats.culled_segments++;
+		}
+
+		ni++;
+	}
+
+	// a batch is drawn if any of its segments is visible
+	for (size_t bi = 0; bi < segment_batches.size(); bi++) {
+		SegmentBatch &batch = segment_batches[bi];
+		const CullingNode &node = culling_nodes[find_culling_node (culling_frame_nodes, batch.frame)];
+
+		batch.visible = false;
+		for (size_t i = node.first_segment; i < node.first_segment + node.segment_count; i++) {
+			if (culling_segments[i]->batched && culling_segments[i]->visible) {
+				batch.visible = true;
+				break;
+			}
+		}
 	}
 }
 
-void MeshupModel::drawPoints() {
+void MeshupModel::updateSegmentDraws() {
+	segment_draws.draws.clear();
+
+	for (SegmentList::iterator seg_iter = segments.begin(); seg_iter != segments.end(); seg_iter++) {
+		if (seg_iter->batched || seg_iter->mesh->bounds_only)
+			continue;
+
+		SegmentDraw draw;
+		draw.mesh = seg_iter->mesh;
+		draw.segment = &*seg_iter;
+		draw.transform = seg_iter->gl_matrix;
+		draw.color.set (seg_iter->color[0], seg_iter->color[1], seg_iter->color[2], 1.f);
+		draw.lod_level = seg_iter->lod_level;
+		segment_draws.draws.push_back (draw);
+	}
+
+	for (size_t i = 0; i < segment_batches.size(); i++) {
+		SegmentDraw draw;
+		draw.mesh = segment_batches[i].mesh;
+		draw.batch = &segment_batches[i];
+		draw.transform = segment_batches[i].frame->pose_transform;
+		segment_draws.draws.push_back (draw);
+	}
+}
+
+void MeshupModel::initDefaultFrameTransform() {
+	Matrix44f base_transform (Matrix44f::Identity());
+
+	for (unsigned int bi = 0; bi < frames.size(); bi++) {
+		frames[bi]->initDefaultFrameTransform (base_transform, configuration);
+	}
+
+	frames_initialized = true;
+}
+
+FrustumTestResult test_box_in_frustum (const Vector3f &bbox_min, const Vector3f &bbox_max, const Matrix44f &transform) {
+	// for every clipping plane count the corners outside of it
+	unsigned int outside[6] = { 0, 0, 0, 0, 0, 0 };
+	bool all_inside = true;
+
+	for (unsigned int ci = 0; ci < 8; ci++) {
+		Vector4f corner (
+				(ci & 1) ? bbox_max[0] : bbox_min[0],
+				(ci & 2) ? bbox_max[1] : bbox_min[1],
+				(ci & 4) ? bbox_max[2] : bbox_min[2],
+				1.f);
+		Vector4f clip = (corner.transpose() * transform).transpose();
+
+		for (unsigned int j = 0; j < 3; j++) {
+			if (clip[j] < -clip[3]) {
+				outside[2 * j]++;
+				all_inside = false;
+			}
+			if (clip[j] > clip[3]) {
+				outside[2 * j + 1]++;
+				all_inside = false;
+			}
+		}
+	}
+
+	for (unsigned int i = 0; i < 6; i++) {
+		if (outside[i] == 8)
+			return FrustumOutside;
+	}
+
+	if (all_inside)
+		return FrustumInside;
+
+	return FrustumIntersecting;
+}
+
+// a level of detail is used if its error on the screen is below this size
+// (in pixels)
+const float lod_max_pixel_error = 1.f;
+// switching to a coarser level requires the error to be clearly below the
+// limit to avoid switching back and forth
+const float lod_hysteresis = 0.7f;
+
+/** Chooses the level of detail of the segment mesh from the size of its
+ * bounding box on the screen. */
+void update_lod_level (Segment &segment, const Matrix44f &modelview_projection, const GLint viewport[4]) {
+	const MeshVBO* mesh = segment.mesh;
+	unsigned int level_count = mesh->lods.size();
+
+	if (level_count == 0) {
+		segment.lod_level = 0;
+		return;
+	}
+
+	Matrix44f transform = segment.gl_matrix * modelview_projection;
+	Vector3f screen_min (std::numeric_limits<float>::max(), std::numeric_limits<float>::max(), 0.f);
+	Vector3f screen_max (-std::numeric_limits<float>::max(), -std::numeric_limits<float>::max(), 0.f);
+
+	for (unsigned int ci = 0; ci < 8; ci++) {
+		Vector4f corner (
+				(ci & 1) ? mesh->bbox_max[0] : mesh->bbox_min[0],
+				(ci & 2) ? mesh->bbox_max[1] : mesh->bbox_min[1],
+				(ci & 4) ? mesh->bbox_max[2] : mesh->bbox_min[2],
+				1.f);
+		Vector4f clip = (corner.transpose() * transform).transpose();
+
+		// the camera is within or close to the box
+		if (clip[3] <= 0.f) {
+			segment.lod_level = 0;
+			return;
+		}
+
+		for (unsigned int j = 0; j < 2; j++) {
+			float screen = (clip[j] / clip[3] * 0.5f + 0.5f) * viewport[j + 2];
+			screen_min[j] = std::min (screen_min[j], screen);
+			screen_max[j] = std::max (screen_max[j], screen);
+		}
+	}
+
+	float diagonal = (mesh->bbox_max - mesh->bbox_min).norm();
+	if (diagonal <= 0.f) {
+		segment.lod_level = 0;
+		return;
+	}
+
+	float projected_size = std::max (screen_max[0] - screen_min[0], screen_max[1] - screen_min[1]);
+	float pixels_per_unit = projected_size / diagonal;
+
+	unsigned int level = std::min (segment.lod_level, level_count);
+	while (level > 0 && mesh->lods[level - 1].error * pixels_per_unit > lod_max_pixel_error)
+		level--;
+	while (level < level_count && mesh->lods[level].error * pixels_per_unit < lod_max_pixel_error * lod_hysteresis)
+		level++;
+
+	segment.lod_level = level;
+}
+
+void MeshupModel::draw() {
+	GLStateCache &state = get_gl_state_cache();
+
 	// save current state of GL_NORMALIZE to properly restore the original
 	// state
-	bool normalize_enabled = glIsEnabled (GL_NORMALIZE);
+	bool normalize_enabled = state.isEnabled (GL_NORMALIZE);
 	if (!normalize_enabled)
-		glEnable (GL_NORMALIZE);
+		state.enable (GL_NORMALIZE);
+
+	// needed to cull the segments and to choose the levels of detail
+	Matrix44f modelview, projection;
+	glGetFloatv (GL_MODELVIEW_MATRIX, modelview.data());
+	glGetFloatv (GL_PROJECTION_MATRIX, projection.data());
+	Matrix44f modelview_projection = modelview * projection;
+
+	GLint viewport[4];
+	glGetIntegerv (GL_VIEWPORT, viewport);
+
+	// the transformations of the segments only get uploaded for the first
+	// pass of a frame
+	SegmentRenderer &renderer = get_segment_renderer();
+	bool use_shaders = renderer.isActive();
+	if (use_shaders && segment_draws.frame_index != renderer.frame_index) {
+		get_frame_profiler().beginCpu (ProfileSegmentUpdate);
+		updateSegmentDraws();
+		get_frame_profiler().endCpu();
+
+		renderer.upload (segment_draws);
+	}
 
-	MeshVBO sphere_mesh = CreateUVSphere (16, 16);
+	// the bounding boxes change with the pose, the frustum with every pass
+	if (culling_frame_index != renderer.frame_index) {
+		get_frame_profiler().beginCpu (ProfileSegmentUpdate);
+		updateCullingHierarchy();
+		get_frame_profiler().endCpu();
 
-	for (unsigned int i = 0; i < points.size(); i++) {
-		Vector3f frame_origin = points[i].frame->getPoseTransformTranslation();
-		Vector3f point_location = points[i].frame->getPoseTransformTranslation() + points[i].frame->getPoseTransformRotation() * points[i].coordinates;
+		culling_frame_index = renderer.frame_index;
+	}
+	cullSegments (modelview_projection);
 
-		glColor3fv (points[i].color.data());
+	render_queue.clear();
+
+	SegmentList::iterator seg_iter = segments.begin();
 
-		if (points[i].draw_line) {
-			float line_range[2];
-			glGetFloatv (GL_ALIASED_LINE_WIDTH_RANGE, line_range);
-			if (points[i].line_width < line_range[0] || points[i].line_width > line_range[1]) {
-				cerr << "Warning: Only line widths within range [" << line_range[0] << ", " << line_range[1] << "] are supported by the graphics driver! (Point '" << points[i].name << "' has line_width = " << points[i].line_width << endl;
+	while (seg_iter != segments.end()) {
+		if (seg_iter->batched || !seg_iter->visible) {
+			seg_iter++;
+			continue;
+		}
+
+		if (!seg_iter->mesh->bounds_only) {
+			update_lod_level (*seg_iter, modelview_projection, viewport);
+
+			// drawn sorted by their state after all segments were visited
+			if (!use_shaders) {
+				render_queue.add (seg_iter->mesh, seg_iter->gl_matrix,
+						Vector4f (seg_iter->color[0], seg_iter->color[1], seg_iter->color[2], 1.f),
+						seg_iter->lod_level);
 			}
-			glLineWidth (points[i].line_width);
-			glBegin (GL_LINES);
-			glVertex3fv (frame_origin.data());
-			glVertex3fv (point_location.data());
-			glEnd();
+
+			seg_iter++;
+			continue;
 		}
 
 		glPushMatrix();
-		glTranslatef (point_location[0], point_location[1], point_location[2]);
-		glScalef (0.025f, 0.025f, 0.025f);
-	
-		sphere_mesh.draw(GL_TRIANGLES);
+
+		glMultMatrixf (seg_iter->gl_matrix.data());
+
+		// drawing
+		glColor3f (seg_iter->color[0], seg_iter->color[1], seg_iter->color[2]);
+
+		const Vector3f &bbox_min = seg_iter->mesh->bbox_min;
+		const Vector3f &bbox_max = seg_iter->mesh->bbox_max;
+
+		// only visible segments get here. Meshes can also be shared with
+		// a model that was loaded lazily.
+		get_lazy_mesh_loader().requestLoad (seg_iter->mesh);
+
+		// draw the outline of the bounding box until the mesh is loaded
+		glPushAttrib (GL_LIGHTING_BIT);
+		glDisable (GL_LIGHTING);
+		glBegin (GL_LINES);
+		for (unsigned int ci = 0; ci < 8; ci++) {
+			Vector3f corner (
+					(ci & 1) ? bbox_max[0] : bbox_min[0],
+					(ci & 2) ? bbox_max[1] : bbox_min[1],
+					(ci & 4) ? bbox_max[2] : bbox_min[2]);
+
+			// edges to the neighboring corners
+			for (unsigned int axis = 0; axis < 3; axis++) {
+				if (ci & (1 << axis))
+					continue;
+
+				Vector3f neighbor (corner);
+				neighbor[axis] = bbox_max[axis];
+				glVertex3fv (corner.data());
+				glVertex3fv (neighbor.data());
+			}
+		}
+		glEnd();
+		glPopAttrib ();
 
 		glPopMatrix();
+
+		seg_iter++;
+	}
+
+	if (use_shaders) {
+		// the levels of detail and the visibility of this pass
+		for (size_t i = 0; i < segment_draws.draws.size(); i++) {
+			SegmentDraw &draw = segment_draws.draws[i];
+			if (draw.segment != NULL) {
+				draw.lod_level = draw.segment->lod_level;
+				draw.visible = draw.segment->visible;
+			} else if (draw.batch != NULL) {
+				draw.visible = draw.batch->visible;
+			}
+		}
+
+		renderer.draw (segment_draws);
+	} else {
+		// the batched meshes already contain the segment transformations
+		// and colors
+		for (size_t i = 0; i < segment_batches.size(); i++) {
+			if (segment_batches[i].visible)
+				render_queue.add (segment_batches[i].mesh, segment_batches[i].frame->pose_transform, Vector4f (1.f, 1.f, 1.f, 1.f));
+		}
+
+		render_queue.draw (GL_TRIANGLES);
 	}
 
 	// disable normalize if it was previously not enabled
 	if (!normalize_enabled)
-		glDisable (GL_NORMALIZE);
+		state.disable (GL_NORMALIZE);
+}
+
+/** Adds the axes of the coordinate system given by the transformation
+ * with the given length. */
+static void add_axes (LineBatch &lines, const Matrix44f &transform, float length) {
+	Vector3f origin (transform(3,0), transform(3,1), transform(3,2));
+	Vector3f colors[3] = {
+		Vector3f (1.f, 0.f, 0.f),
+		Vector3f (0.f, 1.f, 0.f),
+		Vector3f (0.f, 0.f, 1.f)
+	};
+
+	for (int i = 0; i < 3; i++) {
+		Vector3f axis (transform(i,0), transform(i,1), transform(i,2));
+		lines.addLine (origin, origin + axis * length, colors[i], 2.f);
+	}
+}
+
+void MeshupModel::addFrameAxes (LineBatch &lines, const Matrix44f &transform) {
+	// for the rotation of the axes
+	Matrix44f axes_rotation_matrix (Matrix44f::Identity());
+	axes_rotation_matrix.block<3,3> (0,0) = configuration.axes_rotation;
+
+	FrameMap::iterator frame_iter = framemap.begin();
+
+	while (frame_iter != framemap.end()) {
+		// the base frame is drawn by addBaseFrameAxes()
+		if (frame_iter->second != frames[0])
+			add_axes (lines, axes_rotation_matrix * frame_iter->second->pose_transform * transform, 0.1f);
+
+		frame_iter++;
+	}
+}
+
+void MeshupModel::addBaseFrameAxes (LineBatch &lines, const Matrix44f &transform) {
+	// for the rotation of the axes
+	Matrix44f axes_rotation_matrix (Matrix44f::Identity());
+	axes_rotation_matrix.block<3,3> (0,0) = configuration.axes_rotation;
+
+	add_axes (lines, axes_rotation_matrix * frames[0]->pose_transform * transform, 1.f);
+}
+
+void MeshupModel::drawCurves() {
+	CurveMap::iterator curve_iter = curvemap.begin();
+	while (curve_iter != curvemap.end()) {
+		curve_iter->second->draw();
+		curve_iter++;
+	}
+}
+
+void MeshupModel::drawPoints() {
+	get_point_renderer().draw (points);
 }
 
 string vec3_to_string_no_brackets (const Vector3f &vector) {
@@ -827,11 +1331,27 @@ template<> Matrix33f LuaTableNode::getDefault<Matrix33f>(const Matrix33f &defaul
 	return result;
 }
 
+static std::string primitive_mesh_key (const char* type, unsigned int rows, unsigned int segments, float ratio = 0.f) {
+	ostringstream key;
+	key << type << " " << rows << " " << segments << " " << ratio;
+	return key.str();
+}
+
+/** Creates a shared primitive mesh that is drawn using indices. */
+static MeshPtr create_primitive_mesh (const MeshVBO &mesh) {
+	MeshPtr result = new MeshVBO (mesh);
+	result->createIndices();
+	return result;
+}
+
 bool MeshupModel::loadModelFromLuaFile (const char* filename, bool strict) {
+	FileStamp stamp = FileStamp::fromFile (filename);
 	LuaTable model_table = LuaTable::fromFile (filename);
 
 	clear();
 
+	model_stamp = stamp;
+
 	configuration.axis_front = model_table["configuration"]["axis_front"].getDefault(Vector3f (1.f, 0.f, 0.f));
 	configuration.axis_up = model_table["configuration"]["axis_up"].getDefault(Vector3f (0.f, 1.f, 0.f));
 	configuration.axis_right = model_table["configuration"]["axis_right"].getDefault(Vector3f (0.f, 0.f, 1.f));
@@ -848,6 +1368,10 @@ bool MeshupModel::loadModelFromLuaFile (const char* filename, bool strict) {
 	// frames
 	int frame_count = model_table["frames"].length();
 
+	// meshes referenced by the visuals. They are collected while walking the
+	// frames and loaded all at once afterwards.
+	vector<MeshLoadRequest> mesh_requests;
+
 	// Read points
 	int contact_point_count = model_table["points"].length();
 	vector<Point> contact_points;
@@ -1048,7 +1572,8 @@ bool MeshupModel::loadModelFromLuaFile (const char* filename, bool strict) {
 			}
 
             // load the mesh or geometry
-            MeshPtr mesh (new MeshVBO);
+            MeshPtr mesh = NULL;
+            Matrix44f mesh_transform = Matrix44f::Identity();
 
             string mesh_filename = model_table["frames"][i]["visuals"][vi]["src"].getDefault<std::string>("");
             bool have_geometry = model_table["frames"][i]["visuals"][vi]["geometry"].exists();
@@ -1057,26 +1582,57 @@ bool MeshupModel::loadModelFromLuaFile (const char* filename, bool strict) {
                 cerr << "Error reading model " << model_filename << ": visual " << vi << " in frame " << i << ": attributes 'src' and 'geometry' are exclusive!" << endl;
                 abort();
             } else if (have_geometry) {
+                // geometries share a unit size mesh, the actual dimensions
+                // are applied through the mesh transformation of the segment
                 if (model_table["frames"][i]["visuals"][vi]["geometry"]["box"].exists()) {
                     Vector3f dimensions = model_table["frames"][i]["visuals"][vi]["geometry"]["box"]["dimensions"].getDefault (Vector3f (1.f, 1.f, 1.f));
-                    (*mesh) = CreateCuboid(dimensions[0], dimensions[1], dimensions[2]);
+                    MeshPtr &cached_mesh = primitive_meshes["box"];
+                    if (cached_mesh == NULL)
+                        cached_mesh = create_primitive_mesh (CreateCube());
+                    mesh = cached_mesh;
+                    mesh_transform = SimpleMath::GL::ScaleMat44(dimensions[0], dimensions[1], dimensions[2]);
                 } else if (model_table["frames"][i]["visuals"][vi]["geometry"]["sphere"].exists()) {
                     float radius = model_table["frames"][i]["visuals"][vi]["geometry"]["sphere"]["radius"].getDefault (1.f);
                     unsigned int rows = static_cast<unsigned int>(model_table["frames"][i]["visuals"][vi]["geometry"]["sphere"]["rows"].getDefault (16.));
                     unsigned int segments = static_cast<unsigned int>(model_table["frames"][i]["visuals"][vi]["geometry"]["sphere"]["segments"].getDefault (16.));
-                    mesh->join (SimpleMath::GL::ScaleMat44(radius, radius, radius), CreateUVSphere(rows, segments));
+                    MeshPtr &cached_mesh = primitive_meshes[primitive_mesh_key ("sphere", rows, segments)];
+                    if (cached_mesh == NULL)
+                        cached_mesh = create_primitive_mesh (CreateUVSphere(rows, segments));
+                    mesh = cached_mesh;
+                    mesh_transform = SimpleMath::GL::ScaleMat44(radius, radius, radius);
                 } else if (model_table["frames"][i]["visuals"][vi]["geometry"]["capsule"].exists()) {
                     float radius = model_table["frames"][i]["visuals"][vi]["geometry"]["capsule"]["radius"].getDefault (1.f);
                     float length = model_table["frames"][i]["visuals"][vi]["geometry"]["capsule"]["length"].getDefault (2.f);
                     unsigned int rows = static_cast<unsigned int>(model_table["frames"][i]["visuals"][vi]["geometry"]["capsule"]["rows"].getDefault (16.));
                     unsigned int segments = static_cast<unsigned int>(model_table["frames"][i]["visuals"][vi]["geometry"]["capsule"]["segments"].getDefault (16.));
-                    mesh->join (SimpleMath::GL::RotateMat44(90.f, 1.f, 0.f, 0.f), CreateCapsule(rows, segments, length, radius));
+                    if (radius > 0.f) {
+                        // the shape of a capsule only depends on the ratio
+                        // of length and radius
+                        MeshPtr &cached_mesh = primitive_meshes[primitive_mesh_key ("capsule", rows, segments, length / radius)];
+                        if (cached_mesh == NULL)
+                            cached_mesh = create_primitive_mesh (CreateCapsule(rows, segments, length / radius, 1.f));
+                        mesh = cached_mesh;
+                        mesh_transform = SimpleMath::GL::ScaleMat44(radius, radius, radius) * SimpleMath::GL::RotateMat44(90.f, 1.f, 0.f, 0.f);
+                    } else {
+                        // degenerate capsules can not be scaled to the radius
+                        ostringstream key;
+                        key << primitive_mesh_key ("unscaled capsule", rows, segments, length) << " " << radius;
+                        MeshPtr &cached_mesh = primitive_meshes[key.str()];
+                        if (cached_mesh == NULL)
+                            cached_mesh = create_primitive_mesh (CreateCapsule(rows, segments, length, radius));
+                        mesh = cached_mesh;
+                        mesh_transform = SimpleMath::GL::RotateMat44(90.f, 1.f, 0.f, 0.f);
+                    }
                 } else if (model_table["frames"][i]["visuals"][vi]["geometry"]["cylinder"].exists()) {
                     float radius = model_table["frames"][i]["visuals"][vi]["geometry"]["cylinder"]["radius"].getDefault (1.f);
                     float length = model_table["frames"][i]["visuals"][vi]["geometry"]["cylinder"]["length"].getDefault (2.f);
                     unsigned int rows = static_cast<unsigned int>(model_table["frames"][i]["visuals"][vi]["geometry"]["cylinder"]["rows"].getDefault (16.));
                     unsigned int segments = static_cast<unsigned int>(model_table["frames"][i]["visuals"][vi]["geometry"]["cylinder"]["segments"].getDefault (16.));
-                    mesh->join (SimpleMath::GL::ScaleMat44(radius, radius, length) * SimpleMath::GL::RotateMat44(90.f, 1.f, 0.f, 0.f) , CreateCylinder(segments));
+                    MeshPtr &cached_mesh = primitive_meshes[primitive_mesh_key ("cylinder", 0, segments)];
+                    if (cached_mesh == NULL)
+                        cached_mesh = create_primitive_mesh (CreateCylinder(segments));
+                    mesh = cached_mesh;
+                    mesh_transform = SimpleMath::GL::ScaleMat44(radius, radius, length) * SimpleMath::GL::RotateMat44(90.f, 1.f, 0.f, 0.f);
                 } else {
                     vector<LuaKey> keys = model_table["frames"][i]["visuals"][vi]["geometry"].keys();
                     if (keys.size() == 1) {
@@ -1088,27 +1644,38 @@ bool MeshupModel::loadModelFromLuaFile (const char* filename, bool strict) {
                     }
                 }
             } else if (mesh_filename != "") {
-                // check whether we have the mesh, if not try to load it
+                // check whether we have the mesh, if not queue it for loading
                 MeshMap::iterator mesh_iter = meshmap.find (mesh_filename);
                 if (mesh_iter == meshmap.end()) {
                     // check whether we want to extract a sub object within the obj file
-                    string submesh_name = "";
+                    string object_name = "";
+                    string mesh_file_location;
                     if (mesh_filename.find (':') != string::npos) {
-                        submesh_name = mesh_filename.substr (mesh_filename.find(':') + 1, mesh_filename.size());
-                        mesh_filename = mesh_filename.substr (0, mesh_filename.find(':'));
-                        string mesh_file_location = find_mesh_file_by_name (mesh_filename);
-                        cout << "Loading sub object " << submesh_name << " from file " << mesh_file_location << endl;
-                        mesh->loadOBJ(mesh_file_location.c_str(), submesh_name.c_str());
+                        object_name = mesh_filename.substr (mesh_filename.find(':') + 1, mesh_filename.size());
+                        mesh_file_location = find_mesh_file_by_name (mesh_filename.substr (0, mesh_filename.find(':')));
                     } else {
-                        string mesh_file_location = find_mesh_file_by_name (mesh_filename);
-                        cout << "Loading mesh " << mesh_file_location << endl;
-                        mesh->loadOBJ(mesh_file_location.c_str());
+                        mesh_file_location = find_mesh_file_by_name (mesh_filename);
                     }
 
-                    if (!skip_vbo_generation)
-                        mesh->generate_vbo();
-
-                    meshmap[mesh_filename] = mesh;
+                    // meshes that were loaded before (e.g. by another model or
+                    // before a reload) are reused
+                    MeshCache::iterator cache_iter = get_mesh_cache().find (mesh_cache_key (mesh_file_location, object_name));
+                    if (cache_iter != get_mesh_cache().end()) {
+                        meshmap[mesh_filename] = cache_iter->second.mesh;
+                    } else {
+                        MeshLoadRequest request;
+                        request.filename = mesh_file_location;
+                        request.object_name = object_name;
+                        request.mesh = new MeshVBO;
+                        request.mesh->optimize = optimize_meshes;
+                        request.mesh->generate_lods = generate_mesh_lods;
+                        request.mesh->release_cpu_data = release_mesh_data;
+                        if (use_mesh_cache_files)
+                            request.cache_filename = mesh_cache_filename (mesh_file_location, object_name);
+
+                        mesh_requests.push_back (request);
+                        meshmap[mesh_filename] = request.mesh;
+                    }
 
                     mesh_iter = meshmap.find (mesh_filename);
                 }
@@ -1119,10 +1686,19 @@ bool MeshupModel::loadModelFromLuaFile (const char* filename, bool strict) {
                 abort();
             }
 
-			addSegment (frame_name, mesh, dimensions, color, translate, rotate, scale, mesh_center);
+			addSegment (frame_name, mesh, dimensions, color, translate, rotate, scale, mesh_center, mesh_transform);
 		}
 	}
 
+	load_meshes_parallel (mesh_requests, lazy_mesh_loading);
+	add_to_mesh_cache (mesh_requests);
+
+	// before the upload as the meshes might get released
+	updateSegmentBatches();
+
+	if (!skip_vbo_generation)
+		upload_meshes (mesh_requests);
+
 	initDefaultFrameTransform();
 
 	model_filename = filename;
@@ -23,6 +23,10 @@
 #include "FrameConfig.h"
 #include "MeshVBO.h"
 #include "Curve.h"
+#include "FileStamp.h"
+#include "SegmentRenderer.h"
+#include "LineBatch.h"
+#include "RenderQueue.h"
 
 typedef MeshVBO* MeshPtr;
 typedef Curve* CurvePtr;
@@ -33,6 +37,24 @@ typedef Frame* FramePtr;
 /** \brief Searches in various locations for the model. */
 std::string find_model_file_by_name (const std::string &model_name);
 
+/** \brief Computes the axis aligned bounding box of a transformed bounding box. */
+void transform_bounding_box (const Vector3f &bbox_min, const Vector3f &bbox_max, const Matrix44f &transform, Vector3f &result_min, Vector3f &result_max);
+
+enum FrustumTestResult {
+	FrustumOutside = 0,
+	FrustumIntersecting,
+	FrustumInside
+};
+
+/** \brief Checks whether a box transformed by transform (including the
+ * projection) lies outside, partially inside or completely inside the
+ * view frustum.
+ *
+ * Boxes that intersect several clipping planes near a corner of the
+ * frustum may be reported as intersecting although they are outside.
+ */
+FrustumTestResult test_box_in_frustum (const Vector3f &bbox_min, const Vector3f &bbox_max, const Matrix44f &transform);
+
 struct Frame {
 	Frame() :
 		name (""),
@@ -102,8 +124,12 @@ struct Segment {
 		translate (0.f, 0.f, 0.f),
 		rotate (SimpleMath::GL::Quaternion::fromGLRotate (0.f, 1.f, 0.f, 0.f)),
 		gl_matrix (Matrix44f::Identity(4,4)),
+		mesh_transform (Matrix44f::Identity(4,4)),
 		frame (FramePtr()),
-		mesh_filename("")
+		mesh_filename(""),
+		lod_level (0),
+		batched (false),
+		visible (true)
 	{}
 
 	std::string name;
@@ -116,8 +142,101 @@ struct Segment {
 	Vector3f translate;
 	SimpleMath::GL::Quaternion rotate;
 	Matrix44f gl_matrix;
+	/** Transformation applied to the (possibly shared) mesh before all
+	 * other transformations, e.g. the dimensions of a unit primitive. */
+	Matrix44f mesh_transform;
 	FramePtr frame;
 	std::string mesh_filename;
+	/// level of detail of the mesh used when the segment was drawn last
+	unsigned int lod_level;
+	/// the segment is drawn as part of a SegmentBatch
+	bool batched;
+	/// bounding box of the mesh in the current pose (see
+	/// MeshupModel::updateCullingHierarchy())
+	Vector3f bbox_min;
+	Vector3f bbox_max;
+	/// the segment was inside the view frustum of the current pass
+	bool visible;
+};
+
+/** \brief Combined mesh of segments that are attached to the same frame.
+ *
+ * The meshes are already transformed into the frame and the segment
+ * colors are stored as vertex colors so that all segments can be drawn
+ * with a single draw call.
+ */
+struct SegmentBatch {
+	SegmentBatch() :
+		frame (FramePtr()),
+		mesh (NULL),
+		segment_count (0),
+		visible (true)
+	{}
+
+	FramePtr frame;
+	MeshPtr mesh;
+	unsigned int segment_count;
+	/// one of the segments was inside the view frustum of the current pass
+	bool visible;
+};
+
+/** \brief Node of the bounding volume hierarchy that is used to cull the
+ * segments of a model.
+ *
+ * There is one node for every frame. The nodes are stored in depth first
+ * order, so the descendants of a node and their segments directly follow
+ * the node and its segments.
+ */
+struct CullingNode {
+	CullingNode() :
+		frame (FramePtr()),
+		parent (std::numeric_limits<size_t>::max()),
+		subtree_end (0),
+		first_segment (0),
+		segment_count (0),
+		subtree_segment_end (0),
+		has_bounds (false)
+	{}
+
+	FramePtr frame;
+	/// max() for the root frames
+	size_t parent;
+	/// index of the first node after the descendants of this node
+	size_t subtree_end;
+	/// segments of the frame in MeshupModel::culling_segments
+	size_t first_segment;
+	size_t segment_count;
+	/// index after the segments of all descendants
+	size_t subtree_segment_end;
+	/// bounding box of the segments of the frame and all its descendants
+	Vector3f bbox_min;
+	Vector3f bbox_max;
+	/// false if none of the segments has a bounding box
+	bool has_bounds;
+};
+
+/** \brief Numbers of the last culling pass. */
+struct CullingStats {
+	CullingStats() :
+		node_tests (0),
+		segment_tests (0),
+		visible_segments (0),
+		culled_segments (0)
+	{}
+
+	CullingStats& operator+= (const CullingStats &other) {
+		node_tests += other.node_tests;
+		segment_tests += other.segment_tests;
+		visible_segments += other.visible_segments;
+		culled_segments += other.culled_segments;
+		return *this;
+	}
+
+	/// number of frustum tests of hierarchy nodes and single segments
+	unsigned int node_tests;
+	unsigned int segment_tests;
+	unsigned int visible_segments;
+	unsigned int culled_segments;
 };
 
 struct Point {
@@ -147,8 +266,15 @@ struct Point {
 struct MeshupModel {
 	MeshupModel():
 		model_filename (""),
+		culling_frame_index(0),
 		frames_initialized(false),
-		skip_vbo_generation(false)
+		skip_vbo_generation(false),
+		lazy_mesh_loading(false),
+		optimize_meshes(false),
+		generate_mesh_lods(false),
+		release_mesh_data(false),
+		batch_segments(false),
+		use_mesh_cache_files(false)
 	{
 		// create the BASE frame
 		FramePtr base_frame (new (Frame));
@@ -158,8 +284,11 @@ struct MeshupModel {
 		frames.push_back (base_frame);
 		framemap["ROOT"] = base_frame;
 	}
-	MeshupModel (const MeshupModel& other) {
+	MeshupModel (const MeshupModel& other) :
+		culling_frame_index(0)
+	{
 		model_filename = other.model_filename;
+		model_stamp = other.model_stamp;
 
 		segments = other.segments;
 		meshmap = other.meshmap;
@@ -172,13 +301,25 @@ struct MeshupModel {
 
 		configuration = other.configuration;
 		frames_initialized = other.frames_initialized;
+		skip_vbo_generation = other.skip_vbo_generation;
+		lazy_mesh_loading = other.lazy_mesh_loading;
+		optimize_meshes = other.optimize_meshes;
+		generate_mesh_lods = other.generate_mesh_lods;
+		release_mesh_data = other.release_mesh_data;
+		batch_segments = other.batch_segments;
+		use_mesh_cache_files = other.use_mesh_cache_files;
 
 		state_descriptor = other.state_descriptor;
+
+		// the primitives and batches are owned by the model
+		copyPrimitiveMeshes (other);
+		updateSegmentBatches();
 	}
 
 	MeshupModel& operator= (const MeshupModel& other) {
 		if (&other != this) {
 			model_filename = other.model_filename;
+			model_stamp = other.model_stamp;
 
 			segments = other.segments;
 			meshmap = other.meshmap;
@@ -191,18 +332,40 @@ struct MeshupModel {
 
 			configuration = other.configuration;
 			frames_initialized = other.frames_initialized;
+			skip_vbo_generation = other.skip_vbo_generation;
+			lazy_mesh_loading = other.lazy_mesh_loading;
+			optimize_meshes = other.optimize_meshes;
+			generate_mesh_lods = other.generate_mesh_lods;
+			release_mesh_data = other.release_mesh_data;
+			batch_segments = other.batch_segments;
+			use_mesh_cache_files = other.use_mesh_cache_files;
 	
 			state_descriptor = other.state_descriptor;
+
+			clearPrimitiveMeshes();
+			copyPrimitiveMeshes (other);
+			clearSegmentBatches();
+			updateSegmentBatches();
+			clearCullingHierarchy();
 		}
 		return *this;
 	}
+	~MeshupModel() {
+		clearSegmentBatches();
+		clearPrimitiveMeshes();
+	}
 
 	std::string model_filename;
+	/// Stamp of the model file when it was loaded
+	FileStamp model_stamp;
 
 	typedef std::list<Segment> SegmentList;
 	SegmentList segments;
 	typedef std::map<std::string, MeshPtr> MeshMap;
 	MeshMap meshmap;
+	/// unit size meshes of the geometry visuals (box, sphere, ...) that
+	/// are shared by the segments of the model, owned by the model
+	MeshMap primitive_meshes;
 	typedef std::vector<FramePtr> FrameVector;
 	FrameVector frames;
 	typedef std::map<std::string, FramePtr> FrameMap;
@@ -211,6 +374,23 @@ struct MeshupModel {
 	CurveMap curvemap;
 	typedef std::vector<Point> PointVector;
 	PointVector points;
+	typedef std::vector<SegmentBatch> SegmentBatchVector;
+	SegmentBatchVector segment_batches;
+	/// meshes drawn by the SegmentRenderer, filled once per frame
+	SegmentDrawList segment_draws;
+	/// meshes drawn with the fixed function pipeline, filled every pass
+	RenderQueue render_queue;
+	typedef std::vector<CullingNode> CullingNodeVector;
+	CullingNodeVector culling_nodes;
+	/// segments sorted by their culling node
+	std::vector<Segment*> culling_segments;
+	/// culling node of every frame sorted by the frame
+	std::vector<std::pair<FramePtr, size_t> > culling_frame_nodes;
+	/// SegmentRenderer::frame_index of the last update of the bounding
+	/// boxes, 0 if they have to be updated
+	unsigned int culling_frame_index;
+	/// of the last pass that was drawn
+	CullingStats culling_stats;
 
 	/// Configuration how transformations are defined
 	FrameConfig configuration;
@@ -223,6 +403,31 @@ struct MeshupModel {
 	/// Skips vbo generation when adding segments (useful when no OpenGL
 	// available)
 	bool skip_vbo_generation;
+
+	/// Only reads the bounding boxes of the meshes when loading the model.
+	/// The full mesh is loaded in the background once its segment is
+	/// visible and a box is drawn until then.
+	bool lazy_mesh_loading;
+
+	/// Optimizes the vertex order of loaded meshes for rendering (see
+	/// MeshVBO::optimizeVertexOrder())
+	bool optimize_meshes;
+
+	/// Creates simplified versions of large meshes that are drawn when a
+	/// segment only covers a few pixels (see MeshVBO::generateLODs())
+	bool generate_mesh_lods;
+
+	/// Frees the vertex data of meshes once they are uploaded to the GPU
+	/// (see MeshVBO::releaseCpuData())
+	bool release_mesh_data;
+
+	/// Merges the small meshes of segments that are attached to the same
+	/// frame so that they are drawn together (see updateSegmentBatches())
+	bool batch_segments;
+
+	/// Loads meshes from binary cache files (.meshbin) next to the OBJ
+	/// files if they are up to date and creates them otherwise
+	bool use_mesh_cache_files;
 	
 	void addFrame (
 			const std::string &parent_frame_name,
@@ -237,7 +442,8 @@ struct MeshupModel {
 			const Vector3f &translate,
 			const SimpleMath::GL::Quaternion &rotate,
 			const Vector3f &scale,
-			const Vector3f &mesh_center);
+			const Vector3f &mesh_center,
+			const Matrix44f &mesh_transform = Matrix44f::Identity());
 
 	void addCurvePoint (
 			const std::string &curve_name,
@@ -260,6 +466,47 @@ struct MeshupModel {
 	void updateFrames();
 	// applies frame transformations to the segments
 	void updateSegments();
+	/** \brief Builds the combined meshes of the segments of each frame.
+	 *
+	 * Has to be called again whenever the segments or their meshes change
+	 * (e.g. when meshes were reloaded). Segments with large meshes, levels
+	 * of detail or meshes that are not loaded yet are drawn on their own.
+	 */
+	void updateSegmentBatches();
+	void clearSegmentBatches();
+	/// Deletes the primitive meshes, needs a current OpenGL context if
+	/// they were uploaded
+	void clearPrimitiveMeshes();
+	/// Copies the primitive meshes of other and lets the segments use the
+	/// copies
+	void copyPrimitiveMeshes (const MeshupModel &other);
+	/// Fills the draw list of the SegmentRenderer with the segments and
+	/// batches that are not drawn as bounding boxes
+	void updateSegmentDraws();
+	/** \brief Computes the axis aligned bounding box of all segments in
+	 * their current pose.
+	 *
+	 * \returns false if the model has no segments
+	 */
+	bool getBoundingBox (Vector3f &bbox_min, Vector3f &bbox_max);
+	/** \brief Updates the bounding boxes of the segments and of the
+	 * culling hierarchy in the current pose.
+	 *
+	 * The hierarchy follows the frame tree. It is rebuilt if frames or
+	 * segments were added or removed.
+	 */
+	void updateCullingHierarchy();
+	void clearCullingHierarchy();
+	/** \brief Marks the segments and batches that are inside the given
+	 * frustum as visible.
+	 *
+	 * Subtrees of the frame tree that are completely outside or inside
+	 * the frustum are not tested any further.
+	 *
+	 * \param modelview_projection maps model coordinates to clip
+	 * coordinates
+	 */
+	void cullSegments (const Matrix44f &modelview_projection);
 
 	FramePtr findFrame (const char* frame_name) {
 		FrameMap::iterator frame_iter = framemap.find (frame_name);
@@ -304,22 +551,35 @@ struct MeshupModel {
 	}
 
 	void clear() {
+		clearSegmentBatches();
 		segments.clear();
 		frames.clear();
 		framemap.clear();
 		meshmap.clear();
 		clearCurves();
 		state_descriptor.clear();
-	
-		*this = MeshupModel();
+
+		// the loading options are kept
+		MeshupModel empty_model;
+		empty_model.skip_vbo_generation = skip_vbo_generation;
+		empty_model.lazy_mesh_loading = lazy_mesh_loading;
+		empty_model.optimize_meshes = optimize_meshes;
+		empty_model.generate_mesh_lods = generate_mesh_lods;
+		empty_model.release_mesh_data = release_mesh_data;
+		empty_model.batch_segments = batch_segments;
+		empty_model.use_mesh_cache_files = use_mesh_cache_files;
+
+		*this = empty_model;
 	}
 
 	/// Initializes the fixed frame transformations and sets frames_initialized to true
 	void initDefaultFrameTransform();
 
 	void draw();
-	void drawFrameAxes();
-	void drawBaseFrameAxes();
+	/// Adds the axes of all frames except ROOT, transformed by the given
+	/// matrix
+	void addFrameAxes (LineBatch &lines, const Matrix44f &transform = Matrix44f::Identity());
+	void addBaseFrameAxes (LineBatch &lines, const Matrix44f &transform = Matrix44f::Identity());
 	void drawCurves();
 	void drawPoints();
 
@@ -0,0 +1,626 @@
+/*
+ * MeshUp - A visualization tool for multi-body systems based on skeletal
+ * animation and magic.
+ *
+ * Copyright (c) 2012-2018 Martin Felis <martin.felis@iwr.uni-heidelberg.de>
+ *
+ * Licensed under the MIT license. See LICENSE for more details.
+ */
+
+#include "ObjParser.h"
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <cmath>
+#include <stdint.h>
+#include <sstream>
+
+#include "thread_utils.h"
+
+#if defined(WIN32) || defined (_WIN32)
+#define OBJPARSER_NO_MMAP
+#else
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
+
+using namespace std;
+
+bool MappedFile::open (const char* filename) {
+	close();
+
+#ifndef OBJPARSER_NO_MMAP
+	int fd = ::open (filename, O_RDONLY);
+	if (fd < 0)
+		return false;
+
+	struct stat file_status;
+	if (fstat (fd, &file_status) != 0) {
+		::close (fd);
+		return false;
+	}
+
+	size = file_status.st_size;
+
+	if (size > 0) {
+		void* address = mmap (NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+		if (address != MAP_FAILED) {
+			madvise (address, size, MADV_SEQUENTIAL);
+			data = static_cast<const char*>(address);
+			mapped = true;
+		}
+	}
+
+	::close (fd);
+
+	if (mapped || size == 0)
+		return true;
+#endif
+
+	// fall back to reading the whole file
+	FILE* file = fopen (filename, "rb");
+	if (!file)
+		return false;
+
+	buffer.clear();
+	char chunk[65536];
+	size_t count;
+	while ((count = fread (chunk, 1, sizeof(chunk), file)) > 0) {
+		buffer.insert (buffer.end(), chunk, chunk + count);
+	}
+	fclose (file);
+
+	data = buffer.size() > 0 ? &buffer[0] : NULL;
+	size = buffer.size();
+
+	return true;
+}
+
+void MappedFile::close () {
+#ifndef OBJPARSER_NO_MMAP
+	if (mapped)
+		munmap (const_cast<char*>(data), size);
+#endif
+
+	mapped = false;
+	data = NULL;
+	size = 0;
+	buffer.clear();
+}
+
+static inline bool is_space (char c) {
+	return c == ' ' || c == '\t' || c == '\r' || c == '\v' || c == '\f';
+}
+
+static inline bool is_digit (char c) {
+	return c >= '0' && c <= '9';
+}
+
+static inline const char* skip_spaces (const char* c, const char* end) {
+	while (c < end && is_space (*c))
+		c++;
+
+	return c;
+}
+
+static inline char lower (char c) {
+	if (c >= 'A' && c <= 'Z')
+		return c - 'A' + 'a';
+
+	return c;
+}
+
+/** Parses a decimal floating point number.
+ *
+ * Numbers that cannot be handled here (e.g. inf, nan or hexadecimal
+ * notation) are passed to strtod.
+ *
+ * \returns the position after the number or NULL if there is no number.
+ */
+static const char* parse_float (const char* c, const char* end, float &value) {
+	static const double powers_of_ten[] = {
+		1.0e0, 1.0e1, 1.0e2, 1.0e3, 1.0e4, 1.0e5, 1.0e6, 1.0e7, 1.0e8, 1.0e9,
+		1.0e10, 1.0e11, 1.0e12, 1.0e13, 1.0e14, 1.0e15, 1.0e16, 1.0e17, 1.0e18,
+		1.0e19, 1.0e20, 1.0e21, 1.0e22
+	};
+
+	const char* start = c;
+
+	bool negative = false;
+	if (c < end && (*c == '-' || *c == '+')) {
+		negative = *c == '-';
+		c++;
+	}
+
+	uint64_t mantissa = 0;
+	int exponent = 0;
+	int digit_count = 0;
+
+	for (; c < end && is_digit (*c); c++, digit_count++) {
+		if (mantissa < 1000000000000000000ULL)
+			mantissa = mantissa * 10 + (*c - '0');
+		else
+			exponent++;
+	}
+
+	if (c < end && *c == '.') {
+		c++;
+		for (; c < end && is_digit (*c); c++, digit_count++) {
+			if (mantissa < 1000000000000000000ULL) {
+				mantissa = mantissa * 10 + (*c - '0');
+				exponent--;
+			}
+		}
+	}
+
+	if (digit_count == 0 || (c < end && !is_space (*c) && *c != 'e' && *c != 'E' && *c != '#' && *c != '\n')) {
+		// let the C library deal with anything unusual
+		char number[64];
+		size_t length = 0;
+		while (start + length < end && length < sizeof(number) - 1 && !is_space (start[length]) && start[length] != '\n')
+			length++;
+
+		memcpy (number, start, length);
+		number[length] = '\0';
+
+		char* number_end = NULL;
+		double result = strtod (number, &number_end);
+		if (number_end == number)
+			return NULL;
+
+		value = static_cast<float>(result);
+		return start + (number_end - number);
+	}
+
+	if (c < end && (*c == 'e' || *c == 'E')) {
+		const char* exponent_start = c;
+		c++;
+
+		bool negative_exponent = false;
+		if (c < end && (*c == '-' || *c == '+')) {
+			negative_exponent = *c == '-';
+			c++;
+		}
+
+		if (c < end && is_digit (*c)) {
+			int exponent_value = 0;
+			for (; c < end && is_digit (*c); c++) {
+				if (exponent_value < 10000)
+					exponent_value = exponent_value * 10 + (*c - '0');
+			}
+
+			exponent += negative_exponent ? -exponent_value : exponent_value;
+		} else {
+			c = exponent_start;
+		}
+	}
+
+	double result = static_cast<double>(mantissa);
+	if (exponent < 0) {
+		if (exponent >= -22)
+			result /= powers_of_ten[-exponent];
+		else
+			result *= pow (10., exponent);
+	} else if (exponent > 0) {
+		if (exponent <= 22)
+			result *= powers_of_ten[exponent];
+		else
+			result *= pow (10., exponent);
+	}
+
+	value = static_cast<float>(negative ? -result : result);
+
+	return c;
+}
+
+/** \returns the position after the integer or NULL if there is none. */
+static inline const char* parse_int (const char* c, const char* end, int &value) {
+	bool negative = false;
+	if (c < end && (*c == '-' || *c == '+')) {
+		negative = *c == '-';
+		c++;
+	}
+
+	if (c == end || !is_digit (*c))
+		return NULL;
+
+	long result = 0;
+	for (; c < end && is_digit (*c); c++) {
+		if (result < 1000000000L)
+			result = result * 10 + (*c - '0');
+	}
+
+	value = static_cast<int>(negative ? -result : result);
+
+	return c;
+}
+
+/** Turns a one based (or negative relative) OBJ index into a zero based
+ * index. \returns -1 for invalid indices. */
+static inline int resolve_index (int index, size_t count) {
+	if (index > 0 && static_cast<size_t>(index) <= count)
+		return index - 1;
+
+	if (index < 0 && static_cast<size_t>(-index) <= count)
+		return static_cast<int>(count) + index;
+
+	return -1;
+}
+
+const ObjObject* ObjData::findObject (const char* name) const {
+	for (size_t i = 0; i < objects.size(); i++) {
+		if (objects[i].name == name)
+			return &objects[i];
+	}
+
+	return NULL;
+}
+
+/** Starts a new object at the current triangle and drops the previous
+ * one if it has no faces. */
+static void begin_object (ObjData &result, const char* name, size_t name_length) {
+	size_t triangle_offset = result.triangle_positions.size() / 3;
+
+	if (result.objects.size() > 0) {
+		ObjObject &previous = result.objects.back();
+		previous.triangle_count = triangle_offset - previous.triangle_offset;
+		if (previous.triangle_count == 0)
+			result.objects.pop_back();
+	}
+
+	ObjObject object;
+	object.name.assign (name, name_length);
+	object.triangle_offset = triangle_offset;
+	result.objects.push_back (object);
+}
+
+static bool set_error (ObjData &result, int line, const string &message) {
+	result.error = message;
+	result.error_line = line;
+
+	return false;
+}
+
+bool parse_obj (const char* data, size_t size, const char* object_name, ObjData &result) {
+	const char* c = data;
+	const char* end = data + size;
+
+	bool in_object = (object_name == NULL);
+	size_t object_name_length = object_name != NULL ? strlen (object_name) : 0;
+
+	// indices of the current polygon
+	vector<int> polygon_positions;
+	vector<int> polygon_normals;
+
+	unsigned int smoothing_group = 1;
+
+	int line_index = 0;
+
+	if (in_object)
+		begin_object (result, "", 0);
+
+	while (c < end) {
+		const char* line_end = static_cast<const char*>(memchr (c, '\n', end - c));
+		if (line_end == NULL)
+			line_end = end;
+
+		line_index++;
+
+		c = skip_spaces (c, line_end);
+
+		// keywords are case insensitive
+		const char* keyword = c;
+		while (c < line_end && !is_space (*c) && *c != '#')
+			c++;
+		size_t keyword_length = c - keyword;
+
+		char k0 = keyword_length > 0 ? lower (keyword[0]) : '\0';
+		char k1 = keyword_length > 1 ? lower (keyword[1]) : '\0';
+
+		if (keyword_length == 1 && k0 == 'v') {
+			Vector3f position;
+			for (int i = 0; i < 3; i++) {
+				c = skip_spaces (c, line_end);
+				const char* next = parse_float (c, line_end, position[i]);
+				if (next == NULL) {
+					ostringstream message;
+					message << "Invalid vertex '" << string (keyword, line_end - keyword) << "'";
+					return set_error (result, line_index, message.str());
+				}
+				c = next;
+			}
+
+			result.positions.push_back (position);
+		} else if (keyword_length == 2 && k0 == 'v' && k1 == 'n') {
+			Vector3f normal;
+			for (int i = 0; i < 3; i++) {
+				c = skip_spaces (c, line_end);
+				const char* next = parse_float (c, line_end, normal[i]);
+				if (next == NULL) {
+					ostringstream message;
+					message << "Invalid normal '" << string (keyword, line_end - keyword) << "'";
+					return set_error (result, line_index, message.str());
+				}
+				c = next;
+			}
+
+			result.normals.push_back (normal);
+		} else if (keyword_length == 1 && k0 == 'f') {
+			if (!in_object) {
+				c = line_end + 1;
+				continue;
+			}
+
+			// the following are valid face vertex definitions:
+			//   v1  v1/t1  v1//n1  v1/t1/n1
+			polygon_positions.clear();
+			polygon_normals.clear();
+
+			while (true) {
+				c = skip_spaces (c, line_end);
+				if (c == line_end || *c == '#')
+					break;
+
+				int position_index = 0;
+				int normal_index = -1;
+
+				const char* next = parse_int (c, line_end, position_index);
+				if (next != NULL) {
+					c = next;
+					if (c < line_end && *c == '/') {
+						c++;
+
+						// the texture coordinate is not used
+						int texcoord_index;
+						next = parse_int (c, line_end, texcoord_index);
+						if (next != NULL)
+							c = next;
+
+						if (c < line_end && *c == '/') {
+							c++;
+
+							int index = 0;
+							next = parse_int (c, line_end, index);
+							if (next != NULL) {
+								c = next;
+								normal_index = resolve_index (index, result.normals.size());
+								if (normal_index == -1) {
+									ostringstream message;
+									message << "Invalid normal index " << index;
+									return set_error (result, line_index, message.str());
+								}
+							}
+						}
+					}
+				}
+
+				if (next == NULL || (c < line_end && !is_space (*c) && *c != '#')) {
+					ostringstream message;
+					message << "Invalid face '" << string (keyword, line_end - keyword) << "'";
+					return set_error (result, line_index, message.str());
+				}
+
+				int resolved_position_index = resolve_index (position_index, result.positions.size());
+				if (resolved_position_index == -1) {
+					ostringstream message;
+					message << "Invalid vertex index " << position_index;
+					return set_error (result, line_index, message.str());
+				}
+
+				polygon_positions.push_back (resolved_position_index);
+				polygon_normals.push_back (normal_index);
+			}
+
+			if (polygon_positions.size() < 3) {
+				return set_error (result, line_index, "Faces must have at least three vertices!");
+			}
+
+			// triangle fan around the first vertex
+			for (size_t i = 1; i + 1 < polygon_positions.size(); i++) {
+				result.triangle_positions.push_back (polygon_positions[0]);
+				result.triangle_positions.push_back (polygon_positions[i]);
+				result.triangle_positions.push_back (polygon_positions[i + 1]);
+
+				result.triangle_normals.push_back (polygon_normals[0]);
+				result.triangle_normals.push_back (polygon_normals[i]);
+				result.triangle_normals.push_back (polygon_normals[i + 1]);
+
+				result.triangle_smoothing_groups.push_back (smoothing_group);
+			}
+		} else if (keyword_length == 1 && k0 == 's') {
+			c = skip_spaces (c, line_end);
+
+			int group = 0;
+			if (parse_int (c, line_end, group) != NULL)
+				smoothing_group = group > 0 ? group : 0;
+			else
+				smoothing_group = 0;
+		} else if (keyword_length == 1 && k0 == 'o') {
+			// If we have found our object already we can skip all following
+			// objects.
+			if (object_name != NULL && result.object_found)
+				break;
+
+			const char* name = skip_spaces (c, line_end);
+			const char* name_end = name;
+			while (name_end < line_end && *name_end != '#')
+				name_end++;
+			while (name_end > name && is_space (name_end[-1]))
+				name_end--;
+
+			if (object_name != NULL) {
+				in_object = static_cast<size_t>(name_end - name) == object_name_length
+					&& strncmp (name, object_name, object_name_length) == 0;
+				result.object_found = in_object;
+			}
+
+			if (in_object)
+				begin_object (result, name, name_end - name);
+		}
+
+		// everything else (comments, texture coordinates, materials, groups,
+		// ...) is ignored
+		c = line_end + 1;
+	}
+
+	if (result.objects.size() > 0) {
+		ObjObject &last = result.objects.back();
+		last.triangle_count = result.triangle_positions.size() / 3 - last.triangle_offset;
+		if (last.triangle_count == 0)
+			result.objects.pop_back();
+	}
+
+	return true;
+}
+
+bool parse_obj_file (const char* filename, const char* object_name, ObjData &result) {
+	MappedFile file;
+
+	if (!file.open (filename)) {
+		ostringstream message;
+		message << "Could not open OBJ file '" << filename << "'!";
+		return set_error (result, 0, message.str());
+	}
+
+	return parse_obj (file.data, file.size, object_name, result);
+}
+
+// meshes with more triangles get their normals computed by several threads
+const size_t parallel_normals_min_triangle_count = 65536;
+const size_t normals_chunk_size = 16384;
+
+/** Angle of the triangle at the given corner. */
+static float corner_angle (const Vector3f &corner, const Vector3f &a, const Vector3f &b) {
+	Vector3f edge_a = a - corner;
+	Vector3f edge_b = b - corner;
+	float length = edge_a.norm() * edge_b.norm();
+	if (length <= 0.f)
+		return 0.f;
+
+	float cosine = edge_a.dot (edge_b) / length;
+	return acosf (std::max (-1.f, std::min (1.f, cosine)));
+}
+
+void generate_obj_normals (ObjData &data, float crease_angle) {
+	size_t triangle_count = data.triangle_positions.size() / 3;
+
+	// only triangles without any normal get new ones
+	std::vector<bool> needs_normals (triangle_count, false);
+	bool any_missing = false;
+	for (size_t ti = 0; ti < triangle_count; ti++) {
+		needs_normals[ti] = data.triangle_normals[ti * 3] == -1
+			&& data.triangle_normals[ti * 3 + 1] == -1
+			&& data.triangle_normals[ti * 3 + 2] == -1;
+		any_missing = any_missing || needs_normals[ti];
+	}
+
+	if (!any_missing)
+		return;
+
+	unsigned int thread_count = triangle_count >= parallel_normals_min_triangle_count ? get_worker_thread_count() : 1;
+	size_t chunk_count = (triangle_count + normals_chunk_size - 1) / normals_chunk_size;
+
+	// normals are only averaged within an object
+	std::vector<unsigned int> triangle_objects (triangle_count, 0);
+	for (size_t oi = 0; oi < data.objects.size(); oi++) {
+		const ObjObject &object = data.objects[oi];
+		for (size_t ti = object.triangle_offset; ti < object.triangle_offset + object.triangle_count; ti++)
+			triangle_objects[ti] = oi;
+	}
+
+	std::vector<Vector3f> face_normals (triangle_count);
+	std::vector<float> corner_angles (triangle_count * 3);
+	parallel_for (chunk_count, [&](size_t ci) {
+			size_t end = std::min (triangle_count, (ci + 1) * normals_chunk_size);
+			for (size_t ti = ci * normals_chunk_size; ti < end; ti++) {
+				const Vector3f &v0 = data.positions[data.triangle_positions[ti * 3]];
+				const Vector3f &v1 = data.positions[data.triangle_positions[ti * 3 + 1]];
+				const Vector3f &v2 = data.positions[data.triangle_positions[ti * 3 + 2]];
+
+				Vector3f normal = (v1 - v0).cross (v2 - v0);
+				float length = normal.norm();
+				face_normals[ti] = length > 0.f ? Vector3f (normal / length) : Vector3f (0.f, 0.f, 0.f);
+
+				corner_angles[ti * 3] = corner_angle (v0, v1, v2);
+				corner_angles[ti * 3 + 1] = corner_angle (v1, v2, v0);
+				corner_angles[ti * 3 + 2] = corner_angle (v2, v0, v1);
+			}
+			}, thread_count);
+
+	// corners that use each position
+	std::vector<size_t> position_corner_offsets (data.positions.size() + 1, 0);
+	for (size_t ci = 0; ci < triangle_count * 3; ci++) {
+		if (needs_normals[ci / 3])
+			position_corner_offsets[data.triangle_positions[ci] + 1]++;
+	}
+	for (size_t pi = 0; pi < data.positions.size(); pi++)
+		position_corner_offsets[pi + 1] += position_corner_offsets[pi];
+
+	std::vector<size_t> position_corners (position_corner_offsets.back());
+	std::vector<size_t> fill_offsets (position_corner_offsets.begin(), position_corner_offsets.end() - 1);
+	for (size_t ci = 0; ci < triangle_count * 3; ci++) {
+		if (needs_normals[ci / 3])
+			position_corners[fill_offsets[data.triangle_positions[ci]]++] = ci;
+	}
+
+	float min_cosine = cosf (crease_angle * static_cast<float>(M_PI) / 180.f);
+
+	std::vector<Vector3f> corner_normals (triangle_count * 3);
+	parallel_for (chunk_count, [&](size_t ci) {
+			size_t end = std::min (triangle_count, (ci + 1) * normals_chunk_size);
+			for (size_t ti = ci * normals_chunk_size; ti < end; ti++) {
+				if (!needs_normals[ti])
+					continue;
+
+				unsigned int group = data.triangle_smoothing_groups[ti];
+
+				for (size_t k = 0; k < 3; k++) {
+					size_t corner = ti * 3 + k;
+					if (group == 0) {
+						corner_normals[corner] = face_normals[ti];
+						continue;
+					}
+
+					int position = data.triangle_positions[corner];
+					Vector3f normal (0.f, 0.f, 0.f);
+
+					for (size_t pi = position_corner_offsets[position]; pi < position_corner_offsets[position + 1]; pi++) {
+						size_t other_corner = position_corners[pi];
+						size_t other_triangle = other_corner / 3;
+
+						if (data.triangle_smoothing_groups[other_triangle] != group
+								|| triangle_objects[other_triangle] != triangle_objects[ti]
+								|| face_normals[other_triangle].dot (face_normals[ti]) < min_cosine)
+							continue;
+
+						normal += face_normals[other_triangle] * corner_angles[other_corner];
+					}
+
+					float length = normal.norm();
+					corner_normals[corner] = length > 0.f ? Vector3f (normal / length) : face_normals[ti];
+				}
+			}
+			}, thread_count);
+
+	// corners of a position with the same normal share it
+	for (size_t position = 0; position < data.positions.size(); position++) {
+		size_t first_normal = data.normals.size();
+
+		for (size_t pi = position_corner_offsets[position]; pi < position_corner_offsets[position + 1]; pi++) {
+			size_t corner = position_corners[pi];
+			const Vector3f &normal = corner_normals[corner];
+
+			size_t ni = first_normal;
+			while (ni < data.normals.size() && memcmp (data.normals[ni].data(), normal.data(), sizeof(float) * 3) != 0)
+				ni++;
+
+			if (ni == data.normals.size())
+				data.normals.push_back (normal);
+
+			data.triangle_normals[corner] = ni;
+		}
+	}
+}
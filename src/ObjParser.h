@@ -0,0 +1,133 @@
+/*
+ * MeshUp - A visualization tool for multi-body systems based on skeletal
+ * animation and magic.
+ *
+ * Copyright (c) 2012-2018 Martin Felis <martin.felis@iwr.uni-heidelberg.de>
+ *
+ * Licensed under the MIT license. See LICENSE for more details.
+ */
+
+#ifndef _OBJPARSER_H
+#define _OBJPARSER_H
+
+#include <cstddef>
+#include <string>
+#include <vector>
+
+#include "Math.h"
+
+/** \brief Read only view of the whole content of a file.
+ *
+ * The file is mapped into memory where possible and read into a buffer
+ * otherwise.
+ */
+struct MappedFile {
+	MappedFile() :
+		data (NULL),
+		size (0),
+		mapped (false)
+	{}
+	~MappedFile() {
+		close();
+	}
+
+	bool open (const char* filename);
+	void close ();
+
+	const char* data;
+	size_t size;
+
+	private:
+		MappedFile (const MappedFile &other);
+		MappedFile& operator= (const MappedFile &other);
+
+		bool mapped;
+		std::vector<char> buffer;
+};
+
+/** \brief Consecutive triangles of a named object ('o' statement) in an
+ * OBJ file. Faces before the first object have an empty name. */
+struct ObjObject {
+	ObjObject() :
+		name (""),
+		triangle_offset (0),
+		triangle_count (0)
+	{}
+
+	std::string name;
+	size_t triangle_offset;
+	size_t triangle_count;
+};
+
+/** \brief Triangles of an OBJ file (or an object within it).
+ *
+ * All indices are zero based and already resolved (i.e. relative indices
+ * are turned into absolute ones). Polygons with more than three vertices
+ * are split into triangle fans.
+ *
+ * The positions and normals are shared by all objects, so a whole file
+ * can be parsed once and the meshes of its objects can then be created
+ * from the objects list.
+ */
+struct ObjData {
+	ObjData() :
+		object_found (false),
+		error_line (0)
+	{}
+
+	std::vector<Vector3f> positions;
+	std::vector<Vector3f> normals;
+
+	/// three position indices per triangle
+	std::vector<int> triangle_positions;
+	/// three normal indices per triangle, -1 if a vertex has no normal
+	std::vector<int> triangle_normals;
+	/// smoothing group ('s' statement) of each triangle. 0 stands for 's
+	/// off', faces before the first 's' statement are in group 1.
+	std::vector<unsigned int> triangle_smoothing_groups;
+
+	/// objects that have faces, in the order of the file
+	std::vector<ObjObject> objects;
+
+	bool object_found;
+
+	/// Returns the first object with the given name or NULL
+	const ObjObject* findObject (const char* name) const;
+
+	/// description and line of the first error, empty on success
+	std::string error;
+	int error_line;
+};
+
+/** \brief Parses the OBJ data in the buffer.
+ *
+ * If object_name is not NULL only the faces of the object with that name
+ * are returned. The buffer does not need to be null terminated.
+ *
+ * \returns false if the data is malformed (see ObjData::error).
+ */
+bool parse_obj (const char* data, size_t size, const char* object_name, ObjData &result);
+
+/** \brief Parses an OBJ file (see parse_obj()).
+ *
+ * \returns false if the file cannot be read (with an error_line of 0) or
+ * is malformed.
+ */
+bool parse_obj_file (const char* filename, const char* object_name, ObjData &result);
+
+/** \brief Computes the normals of all triangles that have none.
+ *
+ * Triangles without smoothing group get the face normal. Otherwise the
+ * normal of a vertex is the average of the normals of the adjacent faces
+ * of the same object and smoothing group, weighted by the angle of the
+ * face at the vertex. Faces whose normals differ by more than
+ * crease_angle (in degrees) are not averaged so that sharp edges stay
+ * sharp. Identical normals are shared.
+ *
+ * Large meshes are processed by several threads, unless the call is
+ * already part of a parallel_for() (e.g. when several files are loaded
+ * in parallel).
+ */
+void generate_obj_normals (ObjData &data, float crease_angle);
+
+#endif
@@ -0,0 +1,71 @@
+/*
+ * MeshUp - A visualization tool for multi-body systems based on skeletal
+ * animation and magic.
+ *
+ * Copyright (c) 2012-2018 Martin Felis <martin.felis@iwr.uni-heidelberg.de>
+ *
+ * Licensed under the MIT license. See LICENSE for more details.
+ */
+
+#include "GL/glew.h"
+
+#include "PointRenderer.h"
+#include "Model.h"
+
+using namespace std;
+
+/// size of the marker spheres
+const float sphere_scale = 0.025f;
+
+PointRenderer::~PointRenderer() {
+	delete sphere_mesh;
+}
+
+void PointRenderer::updateDraws (const vector<Point> &points) {
+	if (sphere_mesh == NULL)
+		sphere_mesh = new MeshVBO (CreateUVSphere (16, 16));
+
+	sphere_draws.clear();
+	lines.clear();
+
+	for (size_t i = 0; i < points.size(); i++) {
+		Vector3f frame_origin = points[i].frame->getPoseTransformTranslation();
+		Vector3f point_location = frame_origin + points[i].frame->getPoseTransformRotation() * points[i].coordinates;
+
+		SegmentDraw draw;
+		draw.mesh = sphere_mesh;
+		draw.transform = SimpleMath::GL::ScaleMat44 (sphere_scale, sphere_scale, sphere_scale)
+			* SimpleMath::GL::TranslateMat44 (point_location[0], point_location[1], point_location[2]);
+		draw.color.set (points[i].color[0], points[i].color[1], points[i].color[2], 1.f);
+		sphere_draws.draws.push_back (draw);
+
+		if (points[i].draw_line)
+			lines.addLine (frame_origin, point_location, points[i].color, points[i].line_width);
+	}
+}
+
+void PointRenderer::draw (const vector<Point> &points) {
+	updateDraws (points);
+	lines.draw();
+
+	if (sphere_draws.draws.size() == 0)
+		return;
+
+	SegmentRenderer &segment_renderer = get_segment_renderer();
+	if (segment_renderer.isActive()) {
+		segment_renderer.upload (sphere_draws);
+		segment_renderer.draw (sphere_draws);
+		return;
+	}
+
+	sphere_queue.clear();
+	for (size_t i = 0; i < sphere_draws.draws.size(); i++)
+		sphere_queue.add (sphere_mesh, sphere_draws.draws[i].transform, sphere_draws.draws[i].color);
+
+	sphere_queue.draw (GL_TRIANGLES);
+}
+
+PointRenderer& get_point_renderer () {
+	static PointRenderer renderer;
+	return renderer;
+}
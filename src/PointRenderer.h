@@ -0,0 +1,55 @@
+/*
+ * MeshUp - A visualization tool for multi-body systems based on skeletal
+ * animation and magic.
+ *
+ * Copyright (c) 2012-2018 Martin Felis <martin.felis@iwr.uni-heidelberg.de>
+ *
+ * Licensed under the MIT license. See LICENSE for more details.
+ */
+
+#ifndef _POINTRENDERER_H
+#define _POINTRENDERER_H
+
+#include <vector>
+
+#include "SegmentRenderer.h"
+#include "LineBatch.h"
+#include "RenderQueue.h"
+
+struct MeshVBO;
+struct Point;
+
+/** \brief Draws the markers of the points of a model.
+ *
+ * All markers share one sphere mesh which is drawn as instances with the
+ * SegmentRenderer (or with a RenderQueue and the fixed function pipeline).
+ * The lines from the frames to their points are drawn as a LineBatch.
+ */
+struct PointRenderer {
+	PointRenderer() :
+		sphere_mesh (NULL)
+	{
+		// the markers are drawn without depth test, so they keep their order
+		sphere_queue.sorting = false;
+	}
+	~PointRenderer();
+
+	/** \brief Fills sphere_draws and lines with the markers of the given
+	 * points (does not need OpenGL).
+	 */
+	void updateDraws (const std::vector<Point> &points);
+	/// Draws the markers of the points
+	void draw (const std::vector<Point> &points);
+
+	/// shared by all markers
+	MeshVBO *sphere_mesh;
+	SegmentDrawList sphere_draws;
+	/// only used without the SegmentRenderer, not sorted
+	RenderQueue sphere_queue;
+	LineBatch lines;
+};
+
+/** \brief The point renderer that is shared by all models. */
+PointRenderer& get_point_renderer ();
+
+#endif
@@ -0,0 +1,122 @@
+/*
+ * MeshUp - A visualization tool for multi-body systems based on skeletal
+ * animation and magic.
+ *
+ * Copyright (c) 2012-2018 Martin Felis <martin.felis@iwr.uni-heidelberg.de>
+ *
+ * Licensed under the MIT license. See LICENSE for more details.
+ */
+
+#include "GL/glew.h"
+
+#include "RenderQueue.h"
+#include "MeshVBO.h"
+#include "GLStateCache.h"
+
+#include <algorithm>
+
+using namespace std;
+
+/** Orders the items by the state changes they need, the most expensive
+ * ones first. */
+struct RenderItemOrder {
+	bool operator() (const RenderItem &a, const RenderItem &b) const {
+		if (a.mesh->smooth_shading != b.mesh->smooth_shading)
+			return a.mesh->smooth_shading;
+		if (a.mesh != b.mesh)
+			return a.mesh < b.mesh;
+		if (a.lod_level != b.lod_level)
+			return a.lod_level < b.lod_level;
+
+		for (unsigned int i = 0; i < 4; i++) {
+			if (a.color[i] != b.color[i])
+				return a.color[i] < b.color[i];
+		}
+
+		return false;
+	}
+};
+
+void RenderQueue::add (MeshVBO *mesh, const Matrix44f &transform, const Vector4f &color, unsigned int lod_level) {
+	RenderItem item;
+	item.mesh = mesh;
+	item.transform = transform;
+	item.color = color;
+	item.lod_level = lod_level;
+
+	items.push_back (item);
+}
+
+void RenderQueue::sort() {
+	// stable so that equal items keep the order in which they were added
+	std::stable_sort (items.begin(), items.end(), RenderItemOrder());
+}
+
+void RenderQueue::draw (unsigned int mode) {
+	mesh_binds = 0;
+
+	if (items.size() == 0)
+		return;
+
+	// creating the buffers changes the bindings, so they are created before
+	// anything gets bound
+	for (size_t i = 0; i < items.size(); i++) {
+		if (!items[i].mesh->bounds_only && items[i].mesh->vbo_id == 0)
+			items[i].mesh->generate_vbo();
+	}
+
+	if (sorting)
+		sort();
+
+	GLStateCache &state = get_gl_state_cache();
+	state.invalidateColor();
+
+	bool normalize_enabled = state.isEnabled (GL_NORMALIZE);
+	if (!normalize_enabled)
+		state.enable (GL_NORMALIZE);
+
+	glMatrixMode (GL_MODELVIEW);
+
+	const MeshVBO *bound_mesh = NULL;
+
+	for (size_t i = 0; i < items.size(); i++) {
+		const RenderItem &item = items[i];
+		MeshVBO *mesh = item.mesh;
+		if (mesh->bounds_only || mesh->vbo_id == 0)
+			continue;
+
+		state.shadeModel (mesh->smooth_shading ? GL_SMOOTH : GL_FLAT);
+
+		if (mesh != bound_mesh) {
+			mesh->bind();
+			bound_mesh = mesh;
+			mesh_binds++;
+		}
+
+		if (!mesh->has_colors)
+			state.setColor (item.color);
+
+		glPushMatrix();
+		glMultMatrixf (item.transform.data());
+
+		// quantized positions are mapped back onto the bounding box
+		if (mesh->position_type == GL_SHORT) {
+			glTranslatef (mesh->position_offset[0], mesh->position_offset[1], mesh->position_offset[2]);
+			glScalef (mesh->position_scale, mesh->position_scale, mesh->position_scale);
+		}
+
+		mesh->drawBuffers (mode, item.lod_level);
+
+		glPopMatrix();
+
+		// the current color is undefined after drawing a color array
+		if (mesh->has_colors)
+			state.invalidateColor();
+	}
+
+	state.bindBuffer (GL_ELEMENT_ARRAY_BUFFER, 0);
+	state.bindBuffer (GL_ARRAY_BUFFER, 0);
+
+	if (!normalize_enabled)
+		state.disable (GL_NORMALIZE);
+}
@@ -0,0 +1,72 @@
+/*
+ * MeshUp - A visualization tool for multi-body systems based on skeletal
+ * animation and magic.
+ *
+ * Copyright (c) 2012-2018 Martin Felis <martin.felis@iwr.uni-heidelberg.de>
+ *
+ * Licensed under the MIT license. See LICENSE for more details.
+ */
+
+#ifndef _RENDERQUEUE_H
+#define _RENDERQUEUE_H
+
+#include <vector>
+#include <cstddef>
+
+#include "Math.h"
+
+struct MeshVBO;
+
+/** \brief A mesh that is drawn by a RenderQueue. */
+struct RenderItem {
+	RenderItem() :
+		mesh (NULL),
+		transform (Matrix44f::Identity()),
+		color (1.f, 1.f, 1.f, 1.f),
+		lod_level (0)
+	{}
+
+	MeshVBO *mesh;
+	/// multiplied onto the current modelview matrix
+	Matrix44f transform;
+	/// used if the mesh has no vertex colors
+	Vector4f color;
+	unsigned int lod_level;
+};
+
+/** \brief Draws meshes with the fixed function pipeline sorted by their
+ * state.
+ *
+ * The items are sorted by shading model, mesh, level of detail and color
+ * so that the vertex buffers of a mesh are only bound once and the color
+ * only gets set when it changes. All state changes go through the
+ * GLStateCache.
+ */
+struct RenderQueue {
+	RenderQueue() :
+		sorting (true),
+		mesh_binds (0)
+	{}
+
+	/// Removes all items but keeps the allocated memory
+	void clear() {
+		items.clear();
+	}
+	void add (MeshVBO *mesh, const Matrix44f &transform, const Vector4f &color, unsigned int lod_level = 0);
+	/// Sorts the items by their state (does not need OpenGL)
+	void sort();
+	/** \brief Draws all items that can be drawn (i.e. not the meshes that
+	 * are only known by their bounding box).
+	 *
+	 * Sorts the items first if sorting is set.
+	 */
+	void draw (unsigned int mode);
+
+	/// can be cleared to draw the items in the order they were added
+	bool sorting;
+	std::vector<RenderItem> items;
+	/// number of meshes whose buffers were bound by the last draw()
+	unsigned int mesh_binds;
+};
+
+#endif
@@ -4,8 +4,10 @@
 #include "Animation.h"
 #include "ForcesTorques.h"
 #include "GL/glew.h"
+#include "GLStateCache.h"
 
 #include <iostream>
+#include <algorithm>
 
 using namespace std;
 
@@ -16,6 +18,41 @@ void Scene::setCurrentTime (double t){
 	}
 }
 
+bool Scene::getBoundingBox (Vector3f &bbox_min, Vector3f &bbox_max) {
+	Vector3f offset (0.f, 0.f, 0.f);
+	
+	if (models.size() > 1) {
+		offset = - model_displacement * models.size() * 0.5;
+	}
+
+	bool found = false;
+
+	for (unsigned int i = 0; i < models.size(); i++) {
+		offset += model_displacement;
+
+		Vector3f model_min, model_max;
+		if (!models[i]->getBoundingBox (model_min, model_max))
+			continue;
+
+		model_min += offset;
+		model_max += offset;
+
+		if (!found) {
+			bbox_min = model_min;
+			bbox_max = model_max;
+			found = true;
+			continue;
+		}
+
+		for (unsigned int j = 0; j < 3; j++) {
+			bbox_min[j] = std::min (bbox_min[j], model_min[j]);
+			bbox_max[j] = std::max (bbox_max[j], model_max[j]);
+		}
+	}
+
+	return found;
+}
+
 void Scene::drawMeshes() {
 	Vector3f offset_start (0.f, 0.f, 0.f);
 	
@@ -23,51 +60,73 @@ void Scene::drawMeshes() {
 		offset_start = - model_displacement * models.size() * 0.5;
 	}
 
+	culling_stats = CullingStats();
+
 	glPushMatrix();
 	glTranslatef (offset_start[0], offset_start[1], offset_start[2]);
 
 	for (unsigned int i = 0; i < models.size(); i++) {
 		glTranslatef (model_displacement[0], model_displacement[1], model_displacement[2]);
 		models[i]->draw();
+		culling_stats += models[i]->culling_stats;
 	}
 
 	glPopMatrix();
 }
 
+/** Draws the lines on top of everything without lighting. */
+static void draw_overlay_lines (LineBatch &lines) {
+	GLStateCache &state = get_gl_state_cache();
+
+	bool depth_test_enabled = state.isEnabled (GL_DEPTH_TEST);
+	if (depth_test_enabled)
+		state.disable (GL_DEPTH_TEST);
+
+	bool light_enabled = state.isEnabled (GL_LIGHTING);
+	if (light_enabled)
+		state.disable (GL_LIGHTING);
+
+	lines.draw();
+
+	if (depth_test_enabled)
+		state.enable (GL_DEPTH_TEST);
+
+	if (light_enabled)
+		state.enable (GL_LIGHTING);
+}
+
 void Scene::drawBaseFrameAxes(){
-	Vector3f offset_start (0.f, 0.f, 0.f);
+	Vector3f offset (0.f, 0.f, 0.f);
 	
 	if (models.size() > 1) {
-		offset_start = - model_displacement * models.size() * 0.5;
+		offset = - model_displacement * models.size() * 0.5;
 	}
 
-	glPushMatrix();
-	glTranslatef (offset_start[0], offset_start[1], offset_start[2]);
+	axes_lines.clear();
 
 	for (unsigned int i = 0; i < models.size(); i++) {
-		glTranslatef (model_displacement[0], model_displacement[1], model_displacement[2]);
-		models[i]->drawBaseFrameAxes();
+		offset += model_displacement;
+		models[i]->addBaseFrameAxes (axes_lines, SimpleMath::GL::TranslateMat44 (offset[0], offset[1], offset[2]));
 	}
 
-	glPopMatrix();
+	draw_overlay_lines (axes_lines);
 }
 
 void Scene::drawFrameAxes(){
-	Vector3f offset_start (0.f, 0.f, 0.f);
+	Vector3f offset (0.f, 0.f, 0.f);
 	
 	if (models.size() > 1) {
-		offset_start = - model_displacement * models.size() * 0.5;
+		offset = - model_displacement * models.size() * 0.5;
 	}
 
-	glPushMatrix();
-	glTranslatef (offset_start[0], offset_start[1], offset_start[2]);
+	axes_lines.clear();
 
 	for (unsigned int i = 0; i < models.size(); i++) {
-		glTranslatef (model_displacement[0], model_displacement[1], model_displacement[2]);
-		models[i]->drawFrameAxes();
+		offset += model_displacement;
+		models[i]->addFrameAxes (axes_lines, SimpleMath::GL::TranslateMat44 (offset[0], offset[1], offset[2]));
 	}
 
-	glPopMatrix();
+	draw_overlay_lines (axes_lines);
 }
 
 void Scene::drawPoints(){
@@ -116,8 +175,9 @@ void Scene::drawForces() {
 	glPushMatrix();
 	glTranslatef (offset_start[0], offset_start[1], offset_start[2]);
 
-	bool blend_enabled = glIsEnabled(GL_BLEND);
-	glEnable(GL_BLEND);
+	GLStateCache &state = get_gl_state_cache();
+	bool blend_enabled = state.isEnabled (GL_BLEND);
+	state.enable (GL_BLEND);
 	glDepthMask(GL_FALSE);
 	glBlendFunc(GL_ONE_MINUS_SRC_ALPHA, GL_SRC_ALPHA);
 
@@ -135,7 +195,7 @@ void Scene::drawForces() {
 
 	glDepthMask(GL_TRUE);
 	if (!blend_enabled) {
-		glDisable(GL_BLEND);
+		state.disable (GL_BLEND);
 	}
 
 	glPopMatrix();
@@ -151,8 +211,9 @@ void Scene::drawTorques() {
 	glPushMatrix();
 	glTranslatef (offset_start[0], offset_start[1], offset_start[2]);
 
-	bool blend_enabled = glIsEnabled(GL_BLEND);
-	glEnable(GL_BLEND);
+	GLStateCache &state = get_gl_state_cache();
+	bool blend_enabled = state.isEnabled (GL_BLEND);
+	state.enable (GL_BLEND);
 	glDepthMask(GL_FALSE);
 	glBlendFunc(GL_ONE_MINUS_SRC_ALPHA, GL_SRC_ALPHA);
 
@@ -169,7 +230,7 @@ void Scene::drawTorques() {
 
 	glDepthMask(GL_TRUE);
 	if (!blend_enabled) {
-		glDisable(GL_BLEND);
+		state.disable (GL_BLEND);
 	}
 
 	glPopMatrix();
@@ -5,9 +5,10 @@
 
 #include "Math.h"
 #include "Arrow.h"
+#include "LineBatch.h"
+#include "Model.h"
 
 struct Animation;
-struct MeshupModel;
 struct ForcesTorques;
 
 struct Scene {
@@ -20,6 +21,10 @@ struct Scene {
 	float longest_animation;
 	Vector3f model_displacement;
 	ArrowCreator arrow_creator;
+	/// axes of all models, filled every time they are drawn
+	LineBatch axes_lines;
+	/// sum of all models of the last call of drawMeshes()
+	CullingStats culling_stats;
 	bool drawingForces;
 	bool drawingTorques;
 
@@ -28,6 +33,12 @@ struct Scene {
 	std::vector<ForcesTorques*> forcesTorquesQueue;
 
 	void setCurrentTime (double t);
+	/** \brief Computes the bounding box of all models including their
+	 * displacement.
+	 *
+	 * \returns false if there is nothing to draw
+	 */
+	bool getBoundingBox (Vector3f &bbox_min, Vector3f &bbox_max);
 
 	void drawMeshes();
 	void drawBaseFrameAxes();
@@ -8,6 +8,7 @@
 #include "Animation.h"
 #include "Model.h"
 #include "Camera.h"
+#include "FrameProfiler.h"
 
 #include <errno.h>
 
@@ -199,25 +200,35 @@ void scripting_load (lua_State *L, const int argc, char* argv[]) {
 
 /***
  * Update function that gets called every frame before it is drawn. 
+ *
+ * Frames are only drawn when something changed. Changes made through the
+ * meshup functions cause another frame, the function can also return
+ * true to be called again continuously.
  * @function meshup.update(dt)
  * @param dt the elapsed time in seconds since the last drawing update
+ * @return true to keep on drawing frames
 */
-void scripting_update (lua_State *L, float dt) {
+bool scripting_update (lua_State *L, float dt) {
 	assert (lua_gettop(L) == 0);
 	assert (L);
+
+	bool continuous_update = false;
+
 	lua_getglobal (L, "meshup");
 	if (lua_istable(L, 1)) {
 		lua_getfield (L, 1, "update");
 		if (lua_isfunction(L, 2)) {
 			lua_pushnumber(L, dt);
-			lua_call (L, 1, 0);
-		} else {
-			lua_pop(L,1);
+			lua_call (L, 1, 1);
+			continuous_update = lua_toboolean (L, 2);
 		}
+		lua_pop(L,1);
 	}
 	lua_pop (L, 1);
 
 	assert (lua_gettop(L) == 0);
+
+	return continuous_update;
 }
 
 /// Gets called after meshup performed its drawing.
@@ -443,6 +454,8 @@ static int meshup_animation_addRawValues (lua_State *L) {
 	if (animation->duration < values[0])
 		animation->duration = values[0];
 
+	app_ptr->requestRedraw();
+
 	return 0;
 }
 
@@ -471,6 +484,8 @@ static int meshup_animation_setRawValuesAt (lua_State *L) {
 	// TODO: properly check whether values are still ordered in time?
 	if (animation->duration < values[0])
 		animation->duration = values[0];
+
+	app_ptr->requestRedraw();
 	
 	return 0;
 }
@@ -686,6 +701,7 @@ static int meshup_setCurrentTime (lua_State *L) {
 	double time  = luaL_checknumber (L, 1);
 
 	app_ptr->glWidget->scene->setCurrentTime (time);
+	app_ptr->requestRedraw();
 
 	return 0;
 }
@@ -704,6 +720,7 @@ static int meshup_setLightPosition (lua_State *L) {
 	coords[3] = 1.;
 
 	app_ptr->glWidget->light_position = coords;
+	app_ptr->requestRedraw();
 
 	return 0;
 }
@@ -751,10 +768,47 @@ static int meshup_setModelDisplacement (lua_State *L) {
 	coords[2] = luaL_checknumber (L, 3);
 
 	app_ptr->scene->model_displacement = coords;
+	app_ptr->requestRedraw();
 
 	return 0;
 }
 
+/// Get the average frame times of the last frames.
+// @function meshup.getFrameProfile
+// @return table with the times in milliseconds: frames, frame_time,
+// cpu = { scripting, animation, segment_update, draw_submission } and
+// gpu = { shadow_map, floor, meshes, overlays }. gpu is nil if the GPU
+// times are not (yet) known.
+static int meshup_getFrameProfile (lua_State *L) {
+	FrameProfiler &profiler = get_frame_profiler();
+	FrameProfile average = profiler.average();
+
+	lua_newtable (L);
+
+	lua_pushinteger (L, profiler.historyCount());
+	lua_setfield (L, -2, "frames");
+	lua_pushnumber (L, average.frame_time);
+	lua_setfield (L, -2, "frame_time");
+
+	lua_newtable (L);
+	for (unsigned int i = 0; i < ProfileCpuSectionCount; i++) {
+		lua_pushnumber (L, average.cpu_time[i]);
+		lua_setfield (L, -2, profile_cpu_section_name (static_cast<ProfileCpuSection>(i)));
+	}
+	lua_setfield (L, -2, "cpu");
+
+	if (average.gpuTimeValid()) {
+		lua_newtable (L);
+		for (unsigned int i = 0; i < ProfileGpuPassCount; i++) {
+			lua_pushnumber (L, average.gpu_time[i]);
+			lua_setfield (L, -2, profile_gpu_pass_name (static_cast<ProfileGpuPass>(i)));
+		}
+		lua_setfield (L, -2, "gpu");
+	}
+
+	return 1;
+}
+
 static const struct luaL_Reg meshup_f[] = {
 	{ "getCamera", meshup_getCamera},
 	{ "getModel", meshup_getModel},
@@ -766,6 +820,7 @@ static const struct luaL_Reg meshup_f[] = {
 	{ "setLightPosition", meshup_setLightPosition},
 	{ "saveScreenshot", meshup_saveScreenshot},
 	{ "setModelDisplacement", meshup_setModelDisplacement},
+	{ "getFrameProfile", meshup_getFrameProfile},
 	{ NULL, NULL}
 };
 
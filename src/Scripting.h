@@ -13,7 +13,12 @@ void scripting_init (MeshupApp *app, const char* init_filename);
 
 void scripting_load (lua_State *L, const int argc, char* argv[]);
 
-void scripting_update (lua_State *L, float dt);
+/** \brief Calls meshup.update(dt) of the script.
+ *
+ * \returns true if the function wants to be called again continuously
+ * (by returning true)
+ */
+bool scripting_update (lua_State *L, float dt);
 
 void scripting_draw (lua_State *L);
 
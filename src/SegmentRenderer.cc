@@ -0,0 +1,422 @@
+/*
+ * MeshUp - A visualization tool for multi-body systems based on skeletal
+ * animation and magic.
+ *
+ * Copyright (c) 2012-2018 Martin Felis <martin.felis@iwr.uni-heidelberg.de>
+ *
+ * Licensed under the MIT license. See LICENSE for more details.
+ */
+
+#include "GL/glew.h"
+
+#include "SegmentRenderer.h"
+#include "MeshVBO.h"
+#include "GLStateCache.h"
+
+#include <algorithm>
+#include <cstring>
+#include <cstdio>
+#include <iostream>
+
+using namespace std;
+
+// transform (mat4), normal transform (mat4), color (vec4) and attributes
+// (vec4: has colors, has normals) in std140 layout
+const size_t entry_float_count = 40;
+const size_t entry_size = entry_float_count * sizeof(float);
+const size_t max_entries_per_block = 256;
+/// texture unit of the shadow map, the other drawing only uses the first
+/// unit
+const int shadow_map_unit = 1;
+
+static const char* vertex_shader_source =
+	"#version 130\n"
+	"#extension GL_ARB_uniform_buffer_object : require\n"
+	"#extension GL_ARB_draw_instanced : require\n"
+	"\n"
+	"struct SegmentEntry {\n"
+	"	mat4 transform;\n"
+	"	mat4 normal_transform;\n"
+	"	vec4 color;\n"
+	"	vec4 attributes;\n"
+	"};\n"
+	"\n"
+	"layout(std140) uniform SegmentBlock {\n"
+	"	SegmentEntry entries[ENTRY_COUNT];\n"
+	"};\n"
+	"\n"
+	"uniform int first_instance;\n"
+	"uniform bool lighting;\n"
+	"uniform bool shadow_lookup;\n"
+	"uniform mat4 shadow_matrix;\n"
+	"\n"
+	"in vec4 position;\n"
+	"in vec3 normal;\n"
+	"in vec4 color;\n"
+	"\n"
+	"out vec4 shadow_coord;\n"
+	"\n"
+	"void main() {\n"
+	"	int index = first_instance + gl_InstanceIDARB;\n"
+	"	vec4 eye_position = gl_ModelViewMatrix * (entries[index].transform * position);\n"
+	"	gl_Position = gl_ProjectionMatrix * eye_position;\n"
+	"\n"
+	"	if (shadow_lookup)\n"
+	"		shadow_coord = shadow_matrix * eye_position;\n"
+	"\n"
+	"	vec4 base_color = entries[index].attributes.x > 0.5 ? color : entries[index].color;\n"
+	"	if (!lighting) {\n"
+	"		gl_FrontColor = base_color;\n"
+	"		gl_FrontSecondaryColor = base_color;\n"
+	"		return;\n"
+	"	}\n"
+	"\n"
+	"	vec3 n = entries[index].attributes.y > 0.5 ? normal : vec3 (0., 0., 1.);\n"
+	"	n = normalize (gl_NormalMatrix * (mat3 (entries[index].normal_transform) * n));\n"
+	"\n"
+	"	// GL_LIGHT0 with GL_AMBIENT_AND_DIFFUSE color material\n"
+	"	vec3 light_direction;\n"
+	"	float attenuation = 1.;\n"
+	"	if (gl_LightSource[0].position.w == 0.) {\n"
+	"		light_direction = normalize (gl_LightSource[0].position.xyz);\n"
+	"	} else {\n"
+	"		vec3 to_light = gl_LightSource[0].position.xyz / gl_LightSource[0].position.w - eye_position.xyz / eye_position.w;\n"
+	"		float distance = length (to_light);\n"
+	"		light_direction = to_light / distance;\n"
+	"		attenuation = 1. / (gl_LightSource[0].constantAttenuation\n"
+	"			+ gl_LightSource[0].linearAttenuation * distance\n"
+	"			+ gl_LightSource[0].quadraticAttenuation * distance * distance);\n"
+	"	}\n"
+	"\n"
+	"	float diffuse = max (dot (n, light_direction), 0.);\n"
+	"	vec4 specular = vec4 (0.);\n"
+	"	if (diffuse > 0.) {\n"
+	"		vec3 half_vector = normalize (light_direction + vec3 (0., 0., 1.));\n"
+	"		specular = gl_FrontMaterial.specular * gl_LightSource[0].specular\n"
+	"			* pow (max (dot (n, half_vector), 0.), gl_FrontMaterial.shininess);\n"
+	"	}\n"
+	"\n"
+	"	vec4 ambient = gl_FrontMaterial.emission + gl_LightModel.ambient * base_color\n"
+	"		+ attenuation * gl_LightSource[0].ambient * base_color;\n"
+	"	vec4 diffuse_color = attenuation * diffuse * gl_LightSource[0].diffuse * base_color;\n"
+	"	vec4 result = ambient + diffuse_color + attenuation * specular;\n"
+	"	gl_FrontColor = vec4 (clamp (result.rgb, 0., 1.), base_color.a);\n"
+	"\n"
+	"	// the shadowed parts only get a tenth of the diffuse light\n"
+	"	vec4 shadowed = ambient + 0.1 * diffuse_color;\n"
+	"	gl_FrontSecondaryColor = vec4 (clamp (shadowed.rgb, 0., 1.), base_color.a);\n"
+	"}\n";
+
+static const char* fragment_shader_source =
+	"#version 130\n"
+	"\n"
+	"uniform bool shadow_lookup;\n"
+	"uniform sampler2DShadow shadow_map;\n"
+	"uniform float shadow_texel_size;\n"
+	"\n"
+	"in vec4 shadow_coord;\n"
+	"\n"
+	"void main() {\n"
+	"	if (!shadow_lookup) {\n"
+	"		gl_FragColor = gl_Color;\n"
+	"		return;\n"
+	"	}\n"
+	"\n"
+	"	// GL_LINEAR comparison filters 2x2 texels of every lookup\n"
+	"	vec3 coord = shadow_coord.xyz / shadow_coord.w;\n"
+	"#ifdef SOFT_SHADOWS\n"
+	"	float light = 0.;\n"
+	"	for (int i = -1; i <= 1; i++) {\n"
+	"		for (int j = -1; j <= 1; j++) {\n"
+	"			vec2 offset = vec2 (float(i), float(j)) * shadow_texel_size;\n"
+	"			light += shadow2D (shadow_map, vec3 (coord.xy + offset, coord.z)).r;\n"
+	"		}\n"
+	"	}\n"
+	"	light /= 9.;\n"
+	"#else\n"
+	"	float light = shadow2D (shadow_map, coord).r;\n"
+	"#endif\n"
+	"\n"
+	"	gl_FragColor = vec4 (mix (gl_SecondaryColor.rgb, gl_Color.rgb, light), gl_Color.a);\n"
+	"}\n";
+
+static unsigned int compile_shader (GLenum type, const string &source) {
+	unsigned int shader_id = glCreateShader (type);
+	const char* source_str = source.c_str();
+	glShaderSource (shader_id, 1, &source_str, NULL);
+	glCompileShader (shader_id);
+
+	GLint status;
+	glGetShaderiv (shader_id, GL_COMPILE_STATUS, &status);
+	if (status != GL_TRUE) {
+		char log[4096];
+		glGetShaderInfoLog (shader_id, sizeof(log), NULL, log);
+		cerr << "Error: could not compile the segment shader: " << log << endl;
+		glDeleteShader (shader_id);
+		return 0;
+	}
+
+	return shader_id;
+}
+
+/** Draws with the same shading, mesh and level of detail are drawn one
+ * after another. */
+static bool draw_order (const SegmentDraw &draw_a, const SegmentDraw &draw_b) {
+	if (draw_a.mesh->smooth_shading != draw_b.mesh->smooth_shading)
+		return draw_a.mesh->smooth_shading;
+
+	if (draw_a.mesh != draw_b.mesh)
+		return draw_a.mesh < draw_b.mesh;
+
+	return draw_a.lod_level < draw_b.lod_level;
+}
+
+static size_t greatest_common_divisor (size_t a, size_t b) {
+	while (b != 0) {
+		size_t remainder = a % b;
+		a = b;
+		b = remainder;
+	}
+
+	return a;
+}
+
+SegmentDrawList::~SegmentDrawList() {
+	if (buffer_id != 0)
+		glDeleteBuffers (1, &buffer_id);
+}
+
+bool SegmentRenderer::init() {
+	if (initialized)
+		return true;
+
+	// vertex array objects, uniform buffers and instanced drawing
+	if (!GLEW_VERSION_3_0
+			|| !(GLEW_VERSION_3_1 || (GLEW_ARB_uniform_buffer_object && GLEW_ARB_draw_instanced)))
+		return false;
+
+	GLint max_block_size, offset_alignment;
+	glGetIntegerv (GL_MAX_UNIFORM_BLOCK_SIZE, &max_block_size);
+	glGetIntegerv (GL_UNIFORM_BUFFER_OFFSET_ALIGNMENT, &offset_alignment);
+
+	// smallest number of entries whose size is a multiple of the alignment
+	entry_alignment = 1;
+	if (offset_alignment > 0)
+		entry_alignment = offset_alignment / greatest_common_divisor (entry_size, offset_alignment);
+
+	entries_per_block = std::min (static_cast<size_t>(max_block_size) / entry_size, max_entries_per_block);
+	entries_per_block = entries_per_block / entry_alignment * entry_alignment;
+	if (entries_per_block == 0)
+		return false;
+
+	char entry_count_define[64];
+	snprintf (entry_count_define, sizeof(entry_count_define), "#define ENTRY_COUNT %u\n", static_cast<unsigned int>(entries_per_block));
+
+	// the define has to follow the #version and #extension lines
+	string vertex_source (vertex_shader_source);
+	size_t header_end = vertex_source.find ("\n\n") + 1;
+	vertex_source.insert (header_end, entry_count_define);
+
+	string fragment_source (fragment_shader_source);
+	if (soft_shadows)
+		fragment_source.insert (fragment_source.find ("\n\n") + 1, "#define SOFT_SHADOWS\n");
+
+	unsigned int vertex_shader = compile_shader (GL_VERTEX_SHADER, vertex_source);
+	unsigned int fragment_shader = compile_shader (GL_FRAGMENT_SHADER, fragment_source);
+	if (vertex_shader == 0 || fragment_shader == 0) {
+		glDeleteShader (vertex_shader);
+		glDeleteShader (fragment_shader);
+		return false;
+	}
+
+	program_id = glCreateProgram();
+	glAttachShader (program_id, vertex_shader);
+	glAttachShader (program_id, fragment_shader);
+
+	// locations that are used by MeshVBO::generate_vao()
+	glBindAttribLocation (program_id, 0, "position");
+	glBindAttribLocation (program_id, 1, "normal");
+	glBindAttribLocation (program_id, 2, "color");
+
+	glLinkProgram (program_id);
+	glDeleteShader (vertex_shader);
+	glDeleteShader (fragment_shader);
+
+	GLint status;
+	glGetProgramiv (program_id, GL_LINK_STATUS, &status);
+	if (status != GL_TRUE) {
+		char log[4096];
+		glGetProgramInfoLog (program_id, sizeof(log), NULL, log);
+		cerr << "Error: could not link the segment shader: " << log << endl;
+		glDeleteProgram (program_id);
+		program_id = 0;
+		return false;
+	}
+
+	glUniformBlockBinding (program_id, glGetUniformBlockIndex (program_id, "SegmentBlock"), 0);
+	first_instance_location = glGetUniformLocation (program_id, "first_instance");
+	lighting_location = glGetUniformLocation (program_id, "lighting");
+	shadow_lookup_location = glGetUniformLocation (program_id, "shadow_lookup");
+	shadow_matrix_location = glGetUniformLocation (program_id, "shadow_matrix");
+	shadow_texel_size_location = glGetUniformLocation (program_id, "shadow_texel_size");
+
+	glUseProgram (program_id);
+	glUniform1i (glGetUniformLocation (program_id, "shadow_map"), shadow_map_unit);
+	glUseProgram (0);
+
+	initialized = true;
+
+	return true;
+}
+
+void SegmentRenderer::upload (SegmentDrawList &draw_list) {
+	vector<SegmentDraw> &draws = draw_list.draws;
+
+	for (size_t i = 0; i < draws.size(); i++) {
+		if (draws[i].mesh->vbo_id == 0 && !draws[i].mesh->bounds_only)
+			draws[i].mesh->generate_vbo();
+	}
+
+	// the levels of detail of the last pass are most likely used again
+	std::stable_sort (draws.begin(), draws.end(), draw_order);
+
+	draw_list.frame_index = frame_index;
+	draw_list.groups.clear();
+	if (draws.size() == 0)
+		return;
+
+	size_t entry_count = 0;
+	for (size_t i = 0; i < draws.size(); i++) {
+		if (i == 0 || draws[i].mesh != draws[i - 1].mesh) {
+			SegmentDrawGroup group;
+			group.first_draw = i;
+			group.first_entry = (entry_count + entry_alignment - 1) / entry_alignment * entry_alignment;
+			draw_list.groups.push_back (group);
+			entry_count = group.first_entry;
+		}
+
+		draw_list.groups.back().draw_count++;
+		entry_count++;
+	}
+
+	// a whole block gets bound at the start of every group
+	draw_list.entries.assign ((entry_count + entries_per_block) * entry_float_count, 0.f);
+
+	for (size_t gi = 0; gi < draw_list.groups.size(); gi++) {
+		const SegmentDrawGroup &group = draw_list.groups[gi];
+
+		for (size_t i = 0; i < group.draw_count; i++) {
+			const SegmentDraw &draw = draws[group.first_draw + i];
+			const MeshVBO *mesh = draw.mesh;
+			float *entry = &draw_list.entries[(group.first_entry + i) * entry_float_count];
+
+			// maps the compact positions onto the bounding box of the mesh
+			Matrix44f transform = draw.transform;
+			if (mesh->position_type == GL_SHORT) {
+				transform = SimpleMath::GL::ScaleMat44 (mesh->position_scale, mesh->position_scale, mesh->position_scale)
+					* SimpleMath::GL::TranslateMat44 (mesh->position_offset[0], mesh->position_offset[1], mesh->position_offset[2])
+					* transform;
+			}
+
+			Matrix44f normal_transform (Matrix44f::Identity());
+			normal_transform.block<3,3>(0,0) = normal_transformation (transform);
+
+			memcpy (entry, transform.data(), 16 * sizeof(float));
+			memcpy (entry + 16, normal_transform.data(), 16 * sizeof(float));
+			memcpy (entry + 32, draw.color.data(), 4 * sizeof(float));
+			entry[36] = mesh->has_colors ? 1.f : 0.f;
+			entry[37] = mesh->has_normals ? 1.f : 0.f;
+		}
+	}
+
+	if (draw_list.buffer_id == 0)
+		glGenBuffers (1, &draw_list.buffer_id);
+
+	glBindBuffer (GL_UNIFORM_BUFFER, draw_list.buffer_id);
+	glBufferData (GL_UNIFORM_BUFFER, draw_list.entries.size() * sizeof(float), &draw_list.entries[0], GL_STREAM_DRAW);
+	glBindBuffer (GL_UNIFORM_BUFFER, 0);
+}
+
+void SegmentRenderer::draw (const SegmentDrawList &draw_list) {
+	if (draw_list.groups.size() == 0)
+		return;
+
+	// passes that only write depth values (e.g. of the shadow map) do not
+	// need the lighting
+	GLStateCache &state = get_gl_state_cache();
+	bool writes_color = state.writesColor();
+
+	bool shadow_lookup = writes_color && shadow_map_texture_id != 0;
+
+	glUseProgram (program_id);
+	glUniform1i (lighting_location, writes_color && state.isEnabled (GL_LIGHTING));
+	glUniform1i (shadow_lookup_location, shadow_lookup);
+
+	if (shadow_lookup) {
+		glUniformMatrix4fv (shadow_matrix_location, 1, GL_TRUE, shadow_matrix.data());
+		glUniform1f (shadow_texel_size_location, 1.f / shadow_map_size);
+
+		glActiveTexture (GL_TEXTURE0 + shadow_map_unit);
+		glBindTexture (GL_TEXTURE_2D, shadow_map_texture_id);
+		glActiveTexture (GL_TEXTURE0);
+	}
+
+	const vector<SegmentDraw> &draws = draw_list.draws;
+
+	for (size_t gi = 0; gi < draw_list.groups.size(); gi++) {
+		const SegmentDrawGroup &group = draw_list.groups[gi];
+		MeshVBO *mesh = draws[group.first_draw].mesh;
+		if (mesh->bounds_only || (mesh->vbo_id == 0 && mesh->generate_vbo() == 0))
+			continue;
+
+		state.shadeModel (mesh->smooth_shading ? GL_SMOOTH : GL_FLAT);
+
+		if (mesh->vao_id == 0)
+			mesh->generate_vao();
+		glBindVertexArray (mesh->vao_id);
+
+		// groups with more instances than fit into a uniform block need
+		// several draw calls
+		for (size_t block_start = 0; block_start < group.draw_count; block_start += entries_per_block) {
+			glBindBufferRange (GL_UNIFORM_BUFFER, 0, draw_list.buffer_id,
+					(group.first_entry + block_start) * entry_size, entries_per_block * entry_size);
+
+			size_t block_end = std::min (group.draw_count, block_start + entries_per_block);
+
+			// visible instances with the same level of detail are drawn
+			// together
+			size_t instance_start = block_start;
+			for (size_t i = block_start + 1; i <= block_end; i++) {
+				const SegmentDraw &first = draws[group.first_draw + instance_start];
+				if (i < block_end
+						&& draws[group.first_draw + i].lod_level == first.lod_level
+						&& draws[group.first_draw + i].visible == first.visible)
+					continue;
+
+				if (first.visible) {
+					glUniform1i (first_instance_location, instance_start - block_start);
+					mesh->drawBuffers (GL_TRIANGLES, first.lod_level, i - instance_start);
+				}
+				instance_start = i;
+			}
+		}
+	}
+
+	glBindVertexArray (0);
+	glUseProgram (0);
+}
+
+void SegmentRenderer::setShadowMap (unsigned int texture_id, unsigned int size, const Matrix44f &texture_matrix) {
+	shadow_map_texture_id = texture_id;
+	shadow_map_size = size;
+	shadow_matrix = texture_matrix;
+}
+
+void SegmentRenderer::clearShadowMap () {
+	shadow_map_texture_id = 0;
+}
+
+SegmentRenderer& get_segment_renderer () {
+	static SegmentRenderer renderer;
+	return renderer;
+}
@@ -0,0 +1,214 @@
+/*
+ * MeshUp - A visualization tool for multi-body systems based on skeletal
+ * animation and magic.
+ *
+ * Copyright (c) 2012-2018 Martin Felis <martin.felis@iwr.uni-heidelberg.de>
+ *
+ * Licensed under the MIT license. See LICENSE for more details.
+ */
+
+#ifndef _SEGMENTRENDERER_H
+#define _SEGMENTRENDERER_H
+
+#include <vector>
+#include <cstddef>
+
+#include "Math.h"
+
+struct MeshVBO;
+struct Segment;
+struct SegmentBatch;
+
+/** \brief A mesh that is drawn by the SegmentRenderer. */
+struct SegmentDraw {
+	SegmentDraw() :
+		mesh (NULL),
+		segment (NULL),
+		batch (NULL),
+		transform (Matrix44f::Identity()),
+		color (1.f, 1.f, 1.f, 1.f),
+		lod_level (0),
+		visible (true)
+	{}
+
+	MeshVBO *mesh;
+	/// segment that is drawn, NULL for the meshes of a SegmentBatch
+	Segment *segment;
+	/// batch that is drawn, NULL for single segments
+	SegmentBatch *batch;
+	/// transformation of the mesh into the model
+	Matrix44f transform;
+	/// used if the mesh has no vertex colors
+	Vector4f color;
+	/// level of detail for the current pass
+	unsigned int lod_level;
+	/// cleared if the mesh is outside the view frustum of the current pass
+	bool visible;
+};
+
+/** \brief Consecutive draws of the same mesh that are drawn as instances.
+ */
+struct SegmentDrawGroup {
+	SegmentDrawGroup() :
+		first_draw (0),
+		draw_count (0),
+		first_entry (0)
+	{}
+
+	size_t first_draw;
+	size_t draw_count;
+	/// entry of the first draw in the uniform buffer, the entries of the
+	/// other draws follow it
+	size_t first_entry;
+};
+
+/** \brief The meshes of a model and the uniform buffer that contains
+ * their transformations and colors.
+ *
+ * The buffer is filled once per frame (see SegmentRenderer::upload())
+ * and shared by all passes that draw the model. Copies start out empty.
+ */
+struct SegmentDrawList {
+	SegmentDrawList() :
+		buffer_id (0),
+		frame_index (0)
+	{}
+	SegmentDrawList (const SegmentDrawList &other) :
+		buffer_id (0),
+		frame_index (0)
+	{}
+	SegmentDrawList& operator= (const SegmentDrawList &other) {
+		clear();
+		return *this;
+	}
+	~SegmentDrawList();
+
+	/// Removes all draws so that the list gets filled again before the
+	/// next draw
+	void clear() {
+		draws.clear();
+		groups.clear();
+		frame_index = 0;
+	}
+
+	/// sorted by the SegmentRenderer so that draws of the same mesh follow
+	/// each other
+	std::vector<SegmentDraw> draws;
+	std::vector<SegmentDrawGroup> groups;
+	std::vector<float> entries;
+	unsigned int buffer_id;
+	/// SegmentRenderer::frame_index of the last upload, 0 if the list has
+	/// to be filled again
+	unsigned int frame_index;
+};
+
+/** \brief Draws segments with shaders instead of the fixed function
+ * pipeline.
+ *
+ * The transformation and color of every segment are stored in a uniform
+ * buffer. All segments that share a mesh (and level of detail) are drawn
+ * with a single instanced draw call, the instances pick their entry of
+ * the buffer by their instance id. Each mesh uses a vertex array object,
+ * so the number of draw calls and state changes depends on the number of
+ * different meshes and not on the number of segments.
+ *
+ * The shaders use the fixed function lighting state (only GL_LIGHT0 and
+ * color material) so that both paths produce the same images. With a
+ * shadow map (see setShadowMap()) the lit and the shadowed colors are
+ * computed in a single pass and blended by a hardware filtered lookup
+ * of the shadow map (or 3x3 of them with soft_shadows).
+ */
+struct SegmentRenderer {
+	SegmentRenderer() :
+		enabled (true),
+		soft_shadows (false),
+		initialized (false),
+		frame_index (1),
+		program_id (0),
+		first_instance_location (-1),
+		lighting_location (-1),
+		shadow_lookup_location (-1),
+		shadow_matrix_location (-1),
+		shadow_texel_size_location (-1),
+		entries_per_block (0),
+		entry_alignment (1),
+		shadow_map_texture_id (0),
+		shadow_map_size (1),
+		shadow_matrix (Matrix44f::Identity())
+	{}
+
+	/** \brief Compiles the shaders, needs a current OpenGL context.
+	 *
+	 * \returns false if the shaders are not supported in which case the
+	 * fixed function pipeline has to be used.
+	 */
+	bool init();
+	/// true if the segments should be drawn with the shaders
+	bool isActive() const {
+		return enabled && initialized;
+	}
+	/// Invalidates the buffers of all draw lists
+	void beginFrame() {
+		frame_index++;
+		if (frame_index == 0)
+			frame_index = 1;
+	}
+
+	/** \brief Sorts and groups the draws of the list and uploads their
+	 * entries.
+	 *
+	 * Creates the vertex buffers of the meshes if needed, as the
+	 * transformation of compact vertices depends on them.
+	 */
+	void upload (SegmentDrawList &draw_list);
+	/** \brief Draws all visible meshes of the list using the current
+	 * lighting and shadow state.
+	 *
+	 * The levels of detail and the visibility (SegmentDraw::lod_level and
+	 * SegmentDraw::visible) have to be set for the current pass.
+	 */
+	void draw (const SegmentDrawList &draw_list);
+
+	/** \brief Enables the shadows for the following passes that write
+	 * colors.
+	 *
+	 * \param texture_id depth texture with GL_TEXTURE_COMPARE_MODE set
+	 * \param size width and height of the texture
+	 * \param texture_matrix maps eye coordinates to shadow map
+	 * coordinates (column vector convention)
+	 */
+	void setShadowMap (unsigned int texture_id, unsigned int size, const Matrix44f &texture_matrix);
+	void clearShadowMap ();
+
+	/// can be cleared to use the fixed function pipeline
+	bool enabled;
+	/// blurs the shadow edges with 9 instead of 1 lookup of the shadow
+	/// map, has to be set before init()
+	bool soft_shadows;
+	bool initialized;
+	/// incremented by beginFrame()
+	unsigned int frame_index;
+
+	unsigned int program_id;
+	int first_instance_location;
+	int lighting_location;
+	int shadow_lookup_location;
+	int shadow_matrix_location;
+	int shadow_texel_size_location;
+	/// number of entries that fit into one uniform block, i.e. the
+	/// maximum number of instances per draw call
+	size_t entries_per_block;
+	/// groups start at multiples of this number of entries so that their
+	/// offset in the buffer can be bound
+	size_t entry_alignment;
+
+	/// 0 if no shadows are drawn
+	unsigned int shadow_map_texture_id;
+	unsigned int shadow_map_size;
+	Matrix44f shadow_matrix;
+};
+
+/** \brief The renderer that is shared by all models. */
+SegmentRenderer& get_segment_renderer ();
+
+#endif
@@ -38,21 +38,35 @@
 #include "timer.h"
 #include "Animation.h"
 #include "Scene.h"
+#include "MeshLoader.h"
+#include "SegmentRenderer.h"
+#include "GLStateCache.h"
+#include "FrameProfiler.h"
 
 using namespace std;
 
 static bool update_simulation = false;
 
-TimerInfo timer_info;
-double draw_time = 0.;
-int draw_count = 0;
+/// culling statistics of the camera passes of all frames
+CullingStats culling_totals;
+int culling_frame_count = 0;
+/// state changes of all frames
+GLStateStats state_totals;
+int state_frame_count = 0;
 
 Matrix44f camera_projection_matrix (Matrix44f::Identity());
 Matrix44f camera_view_matrix (Matrix44f::Identity());
 Matrix44f light_projection_matrix (Matrix44f::Identity());
 Matrix44f light_view_matrix (Matrix44f::Identity());
-const int shadow_map_size = 512;
 GLuint shadow_map_texture_id = 0;
+/// 0 if the depth pass is drawn into the back buffer
+GLuint shadow_map_framebuffer_id = 0;
+/// cleared if the framebuffer object could not be created
+bool shadow_map_framebuffer_supported = true;
+/// size of the allocated shadow map texture
+int shadow_map_texture_size = 0;
+/// framebuffer that is bound again after the depth pass
+GLint previous_framebuffer_id = 0;
 
 Vector4f light_ka (0.2f, 0.2f, 0.2f, 1.0f);
 Vector4f light_kd (0.7f, 0.7f, 0.7f, 1.0f);
@@ -71,7 +85,10 @@ GLWidget::GLWidget(QWidget *parent)
 		draw_points (true),
 		draw_forces(true),
 		draw_torques(true),
-		white_mode (true)
+		white_mode (true),
+		draw_profiler (false),
+		shadow_map_size (2048),
+		floor_white_mode (true)
 {
 	cam = new Camera();
 	cam->width = width();
@@ -90,9 +107,32 @@ GLWidget::GLWidget(QWidget *parent)
 }
 
 GLWidget::~GLWidget() {
-	cerr << "DESTRUCTOR: drawing time: " << draw_time << "(s) count: " << draw_count << " ~" << draw_time / draw_count << "(s) per draw" << endl;
+	FrameProfiler &profiler = get_frame_profiler();
+	if (profiler.historyCount() > 0) {
+		FrameProfile average = profiler.average();
+		cerr << "DESTRUCTOR: frame time of the last " << profiler.historyCount() << " frames: ~" << average.frame_time << "ms, cpu:";
+		for (unsigned int i = 0; i < ProfileCpuSectionCount; i++)
+			cerr << " " << profile_cpu_section_name (static_cast<ProfileCpuSection>(i)) << " ~" << average.cpu_time[i] << "ms";
+		if (average.gpuTimeValid()) {
+			cerr << ", gpu:";
+			for (unsigned int i = 0; i < ProfileGpuPassCount; i++)
+				cerr << " " << profile_gpu_pass_name (static_cast<ProfileGpuPass>(i)) << " ~" << average.gpu_time[i] << "ms";
+		}
+		cerr << endl;
+	}
+	if (culling_frame_count > 0) {
+		cerr << "DESTRUCTOR: culling: ~" << culling_totals.visible_segments / culling_frame_count << " visible and ~"
+			<< culling_totals.culled_segments / culling_frame_count << " culled segments, ~"
+			<< (culling_totals.node_tests + culling_totals.segment_tests) / culling_frame_count << " frustum tests per frame" << endl;
+	}
+	if (state_frame_count > 0) {
+		cerr << "DESTRUCTOR: state changes: ~" << state_totals.state_changes / state_frame_count << " issued and ~"
+			<< state_totals.redundant_changes / state_frame_count << " skipped, ~"
+			<< state_totals.driver_queries / state_frame_count << " driver queries per frame" << endl;
+	}
 
 	makeCurrent();
+	profiler.releaseQueries();
 }
 
 void GLWidget::actionRenderImage () {
@@ -130,9 +170,14 @@ QImage GLWidget::renderContentOffscreen (int image_width, int image_height, bool
 	int old_width = width();
 	int old_height = height(); 
 
+	// the profiler is not part of the rendered images
+	bool profiler_shown = draw_profiler;
+	draw_profiler = false;
+
 	resizeGL(image_width, image_height);
 	paintGL();
 
+	draw_profiler = profiler_shown;
 	fb->release();
 
 	//reset render parameters
@@ -181,42 +226,52 @@ void GLWidget::saveScreenshot (const char* filename, int width, int height, bool
  ****************/
 void GLWidget::toggle_draw_grid (bool status) {
 	draw_grid = status;
+	emit view_changed();
 }
 
 void GLWidget::toggle_draw_base_axes (bool status) {
 	draw_base_axes = status;
+	emit view_changed();
 }
 
 void GLWidget::toggle_draw_frame_axes (bool status) {
 	draw_frame_axes = status;
+	emit view_changed();
 }
 
 void GLWidget::toggle_draw_floor (bool status) {
 	draw_floor = status;
+	emit view_changed();
 }
 
 void GLWidget::toggle_draw_meshes (bool status) {
 	draw_meshes = status;
+	emit view_changed();
 }
 
 void GLWidget::toggle_draw_shadows (bool status) {
 	draw_shadows = status;
+	emit view_changed();
 }
 
 void GLWidget::toggle_draw_curves (bool status) {
 	draw_curves = status;
+	emit view_changed();
 }
 
 void GLWidget::toggle_draw_points (bool status) {
 	draw_points = status;
+	emit view_changed();
 }
 
 void GLWidget::toggle_draw_forces(bool status) {
 	draw_forces = status;
+	emit view_changed();
 }
 
 void GLWidget::toggle_draw_torques(bool status) {
 	draw_torques = status;
+	emit view_changed();
 }
 
 void GLWidget::toggle_draw_orthographic (bool status) {
@@ -235,6 +290,14 @@ void GLWidget::toggle_white_mode (bool status) {
 	} else {
 		glClearColor (0.f, 0.f, 0.f, 1.f);
 	}
+
+	emit view_changed();
+}
+
+void GLWidget::toggle_draw_profiler (bool status) {
+	draw_profiler = status;
+
+	emit view_changed();
 }
 
 void GLWidget::set_front_view () {
@@ -255,6 +318,8 @@ void GLWidget::set_top_view () {
 void GLWidget::set_light_source(Vector4f pos) {
 	light_position = pos;
 	glLightfv (GL_LIGHT0, GL_POSITION, light_position.data());
+
+	emit view_changed();
 }
 
 void GLWidget::update_timer() {
@@ -329,15 +394,7 @@ void GLWidget::initializeGL()
 	glEnable (GL_NORMALIZE);
 
 	// initialize shadow map texture
-	glGenTextures (1, &shadow_map_texture_id);
-	glBindTexture (GL_TEXTURE_2D, shadow_map_texture_id);
-	glTexImage2D (GL_TEXTURE_2D, 0, GL_DEPTH_COMPONENT,
-			shadow_map_size, shadow_map_size, 
-			0, GL_DEPTH_COMPONENT, GL_UNSIGNED_BYTE, NULL);
-	glTexParameteri (GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
-	glTexParameteri (GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
-	glTexParameteri (GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP);
-	glTexParameteri (GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP);
+	updateShadowMap();
 
 	glColorMaterial (GL_FRONT, GL_AMBIENT_AND_DIFFUSE);
 	glEnable (GL_COLOR_MATERIAL);
@@ -357,6 +414,12 @@ void GLWidget::initializeGL()
 
 	glEnable(GL_DEPTH_CLAMP);
 
+	SegmentRenderer &segment_renderer = get_segment_renderer();
+	if (segment_renderer.enabled && !segment_renderer.init())
+		qDebug() << "Shaders not supported, using the fixed function pipeline";
+
+	qDebug() << "Renderer       : " << (segment_renderer.isActive() ? "shaders" : "fixed function");
+
 
 	emit opengl_initialized();
 }
@@ -375,20 +438,116 @@ void GLWidget::updateLightingMatrices () {
 			(*camera)->up[0], (*camera)->up[1], (*camera)->up[2]);
 	glGetFloatv(GL_MODELVIEW_MATRIX, camera_view_matrix.data());
 
+	// fit the light frustum to the bounding sphere of the scene if the
+	// light is outside of it
+	Vector3f light (light_position[0], light_position[1], light_position[2]);
+	Vector3f bbox_min, bbox_max;
+	Vector3f center (0.f, 0.f, 0.f);
+	float fov = (*camera)->fov;
+	float near = 1.f;
+	float far = 20.f;
+
+	if (scene && scene->getBoundingBox (bbox_min, bbox_max)) {
+		Vector3f bbox_center = (bbox_min + bbox_max) * 0.5f;
+		float radius = std::max ((bbox_max - bbox_min).norm() * 0.5f, 1.0e-3f);
+		float distance = (light - bbox_center).norm();
+
+		if (distance > radius * 1.01f) {
+			center = bbox_center;
+			fov = 2.f * asinf (radius / distance) * 180.f / M_PI;
+			near = std::max (distance - radius, distance * 1.0e-3f);
+			far = distance + radius;
+		}
+	}
+
+	Vector3f light_direction = (center - light).normalized();
+	Vector3f up (0.f, 1.f, 0.f);
+	if (fabs (light_direction.dot (up)) > 0.99f)
+		up.set (0.f, 0.f, 1.f);
+
 	glLoadIdentity();
-	gluPerspective((*camera)->fov, 1.0f, 1.0f, 20.0f);
+	gluPerspective(fov, 1.0f, near, far);
 	glGetFloatv(GL_MODELVIEW_MATRIX, light_projection_matrix.data());
 
 	glLoadIdentity();
 	gluLookAt( light_position[0], light_position[1], light_position[2],
-			0.0f, 0.0f, 0.0f,
-			0.0f, 1.0f, 0.0f);
+			center[0], center[1], center[2],
+			up[0], up[1], up[2]);
 	glGetFloatv(GL_MODELVIEW_MATRIX, light_view_matrix.data());
 
 	glPopMatrix();
 }
 
-void draw_checkers_board_shaded(bool white_mode) {
+void GLWidget::updateShadowMap () {
+	// without framebuffer objects the depth pass is drawn into the back
+	// buffer which limits the size
+	bool use_framebuffer = shadow_map_framebuffer_supported
+		&& (GLEW_VERSION_3_0 || GLEW_ARB_framebuffer_object);
+
+	GLint max_size;
+	glGetIntegerv (GL_MAX_TEXTURE_SIZE, &max_size);
+	int size = use_framebuffer ? std::min (std::max (shadow_map_size, 1), (int) max_size) : 512;
+
+	if (size == shadow_map_texture_size)
+		return;
+
+	if (shadow_map_texture_id == 0)
+		glGenTextures (1, &shadow_map_texture_id);
+
+	glBindTexture (GL_TEXTURE_2D, shadow_map_texture_id);
+	glTexImage2D (GL_TEXTURE_2D, 0, GL_DEPTH_COMPONENT24,
+			size, size,
+			0, GL_DEPTH_COMPONENT, GL_UNSIGNED_INT, NULL);
+	glTexParameteri (GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+	glTexParameteri (GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+	glTexParameteri (GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+	glTexParameteri (GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+
+	// shadow map comparison should be true (i.e. not in shadow)
+	// if r <= texture
+	glTexParameteri (GL_TEXTURE_2D, GL_TEXTURE_COMPARE_MODE_ARB, GL_COMPARE_R_TO_TEXTURE);
+	glTexParameteri (GL_TEXTURE_2D, GL_TEXTURE_COMPARE_FUNC_ARB, GL_LEQUAL);
+	glBindTexture (GL_TEXTURE_2D, 0);
+
+	if (use_framebuffer) {
+		if (shadow_map_framebuffer_id == 0)
+			glGenFramebuffers (1, &shadow_map_framebuffer_id);
+
+		glGetIntegerv (GL_FRAMEBUFFER_BINDING, &previous_framebuffer_id);
+		glBindFramebuffer (GL_FRAMEBUFFER, shadow_map_framebuffer_id);
+		glFramebufferTexture2D (GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_TEXTURE_2D, shadow_map_texture_id, 0);
+		glDrawBuffer (GL_NONE);
+		glReadBuffer (GL_NONE);
+
+		GLenum status = glCheckFramebufferStatus (GL_FRAMEBUFFER);
+		glBindFramebuffer (GL_FRAMEBUFFER, previous_framebuffer_id);
+
+		if (status != GL_FRAMEBUFFER_COMPLETE) {
+			qDebug() << "Warning: could not create the shadow map framebuffer, using the back buffer instead.";
+			glDeleteFramebuffers (1, &shadow_map_framebuffer_id);
+			shadow_map_framebuffer_id = 0;
+			shadow_map_framebuffer_supported = false;
+			updateShadowMap();
+			return;
+		}
+	}
+
+	shadow_map_texture_size = size;
+	qDebug() << "Shadow map     : " << size << "x" << size << (shadow_map_framebuffer_id != 0 ? "(framebuffer object)" : "(back buffer)");
+}
+
+/** Maps world coordinates to the texture coordinates of the shadow map
+ * (column vector convention). */
+static Matrix44f shadow_texture_matrix () {
+	Matrix44f bias_matrix (
+			0.5f, 0.0f, 0.0f, 0.0f,
+			0.0f, 0.5f, 0.0f, 0.0f,
+			0.0f, 0.0f, 0.5f, 0.0f,
+			0.5f, 0.5f, 0.5f, 1.0f);
+	return bias_matrix.transpose() * light_projection_matrix.transpose() * light_view_matrix.transpose();
+}
+
+static MeshVBO create_checkers_board_shaded(bool white_mode) {
 	float length = 16.f;
 	int count = 32;
 	float xmin (-length),
@@ -403,7 +562,6 @@ void draw_checkers_board_shaded(bool white_mode) {
 	shade_width = 5.f;
 	float m = 1.f / (shade_width);
 	Vector4f clear_color;
-	glGetFloatv (GL_COLOR_CLEAR_VALUE, clear_color.data());
 
 	if (white_mode)
 		clear_color.set (1.f, 1.f, 1.f, 1.f);
@@ -412,10 +570,11 @@ void draw_checkers_board_shaded(bool white_mode) {
 
 	Vector4f ground_color (0.5f, 0.5f, 0.5f, 1.f);
 
-	glDisable (GL_LIGHTING);
-	glEnable(GL_DEPTH_TEST);
-
-	glBegin (GL_QUADS);
+	// the grid lies exactly on the floor, so both keep their float
+	// positions
+	MeshVBO result;
+	result.compact_vertices = false;
+	result.begin();
 
 	for (int i = 0; i < count; i++) {
 		float x_shift = (i % 2) * xstep;
@@ -436,33 +595,23 @@ void draw_checkers_board_shaded(bool white_mode) {
 
 			assert (alpha >= 0.f &&  alpha <= 1.f);
 
-			// upper left
-			Vector4f color = ground_color;
-
-			color = (1.f - alpha) * clear_color + ground_color * alpha;
-
-		//	if (color[0] <= 0.f
-		//			&& color[1] <= 0.f
-		//			&& color[2] <= 0.f
-		//		 )
-		//		continue;
-
-			glColor4fv (color.data());
-			glVertex3fv (v0.data());
-			glColor4fv (color.data());
-			glVertex3fv (v1.data());
-			glColor4fv (color.data());
-			glVertex3fv (v2.data());
-			glColor4fv (color.data());
-			glVertex3fv (v3.data());
+			Vector4f color = (1.f - alpha) * clear_color + ground_color * alpha;
+
+			// two triangles per quad
+			const Vector3f* quad_vertices[6] = { &v0, &v1, &v2, &v0, &v2, &v3 };
+			for (int k = 0; k < 6; k++) {
+				result.addColor4fv (color.data());
+				result.addVertex3fv (quad_vertices[k]->data());
+			}
 		}
 	}
 
-	glEnd();
-	glEnable (GL_LIGHTING);
+	result.end();
+
+	return result;
 }
 
-void GLWidget::drawGrid() {
+static MeshVBO create_grid() {
 	float xmin, xmax, xstep, zmin, zmax, zstep;
 	int i, count;
 
@@ -476,42 +625,216 @@ void GLWidget::drawGrid() {
 	xstep = fabs (xmin - xmax) / (float)count;
 	zstep = fabs (zmin - zmax) / (float)count;
 
-	glDisable (GL_LIGHTING);
-	glColor3f (0.2f, 0.2f, 0.2f);
-	glLineWidth(2.f);
-	glBegin (GL_LINES);
+	MeshVBO result;
+	result.compact_vertices = false;
+	result.begin();
+
 	for (i = 0; i <= count; i++) {
-		glColor3f (0.2f, 0.2f, 0.2f);
-		glVertex3f (i * xstep + xmin, 0., zmin);
-		glColor3f (0.2f, 0.2f, 0.2f);
-		glVertex3f (i * xstep + xmin, 0., zmax);
-		glColor3f (0.2f, 0.2f, 0.2f);
-		glVertex3f (xmin, 0, i * zstep + zmin);
-		glColor3f (0.2f, 0.2f, 0.2f);
-		glVertex3f (xmax, 0, i * zstep + zmin);
+		result.addColor3f (0.2f, 0.2f, 0.2f);
+		result.addVertex3f (i * xstep + xmin, 0., zmin);
+		result.addColor3f (0.2f, 0.2f, 0.2f);
+		result.addVertex3f (i * xstep + xmin, 0., zmax);
+		result.addColor3f (0.2f, 0.2f, 0.2f);
+		result.addVertex3f (xmin, 0, i * zstep + zmin);
+		result.addColor3f (0.2f, 0.2f, 0.2f);
+		result.addVertex3f (xmax, 0, i * zstep + zmin);
+	}
+
+	result.end();
+
+	return result;
+}
+
+void GLWidget::drawFloor() {
+	GLStateCache &state = get_gl_state_cache();
+
+	if (floor_mesh.vbo_id == 0 || floor_white_mode != white_mode) {
+		floor_mesh.delete_vbo();
+		floor_mesh = create_checkers_board_shaded (white_mode);
+		floor_white_mode = white_mode;
+	}
+
+	state.disable (GL_LIGHTING);
+	state.enable (GL_DEPTH_TEST);
+
+	floor_mesh.draw (GL_TRIANGLES);
+
+	state.enable (GL_LIGHTING);
+}
+
+void GLWidget::drawGrid() {
+	GLStateCache &state = get_gl_state_cache();
+
+	if (grid_mesh.vbo_id == 0)
+		grid_mesh = create_grid();
+
+	state.disable (GL_LIGHTING);
+	glLineWidth(2.f);
+
+	grid_mesh.draw (GL_LINES);
+
+	state.enable (GL_LIGHTING);
+}
+
+/// colors of the CPU sections in the profiler graph, followed by the
+/// color of the time that is not covered by a section
+static const Vector3f profiler_cpu_colors[ProfileCpuSectionCount + 1] = {
+	Vector3f (0.9f, 0.6f, 0.2f),
+	Vector3f (0.3f, 0.6f, 1.0f),
+	Vector3f (0.3f, 0.8f, 0.3f),
+	Vector3f (0.9f, 0.3f, 0.3f),
+	Vector3f (0.5f, 0.5f, 0.5f)
+};
+static const Vector3f profiler_gpu_color (0.9f, 0.2f, 0.9f);
+
+void GLWidget::drawProfiler() {
+	GLStateCache &state = get_gl_state_cache();
+	FrameProfiler &profiler = get_frame_profiler();
+
+	// graph in the lower left corner, one bar per frame
+	const float graph_x = 10.f;
+	const float graph_y = 10.f;
+	const float graph_height = 100.f;
+	const float bar_width = 2.f;
+	const float graph_width = bar_width * profiler.history_size;
+
+	// the graph shows at least two frames at 60Hz
+	double max_time = 1000. / 30.;
+	for (unsigned int i = 0; i < profiler.historyCount(); i++) {
+		const FrameProfile &frame = profiler.historyFrame (i);
+		max_time = std::max (max_time, std::max (frame.frame_time, frame.cpuTime()));
+		if (frame.gpuTimeValid())
+			max_time = std::max (max_time, frame.gpuTime());
+	}
+	float scale = graph_height / static_cast<float>(max_time);
+
+	profiler_lines.clear();
+
+	Vector3f reference_color (0.4f, 0.4f, 0.4f);
+	const double reference_times[2] = { 1000. / 60., 1000. / 30. };
+	for (unsigned int i = 0; i < 2; i++) {
+		float y = graph_y + static_cast<float>(reference_times[i]) * scale;
+		profiler_lines.addLine (Vector3f (graph_x, y, 0.f), Vector3f (graph_x + graph_width, y, 0.f), reference_color);
+	}
+
+	bool previous_gpu_valid = false;
+	Vector3f previous_gpu_point;
+
+	for (unsigned int i = 0; i < profiler.historyCount(); i++) {
+		const FrameProfile &frame = profiler.historyFrame (i);
+		float x = graph_x + (static_cast<float>(i) + 0.5f) * bar_width;
+
+		// stacked CPU sections
+		float y = graph_y;
+		for (unsigned int j = 0; j <= ProfileCpuSectionCount; j++) {
+			double section_time = 0.;
+			if (j < ProfileCpuSectionCount)
+				section_time = frame.cpu_time[j];
+			else
+				section_time = std::max (0., frame.frame_time - frame.cpuTime());
+
+			float height = static_cast<float>(section_time) * scale;
+			if (height <= 0.f)
+				continue;
+
+			profiler_lines.addLine (Vector3f (x, y, 0.f), Vector3f (x, y + height, 0.f), profiler_cpu_colors[j], bar_width);
+			y += height;
+		}
+
+		// GPU time as a line over the bars
+		if (!frame.gpuTimeValid()) {
+			previous_gpu_valid = false;
+			continue;
+		}
+
+		Vector3f gpu_point (x, graph_y + static_cast<float>(frame.gpuTime()) * scale, 0.f);
+		if (previous_gpu_valid)
+			profiler_lines.addLine (previous_gpu_point, gpu_point, profiler_gpu_color);
+
+		previous_gpu_point = gpu_point;
+		previous_gpu_valid = true;
+	}
+
+	// pixel coordinates with the origin in the lower left corner
+	glMatrixMode (GL_PROJECTION);
+	glPushMatrix();
+	glLoadIdentity();
+	glOrtho (0., windowWidth, 0., windowHeight, -1., 1.);
+
+	glMatrixMode (GL_MODELVIEW);
+	glPushMatrix();
+	glLoadIdentity();
+
+	state.disable (GL_LIGHTING);
+	state.disable (GL_DEPTH_TEST);
+
+	profiler_lines.draw();
+
+	// legend with the averages next to the graph, text positions start at
+	// the upper left corner
+	FrameProfile average = profiler.average();
+
+	const int line_height = 14;
+	int text_x = static_cast<int>(graph_x + graph_width + 10.f);
+	int text_y = static_cast<int>(windowHeight - graph_y - graph_height) + line_height;
+
+	if (white_mode)
+		qglColor (Qt::black);
+	else
+		qglColor (Qt::white);
+	renderText (text_x, text_y, QString ("frame %1 ms (max %2 ms)").arg (average.frame_time, 0, 'f', 2).arg (max_time, 0, 'f', 1));
+
+	for (unsigned int j = 0; j < ProfileCpuSectionCount; j++) {
+		text_y += line_height;
+		const Vector3f &color = profiler_cpu_colors[j];
+		qglColor (QColor::fromRgbF (color[0], color[1], color[2]));
+		renderText (text_x, text_y, QString ("%1 %2 ms").arg (QString (profile_cpu_section_name (static_cast<ProfileCpuSection>(j)))).arg (average.cpu_time[j], 0, 'f', 2));
+	}
+
+	text_y += line_height;
+	qglColor (QColor::fromRgbF (profiler_gpu_color[0], profiler_gpu_color[1], profiler_gpu_color[2]));
+	if (average.gpuTimeValid()) {
+		QString gpu_text = QString ("gpu %1 ms:").arg (average.gpuTime(), 0, 'f', 2);
+		for (unsigned int j = 0; j < ProfileGpuPassCount; j++)
+			gpu_text += QString (" %1 %2").arg (QString (profile_gpu_pass_name (static_cast<ProfileGpuPass>(j)))).arg (average.gpu_time[j], 0, 'f', 2);
+		renderText (text_x, text_y, gpu_text);
+	} else {
+		renderText (text_x, text_y, "gpu n/a");
 	}
-	glEnd ();
-	glEnable (GL_LIGHTING);
+
+	glMatrixMode (GL_PROJECTION);
+	glPopMatrix();
+	glMatrixMode (GL_MODELVIEW);
+	glPopMatrix();
 }
 
 void GLWidget::drawScene() {
+	GLStateCache &state = get_gl_state_cache();
+
 	if (!scene) {
 		return;
 	}
 	emit start_draw();
 
+	FrameProfiler &profiler = get_frame_profiler();
+
+	profiler.beginGpu (ProfileFloorPass);
 	if (draw_grid) {
 		drawGrid();
 	}
 
 	if (draw_floor) {
-		draw_checkers_board_shaded(white_mode);
+		drawFloor();
 	}
+	profiler.endGpu();
 
 	if (draw_meshes) {
+		profiler.beginGpu (ProfileMeshPass);
 		scene->drawMeshes();
+		profiler.endGpu();
 	}
 
+	profiler.beginGpu (ProfileOverlayPass);
 	if (draw_base_axes) {
 		scene->drawBaseFrameAxes();
 	}
@@ -519,11 +842,11 @@ void GLWidget::drawScene() {
 		scene->drawFrameAxes();
 	}
 
-	bool depth_test_enabled = glIsEnabled (GL_DEPTH_TEST);
+	bool depth_test_enabled = state.isEnabled (GL_DEPTH_TEST);
 	if (depth_test_enabled) {
-		glDisable (GL_DEPTH_TEST);
+		state.disable (GL_DEPTH_TEST);
 	}
-	glDisable (GL_LIGHTING);
+	state.disable (GL_LIGHTING);
 
 	if (draw_forces) {
 		scene->drawForces();
@@ -538,20 +861,18 @@ void GLWidget::drawScene() {
 		scene->drawCurves();
 	}
 
-	glEnable (GL_LIGHTING);
+	state.enable (GL_LIGHTING);
 
 	if (depth_test_enabled){
-		glEnable (GL_DEPTH_TEST);
-	}
-
-	/*
-	if (draw_count % 100 == 0) {
-		qDebug() << "drawing time: " << draw_time << "(s) count: " << draw_count << " ~" << draw_time / draw_count << "(s) per draw";
+		state.enable (GL_DEPTH_TEST);
 	}
-	*/
+	profiler.endGpu();
 }
 
 void GLWidget::shadowMapSetupPass1 () {
+	GLStateCache &state = get_gl_state_cache();
+
+	updateShadowMap();
 	updateLightingMatrices();
 
 	// 1st pass: from light's pont of view
@@ -561,30 +882,42 @@ void GLWidget::shadowMapSetupPass1 () {
 	glMatrixMode(GL_MODELVIEW);
 	glLoadMatrixf(light_view_matrix.data());
 
+	// draw into the shadow map directly if possible
+	if (shadow_map_framebuffer_id != 0) {
+		glGetIntegerv (GL_FRAMEBUFFER_BINDING, &previous_framebuffer_id);
+		glBindFramebuffer (GL_FRAMEBUFFER, shadow_map_framebuffer_id);
+		glClear (GL_DEPTH_BUFFER_BIT);
+	}
+
 	// set viewport to shadow map size
-	glViewport (0, 0, shadow_map_size, shadow_map_size);
+	glViewport (0, 0, shadow_map_texture_size, shadow_map_texture_size);
 
 	// draw the back faces
-	glEnable (GL_CULL_FACE);
+	state.enable (GL_CULL_FACE);
 	glCullFace (GL_FRONT);
 
 	// disable color writes and use cheap flat shading
-	glShadeModel (GL_FLAT);
-	glColorMask (0, 0, 0, 0);
+	state.shadeModel (GL_FLAT);
+	state.colorMask (false);
 }
 
-void GLWidget::shadowMapSetupPass2 () {
-	// read the depth buffer back into the shadow map
-	glBindTexture (GL_TEXTURE_2D, shadow_map_texture_id);
-	glCopyTexSubImage2D (GL_TEXTURE_2D, 0, 0, 0, 0, 0, shadow_map_size, shadow_map_size);
+void GLWidget::shadowMapFinishDepthPass () {
+	GLStateCache &state = get_gl_state_cache();
+
+	if (shadow_map_framebuffer_id != 0) {
+		glBindFramebuffer (GL_FRAMEBUFFER, previous_framebuffer_id);
+	} else {
+		// read the depth buffer back into the shadow map
+		glBindTexture (GL_TEXTURE_2D, shadow_map_texture_id);
+		glCopyTexSubImage2D (GL_TEXTURE_2D, 0, 0, 0, 0, 0, shadow_map_texture_size, shadow_map_texture_size);
+		glClear (GL_DEPTH_BUFFER_BIT);
+	}
 
 	// restore previous states
 	glCullFace (GL_BACK);
-	glShadeModel (GL_SMOOTH);
-	glColorMask (1, 1, 1, 1);
+	state.shadeModel (GL_SMOOTH);
+	state.colorMask (true);
 
-	// 2nd pass: draw with dim light
-	glClear (GL_DEPTH_BUFFER_BIT);
 	glMatrixMode (GL_PROJECTION);
 	glLoadMatrixf (camera_projection_matrix.data());
 
@@ -592,30 +925,45 @@ void GLWidget::shadowMapSetupPass2 () {
 	glLoadMatrixf (camera_view_matrix.data());
 
 	glViewport (0, 0, windowWidth, windowHeight);
+}
+
+void GLWidget::shadowMapSetupLitPass () {
+	GLStateCache &state = get_gl_state_cache();
+
+	// the segment shaders draw the lit and the shadowed parts at once
+	glLightfv(GL_LIGHT0, GL_POSITION, light_position.data());
+	glLightfv(GL_LIGHT0, GL_DIFFUSE,  light_kd.data());
+	glLightfv(GL_LIGHT0, GL_SPECULAR, light_ks.data());
+
+	state.enable (GL_LIGHT0);
+	state.enable (GL_LIGHTING);
+
+	// the shaders get eye coordinates
+	Matrix44f texture_matrix = shadow_texture_matrix() * camera_view_matrix.transpose().inverse();
+	get_segment_renderer().setShadowMap (shadow_map_texture_id, shadow_map_texture_size, texture_matrix);
+}
+
+void GLWidget::shadowMapSetupPass2 () {
+	GLStateCache &state = get_gl_state_cache();
 
-	// setup dim light
+	// 2nd pass: draw with dim light
 	glLightfv(GL_LIGHT0, GL_POSITION, light_position.data());
 	//glLightfv(GL_LIGHT0, GL_AMBIENT,  (light_ka * 0.1f).data());
 	glLightfv(GL_LIGHT0, GL_DIFFUSE,  (light_kd * 0.1f).data());
 	glLightfv(GL_LIGHT0, GL_SPECULAR, Vector4f (0.f, 0.f, 0.f, 0.f).data());
 
-	glEnable(GL_LIGHT0);	
-	glEnable(GL_LIGHTING);
+	state.enable (GL_LIGHT0);	
+	state.enable (GL_LIGHTING);
 }
 
 void GLWidget::shadowMapSetupPass3 () {
+	GLStateCache &state = get_gl_state_cache();
+
 	// 3rd pass: draw the lighted area
 	glLightfv(GL_LIGHT0, GL_DIFFUSE,  light_kd.data());
 	glLightfv(GL_LIGHT0, GL_SPECULAR, Vector4f (1.f, 1.f, 1.f, 1.f).data());
 
-	Matrix44f bias_matrix (
-			0.5f, 0.0f, 0.0f, 0.0f,
-			0.0f, 0.5f, 0.0f, 0.0f,
-			0.0f, 0.0f, 0.5f, 0.0f,
-			0.5f, 0.5f, 0.5f, 1.0f);
-	Matrix44f texture_matrix = bias_matrix.transpose() * light_projection_matrix.transpose() * light_view_matrix.transpose();
-
-	texture_matrix = texture_matrix;
+	Matrix44f texture_matrix = shadow_texture_matrix();
 
 	// setup texture coordinate generaton
 	Vector4f row;
@@ -628,7 +976,7 @@ void GLWidget::shadowMapSetupPass3 () {
 			);
 	glTexGeni(GL_S, GL_TEXTURE_GEN_MODE, GL_EYE_LINEAR);
 	glTexGenfv(GL_S, GL_EYE_PLANE, row.data());
-	glEnable(GL_TEXTURE_GEN_S);
+	state.enable (GL_TEXTURE_GEN_S);
 
 	row_i = 1;
 	row.set (
@@ -639,7 +987,7 @@ void GLWidget::shadowMapSetupPass3 () {
 			);
 	glTexGeni(GL_T, GL_TEXTURE_GEN_MODE, GL_EYE_LINEAR);
 	glTexGenfv(GL_T, GL_EYE_PLANE, row.data());
-	glEnable(GL_TEXTURE_GEN_T);
+	state.enable (GL_TEXTURE_GEN_T);
 
 	row_i = 2;
 	row.set (
@@ -650,7 +998,7 @@ void GLWidget::shadowMapSetupPass3 () {
 			);
 	glTexGeni(GL_R, GL_TEXTURE_GEN_MODE, GL_EYE_LINEAR);
 	glTexGenfv(GL_R, GL_EYE_PLANE, row.data());
-	glEnable(GL_TEXTURE_GEN_R);
+	state.enable (GL_TEXTURE_GEN_R);
 
 	row_i = 3;
 	row.set (
@@ -661,11 +1009,11 @@ void GLWidget::shadowMapSetupPass3 () {
 			);
 	glTexGeni(GL_Q, GL_TEXTURE_GEN_MODE, GL_EYE_LINEAR);
 	glTexGenfv(GL_Q, GL_EYE_PLANE, row.data());
-	glEnable(GL_TEXTURE_GEN_Q);	
+	state.enable (GL_TEXTURE_GEN_Q);	
 
 	// bind and enable shadow map texture
 	glBindTexture (GL_TEXTURE_2D, shadow_map_texture_id);
-	glEnable (GL_TEXTURE_2D);
+	state.enable (GL_TEXTURE_2D);
 
 	// enable shadow comparison
 	glTexParameteri (GL_TEXTURE_2D, GL_TEXTURE_COMPARE_MODE_ARB, GL_COMPARE_R_TO_TEXTURE);
@@ -679,25 +1027,46 @@ void GLWidget::shadowMapSetupPass3 () {
 
 	// set alpha test to discard false comparisons
 	glAlphaFunc (GL_GEQUAL, 0.99f);
-	glEnable (GL_ALPHA_TEST);
+	state.enable (GL_ALPHA_TEST);
 }
 
 void GLWidget::shadowMapCleanup() {
+	GLStateCache &state = get_gl_state_cache();
+
 	// reset the state
-	glDisable (GL_TEXTURE_2D);
+	get_segment_renderer().clearShadowMap();
+
+	state.disable (GL_TEXTURE_2D);
 
-	glDisable (GL_TEXTURE_GEN_S);
-	glDisable (GL_TEXTURE_GEN_T);
-	glDisable (GL_TEXTURE_GEN_R);
-	glDisable (GL_TEXTURE_GEN_Q);
+	state.disable (GL_TEXTURE_GEN_S);
+	state.disable (GL_TEXTURE_GEN_T);
+	state.disable (GL_TEXTURE_GEN_R);
+	state.disable (GL_TEXTURE_GEN_Q);
 
-	glDisable (GL_LIGHTING);
-	glDisable (GL_ALPHA_TEST);
+	state.disable (GL_LIGHTING);
+	state.disable (GL_ALPHA_TEST);
 }
 
 void GLWidget::paintGL() {
+	GLStateCache &state = get_gl_state_cache();
+	FrameProfiler &profiler = get_frame_profiler();
+
+	// the timer queries of the previous frames that have finished by now
+	profiler.collectGpuResults();
+	profiler.beginCpu (ProfileDrawSubmission);
+
 	update_timer();
 
+	// move meshes that were loaded in the background into place
+	get_lazy_mesh_loader().processFinishedLoads();
+
+	// segment transformations get uploaded again
+	get_segment_renderer().beginFrame();
+
+	// Qt may have changed the state since the last frame
+	state.invalidate();
+	state.resetStats();
+
 	glMatrixMode (GL_MODELVIEW);
 	glLoadIdentity();
 
@@ -706,29 +1075,54 @@ void GLWidget::paintGL() {
 	glClear (GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
 
 	if (draw_shadows) {
-		// start the shadow mapping magic!
+		// start the shadow mapping magic! Only the meshes cast shadows.
+		profiler.beginGpu (ProfileShadowMapPass);
 		shadowMapSetupPass1();
-		drawScene();
+		if (scene && draw_meshes)
+			scene->drawMeshes();
 
-		shadowMapSetupPass2();
-		drawScene();
+		shadowMapFinishDepthPass();
+		profiler.endGpu();
 
-		shadowMapSetupPass3();
-		drawScene();
+		if (get_segment_renderer().isActive()) {
+			shadowMapSetupLitPass();
+			drawScene();
+		} else {
+			shadowMapSetupPass2();
+			drawScene();
+
+			shadowMapSetupPass3();
+			drawScene();
+		}
 
 		shadowMapCleanup();
 	} else {
-		glDisable (GL_CULL_FACE);
+		state.disable (GL_CULL_FACE);
 	
 		glLightfv(GL_LIGHT0, GL_POSITION, light_position.data());
 		glLightfv(GL_LIGHT0, GL_DIFFUSE,  light_kd.data());
-		glEnable(GL_LIGHT0);	
-		glEnable(GL_LIGHTING);
+		state.enable (GL_LIGHT0);	
+		state.enable (GL_LIGHTING);
 
 		drawScene();
-		glDisable(GL_LIGHTING);
+		state.disable (GL_LIGHTING);
+	}
+
+	// the last pass used the camera frustum
+	if (scene && draw_meshes) {
+		culling_totals += scene->culling_stats;
+		culling_frame_count++;
 	}
 
+	state_totals += state.stats;
+	state_frame_count++;
+
+	profiler.endCpu();
+
+	// not measured, it only shows the frames that were already finished
+	if (draw_profiler)
+		drawProfiler();
+
 	GLenum gl_error = glGetError();
 	if (gl_error != GL_NO_ERROR) {
 		cout << "OpenGL Error: " << gluErrorString(gl_error) << endl;
@@ -790,7 +1184,5 @@ void GLWidget::mouseMoveEvent(QMouseEvent *event)
 	}
 
 	lastMousePos = event->pos();
-
-	updateGL();
 }
 
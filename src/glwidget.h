@@ -16,6 +16,8 @@
 
 #include "Camera.h"
 #include "CameraOperator.h"
+#include "MeshVBO.h"
+#include "LineBatch.h"
 
 struct Scene;
 
@@ -50,6 +52,10 @@ class GLWidget : public QGLWidget
 		bool draw_torques;
 
 		bool white_mode;
+		/// shows the frame times of the last frames
+		bool draw_profiler;
+		/// requested width and height of the shadow map
+		int shadow_map_size;
 
 		Vector4f light_position;
 
@@ -64,6 +70,8 @@ class GLWidget : public QGLWidget
 	protected:
 		void update_timer();
 		void drawGrid();
+		void drawFloor();
+		void drawProfiler();
 
 		void initializeGL();
 		void drawScene ();
@@ -76,8 +84,21 @@ class GLWidget : public QGLWidget
 
 	private:
 		void updateLightingMatrices();
+		/// (Re-)creates the shadow map if its size changed
+		void updateShadowMap();
+
+		/// static buffers of the floor and the grid, the floor is
+		/// rebuilt when white_mode changes
+		MeshVBO floor_mesh;
+		MeshVBO grid_mesh;
+		bool floor_white_mode;
+
+		/// bars of the profiler graph
+		LineBatch profiler_lines;
 
 		void shadowMapSetupPass1();
+		void shadowMapFinishDepthPass();
+		void shadowMapSetupLitPass();
 		void shadowMapSetupPass2();
 		void shadowMapSetupPass3();
 		void shadowMapCleanup();
@@ -105,6 +126,7 @@ class GLWidget : public QGLWidget
 		void toggle_draw_points(bool status);
 		void toggle_draw_orthographic(bool status);
 		void toggle_white_mode(bool status);
+		void toggle_draw_profiler(bool status);
 
 		void toggle_draw_forces(bool status);
 		void toggle_draw_torques(bool status);
@@ -119,6 +141,9 @@ class GLWidget : public QGLWidget
 
 	signals:
 		void camera_changed();
+		/// emitted when a view setting changed and the scene has to be
+		/// drawn again
+		void view_changed();
 		void start_draw();
 		void toggle_camera_fix(bool status);
 		void opengl_initialized();
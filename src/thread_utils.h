@@ -0,0 +1,99 @@
+/*
+ * MeshUp - A visualization tool for multi-body systems based on skeletal
+ * animation and magic.
+ *
+ * Copyright (c) 2012-2018 Martin Felis <martin.felis@iwr.uni-heidelberg.de>
+ *
+ * Licensed under the MIT license. See LICENSE for more details.
+ */
+
+#ifndef _THREAD_UTILS_H
+#define _THREAD_UTILS_H
+
+#include <cstdlib>
+#include <atomic>
+#include <thread>
+#include <vector>
+
+/** \brief Number of worker threads used for parallel work.
+ *
+ * Defaults to the number of hardware threads and can be overridden with
+ * the environment variable MESHUP_THREADS (e.g. on shared machines).
+ */
+inline unsigned int get_worker_thread_count () {
+	const char* env_threads = getenv ("MESHUP_THREADS");
+	if (env_threads) {
+		int count = atoi (env_threads);
+		if (count > 0)
+			return static_cast<unsigned int>(count);
+	}
+
+	unsigned int count = std::thread::hardware_concurrency();
+	if (count == 0)
+		return 1;
+
+	return count;
+}
+
+/** \brief True while the current thread works on the items of a
+ * parallel_for() that uses several threads. */
+inline bool& in_parallel_for () {
+	static thread_local bool active = false;
+	return active;
+}
+
+/** \brief Calls function(i) for all i in [0, count) using a pool of
+ * threads.
+ *
+ * Indices are handed out one at a time so that work items of very
+ * different size (e.g. meshes) are balanced across the threads. The
+ * calling thread takes part in the work and the call returns once all
+ * items are processed. Note that function must not use OpenGL as the
+ * context is only current in the calling thread.
+ *
+ * A parallel_for() within the items of another one that already uses
+ * several threads runs sequentially, so the number of threads stays at
+ * thread_count.
+ */
+template <typename Function>
+void parallel_for (size_t count, Function function, unsigned int thread_count = get_worker_thread_count()) {
+	if (thread_count > count)
+		thread_count = count;
+
+	if (in_parallel_for())
+		thread_count = 1;
+
+	if (thread_count <= 1) {
+		for (size_t i = 0; i < count; i++)
+			function (i);
+
+		return;
+	}
+
+	std::atomic<size_t> next_index (0);
+	auto worker = [&]() {
+		bool was_active = in_parallel_for();
+		in_parallel_for() = true;
+
+		size_t i = next_index++;
+		while (i < count) {
+			function (i);
+			i = next_index++;
+		}
+
+		in_parallel_for() = was_active;
+	};
+
+	std::vector<std::thread> threads;
+	for (unsigned int ti = 0; ti < thread_count - 1; ti++) {
+		threads.push_back (std::thread (worker));
+	}
+
+	worker();
+
+	for (size_t ti = 0; ti < threads.size(); ti++) {
+		threads[ti].join();
+	}
+}
+
+#endif
@@ -0,0 +1,52 @@
+#include <UnitTest++.h>
+
+#include "FrameProfiler.h"
+
+#include <unistd.h>
+
+using namespace std;
+
+TEST (TestFrameProfilerNestedSections) {
+	FrameProfiler profiler;
+
+	profiler.beginFrame();
+	profiler.beginCpu (ProfileScripting);
+	usleep (2000);
+	profiler.beginCpu (ProfileAnimation);
+	usleep (3000);
+	profiler.endCpu();
+	usleep (1000);
+	profiler.endCpu();
+	profiler.endFrame();
+
+	CHECK_EQUAL (1u, profiler.historyCount());
+
+	// the nested section is not counted for the enclosing one
+	const FrameProfile &frame = profiler.historyFrame (0);
+	CHECK (frame.cpu_time[ProfileAnimation] >= 3.);
+	CHECK (frame.cpu_time[ProfileScripting] >= 3.);
+	CHECK (frame.cpu_time[ProfileScripting] < frame.cpu_time[ProfileAnimation] + 2.);
+	CHECK_EQUAL (0., frame.cpu_time[ProfileSegmentUpdate]);
+	CHECK (frame.frame_time >= frame.cpuTime());
+	CHECK (!frame.gpuTimeValid());
+}
+
+TEST (TestFrameProfilerHistory) {
+	FrameProfiler profiler;
+	profiler.history_size = 3;
+
+	for (unsigned int i = 0; i < 5; i++) {
+		profiler.beginFrame();
+		profiler.beginCpu (ProfileDrawSubmission);
+		profiler.endCpu();
+		profiler.endFrame();
+	}
+
+	CHECK_EQUAL (3u, profiler.historyCount());
+	CHECK_EQUAL (2u, profiler.historyFrame (0).frame_number);
+	CHECK_EQUAL (4u, profiler.historyFrame (2).frame_number);
+
+	FrameProfile average = profiler.average();
+	CHECK_EQUAL (0u, average.gpu_results);
+	CHECK (average.frame_time >= average.cpu_time[ProfileDrawSubmission]);
+}
@@ -0,0 +1,194 @@
+#include <UnitTest++.h>
+
+#include "MeshOptimizer.h"
+#include "MeshVBO.h"
+
+#include <algorithm>
+#include <cstdlib>
+#include <vector>
+
+using namespace std;
+
+struct Triangle {
+	Triangle (unsigned int a, unsigned int b, unsigned int c) {
+		v[0] = a; v[1] = b; v[2] = c;
+	}
+	bool operator< (const Triangle &other) const {
+		return lexicographical_compare (v, v + 3, other.v, other.v + 3);
+	}
+	bool operator== (const Triangle &other) const {
+		return v[0] == other.v[0] && v[1] == other.v[1] && v[2] == other.v[2];
+	}
+	unsigned int v[3];
+};
+
+/// Grid of n x n quads in the xy plane with triangles in random order
+static void create_shuffled_grid (unsigned int n, vector<unsigned int> &indices, vector<Vector4f> &vertices) {
+	unsigned int row_size = n + 1;
+	for (unsigned int i = 0; i < row_size; i++) {
+		for (unsigned int j = 0; j < row_size; j++)
+			vertices.push_back (Vector4f (i, j, 0.f, 1.f));
+	}
+
+	vector<Triangle> triangles;
+	for (unsigned int i = 0; i < n; i++) {
+		for (unsigned int j = 0; j < n; j++) {
+			unsigned int a = i * row_size + j;
+			unsigned int b = a + row_size;
+			triangles.push_back (Triangle (a, b, b + 1));
+			triangles.push_back (Triangle (a, b + 1, a + 1));
+		}
+	}
+
+	srand (1);
+	for (size_t i = triangles.size() - 1; i > 0; i--)
+		swap (triangles[i], triangles[rand() % (i + 1)]);
+
+	for (size_t i = 0; i < triangles.size(); i++)
+		indices.insert (indices.end(), triangles[i].v, triangles[i].v + 3);
+}
+
+static vector<Triangle> sorted_triangles (const vector<unsigned int> &indices) {
+	vector<Triangle> result;
+	for (size_t i = 0; i < indices.size(); i += 3)
+		result.push_back (Triangle (indices[i], indices[i + 1], indices[i + 2]));
+
+	sort (result.begin(), result.end());
+	return result;
+}
+
+TEST ( MeshOptimizerACMR ) {
+	// two triangles sharing an edge need four vertices
+	unsigned int quad[] = { 0, 1, 2,  0, 2, 3 };
+	CHECK_EQUAL (2.f, compute_acmr (vector<unsigned int> (quad, quad + 6), 4));
+
+	// without a cache every vertex has to be transformed again
+	CHECK_EQUAL (3.f, compute_acmr (vector<unsigned int> (quad, quad + 6), 4, 0));
+}
+
+TEST ( MeshOptimizerVertexCache ) {
+	vector<unsigned int> indices;
+	vector<Vector4f> vertices;
+	create_shuffled_grid (40, indices, vertices);
+
+	vector<unsigned int> optimized (indices);
+	optimize_vertex_cache (optimized, vertices.size());
+
+	float acmr_before = compute_acmr (indices, vertices.size());
+	float acmr_after = compute_acmr (optimized, vertices.size());
+	CHECK (acmr_before > 2.f);
+	CHECK (acmr_after < 0.8f);
+
+	CHECK (sorted_triangles (indices) == sorted_triangles (optimized));
+
+	// overdraw ordering moves whole clusters only
+	vector<unsigned int> overdraw_optimized (optimized);
+	optimize_overdraw (overdraw_optimized, vertices);
+	CHECK (sorted_triangles (indices) == sorted_triangles (overdraw_optimized));
+	CHECK (compute_acmr (overdraw_optimized, vertices.size()) < 0.8f);
+}
+
+TEST ( MeshOptimizerVertexFetch ) {
+	unsigned int triangles[] = { 3, 1, 4,  3, 4, 2 };
+	vector<unsigned int> indices (triangles, triangles + 6);
+
+	// vertex 0 is not used
+	vector<unsigned int> vertex_order = optimize_vertex_fetch (indices, 5);
+
+	unsigned int expected_indices[] = { 0, 1, 2,  0, 2, 3 };
+	unsigned int expected_order[] = { 3, 1, 4, 2 };
+	CHECK_ARRAY_EQUAL (expected_indices, indices, 6);
+	CHECK_EQUAL (4u, vertex_order.size());
+	CHECK_ARRAY_EQUAL (expected_order, vertex_order, 4);
+}
+
+TEST ( MeshVBOOptimizeVertexOrder ) {
+	MeshVBO sphere = CreateUVSphere (8, 16);
+	MeshVBO optimized (sphere);
+	optimized.optimizeVertexOrder();
+
+	CHECK_EQUAL (sphere.drawCount(), optimized.drawCount());
+	CHECK_EQUAL (optimized.vertices.size(), optimized.normals.size());
+
+	// the same triangles are drawn, only in a different order
+	vector<vector<float> > expected_triangles;
+	vector<vector<float> > actual_triangles;
+	for (size_t i = 0; i < sphere.vertices.size(); i += 3) {
+		vector<float> expected;
+		vector<float> actual;
+		for (size_t k = i; k < i + 3; k++) {
+			const Vector4f &vertex = optimized.vertices[optimized.indices[k]];
+			expected.insert (expected.end(), sphere.vertices[k].data(), sphere.vertices[k].data() + 4);
+			actual.insert (actual.end(), vertex.data(), vertex.data() + 4);
+		}
+		expected_triangles.push_back (expected);
+		actual_triangles.push_back (actual);
+	}
+
+	sort (expected_triangles.begin(), expected_triangles.end());
+	sort (actual_triangles.begin(), actual_triangles.end());
+	CHECK (expected_triangles == actual_triangles);
+}
+
+TEST ( MeshOptimizerSimplify ) {
+	vector<unsigned int> indices;
+	vector<Vector4f> vertices;
+	create_shuffled_grid (20, indices, vertices);
+
+	// a flat grid can be simplified without any error
+	vector<unsigned int> simplified (indices);
+	float error = simplify_mesh (simplified, vertices, 200, 1.f);
+	CHECK (simplified.size() / 3 <= 200);
+	CHECK (simplified.size() / 3 > 0);
+	CHECK_CLOSE (0.f, error, 1.0e-4);
+
+	// the border vertices stay where they are
+	vector<bool> used (vertices.size(), false);
+	for (size_t i = 0; i < simplified.size(); i++)
+		used[simplified[i]] = true;
+	CHECK (used[0]);
+	CHECK (used[20]);
+	CHECK (used[vertices.size() - 1]);
+
+	// no triangle gets flipped
+	for (size_t i = 0; i < simplified.size(); i += 3) {
+		const Vector4f &v0 = vertices[simplified[i]];
+		const Vector4f &v1 = vertices[simplified[i + 1]];
+		const Vector4f &v2 = vertices[simplified[i + 2]];
+		float normal_z = (v1[0] - v0[0]) * (v2[1] - v0[1]) - (v1[1] - v0[1]) * (v2[0] - v0[0]);
+		CHECK (normal_z > 0.f);
+	}
+
+	// the error limit stops the simplification of a bumpy surface early
+	for (size_t i = 0; i < vertices.size(); i++)
+		vertices[i][2] = ((i * 7919) % 13) * 0.1f;
+	vector<unsigned int> bumpy (indices);
+	CHECK (simplify_mesh (bumpy, vertices, 200, 0.01f) <= 0.01f);
+	CHECK (bumpy.size() / 3 > 200);
+}
+
+TEST ( MeshVBOGenerateLODs ) {
+	MeshVBO sphere = CreateUVSphere (64, 64);
+	sphere.createIndices();
+	sphere.generateLODs();
+
+	CHECK (sphere.lods.size() > 2);
+
+	size_t triangle_count = sphere.indices.size() / 3;
+	float error = 0.f;
+	for (size_t i = 0; i < sphere.lods.size(); i++) {
+		CHECK (sphere.lods[i].indices.size() / 3 < triangle_count);
+		CHECK (sphere.lods[i].error >= error);
+		for (size_t j = 0; j < sphere.lods[i].indices.size(); j++)
+			CHECK (sphere.lods[i].indices[j] < sphere.vertices.size());
+
+		triangle_count = sphere.lods[i].indices.size() / 3;
+		error = sphere.lods[i].error;
+	}
+
+	// small meshes are always drawn at full resolution
+	MeshVBO cube = CreateCube();
+	cube.createIndices();
+	cube.generateLODs();
+	CHECK_EQUAL (0u, cube.lods.size());
+}
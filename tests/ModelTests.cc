@@ -0,0 +1,776 @@
+#include <UnitTest++.h>
+
+#include "Model.h"
+#include "MeshLoader.h"
+#include "PointRenderer.h"
+#include "SimpleMath/SimpleMathGL.h"
+
+#include <cmath>
+#include <iostream>
+#include <fstream>
+
+#include <boost/filesystem.hpp>
+
+using namespace std;
+using namespace SimpleMath::GL;
+
+const float TEST_PREC = 1.0e-5;
+
+struct LuaModelFixture {
+	LuaModelFixture() {
+		model_filename = (boost::filesystem::temp_directory_path()
+			/ boost::filesystem::unique_path ("meshup-test-%%%%%%%%.lua")).string();
+		model = MeshupModelPtr (new MeshupModel());
+		model->skip_vbo_generation = true;
+	}
+	~LuaModelFixture() {
+		boost::filesystem::remove (model_filename);
+		delete model;
+	}
+
+	void loadModel (const std::string &model_source) {
+		ofstream model_out (model_filename.c_str());
+		model_out << model_source;
+		model_out.close();
+
+		model->loadModelFromLuaFile (model_filename.c_str());
+		model->updateFrames();
+		model->updateSegments();
+	}
+
+	std::string model_filename;
+	MeshupModelPtr model;
+};
+
+TEST_FIXTURE (LuaModelFixture, TestPrimitiveMeshesAreShared) {
+	loadModel (
+			"return { frames = {\n"
+			"  { name = \"A\", parent = \"ROOT\", visuals = {\n"
+			"    { geometry = { sphere = { radius = 0.5 } } },\n"
+			"    { geometry = { sphere = { radius = 2.0 } } },\n"
+			"    { geometry = { sphere = { radius = 1.0, rows = 8 } } },\n"
+			"    { geometry = { box = { dimensions = { 1, 2, 3 } } } },\n"
+			"    { geometry = { box = { dimensions = { 3, 2, 1 } } } },\n"
+			"  } }\n"
+			"} }\n");
+
+	CHECK_EQUAL (5u, model->segments.size());
+
+	MeshupModel::SegmentList::iterator seg_iter = model->segments.begin();
+	const Segment &sphere_small = *seg_iter++;
+	const Segment &sphere_large = *seg_iter++;
+	const Segment &sphere_coarse = *seg_iter++;
+	const Segment &box_a = *seg_iter++;
+	const Segment &box_b = *seg_iter++;
+
+	CHECK (sphere_small.mesh == sphere_large.mesh);
+	CHECK (sphere_small.mesh != sphere_coarse.mesh);
+	CHECK (box_a.mesh == box_b.mesh);
+
+	// dimensions are applied through the segment transformation
+	Vector4f top (0.f, 1.f, 0.f, 1.f);
+	Vector4f top_small = (top.transpose() * sphere_small.gl_matrix).transpose();
+	Vector4f top_large = (top.transpose() * sphere_large.gl_matrix).transpose();
+	CHECK_CLOSE (0.5f, top_small[1], TEST_PREC);
+	CHECK_CLOSE (2.f, top_large[1], TEST_PREC);
+
+	Vector4f corner (0.5f, 0.5f, 0.5f, 1.f);
+	Vector4f corner_a = (corner.transpose() * box_a.gl_matrix).transpose();
+	CHECK_CLOSE (0.5f, corner_a[0], TEST_PREC);
+	CHECK_CLOSE (1.0f, corner_a[1], TEST_PREC);
+	CHECK_CLOSE (1.5f, corner_a[2], TEST_PREC);
+}
+
+TEST_FIXTURE (LuaModelFixture, TestPrimitiveDimensionsScaling) {
+	// a capsule scaled to given dimensions must fill them exactly
+	loadModel (
+			"return { frames = {\n"
+			"  { name = \"A\", parent = \"ROOT\", visuals = {\n"
+			"    { dimensions = { 1, 1, 1 }, geometry = { capsule = { radius = 0.1, length = 0.5 } } },\n"
+			"  } }\n"
+			"} }\n");
+
+	const Segment &capsule = model->segments.front();
+
+	Vector3f bbox_min, bbox_max;
+	transform_bounding_box (capsule.mesh->bbox_min, capsule.mesh->bbox_max, capsule.gl_matrix, bbox_min, bbox_max);
+
+	CHECK_CLOSE (1.f, bbox_max[0] - bbox_min[0], TEST_PREC);
+	CHECK_CLOSE (1.f, bbox_max[1] - bbox_min[1], TEST_PREC);
+	CHECK_CLOSE (1.f, bbox_max[2] - bbox_min[2], TEST_PREC);
+}
+
+TEST_FIXTURE (LuaModelFixture, TestPrimitiveMeshesAreOwnedByTheModel) {
+	loadModel (
+			"return { frames = {\n"
+			"  { name = \"A\", parent = \"ROOT\", visuals = {\n"
+			"    { geometry = { sphere = { radius = 0.5 } } },\n"
+			"    { geometry = { capsule = { radius = 0, length = 0.5 } } },\n"
+			"  } }\n"
+			"} }\n");
+
+	CHECK_EQUAL (2u, model->primitive_meshes.size());
+
+	// a capsule without radius is not scaled
+	const Segment &capsule = model->segments.back();
+	CHECK (capsule.mesh->vertices.size() > 0);
+	for (unsigned int i = 0; i < 16; i++)
+		CHECK (std::isfinite (capsule.gl_matrix.data()[i]));
+
+	// copies get their own primitives
+	MeshupModel copy (*model);
+	CHECK_EQUAL (2u, copy.primitive_meshes.size());
+	CHECK (copy.segments.front().mesh != model->segments.front().mesh);
+	CHECK (copy.segments.front().mesh == copy.primitive_meshes.begin()->second
+			|| copy.segments.front().mesh == copy.primitive_meshes.rbegin()->second);
+
+	model->clear();
+	CHECK_EQUAL (0u, model->primitive_meshes.size());
+	CHECK_EQUAL (2u, copy.primitive_meshes.size());
+}
+
+TEST_FIXTURE (LuaModelFixture, TestLazyMeshLoadingBounds) {
+	string mesh_filename = model_filename + ".obj";
+	ofstream mesh_out (mesh_filename.c_str());
+	mesh_out << "o first" << endl
+		<< "v -1 -2 -3" << endl
+		<< "v  1  0  0" << endl
+		<< "v  0  4  5" << endl
+		<< "f 1 2 3" << endl
+		<< "o second" << endl
+		<< "v  9  9  9" << endl
+		<< "v  8  9  9" << endl
+		<< "v  9  8  9" << endl
+		<< "f 4 5 6" << endl;
+	mesh_out.close();
+
+	model->lazy_mesh_loading = true;
+	loadModel (
+			"return { frames = {\n"
+			"  { name = \"A\", parent = \"ROOT\", visuals = {\n"
+			"    { src = \"" + mesh_filename + "\" },\n"
+			"    { src = \"" + mesh_filename + ":first\" },\n"
+			"  } }\n"
+			"} }\n");
+
+	MeshPtr whole = model->segments.front().mesh;
+	MeshPtr first = model->segments.back().mesh;
+
+	CHECK (whole->bounds_only);
+	CHECK (first->bounds_only);
+	CHECK_EQUAL (0u, whole->vertices.size());
+
+	CHECK_ARRAY_EQUAL (Vector3f (-1.f, -2.f, -3.f).data(), whole->bbox_min.data(), 3);
+	CHECK_ARRAY_EQUAL (Vector3f (9.f, 9.f, 9.f).data(), whole->bbox_max.data(), 3);
+	CHECK_ARRAY_EQUAL (Vector3f (-1.f, -2.f, -3.f).data(), first->bbox_min.data(), 3);
+	CHECK_ARRAY_EQUAL (Vector3f (1.f, 4.f, 5.f).data(), first->bbox_max.data(), 3);
+
+	// the full load results in the same bounding box
+	MeshVBO loaded;
+	loaded.loadOBJ (mesh_filename.c_str(), "first");
+	CHECK_ARRAY_EQUAL (loaded.bbox_min.data(), first->bbox_min.data(), 3);
+	CHECK_ARRAY_EQUAL (loaded.bbox_max.data(), first->bbox_max.data(), 3);
+
+	boost::filesystem::remove (mesh_filename);
+}
+
+TEST_FIXTURE (LuaModelFixture, TestLazyMeshLoadingBoundsOfSharedVertices) {
+	// the objects use vertices that are declared before them
+	string mesh_filename = model_filename + ".obj";
+	ofstream mesh_out (mesh_filename.c_str());
+	mesh_out << "v 0 0 0" << endl << "v 1 0 0" << endl << "v 0 1 0" << endl << "v 0 0 1" << endl
+		<< "v 7 7 7" << endl
+		<< "o first" << endl << "f 1/1 2/2 3/3" << endl
+		<< "o second" << endl << "f 1 2 4" << endl << "f -4 -3 -2" << endl;
+	mesh_out.close();
+
+	model->lazy_mesh_loading = true;
+	loadModel (
+			"return { frames = {\n"
+			"  { name = \"A\", parent = \"ROOT\", visuals = {\n"
+			"    { src = \"" + mesh_filename + ":first\" },\n"
+			"    { src = \"" + mesh_filename + ":second\" },\n"
+			"    { src = \"" + mesh_filename + "\" },\n"
+			"  } }\n"
+			"} }\n");
+
+	MeshupModel::SegmentList::iterator seg_iter = model->segments.begin();
+	MeshPtr first = (seg_iter++)->mesh;
+	MeshPtr second = (seg_iter++)->mesh;
+	MeshPtr whole = (seg_iter++)->mesh;
+
+	CHECK (first->bounds_only);
+	CHECK_ARRAY_EQUAL (Vector3f (0.f, 0.f, 0.f).data(), first->bbox_min.data(), 3);
+	CHECK_ARRAY_EQUAL (Vector3f (1.f, 1.f, 0.f).data(), first->bbox_max.data(), 3);
+	CHECK_ARRAY_EQUAL (Vector3f (1.f, 1.f, 1.f).data(), second->bbox_max.data(), 3);
+
+	// unused vertices are not part of the full load either
+	MeshVBO loaded;
+	loaded.loadOBJ (mesh_filename.c_str());
+	CHECK_ARRAY_EQUAL (loaded.bbox_min.data(), whole->bbox_min.data(), 3);
+	CHECK_ARRAY_EQUAL (loaded.bbox_max.data(), whole->bbox_max.data(), 3);
+
+	loaded.loadOBJ (mesh_filename.c_str(), "second");
+	CHECK_ARRAY_EQUAL (loaded.bbox_min.data(), second->bbox_min.data(), 3);
+	CHECK_ARRAY_EQUAL (loaded.bbox_max.data(), second->bbox_max.data(), 3);
+
+	boost::filesystem::remove (mesh_filename);
+}
+
+TEST_FIXTURE (LuaModelFixture, TestSubObjectsOfAFileAreLoaded) {
+	string mesh_filename = model_filename + ".obj";
+	ofstream mesh_out (mesh_filename.c_str());
+	mesh_out << "v 0 0 0" << endl << "v 1 0 0" << endl << "v 0 1 0" << endl << "v 0 0 1" << endl
+		<< "o first" << endl << "f 1 2 3" << endl
+		<< "o second" << endl << "f 1 2 4" << endl << "f 2 3 4" << endl;
+	mesh_out.close();
+
+	loadModel (
+			"return { frames = {\n"
+			"  { name = \"A\", parent = \"ROOT\", visuals = {\n"
+			"    { src = \"" + mesh_filename + ":second\" },\n"
+			"    { src = \"" + mesh_filename + "\" },\n"
+			"    { src = \"" + mesh_filename + ":first\" },\n"
+			"  } }\n"
+			"} }\n");
+
+	MeshupModel::SegmentList::iterator seg_iter = model->segments.begin();
+	MeshPtr second = (seg_iter++)->mesh;
+	MeshPtr whole = (seg_iter++)->mesh;
+	MeshPtr first = (seg_iter++)->mesh;
+
+	CHECK_EQUAL (6u, second->drawCount());
+	CHECK_EQUAL (second->vertices.size(), second->normals.size());
+	CHECK_EQUAL (9u, whole->drawCount());
+	CHECK_EQUAL (3u, first->drawCount());
+	CHECK_EQUAL ("second", second->source_object_name);
+
+	boost::filesystem::remove (mesh_filename);
+}
+
+TEST_FIXTURE (LuaModelFixture, TestModifiedMeshesAreReloadedInPlace) {
+	string mesh_filename = model_filename + ".obj";
+	ofstream mesh_out (mesh_filename.c_str());
+	mesh_out << "v 0 0 0" << endl << "v 1 0 0" << endl << "v 0 1 0" << endl << "f 1 2 3" << endl;
+	mesh_out.close();
+
+	string model_source =
+			"return { frames = {\n"
+			"  { name = \"A\", parent = \"ROOT\", visuals = {\n"
+			"    { src = \"" + mesh_filename + "\" },\n"
+			"  } }\n"
+			"} }\n";
+
+	loadModel (model_source);
+	MeshPtr mesh = model->segments.front().mesh;
+	CHECK_EQUAL (3u, mesh->vertices.size());
+
+	// a second model shares the already loaded mesh
+	MeshupModel other_model;
+	other_model.skip_vbo_generation = true;
+	other_model.loadModelFromLuaFile (model_filename.c_str());
+	CHECK (mesh == other_model.segments.front().mesh);
+
+	// rewriting the same content is not a modification once the content
+	// is known, which happens with the first check
+	CHECK_EQUAL (0u, reload_modified_meshes());
+	mesh_out.open (mesh_filename.c_str());
+	mesh_out << "v 0 0 0" << endl << "v 1 0 0" << endl << "v 0 1 0" << endl << "f 1 2 3" << endl;
+	mesh_out.close();
+	CHECK_EQUAL (0u, reload_modified_meshes());
+	CHECK (!model->model_stamp.isModified());
+
+	mesh_out.open (mesh_filename.c_str());
+	mesh_out << "v 0 0 0" << endl << "v 2 0 0" << endl << "v 0 2 0" << endl << "v 0 0 2" << endl
+		<< "f 1 2 3" << endl << "f 1 3 4" << endl;
+	mesh_out.close();
+	CHECK_EQUAL (1u, reload_modified_meshes());
+	// the faces are perpendicular, so the shared edge gets two normals
+	CHECK_EQUAL (6u, mesh->vertices.size());
+	CHECK_EQUAL (6u, mesh->indices.size());
+	CHECK_CLOSE (2.f, mesh->bbox_max[0], TEST_PREC);
+	CHECK_EQUAL (0u, reload_modified_meshes());
+
+	boost::filesystem::remove (mesh_filename);
+}
+
+TEST_FIXTURE (LuaModelFixture, TestSegmentsOfAFrameAreBatched) {
+	model->batch_segments = true;
+	loadModel (
+			"return { frames = {\n"
+			"  { name = \"A\", parent = \"ROOT\", visuals = {\n"
+			"    { color = { 1, 0, 0 }, geometry = { box = { dimensions = { 1, 1, 1 } } } },\n"
+			"    { color = { 0, 0, 1 }, translate = { 2, 0, 0 }, geometry = { box = { dimensions = { 1, 2, 3 } } } },\n"
+			"  } },\n"
+			"  { name = \"B\", parent = \"A\", visuals = {\n"
+			"    { geometry = { box = { dimensions = { 1, 1, 1 } } } },\n"
+			"  } }\n"
+			"} }\n");
+
+	CHECK_EQUAL (1u, model->segment_batches.size());
+
+	const Segment &first = model->segments.front();
+	const Segment &second = *(++model->segments.begin());
+	const Segment &single = model->segments.back();
+	CHECK (first.batched);
+	CHECK (second.batched);
+	CHECK (!single.batched);
+
+	const SegmentBatch &batch = model->segment_batches[0];
+	CHECK (batch.frame == first.frame);
+	CHECK_EQUAL (2u, batch.segment_count);
+	CHECK_EQUAL (2 * first.mesh->drawCount(), batch.mesh->drawCount());
+
+	// the meshes are transformed into the frame
+	CHECK_ARRAY_CLOSE (Vector3f (-0.5f, -1.f, -1.5f).data(), batch.mesh->bbox_min.data(), 3, TEST_PREC);
+	CHECK_ARRAY_CLOSE (Vector3f (2.5f, 1.f, 1.5f).data(), batch.mesh->bbox_max.data(), 3, TEST_PREC);
+
+	// and colored by their segment
+	CHECK_EQUAL (batch.mesh->vertices.size(), batch.mesh->colors.size());
+	CHECK_ARRAY_CLOSE (Vector4f (1.f, 0.f, 0.f, 1.f).data(), batch.mesh->colors.front().data(), 4, TEST_PREC);
+	CHECK_ARRAY_CLOSE (Vector4f (0.f, 0.f, 1.f, 1.f).data(), batch.mesh->colors.back().data(), 4, TEST_PREC);
+
+	// normals stay normalized although the boxes are scaled
+	for (size_t i = 0; i < batch.mesh->normals.size(); i++)
+		CHECK_CLOSE (1.f, batch.mesh->normals[i].norm(), TEST_PREC);
+
+	model->batch_segments = false;
+	model->updateSegmentBatches();
+	CHECK_EQUAL (0u, model->segment_batches.size());
+	CHECK (!model->segments.front().batched);
+}
+
+TEST_FIXTURE (LuaModelFixture, TestBatchedMeshesFromCacheFilesAreNotParsed) {
+	string mesh_filename = model_filename + ".obj";
+	string cache_filename = mesh_cache_filename (mesh_filename, "");
+	ofstream mesh_out (mesh_filename.c_str());
+	mesh_out << "v 0 0 0" << endl << "v 1 0 0" << endl << "v 0 1 0" << endl << "f 1 2 3" << endl;
+	mesh_out.close();
+
+	// whole seconds so that the time can be set again exactly
+	std::time_t write_time = boost::filesystem::last_write_time (mesh_filename);
+	boost::filesystem::last_write_time (mesh_filename, write_time);
+
+	string model_source =
+			"return { frames = {\n"
+			"  { name = \"A\", parent = \"ROOT\", visuals = {\n"
+			"    { src = \"" + mesh_filename + "\" },\n"
+			"    { src = \"" + mesh_filename + "\", translate = { 2, 0, 0 } },\n"
+			"  } }\n"
+			"} }\n";
+
+	model->batch_segments = true;
+	model->use_mesh_cache_files = true;
+	loadModel (model_source);
+	CHECK (boost::filesystem::exists (cache_filename));
+
+	// drops the loaded mesh so that the next model uses the cache file
+	delete model;
+	MeshCache::iterator cache_iter = get_mesh_cache().find (mesh_cache_key (mesh_filename, ""));
+	CHECK (cache_iter != get_mesh_cache().end());
+	delete cache_iter->second.mesh;
+	get_mesh_cache().erase (cache_iter);
+
+	// the OBJ file gets different vertices that the cache file cannot
+	// notice, so they only show up if the OBJ file gets parsed
+	mesh_out.open (mesh_filename.c_str());
+	mesh_out << "v 0 0 0" << endl << "v 5 0 0" << endl << "v 0 5 0" << endl << "f 1 2 3" << endl;
+	mesh_out.close();
+	boost::filesystem::last_write_time (mesh_filename, write_time);
+
+	model = MeshupModelPtr (new MeshupModel());
+	model->skip_vbo_generation = true;
+	model->batch_segments = true;
+	model->use_mesh_cache_files = true;
+	loadModel (model_source);
+
+	MeshPtr mesh = model->segments.front().mesh;
+	CHECK (mesh->cpu_data_released);
+	CHECK (mesh->mesh_bin != NULL);
+	CHECK_EQUAL (1u, model->segment_batches.size());
+	CHECK_ARRAY_CLOSE (Vector3f (0.f, 0.f, 0.f).data(), model->segment_batches[0].mesh->bbox_min.data(), 3, 1.0e-3);
+	CHECK_ARRAY_CLOSE (Vector3f (3.f, 1.f, 0.f).data(), model->segment_batches[0].mesh->bbox_max.data(), 3, 1.0e-3);
+
+	// without the mapping the cache file gets read again
+	mesh->closeMeshBin();
+	model->updateSegmentBatches();
+	CHECK_EQUAL (1u, model->segment_batches.size());
+	CHECK_ARRAY_CLOSE (Vector3f (3.f, 1.f, 0.f).data(), model->segment_batches[0].mesh->bbox_max.data(), 3, 1.0e-3);
+
+	CHECK (mesh->restoreCpuData());
+	CHECK_EQUAL (3u, mesh->vertices.size());
+	CHECK_ARRAY_CLOSE (Vector4f (1.f, 0.f, 0.f, 1.f).data(), mesh->vertices[1].data(), 4, 1.0e-3);
+	CHECK_EQUAL (mesh->vertices.size(), mesh->normals.size());
+	CHECK_ARRAY_CLOSE (Vector3f (0.f, 0.f, 1.f).data(), mesh->normals[0].data(), 3, TEST_PREC);
+
+	boost::filesystem::remove (cache_filename);
+	boost::filesystem::remove (mesh_filename);
+}
+
+TEST_FIXTURE (LuaModelFixture, TestModelAssignmentCopiesTheOptions) {
+	model->batch_segments = true;
+	model->optimize_meshes = true;
+	loadModel (
+			"return { frames = {\n"
+			"  { name = \"A\", parent = \"ROOT\", visuals = {\n"
+			"    { geometry = { box = { dimensions = { 1, 1, 1 } } } },\n"
+			"    { geometry = { box = { dimensions = { 1, 2, 3 } } } },\n"
+			"  } }\n"
+			"} }\n");
+
+	// assigned and copied models get the same batches
+	MeshupModel copied (*model);
+	MeshupModel assigned;
+	assigned = *model;
+
+	CHECK (assigned.batch_segments);
+	CHECK (assigned.optimize_meshes);
+	CHECK (assigned.skip_vbo_generation);
+	CHECK_EQUAL (copied.segment_batches.size(), assigned.segment_batches.size());
+	CHECK_EQUAL (1u, assigned.segment_batches.size());
+
+	// clearing keeps the loading options
+	model->clear();
+	CHECK_EQUAL (0u, model->segments.size());
+	CHECK (model->batch_segments);
+	CHECK (model->optimize_meshes);
+	CHECK (model->skip_vbo_generation);
+}
+
+TEST_FIXTURE (LuaModelFixture, TestSegmentDrawsContainBatchesAndSingleSegments) {
+	model->batch_segments = true;
+	loadModel (
+			"return { frames = {\n"
+			"  { name = \"A\", parent = \"ROOT\", visuals = {\n"
+			"    { color = { 1, 0, 0 }, geometry = { box = { dimensions = { 1, 1, 1 } } } },\n"
+			"    { color = { 0, 0, 1 }, geometry = { box = { dimensions = { 1, 2, 3 } } } },\n"
+			"  } },\n"
+			"  { name = \"B\", parent = \"A\", joint_frame = { r = { 0, 1, 0 } }, visuals = {\n"
+			"    { color = { 0, 1, 0 }, geometry = { box = { dimensions = { 1, 1, 1 } } } },\n"
+			"  } }\n"
+			"} }\n");
+
+	model->updateSegmentDraws();
+	CHECK_EQUAL (2u, model->segment_draws.draws.size());
+
+	// the single segment uses its own transformation and color
+	const Segment &single = model->segments.back();
+	const SegmentDraw &single_draw = model->segment_draws.draws[0];
+	CHECK (single_draw.segment == &single);
+	CHECK (single_draw.mesh == single.mesh);
+	CHECK_ARRAY_CLOSE (single.gl_matrix.data(), single_draw.transform.data(), 16, TEST_PREC);
+	CHECK_ARRAY_CLOSE (Vector4f (0.f, 1.f, 0.f, 1.f).data(), single_draw.color.data(), 4, TEST_PREC);
+
+	// the batch is placed at its frame
+	const SegmentDraw &batch_draw = model->segment_draws.draws[1];
+	CHECK (batch_draw.segment == NULL);
+	CHECK (batch_draw.mesh == model->segment_batches[0].mesh);
+	CHECK_ARRAY_CLOSE (model->segment_batches[0].frame->pose_transform.data(), batch_draw.transform.data(), 16, TEST_PREC);
+
+	// rebuilding the batches invalidates the draws
+	model->updateSegmentBatches();
+	CHECK_EQUAL (0u, model->segment_draws.draws.size());
+}
+
+TEST_FIXTURE (LuaModelFixture, TestModelBoundingBoxContainsAllSegments) {
+	Vector3f bbox_min, bbox_max;
+	CHECK (!model->getBoundingBox (bbox_min, bbox_max));
+
+	loadModel (
+			"return { frames = {\n"
+			"  { name = \"A\", parent = \"ROOT\", joint_frame = { r = { 0, 1, 0 } }, visuals = {\n"
+			"    { geometry = { box = { dimensions = { 1, 1, 1 } } } },\n"
+			"  } },\n"
+			"  { name = \"B\", parent = \"A\", joint_frame = { r = { 2, 0, 0 } }, visuals = {\n"
+			"    { translate = { 0, 0, 1 }, geometry = { box = { dimensions = { 1, 2, 3 } } } },\n"
+			"  } }\n"
+			"} }\n");
+
+	CHECK (model->getBoundingBox (bbox_min, bbox_max));
+	CHECK_ARRAY_CLOSE (Vector3f (-0.5f, 0.f, -0.5f).data(), bbox_min.data(), 3, TEST_PREC);
+	CHECK_ARRAY_CLOSE (Vector3f (2.5f, 2.f, 2.5f).data(), bbox_max.data(), 3, TEST_PREC);
+}
+
+TEST_FIXTURE (LuaModelFixture, TestCullingSkipsSubtreesOutsideTheFrustum) {
+	loadModel (
+			"return { frames = {\n"
+			"  { name = \"A\", parent = \"ROOT\", visuals = {\n"
+			"    { geometry = { box = { dimensions = { 1, 1, 1 } } } },\n"
+			"  } },\n"
+			"  { name = \"B\", parent = \"A\", joint_frame = { r = { 5, 0, 0 } }, visuals = {\n"
+			"    { geometry = { box = { dimensions = { 1, 1, 1 } } } },\n"
+			"  } },\n"
+			"  { name = \"C\", parent = \"B\", joint_frame = { r = { 0, 1, 0 } }, visuals = {\n"
+			"    { geometry = { box = { dimensions = { 1, 1, 1 } } } },\n"
+			"  } },\n"
+			"  { name = \"D\", parent = \"A\", joint_frame = { r = { 1, 0, 0 } }, visuals = {\n"
+			"    { geometry = { box = { dimensions = { 1, 1, 1 } } } },\n"
+			"  } },\n"
+			"  { name = \"E\", parent = \"A\", joint_frame = { r = { 2, 0, 0 } }, visuals = {\n"
+			"    { geometry = { box = { dimensions = { 1, 1, 1 } } } },\n"
+			"  } }\n"
+			"} }\n");
+
+	model->updateCullingHierarchy();
+	CHECK_EQUAL (6u, model->culling_nodes.size());
+	CHECK_EQUAL (5u, model->culling_segments.size());
+
+	const CullingNode &root = model->culling_nodes[0];
+	CHECK (root.has_bounds);
+	CHECK_ARRAY_CLOSE (Vector3f (-0.5f, -0.5f, -0.5f).data(), root.bbox_min.data(), 3, TEST_PREC);
+	CHECK_ARRAY_CLOSE (Vector3f (5.5f, 1.5f, 0.5f).data(), root.bbox_max.data(), 3, TEST_PREC);
+
+	// the frustum is the cube [-2, 2]^3
+	model->cullSegments (ScaleMat44 (0.5f, 0.5f, 0.5f));
+
+	MeshupModel::SegmentList::iterator seg_iter = model->segments.begin();
+	CHECK (seg_iter->visible);
+	CHECK (!(++seg_iter)->visible);
+	CHECK (!(++seg_iter)->visible);
+	CHECK ((++seg_iter)->visible);
+	CHECK ((++seg_iter)->visible);
+
+	// C is culled with B, D is completely inside
+	CHECK_EQUAL (5u, model->culling_stats.node_tests);
+	CHECK_EQUAL (2u, model->culling_stats.segment_tests);
+	CHECK_EQUAL (3u, model->culling_stats.visible_segments);
+	CHECK_EQUAL (2u, model->culling_stats.culled_segments);
+
+	// the boxes follow the pose
+	model->findFrame ("B")->pose_translation.set (-5.f, 0.f, 0.f);
+	model->updateFrames();
+	model->updateSegments();
+	model->updateCullingHierarchy();
+	model->cullSegments (ScaleMat44 (0.5f, 0.5f, 0.5f));
+	CHECK_EQUAL (5u, model->culling_stats.visible_segments);
+}
+
+TEST_FIXTURE (LuaModelFixture, TestPointRendererGroupsLinesByWidth) {
+	loadModel (
+			"return { frames = {\n"
+			"  { name = \"A\", parent = \"ROOT\", joint_frame = { r = { 0, 1, 0 } } },\n"
+			"} }\n");
+
+	model->addPoint ("wide", "A", Vector3f (1.f, 0.f, 0.f), Vector3f (1.f, 0.f, 0.f), true, 3.f);
+	model->addPoint ("plain", "A", Vector3f (0.f, 0.f, 0.f), Vector3f (0.f, 1.f, 0.f), false);
+	model->addPoint ("thin", "A", Vector3f (0.f, 0.f, 1.f), Vector3f (0.f, 0.f, 1.f), true, 1.f);
+	model->updateFrames();
+
+	PointRenderer renderer;
+	renderer.updateDraws (model->points);
+
+	// all markers share the sphere mesh
+	CHECK_EQUAL (3u, renderer.sphere_draws.draws.size());
+	CHECK (renderer.sphere_draws.draws[0].mesh == renderer.sphere_draws.draws[2].mesh);
+	CHECK_ARRAY_CLOSE (Vector4f (0.f, 1.f, 0.f, 1.f).data(), renderer.sphere_draws.draws[1].color.data(), 4, TEST_PREC);
+	CHECK_ARRAY_CLOSE (Vector3f (0.f, 1.f, 0.f).data(), &renderer.sphere_draws.draws[1].transform(3,0), 3, TEST_PREC);
+
+	// every width gets its own list of vertices
+	CHECK_EQUAL (2u, renderer.lines.lineCount());
+	CHECK_EQUAL (6u * 2u, renderer.lines.vertices[1.f].size());
+	CHECK_EQUAL (6u * 2u, renderer.lines.vertices[3.f].size());
+
+	// lines go from the frame origin to the point
+	const vector<float> &thin_line = renderer.lines.vertices[1.f];
+	Vector3f thin_location = Vector3f (0.f, 1.f, 0.f) + model->points[2].coordinates;
+	CHECK_ARRAY_CLOSE (Vector3f (0.f, 1.f, 0.f).data(), &thin_line[0], 3, TEST_PREC);
+	CHECK_ARRAY_CLOSE (Vector3f (0.f, 0.f, 1.f).data(), &thin_line[3], 3, TEST_PREC);
+	CHECK_ARRAY_CLOSE (thin_location.data(), &thin_line[6], 3, TEST_PREC);
+
+	// the lines are replaced in the next frame
+	model->points.pop_back();
+	renderer.updateDraws (model->points);
+	CHECK_EQUAL (1u, renderer.lines.lineCount());
+}
+
+TEST_FIXTURE (LuaModelFixture, TestFrameAxesLines) {
+	loadModel (
+			"return { frames = {\n"
+			"  { name = \"A\", parent = \"ROOT\", joint_frame = { r = { 0, 1, 0 } } },\n"
+			"  { name = \"B\", parent = \"A\", joint_frame = { r = { 1, 0, 0 } } },\n"
+			"} }\n");
+	model->updateFrames();
+
+	LineBatch lines;
+	model->addFrameAxes (lines, SimpleMath::GL::TranslateMat44 (0.f, 0.f, -1.f));
+
+	// three axes for every frame but ROOT, all of the same width
+	CHECK_EQUAL (6u, lines.lineCount());
+	CHECK_EQUAL (1u, lines.vertices.size());
+	CHECK_EQUAL (2.f, lines.vertices.begin()->first);
+
+	// the x axis of frame A is moved by the given transformation
+	const vector<float> &vertices = lines.vertices[2.f];
+	CHECK_ARRAY_CLOSE (Vector3f (0.f, 1.f, -1.f).data(), &vertices[0], 3, TEST_PREC);
+	CHECK_ARRAY_CLOSE (Vector3f (0.1f, 1.f, -1.f).data(), &vertices[6], 3, TEST_PREC);
+
+	model->addBaseFrameAxes (lines);
+	CHECK_EQUAL (9u, lines.lineCount());
+
+	// the red base x axis starts at the origin and has unit length
+	size_t base_x_axis = 6 * 2 * 6;
+	CHECK_ARRAY_CLOSE (Vector3f (0.f, 0.f, 0.f).data(), &vertices[base_x_axis], 3, TEST_PREC);
+	CHECK_ARRAY_CLOSE (Vector3f (1.f, 0.f, 0.f).data(), &vertices[base_x_axis + 3], 3, TEST_PREC);
+	CHECK_ARRAY_CLOSE (Vector3f (1.f, 0.f, 0.f).data(), &vertices[base_x_axis + 6], 3, TEST_PREC);
+
+	lines.clear();
+	CHECK_EQUAL (0u, lines.lineCount());
+}
+
+TEST (MeshCacheFiles) {
+	string mesh_filename = (boost::filesystem::temp_directory_path()
+			/ boost::filesystem::unique_path ("meshup-test-%%%%%%%%.obj")).string();
+	ofstream mesh_out (mesh_filename.c_str());
+	mesh_out << "v 0 0 0" << endl << "v 1 0 0" << endl << "v 0 1 0" << endl << "v 0 0 1" << endl
+		<< "o first" << endl << "f 1 2 3" << endl
+		<< "o second" << endl << "f 1 2 4" << endl << "f 2 3 4" << endl;
+	mesh_out.close();
+
+	std::vector<MeshLoadRequest> requests (2);
+	for (size_t i = 0; i < requests.size(); i++) {
+		requests[i].filename = mesh_filename;
+		requests[i].object_name = i == 0 ? "first" : "second";
+		requests[i].cache_filename = mesh_cache_filename (mesh_filename, requests[i].object_name);
+		requests[i].mesh = new MeshVBO;
+	}
+
+	// the first load parses the OBJ file and creates the cache files
+	CHECK (load_meshes_parallel (requests));
+	MeshPtr parsed = requests[1].mesh;
+	CHECK (!parsed->cpu_data_released);
+	CHECK (boost::filesystem::exists (requests[1].cache_filename));
+
+	std::vector<MeshLoadRequest> cached_requests (requests);
+	for (size_t i = 0; i < cached_requests.size(); i++)
+		cached_requests[i].mesh = new MeshVBO;
+
+	CHECK (load_meshes_parallel (cached_requests));
+	MeshPtr cached = cached_requests[1].mesh;
+	CHECK (cached->cpu_data_released);
+	CHECK_EQUAL (0u, cached->vertices.size());
+	CHECK_EQUAL (parsed->vertices.size(), cached->vertex_count);
+	CHECK_EQUAL (parsed->drawCount(), cached->drawCount());
+	CHECK_ARRAY_EQUAL (parsed->bbox_min.data(), cached->bbox_min.data(), 3);
+	CHECK_ARRAY_EQUAL (parsed->bbox_max.data(), cached->bbox_max.data(), 3);
+
+	// the cached buffers are exactly what would be uploaded and stay in
+	// the mapped file
+	parsed->packBuffers();
+	size_t vertex_data_size = 0;
+	size_t index_data_size = 0;
+	const char* vertex_data = cached->vertexBufferData (vertex_data_size);
+	const char* index_data = cached->indexBufferData (index_data_size);
+	CHECK (cached->mesh_bin != NULL);
+	CHECK_EQUAL (0u, cached->packed_vertices.size());
+	CHECK (parsed->packed_vertices == std::vector<char> (vertex_data, vertex_data + vertex_data_size));
+	CHECK (parsed->packed_indices == std::vector<char> (index_data, index_data + index_data_size));
+	CHECK_EQUAL (parsed->vertex_stride, cached->vertex_stride);
+	CHECK_EQUAL (parsed->index_type, cached->index_type);
+
+	// the vertex data itself comes from the OBJ file
+	CHECK (cached->restoreCpuData());
+	CHECK_EQUAL (parsed->vertices.size(), cached->vertices.size());
+	CHECK (cached->mesh_bin == NULL);
+
+	// the bounding box for lazy loading only needs the header
+	MeshVBO bounds;
+	bounds.source_object_name = "second";
+	CHECK (bounds.loadMeshBinBoundingBox (requests[1].cache_filename.c_str(), FileStamp::fromFile (mesh_filename)));
+	CHECK (bounds.bounds_only);
+	CHECK_ARRAY_EQUAL (parsed->bbox_min.data(), bounds.bbox_min.data(), 3);
+	CHECK_ARRAY_EQUAL (parsed->bbox_max.data(), bounds.bbox_max.data(), 3);
+
+	MeshVBO other_object;
+	other_object.source_object_name = "first";
+	CHECK (!other_object.loadMeshBinBoundingBox (requests[1].cache_filename.c_str(), FileStamp::fromFile (mesh_filename)));
+
+	// a source that was only written again is still valid and does not
+	// need to be hashed on the next load
+	std::time_t write_time = boost::filesystem::last_write_time (mesh_filename);
+	boost::filesystem::last_write_time (mesh_filename, write_time + 10);
+	FileStamp touched_stamp = FileStamp::fromFile (mesh_filename);
+	MeshVBO touched;
+	touched.source_object_name = "second";
+	CHECK (touched.loadMeshBin (requests[1].cache_filename.c_str(), touched_stamp));
+	CHECK (touched_stamp.hash_valid);
+
+	FileStamp later_stamp = FileStamp::fromFile (mesh_filename);
+	CHECK (touched.loadMeshBin (requests[1].cache_filename.c_str(), later_stamp));
+	CHECK (!later_stamp.hash_valid);
+
+	// different options or a modified source make the cache file invalid
+	MeshVBO optimized;
+	optimized.optimize = true;
+	optimized.source_object_name = "second";
+	CHECK (!optimized.loadMeshBin (requests[1].cache_filename.c_str(), FileStamp::fromFile (mesh_filename)));
+
+	mesh_out.open (mesh_filename.c_str(), ios_base::app);
+	mesh_out << "f 1 3 4" << endl;
+	mesh_out.close();
+	MeshVBO modified;
+	modified.source_object_name = "second";
+	CHECK (!modified.loadMeshBin (requests[1].cache_filename.c_str(), FileStamp::fromFile (mesh_filename)));
+
+	for (size_t i = 0; i < requests.size(); i++) {
+		boost::filesystem::remove (requests[i].cache_filename);
+		delete requests[i].mesh;
+		delete cached_requests[i].mesh;
+	}
+	boost::filesystem::remove (mesh_filename);
+}
+
+TEST (FileStampDetectsModifications) {
+	string filename = (boost::filesystem::temp_directory_path()
+			/ boost::filesystem::unique_path ("meshup-test-%%%%%%%%.txt")).string();
+
+	ofstream file_out (filename.c_str());
+	file_out << "1, 2, 3" << endl;
+	file_out.close();
+
+	FileStamp stamp = FileStamp::fromFile (filename);
+	CHECK (stamp.exists);
+	CHECK (!stamp.isModified());
+
+	// same size, different content
+	file_out.open (filename.c_str());
+	file_out << "1, 2, 4" << endl;
+	file_out.close();
+	CHECK (stamp.isModified());
+
+	boost::filesystem::remove (filename);
+	CHECK (stamp.isModified());
+	CHECK (!FileStamp::fromFile (filename).isModified());
+}
+
+TEST (FileStampIgnoresRewritesWithSameContent) {
+	string filename = (boost::filesystem::temp_directory_path()
+			/ boost::filesystem::unique_path ("meshup-test-%%%%%%%%.txt")).string();
+
+	ofstream file_out (filename.c_str());
+	file_out << "1, 2, 3" << endl;
+	file_out.close();
+
+	// the content only gets hashed once it is needed
+	FileStamp stamp = FileStamp::fromFile (filename);
+	CHECK (!stamp.hash_valid);
+	CHECK (!stamp.isModified());
+	CHECK (stamp.hash_valid);
+
+	// written again with the same content
+	file_out.open (filename.c_str());
+	file_out << "1, 2, 3" << endl;
+	file_out.close();
+	std::time_t write_time = boost::filesystem::last_write_time (filename);
+	boost::filesystem::last_write_time (filename, write_time + 10);
+
+	CHECK (!stamp.isModified());
+
+	int64_t mtime;
+	uint64_t size;
+	get_file_status (filename, mtime, size);
+	CHECK (mtime != stamp.mtime);
+	stamp.refresh();
+	CHECK_EQUAL (mtime, stamp.mtime);
+
+	boost::filesystem::remove (filename);
+}
@@ -0,0 +1,335 @@
+#include <UnitTest++.h>
+
+#include "ObjParser.h"
+#include "MeshVBO.h"
+#include "thread_utils.h"
+
+#include <iostream>
+#include <fstream>
+#include <cstring>
+#include <mutex>
+#include <set>
+
+#include <boost/filesystem.hpp>
+
+using namespace std;
+
+const float OBJ_TEST_PREC = 1.0e-6;
+
+static bool parse_obj_string (const string &source, ObjData &result, const char* object_name = NULL) {
+	return parse_obj (source.c_str(), source.size(), object_name, result);
+}
+
+TEST ( ObjParserTriangulatesPolygons ) {
+	ObjData data;
+	CHECK (parse_obj_string (
+				"v 0 0 0\n"
+				"v 1 0 0\n"
+				"v 1 1 0\n"
+				"v 0 1 0\n"
+				"v -1 1 0\n"
+				"f 1 2 3 4\n"
+				"f 1 3 4 5 2\n"
+				, data));
+
+	// a quad and a pentagon as triangle fans
+	CHECK_EQUAL (5u, data.positions.size());
+	CHECK_EQUAL (15u, data.triangle_positions.size());
+
+	int expected[] = { 0, 1, 2,  0, 2, 3,  0, 2, 3,  0, 3, 4,  0, 4, 1 };
+	CHECK_ARRAY_EQUAL (expected, data.triangle_positions, 15);
+}
+
+TEST ( ObjParserFaceFormats ) {
+	ObjData data;
+	CHECK (parse_obj_string (
+				"v 0 0 0\nv 1 0 0\nv 0 1 0\n"
+				"vt 0 0\nvt 1 0\nvt 0 1\n"
+				"vn 0 0 1\nvn 0 1 0\nvn 1 0 0\n"
+				"f 1/1/1 2/2/2 3/3/3\n"
+				"f 1//3 2//2 3//1\n"
+				"F 3/1 2/2 1/3\n"
+				, data));
+
+	CHECK_EQUAL (9u, data.triangle_positions.size());
+	int expected_normals[] = { 0, 1, 2,  2, 1, 0,  -1, -1, -1 };
+	CHECK_ARRAY_EQUAL (expected_normals, data.triangle_normals, 9);
+	CHECK_EQUAL (2, data.triangle_positions[6]);
+}
+
+TEST ( ObjParserRelativeIndices ) {
+	ObjData data;
+	CHECK (parse_obj_string (
+				"v 0 0 0\nv 1 0 0\nv 0 1 0\n"
+				"vn 0 0 1\n"
+				"f -3//-1 -2//-1 -1//-1\n"
+				"v 5 5 5\n"
+				"f -1 -2 -3\n"
+				, data));
+
+	int expected[] = { 0, 1, 2,  3, 2, 1 };
+	CHECK_ARRAY_EQUAL (expected, data.triangle_positions, 6);
+	CHECK_EQUAL (0, data.triangle_normals[0]);
+}
+
+TEST ( ObjParserNumbers ) {
+	ObjData data;
+	CHECK (parse_obj_string (
+				"  v\t1.5 -2.25e1 +3e-2 1.0 # comment\r\n"
+				"v .5 -0. 123456.789\r\n"
+				"v 1E3 0.000001 -1.0e+2\r\n"
+				, data));
+
+	CHECK_EQUAL (3u, data.positions.size());
+	CHECK_CLOSE (1.5f, data.positions[0][0], OBJ_TEST_PREC);
+	CHECK_CLOSE (-22.5f, data.positions[0][1], OBJ_TEST_PREC);
+	CHECK_CLOSE (0.03f, data.positions[0][2], OBJ_TEST_PREC);
+	CHECK_CLOSE (0.5f, data.positions[1][0], OBJ_TEST_PREC);
+	CHECK_CLOSE (0.f, data.positions[1][1], OBJ_TEST_PREC);
+	CHECK_EQUAL (123456.789f, data.positions[1][2]);
+	CHECK_EQUAL (1000.f, data.positions[2][0]);
+	CHECK_EQUAL (0.000001f, data.positions[2][1]);
+	CHECK_EQUAL (-100.f, data.positions[2][2]);
+}
+
+TEST ( ObjParserObjects ) {
+	string source =
+		"v 0 0 0\nv 1 0 0\nv 0 1 0\nv 0 0 1\n"
+		"o First\n"
+		"f 1 2 3\n"
+		"o Second # comment\n"
+		"f 1 2 4\n"
+		"f 2 3 4\n"
+		"o Third\n"
+		"f 1 3 4\n";
+
+	ObjData all;
+	CHECK (parse_obj_string (source, all));
+	CHECK_EQUAL (12u, all.triangle_positions.size());
+
+	ObjData second;
+	CHECK (parse_obj_string (source, second, "Second"));
+	CHECK (second.object_found);
+	CHECK_EQUAL (6u, second.triangle_positions.size());
+	CHECK_EQUAL (3, second.triangle_positions[2]);
+
+	ObjData missing;
+	CHECK (parse_obj_string (source, missing, "second"));
+	CHECK (!missing.object_found);
+	CHECK_EQUAL (0u, missing.triangle_positions.size());
+}
+
+TEST ( ObjParserObjectIndex ) {
+	string source =
+		"v 0 0 0\nv 1 0 0\nv 0 1 0\nv 0 0 1\n"
+		"f 1 2 3\n"
+		"o Empty\n"
+		"o First\n"
+		"f 1 2 4\n"
+		"f 2 3 4\n"
+		"o Second\n"
+		"f 1 3 4 2\n";
+
+	ObjData data;
+	CHECK (parse_obj_string (source, data));
+
+	// objects without faces are not listed
+	CHECK_EQUAL (3u, data.objects.size());
+	CHECK (data.findObject ("Empty") == NULL);
+
+	const ObjObject* unnamed = data.findObject ("");
+	const ObjObject* first = data.findObject ("First");
+	const ObjObject* second = data.findObject ("Second");
+	CHECK (unnamed != NULL && first != NULL && second != NULL);
+	CHECK_EQUAL (0u, unnamed->triangle_offset);
+	CHECK_EQUAL (1u, unnamed->triangle_count);
+	CHECK_EQUAL (1u, first->triangle_offset);
+	CHECK_EQUAL (2u, first->triangle_count);
+	CHECK_EQUAL (3u, second->triangle_offset);
+	CHECK_EQUAL (2u, second->triangle_count);
+
+	// meshes created from the index match the ones loaded separately
+	MeshVBO indexed;
+	CHECK (indexed.loadOBJObject (data, "test.obj", "Second"));
+
+	ObjData second_only;
+	CHECK (parse_obj_string (source, second_only, "Second"));
+	CHECK_EQUAL (1u, second_only.objects.size());
+	MeshVBO separate;
+	CHECK (separate.loadOBJObject (second_only, "test.obj", "Second"));
+
+	CHECK_EQUAL (separate.vertices.size(), indexed.vertices.size());
+	CHECK_EQUAL (4u, indexed.vertices.size());
+	CHECK_EQUAL (6u, indexed.indices.size());
+	CHECK_ARRAY_EQUAL (separate.indices, indexed.indices, 6);
+	for (size_t i = 0; i < indexed.vertices.size(); i++)
+		CHECK_ARRAY_EQUAL (separate.vertices[i].data(), indexed.vertices[i].data(), 4);
+
+	MeshVBO missing;
+	CHECK (!missing.loadOBJObject (data, "test.obj", "Third"));
+}
+
+TEST ( ObjParserGeneratedNormals ) {
+	// a flat fan, a second smoothing group at a sharp angle and a flat face
+	ObjData data;
+	CHECK (parse_obj_string (
+				"v 0 0 0\nv 1 0 0\nv 1 1 0\nv 0 1 0\nv 0 0 1\n"
+				"f 1 2 3\n"
+				"f 1 3 4\n"
+				"s 2\n"
+				"f 1 5 2\n"
+				"s off\n"
+				"f 1 4 5\n"
+				, data));
+
+	unsigned int expected_groups[] = { 1, 1, 2, 0 };
+	CHECK_ARRAY_EQUAL (expected_groups, data.triangle_smoothing_groups, 4);
+
+	generate_obj_normals (data, 60.f);
+	CHECK_EQUAL (12u, data.triangle_normals.size());
+
+	// the two coplanar triangles share the normals of their vertices
+	CHECK_EQUAL (data.triangle_normals[0], data.triangle_normals[3]);
+	CHECK_EQUAL (data.triangle_normals[2], data.triangle_normals[4]);
+	CHECK_ARRAY_CLOSE (Vector3f (0.f, 0.f, 1.f).data(), data.normals[data.triangle_normals[0]].data(), 3, OBJ_TEST_PREC);
+
+	// the other groups have their own normals
+	CHECK (data.triangle_normals[6] != data.triangle_normals[0]);
+	CHECK_ARRAY_CLOSE (Vector3f (0.f, 1.f, 0.f).data(), data.normals[data.triangle_normals[6]].data(), 3, OBJ_TEST_PREC);
+	for (size_t i = 9; i < 12; i++)
+		CHECK_ARRAY_CLOSE (Vector3f (1.f, 0.f, 0.f).data(), data.normals[data.triangle_normals[i]].data(), 3, OBJ_TEST_PREC);
+
+	// a curved surface gets averaged normals below the crease angle
+	ObjData smooth;
+	CHECK (parse_obj_string (
+				"v -1 0 0\nv 0 0 0.2\nv 1 0 0\nv -1 1 0\nv 0 1 0.2\nv 1 1 0\n"
+				"f 1 2 5 4\n"
+				"f 2 3 6 5\n"
+				, smooth));
+	generate_obj_normals (smooth, 60.f);
+	const Vector3f &middle = smooth.normals[smooth.triangle_normals[1]];
+	CHECK_ARRAY_CLOSE (Vector3f (0.f, 0.f, 1.f).data(), middle.data(), 3, OBJ_TEST_PREC);
+	CHECK_EQUAL (smooth.triangle_normals[1], smooth.triangle_normals[6]);
+
+	// given normals are kept
+	ObjData given;
+	CHECK (parse_obj_string ("v 0 0 0\nv 1 0 0\nv 0 1 0\nvn 1 0 0\nf 1//1 2//1 3//1\n", given));
+	generate_obj_normals (given, 60.f);
+	CHECK_EQUAL (1u, given.normals.size());
+}
+
+TEST ( ObjParserErrors ) {
+	ObjData invalid_index;
+	CHECK (!parse_obj_string ("v 0 0 0\nv 1 0 0\nv 0 1 0\n\nf 1 2 4\n", invalid_index));
+	CHECK_EQUAL (5, invalid_index.error_line);
+
+	ObjData invalid_face;
+	CHECK (!parse_obj_string ("v 0 0 0\nv 1 0 0\nv 0 1 0\nf 1 2\n", invalid_face));
+	CHECK_EQUAL (4, invalid_face.error_line);
+
+	ObjData invalid_token;
+	CHECK (!parse_obj_string ("v 0 0 0\nv 1 0 0\nv 0 1 0\nf 1 2 x3\n", invalid_token));
+
+	ObjData invalid_vertex;
+	CHECK (!parse_obj_string ("v 0 0\n", invalid_vertex));
+}
+
+TEST ( MeshVBOLoadOBJPolygons ) {
+	string filename = (boost::filesystem::temp_directory_path()
+			/ boost::filesystem::unique_path ("meshup-test-%%%%%%%%.obj")).string();
+
+	ofstream obj_out (filename.c_str());
+	obj_out << "v -1 -1 0\nv 1 -1 0\nv 1 1 2\nv -1 1 0\n"
+		<< "vn 0 0 1\n"
+		<< "f 1//1 2//1 3//1 4//1";
+	obj_out.close();
+
+	MeshVBO mesh;
+	bool result = mesh.loadOBJ (filename.c_str(), NULL, false);
+	boost::filesystem::remove (filename);
+
+	CHECK (result);
+
+	// the vertices of the two triangles are shared
+	CHECK_EQUAL (4u, mesh.vertices.size());
+	CHECK_EQUAL (4u, mesh.normals.size());
+	CHECK_EQUAL (6u, mesh.drawCount());
+	unsigned int expected_indices[] = { 0, 1, 2, 0, 2, 3 };
+	CHECK_ARRAY_EQUAL (expected_indices, mesh.indices, 6);
+	CHECK_CLOSE (1.f, mesh.vertices[3][3], OBJ_TEST_PREC);
+	CHECK_CLOSE (-1.f, mesh.bbox_min[0], OBJ_TEST_PREC);
+	CHECK_CLOSE (2.f, mesh.bbox_max[2], OBJ_TEST_PREC);
+}
+
+TEST ( MeshVBOCreateIndices ) {
+	MeshVBO cube = CreateCube();
+	MeshVBO indexed_cube (cube);
+	indexed_cube.createIndices();
+
+	// the faces of a cube have different normals and therefore only share
+	// the vertices within a face
+	CHECK_EQUAL (36u, cube.drawCount());
+	CHECK_EQUAL (36u, indexed_cube.drawCount());
+	CHECK_EQUAL (24u, indexed_cube.vertices.size());
+	CHECK_EQUAL (24u, indexed_cube.normals.size());
+
+	for (size_t i = 0; i < cube.vertices.size(); i++) {
+		CHECK_ARRAY_EQUAL (cube.vertices[i].data(), indexed_cube.vertices[indexed_cube.indices[i]].data(), 4);
+		CHECK_ARRAY_EQUAL (cube.normals[i].data(), indexed_cube.normals[indexed_cube.indices[i]].data(), 3);
+	}
+
+	// joining keeps the indices of both meshes valid
+	MeshVBO joined (indexed_cube);
+	joined.join (Matrix44f::Identity(), cube);
+	CHECK_EQUAL (72u, joined.drawCount());
+	CHECK_EQUAL (60u, joined.vertices.size());
+	CHECK_EQUAL (59u, joined.indices[71]);
+}
+
+TEST ( MeshVBOVertexLayout ) {
+	MeshVBO cube = CreateCube();
+
+	// 16 bit positions (padded to 8 bytes) and 8 bit normals
+	cube.chooseVertexLayout();
+	CHECK_EQUAL (12, cube.vertex_stride);
+	CHECK_EQUAL (8, cube.normal_offset);
+	CHECK_CLOSE (0.5f / 32767.f, cube.position_scale, OBJ_TEST_PREC);
+
+	cube.compact_vertices = false;
+	cube.chooseVertexLayout();
+	CHECK_EQUAL (24, cube.vertex_stride);
+
+	// homogeneous coordinates are kept as they are
+	MeshVBO homogeneous;
+	homogeneous.addVertex4f (0.f, 0.f, 0.f, 1.f);
+	homogeneous.addVertex4f (1.f, 0.f, 0.f, 0.5f);
+	homogeneous.addVertex4f (0.f, 1.f, 0.f, 1.f);
+	homogeneous.addColor3f (1.f, 0.f, 0.f);
+	homogeneous.addColor3f (0.f, 1.f, 0.f);
+	homogeneous.addColor3f (0.f, 0.f, 1.f);
+	homogeneous.chooseVertexLayout();
+	CHECK_EQUAL (4, homogeneous.position_size);
+	CHECK_EQUAL (16 + 4, homogeneous.vertex_stride);
+}
+
+TEST ( NestedParallelForKeepsTheThreadCount ) {
+	std::mutex mutex;
+	std::set<std::thread::id> threads;
+	std::atomic<size_t> item_count (0);
+
+	// e.g. normals that are generated while several files get loaded
+	parallel_for (4, [&](size_t i) {
+			parallel_for (16, [&](size_t j) {
+					{
+						std::lock_guard<std::mutex> lock (mutex);
+						threads.insert (std::this_thread::get_id());
+					}
+					item_count++;
+					std::this_thread::sleep_for (std::chrono::milliseconds (1));
+				}, 4);
+		}, 2);
+
+	CHECK_EQUAL (64u, item_count.load());
+	CHECK (threads.size() <= 2);
+	CHECK (!in_parallel_for());
+}
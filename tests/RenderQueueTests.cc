@@ -0,0 +1,47 @@
+#include <UnitTest++.h>
+
+#include "RenderQueue.h"
+#include "MeshVBO.h"
+
+using namespace std;
+
+TEST (TestRenderQueueSortsByMeshAndColor) {
+	MeshVBO smooth_a, smooth_b, flat;
+	flat.smooth_shading = false;
+
+	Vector4f red (1.f, 0.f, 0.f, 1.f);
+	Vector4f blue (0.f, 0.f, 1.f, 1.f);
+
+	RenderQueue queue;
+	queue.add (&flat, Matrix44f::Identity(), red);
+	queue.add (&smooth_a, Matrix44f::Identity(), red);
+	queue.add (&smooth_b, Matrix44f::Identity(), blue);
+	queue.add (&smooth_a, Matrix44f::Identity(), blue);
+	queue.add (&smooth_b, Matrix44f::Identity(), red, 1);
+	queue.add (&smooth_a, Matrix44f::Identity(), red);
+	queue.sort();
+
+	CHECK_EQUAL (6u, queue.items.size());
+
+	// the smooth meshes come first and every mesh is bound only once
+	unsigned int mesh_changes = 0;
+	for (size_t i = 1; i < queue.items.size(); i++) {
+		const RenderItem &previous = queue.items[i - 1];
+		const RenderItem &item = queue.items[i];
+
+		CHECK (previous.mesh->smooth_shading || !item.mesh->smooth_shading);
+
+		if (item.mesh != previous.mesh) {
+			mesh_changes++;
+			continue;
+		}
+
+		// then by level of detail and color
+		CHECK (previous.lod_level <= item.lod_level);
+		if (previous.lod_level == item.lod_level)
+			CHECK (previous.color == item.color || previous.color == blue);
+	}
+
+	CHECK_EQUAL (2u, mesh_changes);
+	CHECK (&flat == queue.items.back().mesh);
+}